@@ -6,6 +6,7 @@
 #cmakedefine MUTEX_DEBUG 1
 #cmakedefine RWSEM_DEBUG 1
 #cmakedefine BUDDY_DEBUG 1
+#cmakedefine BUDDY_HUGEPAGE 1
 #cmakedefine SLAB_DEBUG 1
 #cmakedefine DICT_DEBUG 1
 #cmakedefine EVENT_SINGLE 1
@@ -42,6 +42,29 @@
 #define VPAGE_SHIFT CONFIG_VPAGE_SHIFT
 #define VPAGE_SIZE (1UL << VPAGE_SHIFT)
 
+/*
+ * 将物理 NUMA 节点映射到伙伴系统的节点，并使用 mbind 绑定节点的内存
+ * 物理节点 n 对应伙伴系统的节点 NUMA_NID_BASE + n
+ */
+#ifndef CONFIG_BUDDY_NUMA
+# if defined(__linux__) && defined(__x86_64__)
+#  define CONFIG_BUDDY_NUMA 1
+# else
+#  define CONFIG_BUDDY_NUMA 0
+# endif
+#endif
+
+/*支持的物理 NUMA 节点和 CPU 的最大数量*/
+#ifndef CONFIG_NUMA_NODES_SHIFT
+# define CONFIG_NUMA_NODES_SHIFT 6
+#endif
+#ifndef CONFIG_NUMA_MAX_CPUS
+# define CONFIG_NUMA_MAX_CPUS 1024
+#endif
+
+#define MAX_NUMA_NODES (1U << CONFIG_NUMA_NODES_SHIFT)
+#define NUMA_NID_BASE (MAX_NUMNODES / 4)
+
 #define MAX_NR_VPAGES (VADDR_END/VPAGE_SIZE)
 #define VPAGES_PER_NODE (MAX_NR_VPAGES/MAX_NUMNODES)
 
@@ -57,6 +80,14 @@
 #define BUDDY_BLKPAGES (1UL << BUDDY_BLKORDER)
 #define BUDDY_BLKSIZE (BUDDY_BLKPAGES << VPAGE_SHIFT)
 
+/*大页大小，用于 CONFIG_BUDDY_HUGEPAGE 模式*/
+#ifndef CONFIG_HPAGE_SHIFT
+# define CONFIG_HPAGE_SHIFT 21
+#endif
+
+#define HPAGE_SHIFT CONFIG_HPAGE_SHIFT
+#define HPAGE_SIZE (1UL << HPAGE_SHIFT)
+
 #define MAX_ELEMENTS (1U << MAX_NODES_SHIFT)
 #define VPAGES_PER_ELEMENT (MAX_NR_VPAGES/MAX_ELEMENTS)
 #define VPAGES_PER_ELEMENT_SHIFT ilog2(VPAGES_PER_ELEMENT)
@@ -66,5 +97,21 @@
 #define CONFIG_BUDDY_FILEMMAP
 #define CONFIG_BUDDY_SHAREDMMAP
  */
+/*是否使用大页映射伙伴系统的内存块（cmake -DBUDDY_HUGEPAGE=ON）
+ *先尝试 MAP_HUGETLB，失败后退化为 madvise(MADV_HUGEPAGE)
+#define CONFIG_BUDDY_HUGEPAGE
+ */
+#if defined(BUDDY_HUGEPAGE) && !defined(CONFIG_BUDDY_HUGEPAGE)
+# define CONFIG_BUDDY_HUGEPAGE
+#endif
+
+/*归还空闲内存时使用 MADV_FREE，由系统在内存紧张时再回收，但内容不保证为零
+#define CONFIG_BUDDY_SCAVENGE_LAZY
+ */
+#if defined(CONFIG_BUDDY_SCAVENGE_LAZY) && !defined(CONFIG_BUDDY_SHAREDMMAP)
+# define BUDDY_SCAVENGE_ZEROED 0
+#else
+# define BUDDY_SCAVENGE_ZEROED 1
+#endif
 
 #endif /* __US_MMCFG_H__ */
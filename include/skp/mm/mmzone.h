@@ -112,10 +112,79 @@ static __always_inline bool node_has_freepg(int nid, int order)
 	return false;
 }
 
-/*补充一些内存到伙伴系统中*/
-extern int node_supply_memory(int order);
+/*物理 NUMA 拓扑，在 __setup_memory() 中从 /sys/devices/system/node 获取*/
+struct numa_topology {
+	uint32_t nr_nodes; /**< 在线的物理节点数量，为 0 表示未启用*/
+	uint8_t nodes[MAX_NUMA_NODES]; /**< 在线的物理节点编号，升序*/
+	uint8_t fallback[MAX_NUMA_NODES][MAX_NUMA_NODES]; /**<
+		* 以物理节点编号为下标，按距离由近到远排列的在线节点，首个为自身*/
+	uint8_t cpu_node[CONFIG_NUMA_MAX_CPUS]; /**< CPU 所属的物理节点*/
+};
+
+extern struct numa_topology numa_topo;
+
+static inline int numa_to_nid(int numa)
+{
+	return NUMA_NID_BASE + numa;
+}
+
+static inline int nid_to_numa(int nid)
+{
+	if (nid < (int)NUMA_NID_BASE ||
+			nid >= (int)(NUMA_NID_BASE + MAX_NUMA_NODES))
+		return NUMA_NO_NODE;
+	return nid - NUMA_NID_BASE;
+}
+
+/*当前线程所在物理节点对应的伙伴系统节点，未启用时返回 NUMA_NO_NODE*/
+static inline int numa_local_nid(void)
+{
+	int cpu;
+
+	if (!CONFIG_BUDDY_NUMA || !READ_ONCE(numa_topo.nr_nodes))
+		return NUMA_NO_NODE;
+
+	cpu = thread_getcpu();
+	if (skp_unlikely(cpu < 0 || cpu >= CONFIG_NUMA_MAX_CPUS))
+		return NUMA_NO_NODE;
+	return numa_to_nid(numa_topo.cpu_node[cpu]);
+}
+
+/**
+ * 补充一些内存到伙伴系统中
+ * @param nid 为指定的物理节点补充内存，该节点没有地址空间时失败；
+ * 为 NUMA_NO_NODE 时，只在所有节点都没有满足条件的空闲页时补充，
+ * 并尽量放在当前线程的本地节点上
+ * @return 有空闲页的节点，失败返回负的错误码
+ */
+extern int node_supply_memory(int nid, int order);
 /*从伙伴系统中回收一些内存*/
 extern void node_reclaim_memory(struct vpage *page, int order);
+/**
+ * 将伙伴系统中的空闲块所占用的物理内存归还给系统，虚地址仍然保留
+ * 成功返回 0，否则返回负的错误码
+ */
+extern int node_scavenge_memory(struct vpage *page, int order);
+/*
+ * 地址所在的内存块是否以 hugetlb 映射
+ * hugetlb 的内存在映射时就已预留，其中的空闲块不能归还给系统
+ */
+extern bool node_memblock_hugetlb(const void *addr);
+
+/*伙伴系统内存块的大页统计（字节）*/
+struct hpage_stat {
+	unsigned long mapped; /**< 伙伴系统映射的全部内存*/
+	unsigned long hugetlb; /**< 以 MAP_HUGETLB 映射的内存*/
+	unsigned long advised; /**< 以 madvise(MADV_HUGEPAGE) 建议的内存*/
+	unsigned long resident; /**< 已驻留的内存*/
+	unsigned long huge_backed; /**< 实际由大页（透明大页或 hugetlb）驻留的内存*/
+};
+
+/**
+ * 读取 /proc/self/smaps 统计伙伴系统内存块实际的大页驻留情况
+ * 成功返回 0，否则返回负的错误码
+ */
+extern int node_hpage_stat(struct hpage_stat *stat);
 
 static inline uint32_t pfn_to_nid(unsigned long pfn)
 {
@@ -38,6 +38,8 @@ enum {
 	PG_block, /**< 分配的续页作为块整体，order 存储在第二页中*/
 	PG_inited, /**<全局初始化标志，对应的虚地址只能初始化一次*/
 	PG_reserved, /**< 保留页框*/
+	PG_clean, /**< 空闲块的内容全为零（新映射或已归还给系统），只在头页上有效*/
+	PG_idle, /**< 空闲块在一个回收周期内未被使用，只在头页上有效*/
 	PG_MAX_FLAG,
 };
 
@@ -134,6 +136,18 @@ extern void __free_pages_ok(struct vpage *page, int order);
 /**释放 单页 到per-thread缓存中，缓存满了才会被批量的返回到伙伴系统*/
 extern void free_hot_page(struct vpage *page);
 
+/**
+ * 将伙伴系统中不小于 order 阶、且空闲超过一个回收周期的块归还给系统
+ * 第一次扫描时标记空闲块，再次扫描时仍然空闲的才会被归还
+ * 返回本次归还的页数
+ */
+extern unsigned long buddy_scavenge(int order);
+/**
+ * 在后台周期性的调用 buddy_scavenge()
+ * @param age 回收周期（毫秒），空闲块至少空闲这么久才会被归还，为 0 则停止
+ */
+extern void buddy_set_scavenger(int order, uint32_t age);
+
 /**会查看引用计数是否为0*/
 extern void __free_pages(struct vpage *page, int order);
 /*忽略TLS缓存，查看引用计数，释放到伙伴系统*/
@@ -198,6 +212,8 @@ __defpg_func(Active, PG_active)
 __defpg_func(Block, PG_block)
 __defpg_func(Inited, PG_inited)
 __defpg_func(Reserved, PG_reserved)
+__defpg_func(Clean, PG_clean)
+__defpg_func(Idle, PG_idle)
 
 ////////////////////////////////////////////////////////////////////////////////
 /*
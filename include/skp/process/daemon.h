@@ -9,6 +9,7 @@
 __BEGIN_DECLS
 
 extern bool isdaemon;
+extern bool isrestart;
 #define __syslog(level, log_type, fmt, ...) \
 	syslog(level, \
 		"[" #log_type "] [" XX_MODULE_NAME "] %s:%d[%s] - " fmt "\n", \
@@ -34,8 +35,18 @@ extern bool isdaemon;
   #define __log_debug(fmt, ...)
 #endif
 
+/**
+ * -D/--daemon 以守护进程运行，-R/--restart 热重启
+ * 返回加锁的 pid 文件，已有实例运行时返回 -1，
+ * 热重启时不退出，返回未加锁的 pid 文件 @see restart_takeover()
+ */
 extern int daemonize(int argc, char *argv[]);
 
+/*等待 pid 文件锁并写入当前进程号，timeout 为毫秒*/
+extern int daemon_pidfile_lock(int lfd, int timeout);
+/*释放 pid 文件锁，但不关闭*/
+extern int daemon_pidfile_unlock(int lfd);
+
 __END_DECLS
 
 #endif
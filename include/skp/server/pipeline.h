@@ -0,0 +1,150 @@
+//
+//  pipeline.h
+//  test
+//
+//  Created by 周凯 on 2020/01/14.
+//  Copyright © 2020 zhoukai. All rights reserved.
+//
+
+#ifndef __US_PIPELINE_H__
+#define __US_PIPELINE_H__
+
+#include "../utils/pbuff.h"
+#include "xprt.h"
+
+__BEGIN_DECLS
+
+/*
+ * 传输对象的处理器链
+ * 1. 传输对象拥有一条有序的处理器链，入站数据从头部（传输层）向尾部（应用层）传递，
+ *    出站数据从尾部向头部传递，到达头部后写入套接字
+ * 2. 处理器之间传递 struct pbuff，所有权随之转移，接收者负责释放或继续传递，
+ *    拆分使用 pb_share()，复制控制结构使用 pb_clone()，都不会复制数据，
+ *    出站数据可以带有分片 @see pb_add_frag()，写入时与线性数据一同由 writev 发出
+ * 3. 处理器的上下文与私有数据随传输对象一次性连续分配
+ * 4. 所有的回调都在传输对象的事件线程中调用，处理器不需要加锁，
+ *    xprt_pipeline_write() 也必须在事件回调中调用
+ */
+
+/*每次从套接字读取的缓存大小*/
+#ifndef CONFIG_XPRT_PIPELINE_RXSIZE
+# define CONFIG_XPRT_PIPELINE_RXSIZE (16384)
+#endif
+
+/*等待写入套接字的缓存数量，超过则返回 -ENOBUFS*/
+#ifndef CONFIG_XPRT_PIPELINE_TXQ
+# define CONFIG_XPRT_PIPELINE_TXQ (64)
+#endif
+
+struct xprt_pipeline;
+struct xprt_handler_ctx;
+
+struct xprt_handler {
+	const char *name;
+	/*每个连接的私有数据大小，与传输对象连续分配，初始化为 0*/
+	size_t privsize;
+	/*出站时需要在头部添加的数据长度 @see xprt_pipeline_alloc()*/
+	size_t headroom;
+	/*构造传输对象时调用，返回负值的错误号则构造失败*/
+	int (*init)(struct xprt_handler_ctx *);
+	/*销毁传输对象时调用*/
+	void (*fini)(struct xprt_handler_ctx *);
+	/**
+	 * 入站与出站，为空则跳过此处理器
+	 * 无论成功与否都获得 pb 的所有权，处理后调用 xprt_fire_inbound()/
+	 * xprt_fire_outbound() 继续传递，返回 0 或负值的错误号，入站的错误会关闭传输对象
+	 */
+	int (*inbound)(struct xprt_handler_ctx *, struct pbuff *);
+	int (*outbound)(struct xprt_handler_ctx *, struct pbuff *);
+	/*状态改变，从头部向尾部通知 XPRT_OPENED/XPRT_CLOSED/XPRT_WRREADY*/
+	void (*changed)(struct xprt_handler_ctx *, unsigned long stats);
+};
+
+struct xprt_handler_ctx {
+	const struct xprt_handler *handler;
+	struct xprt_pipeline *pipeline;
+	void *priv;
+	uint32_t index;
+};
+
+/*处理器链的描述，由使用者静态定义 @see XPRT_PIPELINE_DESC()*/
+struct xprt_pipeline_desc {
+	uint32_t nr_handlers;
+	const struct xprt_handler *const *handlers;
+};
+
+#define XPRT_PIPELINE_DESC(h) { .nr_handlers = ARRAY_SIZE(h), .handlers = (h), }
+
+struct xprt_pipeline {
+	/*私有字段，用户只读或通过接口操作*/
+	struct xprt_tcpclnt clnt; /*base class*/
+	const struct xprt_pipeline_desc *desc;
+	size_t headroom;
+	/*等待写入套接字的环形队列*/
+	uint32_t tx_head;
+	uint32_t tx_tail;
+	struct pbuff *txq[CONFIG_XPRT_PIPELINE_TXQ];
+	/*处理器的上下文，之后紧跟着各处理器的私有数据*/
+	struct xprt_handler_ctx ctx[];
+};
+
+#define xprt_to_pipeline(__xprt)												\
+	({ struct xprt * __x = (__xprt); skp_likely(__x) ?						\
+		container_of((__x), struct xprt_pipeline, clnt.xprt) : NULL;})
+
+#define xprt_handler_xprt(__ctx) (&(__ctx)->pipeline->clnt.xprt)
+
+/**
+ * 使用 xprt_pipeline_ops 创建传输对象
+ * 1. 主动连接时，create_xprt() 的 user 参数为 struct xprt_pipeline_desc
+ * 2. 被动连接时，侦听对象的 user 参数为 struct xprt_pipeline_desc，
+ *    被动端的 user 依然为侦听对象
+ * 3. 就绪后自动开启读事件
+ */
+extern const struct xprt_operations xprt_pipeline_ops;
+
+/*从 ctx 的下一个处理器开始向应用层传递，没有处理器则丢弃*/
+extern int xprt_fire_inbound(struct xprt_handler_ctx *ctx, struct pbuff *pb);
+/*从 ctx 的上一个处理器开始向传输层传递，没有处理器则写入套接字*/
+extern int xprt_fire_outbound(struct xprt_handler_ctx *ctx, struct pbuff *pb);
+/**
+ * 从尾部开始出站，无论成功与否都获得 pb 的所有权
+ * 套接字不可写时缓存在发送队列中，写就绪后自动发出，然后通知 XPRT_WRREADY
+ * @return 0 已发出或已缓存，-ENOBUFS 发送队列已满，其他为错误
+ */
+extern int xprt_pipeline_write(struct xprt *, struct pbuff *pb);
+
+/*分配出站的缓存，头部预留了所有处理器需要的空间，避免再次扩展*/
+static inline struct pbuff *xprt_pipeline_alloc(struct xprt *xprt, size_t size)
+{
+	size_t headroom = xprt_to_pipeline(xprt)->headroom;
+	struct pbuff *pb = alloc_pb(headroom + size);
+	if (skp_likely(pb))
+		pb_reserve(pb, headroom);
+	return pb;
+}
+
+/*按名称查找处理器的上下文*/
+extern struct xprt_handler_ctx *xprt_pipeline_lookup(struct xprt *,
+	const char *name);
+
+////////////////////////////////////////////////////////////////////////////////
+// 预实现的处理器
+////////////////////////////////////////////////////////////////////////////////
+
+/*单个帧的最大长度*/
+#ifndef CONFIG_XPRT_LENFRAME_MAX
+# define CONFIG_XPRT_LENFRAME_MAX (16U << 20)
+#endif
+
+/**
+ * 以 4 字节网络序长度为前缀的帧
+ * 入站时拆分为不含前缀的帧，同一缓存中的多个帧共享底层数据，
+ * 仅跨越读取边界的不完整帧会被复制
+ * 出站时在头部添加前缀
+ */
+extern const struct xprt_handler xprt_lenframe_handler;
+
+__END_DECLS
+
+#endif
@@ -0,0 +1,128 @@
+//
+//  prefork.h
+//  test
+//
+//  Created by 周凯 on 2020/01/16.
+//  Copyright © 2020 zhoukai. All rights reserved.
+//
+
+#ifndef __US_PREFORK_H__
+#define __US_PREFORK_H__
+
+#include "types.h"
+
+__BEGIN_DECLS
+
+/*
+ * 多进程模式
+ * 1. 主进程在 daemonize() 之后调用 prefork_listen() 创建侦听套接字，
+ *    此前不能使用事件、工作队列等会创建线程的模块
+ * 2. prefork_run() 创建工作进程，每个工作进程有独立的事件槽、内存池与锁，
+ *    在工作进程中 create_xprt_tcpserv() 使用主进程侦听套接字的副本
+ *    每个工作进程有自己的 SO_REUSEPORT 侦听套接字，连接由内核分配，没有惊群；
+ *    未使用 EPOLLEXCLUSIVE，因为事件模块以 EPOLL_CTL_MOD 开关事件，而它不能与之共用
+ * 3. 工作进程异常退出（信号或非 0 退出码）时由主进程重新创建，正常退出则不再创建
+ * 4. 每个工作进程在共享内存中有一组计数器，主进程或工作进程都可以汇总
+ */
+
+/*最多的工作进程数量*/
+#ifndef CONFIG_PREFORK_MAX_WORKERS
+# define CONFIG_PREFORK_MAX_WORKERS (256)
+#endif
+
+/*最多的侦听套接字数量*/
+#ifndef CONFIG_PREFORK_MAX_LISTENERS
+# define CONFIG_PREFORK_MAX_LISTENERS (64)
+#endif
+
+/*每个工作进程的计数器数量*/
+#ifndef CONFIG_PREFORK_NR_COUNTERS
+# define CONFIG_PREFORK_NR_COUNTERS (16)
+#endif
+
+/*重新创建工作进程的初始延迟，连续崩溃时加倍，毫秒*/
+#ifndef CONFIG_PREFORK_RESPAWN_DELAY
+# define CONFIG_PREFORK_RESPAWN_DELAY (100)
+#endif
+
+/*重新创建的最大延迟，工作进程运行超过此时间则恢复为初始延迟，毫秒*/
+#ifndef CONFIG_PREFORK_RESPAWN_MAX
+# define CONFIG_PREFORK_RESPAWN_MAX (5000)
+#endif
+
+/*计数器索引，之后的由用户使用*/
+enum {
+	PREFORK_STAT_ACCEPTED, /*接受的连接*/
+	PREFORK_STAT_CLOSED, /*关闭的被动连接*/
+	PREFORK_STAT_USER,
+};
+
+/*位于共享内存，计数器只由对应的工作进程修改*/
+struct prefork_worker {
+	int32_t index;
+	pid_t pid; /*0 表示没有运行*/
+	uint32_t nr_spawns; /*创建次数，大于 1 表示被重新创建过*/
+	uint64_t counters[CONFIG_PREFORK_NR_COUNTERS];
+} __cacheline_aligned;
+
+/*返回值作为工作进程的退出码*/
+typedef int (*prefork_fn)(int index, void *arg);
+
+extern struct prefork_worker *__prefork_self;
+
+/**
+ * 主进程：创建侦听套接字，必须在 prefork_run() 之前调用
+ * @return 0 成功，或负值的错误号
+ */
+extern int prefork_listen(const struct service_address *addr);
+
+/**
+ * 工作进程：复制与地址相同的侦听套接字，由 create_xprt_tcpserv() 调用
+ * @return 套接字，或 -ENOENT
+ */
+extern int prefork_inherit(const struct service_address *addr);
+
+/**
+ * 主进程：创建 nr 个工作进程运行 fn，直到所有工作进程正常退出或 prefork_stop()
+ * SIGTERM/SIGINT 会停止所有工作进程，工作进程应自行处理 SIGTERM
+ * @return 0 成功，或负值的错误号
+ */
+extern int prefork_run(int nr, prefork_fn fn, void *arg);
+
+/*向所有工作进程发送 SIGTERM，并不再重新创建，可以在信号处理函数中调用*/
+extern void prefork_stop(void);
+
+/**
+ * 汇总所有工作进程的计数器，prefork_run() 返回后依然有效
+ * @return 工作进程的数量
+ */
+extern int prefork_stats(uint64_t counters[CONFIG_PREFORK_NR_COUNTERS]);
+
+/*获取工作进程的共享数据，不存在返回 NULL*/
+extern const struct prefork_worker *prefork_worker(int index);
+
+/*当前工作进程的索引，主进程返回 -1*/
+static inline int prefork_index(void)
+{
+	struct prefork_worker *self = READ_ONCE(__prefork_self);
+	return self ? self->index : -1;
+}
+
+/*工作进程中的多个事件线程可能同时修改，非工作进程中忽略*/
+static inline void prefork_stat_add(int idx, uint64_t val)
+{
+	struct prefork_worker *self = READ_ONCE(__prefork_self);
+	if (WARN_ON(idx < 0 || idx >= CONFIG_PREFORK_NR_COUNTERS))
+		return;
+	if (self)
+		__atomic_add_fetch(&self->counters[idx], val, __ATOMIC_RELAXED);
+}
+
+static inline void prefork_stat_inc(int idx)
+{
+	prefork_stat_add(idx, 1);
+}
+
+__END_DECLS
+
+#endif
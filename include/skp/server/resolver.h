@@ -0,0 +1,86 @@
+//
+//  resolver.h
+//  test
+//
+//  Created by 周凯 on 2020/01/06.
+//  Copyright © 2020 zhoukai. All rights reserved.
+//
+
+#ifndef __US_RESOLVER_H__
+#define __US_RESOLVER_H__
+
+#include "../adt/list.h"
+#include "types.h"
+
+__BEGIN_DECLS
+
+/*
+ * 带缓存的主机名解析（TCP）
+ * 1. 数字地址直接转换，不经过缓存
+ * 2. 主机名以 主机名 + 服务名 + 地址族 为键缓存解析结果，失败的结果也会被短暂缓存
+ * 3. 过期不久的结果在后台刷新期间仍然可用，避免热点名称在过期时阻塞
+ * 4. 异步解析在专用的工作队列中进行，同一名称的并发解析只会发起一次
+ * 5. 解析结果按地址族交错排列 @see inet_address_interleave()
+ */
+
+/*单个名称最多缓存的地址数量*/
+#ifndef CONFIG_RESOLV_MAX_ADDRS
+# define CONFIG_RESOLV_MAX_ADDRS 8
+#endif
+
+struct resolv_result {
+	uint32_t nr;
+	union inet_address addrs[CONFIG_RESOLV_MAX_ADDRS];
+};
+
+struct resolv_req;
+/**
+ * 异步解析的完成回调，在解析的工作线程中调用
+ * @param err 0 或负值的错误号，成功时结果位于 req->result
+ */
+typedef void (*resolv_fn)(struct resolv_req *, int err);
+
+struct resolv_req {
+	/*私有字段*/
+	struct list_head node;
+	resolv_fn done;
+	/*解析的结果*/
+	struct resolv_result result;
+};
+
+/**
+ * 仅查询数字地址和缓存，不会阻塞
+ * @return 0 命中，-ENOENT 未命中或需要刷新，其他负值为缓存的错误
+ */
+extern int resolv_cached(const struct service_address *, int family,
+		struct resolv_result *);
+
+/**
+ * 同步解析，优先使用缓存，未命中时在调用线程中阻塞解析并更新缓存
+ * @return 0 成功，负值为错误
+ */
+extern int resolv_lookup(const struct service_address *, int family,
+		struct resolv_result *);
+
+/**
+ * 异步解析
+ * @return 0 命中缓存，结果已经填充到 req->result，不会回调
+ *         -EINPROGRESS 正在解析，完成后回调 done
+ *         其他负值为错误，不会回调
+ */
+extern int resolv_async(const struct service_address *, int family,
+		struct resolv_req *req, resolv_fn done);
+
+/**
+ * 预置解析结果，例如由服务发现得到的地址，按给定的顺序连接
+ * 与解析得到的结果一样会过期，过期后按正常的流程刷新
+ */
+extern int resolv_cache_insert(const struct service_address *, int family,
+		const struct resolv_result *);
+
+/*使所有缓存失效，正在进行的解析不受影响*/
+extern void resolv_cache_flush(void);
+
+__END_DECLS
+
+#endif
@@ -0,0 +1,82 @@
+//
+//  restart.h
+//  test
+//
+//  Created by 周凯 on 2020/01/15.
+//  Copyright © 2020 zhoukai. All rights reserved.
+//
+
+#ifndef __US_RESTART_H__
+#define __US_RESTART_H__
+
+#include "server.h"
+#include "socket.h"
+
+__BEGIN_DECLS
+
+/*
+ * 不中断服务的热重启
+ * 1. 旧进程调用 restart_serve()，在 unix 套接字上等待接管的请求
+ * 2. 新进程以 --restart 启动，daemonize() 不会因为 pid 文件被锁而退出，
+ *    创建侦听对象前调用 restart_takeover()，通过 SCM_RIGHTS 接收旧进程所有
+ *    侦听对象的套接字，之后 create_xprt_tcpserv() 优先使用地址相同的继承套接字
+ * 3. 旧进程交出套接字后销毁侦听对象但不关闭套接字的读端，释放 pid 文件锁，
+ *    等待已有的连接结束（或超时）后调用 server_pause() 退出主循环
+ * 侦听套接字在交接中一直存在，内核的全连接队列不会被丢弃
+ */
+
+/*
+ * 交接使用的 unix 套接字所在的私有目录，%s 为程序名，与 pid 文件相邻
+ * 目录的权限为 0700，套接字为 0600，两端还会检查对端的有效用户与自己相同
+ */
+#ifndef CONFIG_RESTART_DIR
+# define CONFIG_RESTART_DIR "/tmp/%s.restart"
+#endif
+
+/*目录中 unix 套接字的文件名*/
+#ifndef CONFIG_RESTART_SOCKET
+# define CONFIG_RESTART_SOCKET "restart.sock"
+#endif
+
+/*一次交接最多的侦听套接字数量*/
+#ifndef CONFIG_RESTART_MAX_FDS
+# define CONFIG_RESTART_MAX_FDS (64)
+#endif
+
+/*交接中每次读写的超时，以及新进程等待 pid 文件锁的超时，毫秒*/
+#ifndef CONFIG_RESTART_TIMEOUT
+# define CONFIG_RESTART_TIMEOUT (3000)
+#endif
+
+/*旧进程等待已有连接结束的最长时间，毫秒*/
+#ifndef CONFIG_RESTART_DRAIN
+# define CONFIG_RESTART_DRAIN (30000)
+#endif
+
+/**
+ * 旧进程：等待新进程接管 serv 的所有侦听对象
+ * @param name 程序名，可以是 argv[0]
+ * @param lfd daemonize() 返回的 pid 文件锁，交接后释放，小于 0 则忽略
+ * @return 0 成功，或负值的错误号
+ */
+extern int restart_serve(struct server *serv, const char *name, int lfd);
+
+/**
+ * 新进程：从旧进程接收侦听套接字，然后等待旧进程释放 pid 文件锁
+ * @param lfd daemonize() 在 --restart 时返回的未加锁的 pid 文件
+ * @return 接收的套接字数量，没有旧进程时返回 0，或负值的错误号
+ */
+extern int restart_takeover(const char *name, int lfd);
+
+/**
+ * 取出与地址相同的继承套接字，由 create_xprt_tcpserv() 调用
+ * @return 套接字，或 -ENOENT
+ */
+extern int restart_inherit(const struct service_address *addr);
+
+/*关闭没有被取出的继承套接字*/
+extern void restart_release(void);
+
+__END_DECLS
+
+#endif
@@ -32,6 +32,8 @@ struct server {
 	struct list_head xprt_list;
 	wait_queue_head_t waitqueue;
 	/*other statistic*/
+	uint32_t tcpinfo_period; /*TCP_INFO 的采样周期 @see server_set_tcpinfo()*/
+	struct delayed_work tcpinfo_work;
 
 	/*提供给用户的字段*/
 	void (*destructor)(struct server*);
@@ -47,6 +49,22 @@ extern void server_loop(struct server *);
 
 extern void __server_stop(struct server *, bool destroy_xprts);
 
+/**
+ * 遍历所有已安装的传输对象，fn 返回非 0 值时停止遍历并返回这个值
+ * 持有服务器的锁回调，不能休眠、关闭或销毁传输对象，也不能再次遍历
+ * 统计是近似值 @see struct xprt_stats
+ */
+extern int server_for_each_xprt(struct server *,
+	int (*fn)(struct xprt *, void *), void *arg);
+
+/**
+ * 设置周期性采样所有 xprt_tcpclnt 的 TCP_INFO，period 为毫秒，0 则停止
+ * 在系统工作队列中遍历，每个连接一次 getsockopt()，事件线程没有额外的开销，
+ * 只在收集引用时持有服务器的锁
+ * @see xprt_tcpinfo_sample()
+ */
+extern void server_set_tcpinfo(struct server *, uint32_t period);
+
 /*关闭所有连接*/
 static inline void server_stop(struct server * serv)
 {
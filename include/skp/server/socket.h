@@ -29,6 +29,21 @@ static inline void sock_freeaddrinfo(struct addrinfo *info)
 }
 
 typedef void (*sockfd_setopt)(int fd, void *user);
+
+/*侦听套接字的连接队列长度*/
+#ifndef CONFIG_LISTENQ
+# define CONFIG_LISTENQ (1024)
+#endif
+
+/*并行连接（RFC 8305）时相邻两次尝试的间隔，单位毫秒*/
+#ifndef CONFIG_TCP_CONNECT_DELAY
+# define CONFIG_TCP_CONNECT_DELAY 250
+#endif
+/*并行连接时同时进行的最大尝试数*/
+#ifndef CONFIG_TCP_CONNECT_RACE
+# define CONFIG_TCP_CONNECT_RACE 8
+#endif
+
 /**
  * 创建侦听套接字
  * @return -1 or sockfd
@@ -36,12 +51,25 @@ typedef void (*sockfd_setopt)(int fd, void *user);
 extern int tcp_listen(const struct service_address *address,
 	sockfd_setopt action, void *user);
 /**
- * 创建连接套接字
+ * 创建连接套接字，主机名的解析结果会被缓存 @see resolv_lookup()
  * @param pflags indicate socket is in connecting
  * @return -1 or sockfd
  */
 extern int tcp_connect(const struct service_address *address,
 	sockfd_setopt action, void *user, int *pflags, union inet_address *sin);
+/**
+ * 连接已解析的地址，不会阻塞在解析上
+ * 1. 非阻塞套接字（由 action 设置）依次尝试，返回第一个正在连接的套接字
+ * 2. 阻塞套接字在有多个地址时并行连接（RFC 8305），返回第一个连接成功的套接字
+ * @return 负值的错误号 or sockfd
+ */
+extern int tcp_connect_inet(const union inet_address *addrs, uint32_t nr,
+	sockfd_setopt action, void *user, int *pflags, union inet_address *sin);
+/**
+ * 按 RFC 8305 交错排列地址族，第一个地址的地址族优先，
+ * 同一地址族内保持原有的顺序
+ */
+extern void inet_address_interleave(union inet_address *addrs, uint32_t nr);
 
 /**
  * 接受一个连接
@@ -162,6 +190,49 @@ extern int sockopt_set_linger(int fd, bool onoff, int linger);
 #define sockopt_disable_nodelay(fd) \
 	(sockopt_set_intval((fd), SOL_SOCKET, TCP_NODELAY, 0))
 
+/* 侦听套接字开启 TFO，qlen 为 SYN 中携带数据的待完成握手的队列长度 */
+#ifdef TCP_FASTOPEN
+  #define sockopt_enable_fastopen(fd, qlen) \
+	(sockopt_set_intval((fd), IPPROTO_TCP, TCP_FASTOPEN, (qlen)))
+#else
+  #define sockopt_enable_fastopen(fd, qlen) (-EOPNOTSUPP)
+#endif
+
+/* 客户端开启 TFO，connect() 不发出 SYN，第一次写入的数据随 SYN 发出 */
+#ifdef TCP_FASTOPEN_CONNECT
+  #define sockopt_enable_fastopen_connect(fd) \
+	(sockopt_set_intval((fd), IPPROTO_TCP, TCP_FASTOPEN_CONNECT, 1))
+#else
+  #define sockopt_enable_fastopen_connect(fd) (-EOPNOTSUPP)
+#endif
+
+/* 侦听套接字上的连接有数据到达后才能被接受，sec 为最长等待的秒数 */
+#ifdef TCP_DEFER_ACCEPT
+  #define sockopt_set_defer_accept(fd, sec) \
+	(sockopt_set_intval((fd), IPPROTO_TCP, TCP_DEFER_ACCEPT, (sec)))
+#else
+  #define sockopt_set_defer_accept(fd, sec) (-EOPNOTSUPP)
+#endif
+
+/* 发送缓存中未发出的数据低于此值才可写，而不是发送缓存有空闲 */
+#ifdef TCP_NOTSENT_LOWAT
+  #define sockopt_set_notsent_lowat(fd, val) \
+	(sockopt_set_intval((fd), IPPROTO_TCP, TCP_NOTSENT_LOWAT, (val)))
+#else
+  #define sockopt_set_notsent_lowat(fd, val) (-EOPNOTSUPP)
+#endif
+
+/* 关闭 TCP_CORK，立即发出积攒的数据，包括 MSG_MORE 积攒的数据 */
+#ifdef TCP_CORK
+  #define sockopt_enable_cork(fd) \
+	(sockopt_set_intval((fd), IPPROTO_TCP, TCP_CORK, 1))
+  #define sockopt_disable_cork(fd) \
+	(sockopt_set_intval((fd), IPPROTO_TCP, TCP_CORK, 0))
+#else
+  #define sockopt_enable_cork(fd) (-EOPNOTSUPP)
+  #define sockopt_disable_cork(fd) (-EOPNOTSUPP)
+#endif
+
 /* 得到套接字上的错误值 */
 #define sockopt_get_sockerr(fd) \
 	({ int _val = 0; sockopt_get_intval((fd), \
@@ -171,6 +242,14 @@ extern int sockopt_set_linger(int fd, bool onoff, int linger);
 #define sockopt_reuseaddress(fd) \
 	(sockopt_set_intval((fd), SOL_SOCKET, SO_REUSEADDR, 1))
 
+#if defined(SO_REUSEPORT)
+/* 多个套接字绑定同一地址，由内核在其间分配连接 */
+  #define sockopt_reuseport(fd) \
+	(sockopt_set_intval((fd), SOL_SOCKET, SO_REUSEPORT, 1))
+#else
+  #define sockopt_reuseport(fd) (-EOPNOTSUPP)
+#endif
+
 /* 开启广播 */
 #define sockopt_enable_broadcast(fd) \
 	(sockopt_set_intval((fd), SOL_SOCKET, SO_BROADCAST, 1))
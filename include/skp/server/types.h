@@ -42,6 +42,11 @@ enum {
 	XPRT_OPT_TCPKEEPALIVE = 0x00000040U, /**< 通过特殊分节自动保持活动链接*/
 	XPRT_OPT_TCPLINGEROFF = 0x00000080U, /**< 没有四路挥手关闭*/
 	XPRT_OPT_TCPLARGELINGER = 0x00000100U, /**< 无限延迟关闭，直到发送完毕，默认 81920 毫秒*/
+	XPRT_OPT_KTLS         = 0x00000200U, /**< 握手后尝试将加解密卸载到内核（kTLS），仅对 xprt_ssl 有效*/
+	XPRT_OPT_SSLASYNC     = 0x00000400U, /**< 在工作队列中进行握手计算，仅对 xprt_ssl 有效*/
+	XPRT_OPT_TCPFASTOPEN  = 0x00000800U, /**< TFO，侦听对象接受 SYN 中的数据，客户端的第一次写入随 SYN 发出，多个地址并行连接时不使用*/
+	XPRT_OPT_TCPDEFERACCEPT = 0x00001000U, /**< 仅对侦听对象有效，有数据到达后才唤醒*/
+	XPRT_OPT_TCPNOTSENTLOWAT = 0x00002000U, /**< 未发出的数据低于水位才可写，可写即表示网络在排空*/
 	XPRT_OPT_MASK = 0x0000fff0U,
 
 	/* status bit of xprt
@@ -58,6 +63,8 @@ enum {
 	/*7*/XPRT_WRREADY_BIT, /**< 写就绪，仅为事件标识，不驻留在状态中*/
 	/*8*/XPRT_CONNREFUSED_BIT, /**< 连接拒绝，作为最后退出状态*/
 	/*9*/XPRT_HANDSHAKED_BIT, /**< 已完成握手*/
+	/*10*/XPRT_TIMEDOUT_BIT, /**< 超时，仅为事件标识，不驻留在状态中*/
+	/*11*/XPRT_CORKED_BIT, /**< 有 MSG_MORE 积攒的数据未发出 @see xprt_write_more()*/
 
 	XPRT_STATS_MASK = (~(XPRT_TYPE_MASK | XPRT_OPT_MASK)),
 
@@ -71,6 +78,8 @@ enum {
 	XPRT_WRREADY = 1U << XPRT_WRREADY_BIT,
 	XPRT_CONNREFUSED = 1U << XPRT_CONNREFUSED_BIT,
 	XPRT_HANDSHAKED = 1U << XPRT_HANDSHAKED_BIT,
+	XPRT_TIMEDOUT = 1U << XPRT_TIMEDOUT_BIT,
+	XPRT_CORKED = 1U << XPRT_CORKED_BIT,
 
 	XPRT_SHUT_RDWR = XPRT_SHUTWR | XPRT_SHUTRD,
 
@@ -78,6 +87,15 @@ enum {
 	XPRT_SSL_NONHANDSHAKE = 0,
 	XPRT_SSL_HANDSHAKING,
 	XPRT_SSL_HANDSHAKED,
+
+	/*xprt_ssl.ktls*/
+	XPRT_SSL_KTLS_TX = 0x01, /**< 发送方向已由内核加密*/
+	XPRT_SSL_KTLS_RX = 0x02, /**< 接收方向已由内核解密*/
+
+	/*xprt_ssl.hs_state*/
+	XPRT_SSL_HS_IDLE = 0,
+	XPRT_SSL_HS_RUNNING, /**< 正在工作队列中握手*/
+	XPRT_SSL_HS_DONE, /**< 单步握手完成，等待事件线程处理结果*/
 #endif
 
 };
@@ -175,6 +193,25 @@ static __always_inline size_t sock_address2inet(const struct sock_address *saddr
 	return length;
 }
 
+/*比较地址族、端口与地址是否相同*/
+static inline bool inet_address_equal(const union inet_address *inet,
+		const struct sockaddr *sa)
+{
+	if (inet->sock_addr.sa_family != sa->sa_family)
+		return false;
+	if (sa->sa_family == AF_INET) {
+		const struct sockaddr_in *sin = (const struct sockaddr_in*)sa;
+		return inet->sin_addr.sin_port == sin->sin_port &&
+			inet->sin_addr.sin_addr.s_addr == sin->sin_addr.s_addr;
+	} else if (sa->sa_family == AF_INET6) {
+		const struct sockaddr_in6 *sin6 = (const struct sockaddr_in6*)sa;
+		return inet->sin6_addr.sin6_port == sin6->sin6_port &&
+			!memcmp(&inet->sin6_addr.sin6_addr, &sin6->sin6_addr,
+				sizeof(sin6->sin6_addr));
+	}
+	return false;
+}
+
 __END_DECLS
 
 #endif
@@ -4,6 +4,7 @@
 #include "../utils/uref.h"
 #include "../adt/list.h"
 #include "../process/event.h"
+#include "../process/workqueue.h"
 #include "types.h"
 
 __BEGIN_DECLS
@@ -30,6 +31,8 @@ struct xprt_operations {
 
 	/**
 	 * 握手，返回0则握手完成，继续下面的流程，
+	 * 返回正值表示握手完成，且握手层已缓存了应用数据，开启了读事件时
+	 * 会通知一次 on_recv()，
 	 * 返回 -EAGAIN 则重试，否则视为发生错误，关闭底层
 	 */
 	int (*do_handshake)(struct xprt*, unsigned long event);
@@ -63,6 +66,71 @@ struct xprt_operations {
 	 * 所以如果不在事件触发中调用，则必须保证事件已停止
 	 */
 	void (*on_shutdown)(struct xprt*, int how);
+
+	/**
+	 * 超时钩子函数，@see xprt_set_timeouts()
+	 * status : XPRT_TIMEDOUT | EVENT_READ (读超时) | EVENT_WRITE (写超时)，
+	 *          如果没有读写标识，则为空闲超时
+	 * 在传输对象所在的事件线程中异步回调，为空则默认关闭传输对象，
+	 * 否则由使用者决定是否关闭，不关闭则对应的超时将重新计时
+	 */
+	void (*on_timeout)(struct xprt*, unsigned long status);
+
+	/**
+	 * 刷新传输层缓存的待发送数据，@see xprt_ssl_flush()
+	 * 在写就绪时、on_send() 之前调用，为空则不缓存
+	 * 返回 0 则继续通知 on_send()，返回 -EAGAIN 表示仍有数据待发送，
+	 * 写事件已重新开启，本次不通知 on_send()，其他负值视为错误
+	 */
+	int (*do_flush)(struct xprt*);
+};
+
+struct xprt_rate;
+
+/*
+ * 超时管理，每个事件槽位一个粗粒度的时间轮
+ * 活动时仅刷新时间戳，不会修改时间轮和定时器堆
+ */
+struct xprt_wheel;
+struct xprt_timeo {
+	struct list_head node;
+	struct xprt_wheel *wheel; /**< 不为空则表示已开启超时管理*/
+	/*以时间轮的滴答为单位，0表示关闭*/
+	uint32_t idle;
+	uint32_t rdtmo;
+	uint32_t wrtmo;
+	/*最后活动的时间戳*/
+	uint32_t rd_stamp;
+	uint32_t wr_stamp;
+	uint32_t expires; /**< 所在的时间轮槽位的到期滴答*/
+};
+
+/*TFO 侦听对象的待完成握手的队列长度 @see XPRT_OPT_TCPFASTOPEN*/
+#ifndef CONFIG_XPRT_TFO_QLEN
+# define CONFIG_XPRT_TFO_QLEN (256)
+#endif
+
+/*等待第一个数据的最长时间，秒 @see XPRT_OPT_TCPDEFERACCEPT*/
+#ifndef CONFIG_XPRT_DEFER_ACCEPT
+# define CONFIG_XPRT_DEFER_ACCEPT (10)
+#endif
+
+/*未发出数据的水位，字节 @see XPRT_OPT_TCPNOTSENTLOWAT*/
+#ifndef CONFIG_XPRT_NOTSENT_LOWAT
+# define CONFIG_XPRT_NOTSENT_LOWAT (16384)
+#endif
+
+/*
+ * 读写的统计，只由读写的路径修改，不加锁，
+ * 在其他线程中读取时是近似值 @see server_for_each_xprt()
+ * 字节为交给使用者或由使用者写入的数据量，SSL 为明文
+ * 消息由使用者在解析出完整的消息后计数 @see xprt_stat_msgs()
+ */
+struct xprt_stats {
+	uint64_t rx_bytes;
+	uint64_t tx_bytes;
+	uint64_t rx_msgs;
+	uint64_t tx_msgs;
 };
 
 /*基类*/
@@ -78,6 +146,12 @@ struct xprt {
 	struct server *server;
 	const struct xprt_operations *xprt_ops;
 
+	/*超时管理*/
+	struct xprt_timeo timeo;
+	/*限速与公平调度，为空则不限制 @see xprt_set_rate()*/
+	struct xprt_rate *rate;
+	struct xprt_stats stats;
+
 	/*提供给基类的字段*/
 	void *user;
 };
@@ -99,6 +173,12 @@ struct xprt {
  * 套接字选项 XPRT_OPT_XXX
  * 或开启事件的选项 XPRT_RDREADY/XPRT_WRREADY
  * !!! 注意，写事件默认是单次触发 !!!
+ * 6. 非阻塞客户端的主机名未命中解析缓存时，在解析工作队列中异步解析，
+ *    期间传输对象还没有描述符，不能修改事件，解析完成后再发起连接并开启
+ *    XPRT_RDREADY/XPRT_WRREADY 指定的事件，解析失败则触发 XPRT_CONNREFUSED
+ * 7. 非阻塞客户端解析出多个地址时，在事件线程上并行连接（RFC 8305），
+ *    第一个成功的连接被安装，与 6 一样在此之前不能修改事件，全部失败则触发
+ *    XPRT_CONNREFUSED
  */
 extern struct xprt *create_xprt(struct server *, const struct service_address *,
 	unsigned long opt, const struct xprt_operations *, void *user, ...);
@@ -174,22 +254,171 @@ static inline void xprt_set_nonblock(struct xprt *xprt)
 // 一些辅助函数
 ////////////////////////////////////////////////////////////////////////////////
 
+static inline void xprt_stat_rx(struct xprt *x, size_t bytes)
+{
+	x->stats.rx_bytes += bytes;
+}
+
+static inline void xprt_stat_tx(struct xprt *x, size_t bytes)
+{
+	x->stats.tx_bytes += bytes;
+}
+
+/*累计收发的消息数量，必须在传输对象所在的事件线程中调用*/
+static inline void xprt_stat_msgs(struct xprt *xprt, uint32_t rx, uint32_t tx)
+{
+	xprt->stats.rx_msgs += rx;
+	xprt->stats.tx_msgs += tx;
+}
+
+/*
+ * TFO 的客户端没有缓存的 cookie 时，数据不能随 SYN 发出，
+ * 第一次写入返回 EINPROGRESS，与 EAGAIN 一样等待可写
+ */
+static inline ssize_t __xprt_write_errno(void)
+{
+	return skp_unlikely(errno == EINPROGRESS) ? -EAGAIN : -errno;
+}
+
+extern ssize_t __xprt_rate_read(const struct xprt *, void *, size_t);
+extern ssize_t __xprt_rate_write(const struct xprt *, const void *, size_t);
+
+/*统计与限速只修改传输对象的内部状态，接口保持 const*/
 static inline ssize_t xprt_read(const struct xprt *x, void *b, size_t s)
 {
-	ssize_t rc = read(xprt_fd((x)), (b), (s));
+	ssize_t rc;
+	if (skp_unlikely(READ_ONCE(x->rate)))
+		return __xprt_rate_read(x, b, s);
+	rc = read(xprt_fd((x)), (b), (s));
 	if (skp_unlikely(rc < 0))
-		rc = -errno;
+		return -errno;
+	xprt_stat_rx((struct xprt *)x, rc);
 	return rc;
 }
 
 static inline ssize_t xprt_write(const struct xprt *x, const void *b, size_t s)
 {
-	ssize_t rc = write(xprt_fd((x)), (b), (s));
+	ssize_t rc;
+	if (skp_unlikely(READ_ONCE(x->rate)))
+		return __xprt_rate_write(x, b, s);
+	rc = write(xprt_fd((x)), (b), (s));
 	if (skp_unlikely(rc < 0))
-		rc = -errno;
+		return __xprt_write_errno();
+	xprt_stat_tx((struct xprt *)x, rc);
 	return rc;
 }
 
+/**
+ * 以 MSG_MORE 写入，数据在内核中积攒，与之后的写入合并为尽量大的分节
+ * 在传输对象的事件回调中调用时，回调返回后由框架统一发出，
+ * 在其他线程或其他对象的回调中调用时，必须调用 xprt_write_flush()
+ * 仅对 TCP 的明文传输对象有效，不需要关闭 Nagle 算法
+ * @return 写入的字节数，或负值的错误号
+ */
+extern ssize_t xprt_write_more(struct xprt *, const void *, size_t);
+
+extern int __xprt_write_flush(struct xprt *);
+/**
+ * 立即发出 xprt_write_more() 积攒的数据，没有积攒的数据时不做系统调用
+ * @return 0 成功，或负值的错误号
+ */
+static inline int xprt_write_flush(struct xprt *xprt)
+{
+	if (skp_likely(!test_bit(XPRT_CORKED_BIT, &xprt->flags)))
+		return 0;
+	return __xprt_write_flush(xprt);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// 超时管理
+////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * 设置空闲、读、写超时，毫秒单位，精度为时间轮的滴答（CONFIG_XPRT_TIMEO_TICK）
+ * 1. 空闲超时：读写均没有活动
+ * 2. 读超时：开启了读事件，但没有读活动
+ * 3. 写超时：开启了写事件，但一直不可写
+ * 全部为 0 则关闭超时管理，超时后回调 on_timeout()，@see xprt_operations
+ * @return 0 成功，或负值的错误号
+ */
+extern int xprt_set_timeouts(struct xprt *, uint32_t idle_ms,
+	uint32_t rd_ms, uint32_t wr_ms);
+
+/*所有槽位的时间轮的累计统计*/
+struct xprt_timeo_stat {
+	uint64_t nr_ticks; /**< 定时器回调的次数*/
+	uint64_t nr_slots; /**< 回调中遍历的槽位数，正常时每次回调约为一个*/
+};
+
+extern void xprt_timeo_stat(struct xprt_timeo_stat *);
+
+extern void __xprt_timeo_touch(struct xprt *, uint16_t mask);
+/**
+ * 刷新读(EVENT_READ)/写(EVENT_WRITE)活动的时间戳，O(1) 操作
+ * 框架在触发读写事件时会自动刷新
+ */
+static inline void xprt_timeo_touch(struct xprt *xprt, uint16_t mask)
+{
+	if (READ_ONCE(xprt->timeo.wheel))
+		__xprt_timeo_touch(xprt, mask);
+}
+
+/*重新开启读写事件时，重新开始对应超时的计时*/
+static inline void xprt_timeo_arm(struct xprt *xprt, uint8_t mask)
+{
+	mask &= ~uev_stream_mask(xprt_ev(xprt)) & (EVENT_READ | EVENT_WRITE);
+	if (mask)
+		xprt_timeo_touch(xprt, mask);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// 限速与公平调度
+////////////////////////////////////////////////////////////////////////////////
+
+/*公平调度时，每一轮每个单位权重可以发送的字节数*/
+#ifndef CONFIG_XPRT_DRR_QUANTUM
+# define CONFIG_XPRT_DRR_QUANTUM (16384)
+#endif
+
+/**
+ * 设置接收方向的限速，0 表示不限制
+ * 1. 字节令牌由 xprt_read() 消耗，消息令牌由 xprt_rate_charge() 消耗
+ * 2. 令牌耗尽时暂停读事件，xprt_read() 返回 -EAGAIN，
+ *    由传输对象所在事件槽位的补充滴答（CONFIG_XPRT_RATE_TICK）恢复
+ * 3. 不作用于 xprt_ssl，因为 SSL 内部缓存的明文不会再引发读事件
+ * @return 0 成功，或负值的错误号
+ */
+extern int xprt_set_rate(struct xprt *, uint32_t bytes_ps, uint32_t msgs_ps);
+
+/**
+ * 设置发送方向的公平调度权重，0 表示不参与
+ * 同一事件槽位上有权重的传输对象按轮次发送，每轮最多发送
+ * weight * CONFIG_XPRT_DRR_QUANTUM 字节，用完后 xprt_write() 返回 -EAGAIN
+ * 并暂停写事件，所有参与者都用完份额或到达补充滴答时开始新的一轮，
+ * 然后重新开启写事件
+ * 调度状态属于事件槽位而不是服务器，这是一种近似：
+ * 1. 只在同一槽位的传输对象之间公平，不论它们属于哪个服务器，
+ *    同一服务器分布在不同槽位上的连接各自独立调度，彼此之间不做比较
+ * 2. 权重只在所在的槽位内生效，一个服务器在每个槽位上都按各自的权重分配，
+ *    服务器整体得到的带宽随其占用的槽位数而增加
+ * 这样每次写入只需要槽位内的锁，目的是防止一个连接占满所在的事件循环
+ * @return 0 成功，或负值的错误号
+ */
+extern int xprt_set_weight(struct xprt *, uint16_t weight);
+
+extern void __xprt_rate_charge(struct xprt *, uint32_t msgs);
+/*消耗接收方向的消息令牌，由使用者在解析出完整的消息后调用*/
+static inline void xprt_rate_charge(struct xprt *xprt, uint32_t msgs)
+{
+	if (READ_ONCE(xprt->rate))
+		__xprt_rate_charge(xprt, msgs);
+}
+
+/*过滤被暂停的事件，或在关闭事件时放弃恢复*/
+extern uint8_t __xprt_rate_filter(struct xprt *, uint8_t mask, bool enable);
+
+////////////////////////////////////////////////////////////////////////////////
+
 static inline int xprt_event_add(struct xprt* xprt, uint8_t mask)
 {
 	if (xprt_has_closed(xprt))
@@ -198,6 +427,9 @@ static inline int xprt_event_add(struct xprt* xprt, uint8_t mask)
 		mask &= ~ EVENT_READ;
 	if (READ_ONCE(xprt->flags) & XPRT_SHUTWR)
 		mask &= ~ EVENT_WRITE;
+	if (skp_unlikely(READ_ONCE(xprt->rate)))
+		mask = __xprt_rate_filter(xprt, mask, true);
+	xprt_timeo_arm(xprt, mask);
 	return uev_stream_add(xprt_ev(xprt), mask);
 }
 
@@ -209,12 +441,22 @@ static inline int xprt_event_enable(struct xprt *xprt, uint8_t mask)
 		mask &= ~ EVENT_READ;
 	if (READ_ONCE(xprt->flags) & XPRT_SHUTWR)
 		mask &= ~ EVENT_WRITE;
+	/*被暂停的事件由限速恢复*/
+	if (skp_unlikely(READ_ONCE(xprt->rate)))
+		mask = __xprt_rate_filter(xprt, mask, true);
+	xprt_timeo_arm(xprt, mask);
 	return uev_stream_enable(xprt_ev(xprt), mask);
 }
 
+static inline int xprt_event_disable(struct xprt *xprt, uint8_t mask)
+{
+	if (skp_unlikely(READ_ONCE(xprt->rate)))
+		__xprt_rate_filter(xprt, mask, false);
+	return uev_stream_disable(xprt_ev(xprt), mask);
+}
+
 #define xprt_event_delete(x) uev_stream_delete_async(xprt_ev((x)))
 #define xprt_event_delete_sync(x) uev_stream_delete_sync(xprt_ev((x)))
-#define xprt_event_disable(x, mask) uev_stream_disable(xprt_ev((x)), (mask))
 
 ////////////////////////////////////////////////////////////////////////////////
 // 预实现的二级传输对象
@@ -230,6 +472,29 @@ static inline int xprt_event_enable(struct xprt *xprt, uint8_t mask)
 #define tcpserv_family(__s)												\
 	((__s)->lstn_address.sock_addr.sa_family)
 
+/*过载时的动作 @see xprt_tcpserv_set_admission()*/
+enum {
+	XPRT_ADMIT_DEFER  = 0x01, /**< 暂停接受新连接，由内核的侦听队列缓冲*/
+	XPRT_ADMIT_REJECT = 0x02, /**< 接受新连接后立即以 RST 关闭*/
+	XPRT_ADMIT_SHED   = 0x04, /**< 关闭优先级最低的已有被动连接*/
+};
+
+/*自适应的准入控制*/
+struct xprt_admission {
+	struct workqueue_struct *wq; /**< 观察积压的工作队列，可以为空*/
+	uint32_t max_lag; /**< 事件循环延迟的阈值，毫秒，0 表示不观察*/
+	uint32_t max_congested; /**< 拥塞的任务队列数量的阈值*/
+	uint8_t policy;
+	bool overloaded;
+	bool deferred; /**< 因为过载而暂停了接受*/
+	bool armed;
+	/*统计*/
+	uint32_t nr_overloads;
+	uint32_t nr_rejected;
+	uint32_t nr_shed;
+	struct uev_timer timer;
+};
+
 struct xprt_tcpserv {
 	/*私有字段，用户只读或通过接口操作*/
 	struct xprt xprt; /*base class*/
@@ -237,8 +502,45 @@ struct xprt_tcpserv {
 	const struct xprt_operations *clnt_xprt_ops;
 	/*因为接受了太多被动连接而暂停*/
 	bool cool_down;
+	struct xprt_admission admission;
 };
 
+/*过载检测的周期，毫秒*/
+#ifndef CONFIG_XPRT_ADMIT_PROBE
+# define CONFIG_XPRT_ADMIT_PROBE (100)
+#endif
+
+/*每个检测周期最多关闭的被动连接数量*/
+#ifndef CONFIG_XPRT_ADMIT_SHED
+# define CONFIG_XPRT_ADMIT_SHED (8)
+#endif
+
+/**
+ * 设置侦听对象的准入控制，policy 为 0 则关闭
+ * 1. 每个检测周期观察所有事件槽位的循环延迟 @see xprt_loop_lag()，
+ *    以及 wq 中拥塞的任务队列数量 @see workqueue_congested()
+ * 2. 延迟超过 max_lag 或拥塞数量超过 max_congested 则进入过载状态，
+ *    延迟回落到阈值的一半以下且不再拥塞时退出
+ * 3. 过载时按 policy 处理新连接，XPRT_ADMIT_DEFER 优先于 XPRT_ADMIT_REJECT，
+ *    XPRT_ADMIT_SHED 在每个周期关闭本侦听对象接受的优先级最低、最新的
+ *    CONFIG_XPRT_ADMIT_SHED 个被动连接 @see xprt_tcpclnt_set_priority()
+ * @return 0 成功，或负值的错误号
+ */
+extern int xprt_tcpserv_set_admission(struct xprt *, uint8_t policy,
+	uint32_t max_lag, struct workqueue_struct *wq, uint32_t max_congested);
+
+/*侦听对象是否处于过载状态*/
+static inline bool xprt_tcpserv_overloaded(struct xprt *xprt)
+{
+	return READ_ONCE(xprt_to_tcpserv(xprt)->admission.overloaded);
+}
+
+/*
+ * 所有事件槽位中平滑后的最大循环延迟，毫秒，仅在开启准入控制后才会采样，
+ * 所有侦听对象都关闭了准入控制后停止采样并归零
+ */
+extern uint32_t xprt_loop_lag(void);
+
 /**
  * 创建服务器
  * 绑定并侦听连接，并在成功后安装
@@ -276,6 +578,24 @@ extern const struct xprt_operations xprt_tcpserv_ops;
 		uint8_t __f2 = (__clnt)->remote.sock_addr.sa_family;				\
 		WARN_ON(__f1 != __f2); __f1; })
 
+/*
+ * 内核的 TCP 状态，用于区分网络与应用的延迟
+ * 采样之间的差值比单次的值更有意义，比如重传的增长
+ */
+struct xprt_tcpinfo {
+	uint64_t stamp; /**< 采样的单调时间，毫秒，0 表示没有采样过*/
+	uint32_t rtt; /**< 平滑的往返时间，微秒*/
+	uint32_t rttvar; /**< 往返时间的偏差，微秒*/
+	uint32_t snd_cwnd; /**< 拥塞窗口，以 MSS 为单位*/
+	uint32_t snd_mss;
+	uint32_t unacked; /**< 已发送但没有确认的分段*/
+	uint32_t retransmits; /**< 当前连续超时重传的次数*/
+	uint32_t total_retrans; /**< 累计重传的分段*/
+	uint32_t lost; /**< 被认为丢失的分段*/
+	uint8_t state; /**< TCP_ESTABLISHED 等*/
+};
+
+struct xprt_race;
 struct xprt_tcpclnt {
 	/*私有字段，用户只读或通过接口操作*/
 	struct xprt xprt;/*base class*/
@@ -283,12 +603,31 @@ struct xprt_tcpclnt {
 
 	union inet_address local;
 	union inet_address remote;
+	/*过载时优先关闭低优先级的被动连接 @see XPRT_ADMIT_SHED*/
+	uint8_t priority;
+	/*最近一次的 TCP_INFO 采样 @see xprt_tcpinfo_sample()*/
+	struct xprt_tcpinfo tcpinfo;
+	/*多个地址并行连接的状态，连接建立前由关闭路径取消*/
+	struct xprt_race *race;
 
 	/*TODO:提供给继承类的字段，由用户初始化，比如控制、套接字选项信息*/
 };
 
+static inline void xprt_tcpclnt_set_priority(struct xprt *xprt, uint8_t prio)
+{
+	WRITE_ONCE(xprt_to_tcpclnt(xprt)->priority, prio);
+}
+
+/**
+ * 立即采样 TCP_INFO，结果保存在 xprt_tcpclnt.tcpinfo 中
+ * 周期性的采样 @see server_set_tcpinfo()
+ * @return 0 成功，或负值的错误号
+ */
+extern int xprt_tcpinfo_sample(struct xprt *);
+
 /** 创建客户端
  * 发起（非阻塞）连接，并在成功后安装
+ * 主机名使用带缓存的同步解析 @see resolv_lookup()
  */
 extern int create_xprt_tcpclnt(struct xprt*, struct server *serv,
 	const struct service_address *address, unsigned long opt,
@@ -325,6 +664,15 @@ extern bool xprt_tcpclnt_move(struct xprt_tcpclnt *alias, struct xprt_tcpclnt *s
 
 #ifdef ENABLE_SSL
 
+/*发送链的最大分片数及每个分片的大小，一个分片至少能容纳一个完整的记录*/
+#ifndef CONFIG_XPRT_SSL_TXSEGS
+# define CONFIG_XPRT_SSL_TXSEGS 4
+#endif
+#ifndef CONFIG_XPRT_SSL_TXSEG_SIZE
+# define CONFIG_XPRT_SSL_TXSEG_SIZE (16384 + 512)
+#endif
+
+struct pbuff;
 struct ssl_st;
 struct ssl_ctx_st;
 struct xprt_ssl {
@@ -335,6 +683,21 @@ struct xprt_ssl {
 
 	int ev_mask; /*原来的  ev_mask，握手后需要恢复*/
 	int handshake_stat; /*XPRT_SSL_XXX*/
+	int ktls; /*XPRT_SSL_KTLS_XX，握手后内核接管的方向*/
+
+	/*异步握手，@see XPRT_OPT_SSLASYNC*/
+	int hs_state; /*XPRT_SSL_HS_XXX*/
+	int hs_result; /*工作队列中单步握手的结果*/
+	bool hs_rdmask; /*执行期间是否关闭了读事件*/
+	struct work_struct hs_work;
+
+	/*
+	 * 发送链，使用 pbuff 的 BIO 时保存套接字未接受的密文，
+	 * 在写就绪时由 writev 一次性发出，@see xprt_ssl_flush()
+	 */
+	struct pbuff *txq[CONFIG_XPRT_SSL_TXSEGS];
+	uint32_t txq_nr; /*已分配的分片数*/
+	uint32_t txq_len; /*待发送的字节数*/
 
 	union {
 		const char *tlsext_host_name; /*客户端使用*/
@@ -403,6 +766,9 @@ extern void xprt_ssl_shutdown(struct xprt *, int how);
  * 默认的握手函数
  * 内部会自动辨别是客户端握手还是服务器端握手
  * 可重入，但不保证线程安全
+ * 设置了 XPRT_OPT_SSLASYNC 时，握手的计算在工作队列中进行，事件线程不会被阻塞，
+ * 返回值的语义不变
+ * 握手完成时如果预读了应用数据则返回 1 @see xprt_operations.do_handshake
  */
 extern int xprt_ssl_handshake(struct xprt *, unsigned long event);
 
@@ -410,6 +776,36 @@ extern int xprt_ssl_handshake(struct xprt *, unsigned long event);
 extern ssize_t xprt_ssl_read(struct xprt *x, void *b, size_t s);
 extern ssize_t xprt_ssl_write(struct xprt *x, const void *b, size_t s);
 
+/**
+ * 发送链的刷新函数，可直接作为 do_flush 钩子
+ * 设置了 do_flush 且未开启 XPRT_OPT_KTLS 时，握手前会使用基于 pbuff 的 BIO
+ * 替换默认的套接字 BIO，没有积压时记录直接从 openssl 的写缓存发出，
+ * 只有套接字未接受的密文才拷贝到发送链中，积压时写入不会返回 -EAGAIN，
+ * 直到发送链用完，积压的分片在写就绪时由一次 writev 发出，
+ * 接收仍直接读入 openssl 的记录缓存，并开启预读以便一次读取多个记录
+ * @return 0 全部发出，-EAGAIN 仍有剩余并已开启写事件，其他为错误
+ */
+extern int xprt_ssl_flush(struct xprt *x);
+
+/**
+ * 零拷贝发送文件，仅在发送方向已卸载到内核（XPRT_SSL_KTLS_TX）时可用
+ * @return 发送的字节数，或负值的错误号，-EOPNOTSUPP 表示需要回退到 xprt_ssl_write()
+ */
+extern ssize_t xprt_ssl_sendfile(struct xprt *x, int fd, off_t off, size_t s);
+
+/**
+ * 握手后，是否复用了会话（会话 ID 或票据）
+ * 默认上下文中，服务器端使用分片的会话缓存与轮换的票据密钥，
+ * 客户端以上游的地址与 SNI 为键存储会话，再次连接时自动复用
+ */
+extern bool xprt_ssl_session_reused(const struct xprt *x);
+
+/*握手后，内核是否已接管加解密，XPRT_SSL_KTLS_XX*/
+static inline int xprt_ssl_ktls(const struct xprt *x)
+{
+	return READ_ONCE(xprt_to_ssl((struct xprt *)x)->ktls);
+}
+
 #endif
 
 
@@ -6,12 +6,13 @@
 /* #undef MUTEX_DEBUG */
 /* #undef RWSEM_DEBUG */
 /* #undef BUDDY_DEBUG */
+/* #undef BUDDY_HUGEPAGE */
 /* #undef SLAB_DEBUG */
 /* #undef DICT_DEBUG */
 /* #undef EVENT_SINGLE */
 #define UMALLOC_MANGLE 1
-#define ENABLE_SSL 1
+/* #undef ENABLE_SSL */
 
-#define CONFIG_CPU_CORES 4
+#define CONFIG_CPU_CORES 0
 
 #endif
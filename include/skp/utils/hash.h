@@ -15,6 +15,13 @@ static inline uint32_t __get_unaligned_cpu32(const void *p)
 	return ptr->x;
 }
 
+static inline uint64_t __get_unaligned_cpu64(const void *p)
+{
+	struct __una_u64 { uint64_t x; } __aligned_packed;
+	const struct __una_u64 *ptr = (const struct __una_u64 *)p;
+	return ptr->x;
+}
+
 /* Best hash sizes are of power of two */
 #define jhash_size(n)   ((uint32_t)1<<(n))
 /* Mask the hash value, i.e (value & jhash_mask(n)) instead of (value % n) */
@@ -159,9 +166,52 @@ extern uint32_t HashIgnoreCaseTime33(const void *key, ssize_t keyLen);
 extern uint32_t HashReduceBit(const void *key, ssize_t keyLen);
 extern uint32_t HashPJW(const void *key, ssize_t keyLen);
 
-/*计算检验和*/
+/*
+ * 计算检验和，多项式 0x04c11db7，不反射、首尾不取反
+ * 可以分段计算，init 为上一段的结果
+ * 支持 PCLMULQDQ 时使用无进位乘法折叠
+ */
 extern uint32_t byteCrc32(const void *buf, size_t size, uint32_t init);
 
+/*
+ * CRC32C（Castagnoli），与 iSCSI、ext4 等相同
+ * 可以分段计算，crc 为上一段的结果，第一段为 0
+ * 支持 SSE4.2 时使用 crc32 指令
+ */
+extern uint32_t crc32c(const void *buf, size_t size, uint32_t crc);
+
+/*
+ * Internet 校验和（RFC 1071）的部分和，未折叠，按内存中的字节顺序解释
+ * 可以分段计算，sum 为上一段的结果，第一段为 0
+ * 上一段在奇数偏移处结束时，单独计算后用 csum_block_add() 合并
+ * 支持 AVX2 时使用向量指令
+ */
+extern uint32_t csum_partial(const void *buf, size_t size, uint32_t sum);
+
+/*带进位回卷的加法*/
+static inline uint32_t csum_add(uint32_t sum, uint32_t addend)
+{
+	sum += addend;
+	return sum + (sum < addend);
+}
+
+/*合并从 offset 处开始的一段数据的部分和，奇数偏移时高低字节互换*/
+static inline uint32_t csum_block_add(uint32_t sum, uint32_t sum2,
+		size_t offset)
+{
+	if (offset & 1)
+		sum2 = (sum2 >> 8) | (sum2 << 24);
+	return csum_add(sum, sum2);
+}
+
+/*折叠为 16 位并取反，结果按内存顺序写入报文*/
+static inline uint16_t csum_fold(uint32_t sum)
+{
+	sum = (sum & 0xffff) + (sum >> 16);
+	sum = (sum & 0xffff) + (sum >> 16);
+	return (uint16_t)~sum;
+}
+
 __END_DECLS
 
 #endif
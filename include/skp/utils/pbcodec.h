@@ -0,0 +1,373 @@
+#ifndef __US_PBCODEC_H__
+#define __US_PBCODEC_H__
+
+#include "pbuff.h"
+
+__BEGIN_DECLS
+
+/*
+ * 序列化辅助
+ * 1. LEB128 变长整数与 zigzag 编码，与 protobuf 兼容
+ * 2. 大端、小端的定长整数
+ * 3. 读写游标，越界后错误是粘滞的，之后的读写都不生效，
+ *    解码完一组字段后只需检查一次，不用逐个字段检查返回值
+ */
+
+/*64 位变长整数的最大长度*/
+#define VARINT_MAX_LEN 10
+
+////////////////////////////////////////////////////////////////////////////////
+// 定长整数，地址不要求对齐
+////////////////////////////////////////////////////////////////////////////////
+
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+# define __codec_le16(v) __builtin_bswap16(v)
+# define __codec_le32(v) __builtin_bswap32(v)
+# define __codec_le64(v) __builtin_bswap64(v)
+# define __codec_be16(v) (v)
+# define __codec_be32(v) (v)
+# define __codec_be64(v) (v)
+#else
+# define __codec_le16(v) (v)
+# define __codec_le32(v) (v)
+# define __codec_le64(v) (v)
+# define __codec_be16(v) __builtin_bswap16(v)
+# define __codec_be32(v) __builtin_bswap32(v)
+# define __codec_be64(v) __builtin_bswap64(v)
+#endif
+
+#define __def_codec_fixed(order, bits)									\
+static inline uint##bits##_t get_##order##bits(const void *p)			\
+{																		\
+	uint##bits##_t v;													\
+	memcpy(&v, p, sizeof(v));											\
+	return __codec_##order##bits(v);									\
+}																		\
+static inline void put_##order##bits(void *p, uint##bits##_t v)		\
+{																		\
+	v = __codec_##order##bits(v);										\
+	memcpy(p, &v, sizeof(v));											\
+}
+
+__def_codec_fixed(be, 16)
+__def_codec_fixed(be, 32)
+__def_codec_fixed(be, 64)
+__def_codec_fixed(le, 16)
+__def_codec_fixed(le, 32)
+__def_codec_fixed(le, 64)
+
+#undef __def_codec_fixed
+
+////////////////////////////////////////////////////////////////////////////////
+// zigzag 与变长整数
+////////////////////////////////////////////////////////////////////////////////
+
+static inline uint32_t zigzag_encode32(int32_t v)
+{
+	return ((uint32_t)v << 1) ^ (uint32_t)(v >> 31);
+}
+
+static inline int32_t zigzag_decode32(uint32_t v)
+{
+	return (int32_t)((v >> 1) ^ (0U - (v & 1)));
+}
+
+static inline uint64_t zigzag_encode64(int64_t v)
+{
+	return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63);
+}
+
+static inline int64_t zigzag_decode64(uint64_t v)
+{
+	return (int64_t)((v >> 1) ^ (0ULL - (v & 1)));
+}
+
+/*编码后的长度*/
+static inline uint32_t varint_len(uint64_t v)
+{
+	/*每 7 位一个字节，0 也需要一个字节*/
+	return (uint32_t)(((64 - __builtin_clzll(v | 1)) * 9 + 64) / 64);
+}
+
+/**
+ * 编码，p 至少有 varint_len(v) 个字节的空间
+ * @return 写入的长度
+ */
+static inline uint32_t varint_encode(uint8_t *p, uint64_t v)
+{
+	uint8_t *s = p;
+	while (v >= 0x80) {
+		*p++ = (uint8_t)v | 0x80;
+		v >>= 7;
+	}
+	*p++ = (uint8_t)v;
+	return (uint32_t)(p - s);
+}
+
+/**
+ * 解码 [p, end) 中的一个变长整数
+ * @return 消费的长度，数据不完整或超过 64 位时返回 0
+ */
+static inline uint32_t varint_decode(const uint8_t *p, const uint8_t *end,
+		uint64_t *v)
+{
+	uint64_t r = 0;
+	uint32_t n = 0;
+
+	/*单字节最常见*/
+	if (skp_likely(p < end && *p < 0x80)) {
+		*v = *p;
+		return 1;
+	}
+
+	for (; p + n < end && n < VARINT_MAX_LEN; n++) {
+		r |= (uint64_t)(p[n] & 0x7f) << (7 * n);
+		if (!(p[n] & 0x80)) {
+			/*第 10 个字节只能有 1 位有效*/
+			if (skp_unlikely(n == VARINT_MAX_LEN - 1 && p[n] > 1))
+				return 0;
+			*v = r;
+			return n + 1;
+		}
+	}
+	return 0;
+}
+
+/**
+ * 批量解码，使用 SIMD 跳过连续的单字节整数
+ * @param pos 起始位置，返回时更新为未解码的位置
+ * @return 解码的数量，小于 n 时 *pos 处的数据不完整或错误
+ */
+extern size_t varint_decode_array(const uint8_t **pos, const uint8_t *end,
+		uint64_t *out, size_t n);
+
+/*同上，但是解码为 32 位，超出 32 位的值视为错误*/
+extern size_t varint_decode_array32(const uint8_t **pos, const uint8_t *end,
+		uint32_t *out, size_t n);
+
+////////////////////////////////////////////////////////////////////////////////
+// 读游标，读取线性数据，提交后消费
+////////////////////////////////////////////////////////////////////////////////
+
+struct pb_rcursor {
+	const uint8_t *pos;
+	const uint8_t *end;
+	int error; /*0 或者 -ENODATA、-EBADMSG，粘滞*/
+};
+
+static inline void pb_rcursor_init(struct pb_rcursor *rc, const struct pbuff *pb)
+{
+	rc->pos = pb_data(pb);
+	rc->end = pb_tail(pb);
+	rc->error = 0;
+}
+
+static inline size_t pb_rcursor_remain(const struct pb_rcursor *rc)
+{
+	return (size_t)(rc->end - rc->pos);
+}
+
+/*失败后游标停在末尾，之后的读取都返回 0*/
+static inline void __pb_rcursor_fail(struct pb_rcursor *rc, int error)
+{
+	if (!rc->error)
+		rc->error = error;
+	rc->pos = rc->end;
+}
+
+/**
+ * 消费已读取的数据
+ * @return 0 或者读取时的错误号，出错时不消费
+ */
+static inline int pb_rcursor_commit(const struct pb_rcursor *rc,
+		struct pbuff *pb)
+{
+	if (skp_unlikely(rc->error))
+		return rc->error;
+	BUG_ON(rc->pos < pb_data(pb) || rc->pos > pb_tail(pb));
+	pb->data = (uint8_t*)rc->pos;
+	return 0;
+}
+
+/*读取 n 个字节，返回起始位置，不足时返回 NULL*/
+static inline const void *pb_rcursor_bytes(struct pb_rcursor *rc, size_t n)
+{
+	const uint8_t *p = rc->pos;
+	if (skp_unlikely(pb_rcursor_remain(rc) < n)) {
+		__pb_rcursor_fail(rc, -ENODATA);
+		return NULL;
+	}
+	rc->pos += n;
+	return p;
+}
+
+static inline uint8_t pb_rcursor_u8(struct pb_rcursor *rc)
+{
+	const uint8_t *p = pb_rcursor_bytes(rc, 1);
+	return skp_likely(p) ? *p : 0;
+}
+
+#define __def_rcursor_fixed(order, bits)								\
+static inline uint##bits##_t pb_rcursor_##order##bits(struct pb_rcursor *rc)\
+{																		\
+	const void *p = pb_rcursor_bytes(rc, bits / 8);						\
+	return skp_likely(p) ? get_##order##bits(p) : 0;					\
+}
+
+__def_rcursor_fixed(be, 16)
+__def_rcursor_fixed(be, 32)
+__def_rcursor_fixed(be, 64)
+__def_rcursor_fixed(le, 16)
+__def_rcursor_fixed(le, 32)
+__def_rcursor_fixed(le, 64)
+
+#undef __def_rcursor_fixed
+
+static inline uint64_t pb_rcursor_varint(struct pb_rcursor *rc)
+{
+	uint64_t v;
+	uint32_t n = varint_decode(rc->pos, rc->end, &v);
+	if (skp_unlikely(!n)) {
+		__pb_rcursor_fail(rc, pb_rcursor_remain(rc) < VARINT_MAX_LEN ?
+			-ENODATA : -EBADMSG);
+		return 0;
+	}
+	rc->pos += n;
+	return v;
+}
+
+static inline uint32_t pb_rcursor_varint32(struct pb_rcursor *rc)
+{
+	uint64_t v = pb_rcursor_varint(rc);
+	if (skp_unlikely(v > U32_MAX)) {
+		__pb_rcursor_fail(rc, -EBADMSG);
+		return 0;
+	}
+	return (uint32_t)v;
+}
+
+static inline int64_t pb_rcursor_svarint(struct pb_rcursor *rc)
+{
+	return zigzag_decode64(pb_rcursor_varint(rc));
+}
+
+/*读取 n 个变长整数，不足 n 个时失败*/
+static inline void pb_rcursor_varint_array(struct pb_rcursor *rc,
+		uint64_t *out, size_t n)
+{
+	if (skp_unlikely(varint_decode_array(&rc->pos, rc->end, out, n) != n))
+		__pb_rcursor_fail(rc, pb_rcursor_remain(rc) < VARINT_MAX_LEN ?
+			-ENODATA : -EBADMSG);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// 写游标，写入尾部剩余空间，提交后追加
+////////////////////////////////////////////////////////////////////////////////
+
+struct pb_wcursor {
+	uint8_t *pos;
+	uint8_t *end;
+	int error; /*0 或者 -ENOSPC、-ENOMEM，粘滞*/
+};
+
+/**
+ * 初始化，预留至少 need 个字节的尾部空间，必要时扩展数据区
+ * 之后到提交之前不能再修改 pb
+ */
+static inline void pb_wcursor_init(struct pb_wcursor *wc, struct pbuff *pb,
+		size_t need)
+{
+	wc->error = 0;
+	if (skp_unlikely(pb_tailroom(pb) < need) &&
+			pb_expand_head(pb, 0, need - pb_tailroom(pb)))
+		wc->error = -ENOMEM;
+	wc->pos = pb_tail(pb);
+	wc->end = skp_likely(!wc->error) ? pb->end : wc->pos;
+}
+
+static inline size_t pb_wcursor_room(const struct pb_wcursor *wc)
+{
+	return (size_t)(wc->end - wc->pos);
+}
+
+/**
+ * 追加已写入的数据
+ * @return 0 或者写入时的错误号，出错时不追加
+ */
+static inline int pb_wcursor_commit(const struct pb_wcursor *wc,
+		struct pbuff *pb)
+{
+	if (skp_unlikely(wc->error))
+		return wc->error;
+	BUG_ON(wc->pos < pb_tail(pb) || wc->pos > pb->end);
+	pb->tail = wc->pos;
+	return 0;
+}
+
+/*预留 n 个字节，返回起始位置，不足时返回 NULL*/
+static inline void *pb_wcursor_bytes(struct pb_wcursor *wc, size_t n)
+{
+	uint8_t *p = wc->pos;
+	if (skp_unlikely(pb_wcursor_room(wc) < n)) {
+		if (!wc->error)
+			wc->error = -ENOSPC;
+		wc->end = wc->pos;
+		return NULL;
+	}
+	wc->pos += n;
+	return p;
+}
+
+static inline void pb_wcursor_write(struct pb_wcursor *wc, const void *ptr,
+		size_t n)
+{
+	void *p = pb_wcursor_bytes(wc, n);
+	if (skp_likely(p))
+		memcpy(p, ptr, n);
+}
+
+static inline void pb_wcursor_u8(struct pb_wcursor *wc, uint8_t v)
+{
+	uint8_t *p = pb_wcursor_bytes(wc, 1);
+	if (skp_likely(p))
+		*p = v;
+}
+
+#define __def_wcursor_fixed(order, bits)								\
+static inline void pb_wcursor_##order##bits(struct pb_wcursor *wc,		\
+		uint##bits##_t v)												\
+{																		\
+	void *p = pb_wcursor_bytes(wc, bits / 8);							\
+	if (skp_likely(p))													\
+		put_##order##bits(p, v);										\
+}
+
+__def_wcursor_fixed(be, 16)
+__def_wcursor_fixed(be, 32)
+__def_wcursor_fixed(be, 64)
+__def_wcursor_fixed(le, 16)
+__def_wcursor_fixed(le, 32)
+__def_wcursor_fixed(le, 64)
+
+#undef __def_wcursor_fixed
+
+static inline void pb_wcursor_varint(struct pb_wcursor *wc, uint64_t v)
+{
+	/*空间足够时不需要先计算长度*/
+	if (skp_likely(pb_wcursor_room(wc) >= VARINT_MAX_LEN)) {
+		wc->pos += varint_encode(wc->pos, v);
+		return;
+	}
+	uint8_t *p = pb_wcursor_bytes(wc, varint_len(v));
+	if (skp_likely(p))
+		varint_encode(p, v);
+}
+
+static inline void pb_wcursor_svarint(struct pb_wcursor *wc, int64_t v)
+{
+	pb_wcursor_varint(wc, zigzag_encode64(v));
+}
+
+__END_DECLS
+
+#endif
@@ -0,0 +1,78 @@
+#ifndef __US_PBQUEUE_H__
+#define __US_PBQUEUE_H__
+
+#include "pbuff.h"
+
+__BEGIN_DECLS
+
+/*
+ * 在线程之间传递 struct pbuff，所有权随之转移
+ * 1. 无界的多生产者、单消费者队列，通过 pbuff 中的链接串联，入队不分配内存
+ * 2. 有界的单生产者、单消费者队列，基于 struct ringb
+ * 只在队列由空变为非空时唤醒消费者：
+ * 消费者在事件循环中时触发创建时给出的 uev_async，
+ * 否则唤醒在 pb_queue_wait() 中等待的线程
+ * 所以消费者被唤醒后需要一直出队列，直到队列为空
+ */
+
+struct ringb;
+struct uev_async;
+
+struct pb_queue {
+	struct ringb *ring; /*为空则是多生产者队列*/
+	struct uev_async *async;
+	/*生产者压入，后进先出*/
+	struct pbuff *stack __cacheline_aligned;
+	/*消费者私有，已经按先进先出排列*/
+	struct pbuff *head __cacheline_aligned;
+	int sleeping; /*消费者在 pb_queue_wait() 中等待*/
+};
+
+/**
+ * 初始化
+ * @param capacity 为 0 则是无界的多生产者队列，否则是有界的单生产者队列
+ * @param async 队列由空变为非空时触发，可以为空
+ * @return 0 成功，或负值的错误号
+ */
+extern int pb_queue_init(struct pb_queue *q, uint32_t capacity,
+		struct uev_async *async);
+
+/**
+ * 释放队列中剩余的 pbuff 和 ring
+ */
+extern void pb_queue_destroy(struct pb_queue *q);
+
+/**
+ * 入队列
+ * @return 0 成功，-ENOSPC 有界队列已满，pbuff 的所有权仍归调用者
+ */
+extern int pb_queue_push(struct pb_queue *q, struct pbuff *pb);
+
+/**
+ * 批量出队列，只能由一个消费者调用
+ * @return 出队列的数量
+ */
+extern uint32_t pb_queue_pop_bulk(struct pb_queue *q, struct pbuff **pbs,
+		uint32_t n);
+
+static inline struct pbuff *pb_queue_pop(struct pb_queue *q)
+{
+	struct pbuff *pb;
+	return pb_queue_pop_bulk(q, &pb, 1) ? pb : NULL;
+}
+
+/**
+ * 只能由消费者调用，其他线程调用时的结果只能作为参考
+ */
+extern bool pb_queue_empty(const struct pb_queue *q);
+
+/**
+ * 等待队列非空，不在事件循环中的消费者使用
+ * @param timeout 超时毫秒数，小于 0 则一直等待
+ * @return 0 非空，-ETIMEDOUT 超时
+ */
+extern int pb_queue_wait(struct pb_queue *q, int timeout);
+
+__END_DECLS
+
+#endif
@@ -18,12 +18,87 @@ struct pb_ops {
 	void (*expand)(struct pbuff*, ssize_t offset);
 };
 
+/*
+ * 缓存池
+ * 1. 数据区按尺寸等级分配，默认的控制结构（pb_ops 为空）使用单独的等级
+ * 2. 每个线程的每个等级有一个弹匣，分配与释放只是链表的弹出与压入
+ * 3. 在其他线程中释放的对象攒够一批后一次性归还给所属线程，
+ *    所属线程的弹匣为空时再取回
+ * 4. 线程退出后缓存由新的线程接管，超过尺寸上限的数据区不使用缓存池
+ */
+
+/*数据区的尺寸等级，递增*/
+#ifndef CONFIG_PB_POOL_SIZES
+# define CONFIG_PB_POOL_SIZES 256, 2048, 16384, 65536
+#endif
+
+/*每个线程的每个等级最多缓存的数量*/
+#ifndef CONFIG_PB_POOL_MAGAZINE
+# define CONFIG_PB_POOL_MAGAZINE (64)
+#endif
+
+/*归还给其他线程时，每批的数量*/
+#ifndef CONFIG_PB_POOL_BATCH
+# define CONFIG_PB_POOL_BATCH (16)
+#endif
+
+/*释放当前线程缓存的所有对象，并归还攒下的其他线程的对象*/
+extern void pb_pool_reclaim(void);
+
+/*每个数据区最多引用的分片数量，分片数组在第一次添加分片时分配*/
+#ifndef CONFIG_PB_MAX_FRAGS
+# define CONFIG_PB_MAX_FRAGS (16)
+#endif
+
+struct pb_shared_info;
+
+/*
+ * 分片，引用其他数据区中的一段，持有该数据区的一个 dataref
+ * 分片是只读的，随数据区一同被克隆、共享，最后一个 dataref 释放时解除引用
+ */
+struct pb_frag {
+	struct pb_shared_info *shinfo; /*被引用的数据区*/
+	uint32_t offset; /*相对被引用数据区的起始位置*/
+	uint32_t size;
+};
+
 struct pb_shared_info {
 	uref_t dataref;
 	uint32_t datalen;
-	/*TODO : block data arrays*/
+	uint16_t nr_frags;
+	uint16_t pool; /*缓存池的尺寸等级加 1，0 表示不在缓存池中*/
+	uint32_t frags_len; /*所有分片的总长度*/
+	bool external; /*数据区由调用者提供，见 pb_attach_external()*/
+	bool confined; /*dataref 只被一个线程访问，见 pb_confine()*/
+	/*
+	 * 不在共享信息内，没有分片的数据区不为此付出空间，
+	 * 只在 nr_frags 不为 0 时有效，分片全部释放时一同释放
+	 */
+	struct pb_frag *frags;
 };
 
+/*数据区的对齐，共享信息紧随其后*/
+#define PB_DATA_ALIGN __alignof__(struct pb_shared_info)
+
+/*最后一个 dataref 释放时，归还调用者提供的数据区*/
+typedef void (*pb_ext_release)(void *ptr, void *arg);
+
+/*外部数据区的共享信息单独分配，不在数据区之后*/
+struct pb_ext_shared_info {
+	uint8_t *head;
+	pb_ext_release release;
+	void *arg;
+	struct pb_shared_info shinfo;
+};
+
+/*数据区的起始位置*/
+static inline uint8_t *pb_shinfo_head(const struct pb_shared_info *shinfo)
+{
+	if (skp_unlikely(shinfo->external))
+		return container_of(shinfo, struct pb_ext_shared_info, shinfo)->head;
+	return (uint8_t*)shinfo - shinfo->datalen;
+}
+
 /*help to structure protocol data*/
 struct pbuff {
 	uref_t users;
@@ -32,29 +107,71 @@ struct pbuff {
 		uint32_t flags;
 		struct {
 			uint32_t cloned:1;
+			uint32_t confined:1; /*users 只被一个线程访问*/
 		};
 	};
+	/*
+	 * 可见的分片数据为所有分片连接后的 [frag_off, frag_off + data_len)，
+	 * 消费或截断分片数据时只修改这两个字段，不修改共享的分片
+	 */
+	uint32_t data_len;
+	uint32_t frag_off;
 	uint8_t *data; /*data pointer with length*/
 	uint8_t *tail;
 	uint8_t *end;
+	/*共享信息，除外部数据区外都紧随 end 之后*/
+	struct pb_shared_info *shinfo;
 	void *user;
 	const struct pb_ops *pb_ops;
+	struct pbuff *next; /*在 pb_queue 中时的链接*/
 };
 
 #define pb_data(pb) ((pb)->data)
 #define pb_tail(pb) ((pb)->tail)
 /*共享缓存信息*/
-#define pb_shinfo(pb) ((struct pb_shared_info*)((pb)->end))
+#define pb_shinfo(pb) ((pb)->shinfo)
 /*总空间大小*/
 #define pb_size(pb) (pb_shinfo(pb)->datalen)
 /*起始位置*/
 #define pb_head(pb) ((pb)->end - pb_shinfo(pb)->datalen)
 /*有效数据长度*/
 #define pb_headlen(pb) ((size_t)(pb_tail(pb) - pb_data(pb)))
-/*头部剩余空间*/
-#define pb_headroom(pb) ((size_t)((pb)->data - pb_head(pb)))
-/*尾部剩余空间*/
-#define pb_tailroom(pb) ((size_t)((pb)->end - (pb)->tail))
+/*
+ * 头尾剩余空间，外部数据区是只读的，消费或截断后也没有可写的剩余空间，
+ * 写入前会先扩展到新分配的数据区
+ */
+#define pb_headroom(pb) (skp_unlikely(pb_shinfo(pb)->external) ? 0 :	\
+	(size_t)((pb)->data - pb_head(pb)))
+#define pb_tailroom(pb) (skp_unlikely(pb_shinfo(pb)->external) ? 0 :	\
+	(size_t)((pb)->end - (pb)->tail))
+/*包括分片在内的总数据长度*/
+#define pb_len(pb) (pb_headlen(pb) + (pb)->data_len)
+/*是否有可见的分片数据*/
+#define pb_is_nonlinear(pb) (!!(pb)->data_len)
+/*分片数组*/
+#define pb_nr_frags(pb) (pb_shinfo(pb)->nr_frags)
+#define pb_frag(pb, i) (&pb_shinfo(pb)->frags[(i)])
+
+/*分片数据的起始地址*/
+static inline void *pb_frag_address(const struct pb_frag *frag)
+{
+	return pb_shinfo_head(frag->shinfo) + frag->offset;
+}
+
+/*
+ * 遍历可见的分片数据，addr/len 为每段的地址与长度
+ * 已消费和被截断的部分不会出现
+ */
+#define pb_for_each_frag(pb, addr, len)										\
+	for (uint32_t __pbf_i = 0, __pbf_skip = (pb)->frag_off,					\
+			__pbf_remain = (pb)->data_len;									\
+			__pbf_remain && __pbf_i < pb_nr_frags(pb); __pbf_i++)			\
+		if (__pbf_skip >= pb_frag(pb, __pbf_i)->size) {						\
+			__pbf_skip -= pb_frag(pb, __pbf_i)->size;						\
+		} else if (((addr) = (uint8_t*)pb_frag_address(pb_frag(pb, __pbf_i))\
+				+ __pbf_skip), ((len) = min_t(uint32_t, __pbf_remain,		\
+				pb_frag(pb, __pbf_i)->size - __pbf_skip)), (__pbf_skip = 0),	\
+				(__pbf_remain -= (len)), true)
 
 static inline bool pb_shared(const struct pbuff *pb)
 {
@@ -66,13 +183,25 @@ static inline bool pb_cloned(const struct pbuff *pb)
 	return pb->cloned && uref_read(&pb_shinfo(pb)->dataref) != 1;
 }
 
-/*check if pbuff could be reused then reset user data, and return true*/
+extern void __pb_release_frags(struct pb_shared_info *);
+
+/*
+ * check if pbuff could be reused then reset user data, and return true
+ * 外部数据区归调用者所有，不能复用
+ */
 static inline bool pb_reset(struct pbuff *pb)
 {
+	bool confined = pb->confined;
 	if (WARN_ON(pb_shared(pb) || pb_cloned(pb)))
 		return false;
+	if (skp_unlikely(pb_shinfo(pb)->external))
+		return false;
 	pb->flags = 0;
+	pb->confined = confined;
 	pb->data = pb->tail = pb_head(pb);
+	if (skp_unlikely(pb_nr_frags(pb)))
+		__pb_release_frags(pb_shinfo(pb));
+	pb->data_len = pb->frag_off = 0;
 	return true;
 }
 
@@ -90,19 +219,70 @@ static inline struct pbuff *alloc_pb(size_t size)
 	return __alloc_pb(size, NULL, NULL);
 }
 
+/**
+ * 包装调用者提供的内存，不复制，[ptr, ptr + len) 全部作为有效数据
+ * 最后一个 dataref 释放时调用 release(ptr, arg)，失败时内存仍归调用者所有
+ * 数据区只读，始终没有头尾剩余空间，pb_write_*() 等写入会先扩展到新分配的数据区，
+ * 也不能 pb_reset() 复用
+ * 克隆、共享、作为分片引用与一般的 pbuff 相同
+ */
+extern struct pbuff *__pb_attach_external(void *ptr, size_t len,
+		pb_ext_release release, void *arg, const struct pb_ops *pb_ops,
+		void *user);
+
+static inline struct pbuff *pb_attach_external(void *ptr, size_t len,
+		pb_ext_release release, void *arg)
+{
+	return __pb_attach_external(ptr, len, release, arg, NULL, NULL);
+}
+
 static inline void free_pb(struct pbuff *pb)
 {
-	if (skp_likely(pb))
-		uref_put(&pb->users, __free_pb);
+	if (skp_unlikely(!pb))
+		return;
+	if (pb->confined) {
+		if (__uref_put_local(&pb->users))
+			__free_pb(&pb->users);
+		return;
+	}
+	uref_put(&pb->users, __free_pb);
 }
 
 static inline struct pbuff *pb_get(struct pbuff *pb)
 {
-	if (skp_likely(pb) && !uref_get_unless_zero(&pb->users))
+	if (skp_unlikely(!pb))
+		return NULL;
+	if (pb->confined) {
+		if (skp_unlikely(!uref_read(&pb->users)))
+			return NULL;
+		uref_get_local(&pb->users);
+		return pb;
+	}
+	if (!uref_get_unless_zero(&pb->users))
 		return NULL;
 	return pb;
 }
 
+/**
+ * 限定在当前线程中使用，之后 pb_get()、free_pb()、pb_clone() 等
+ * 对引用计数的操作不再是原子的，克隆与共享出的 pbuff 同样被限定
+ * 只能在 pbuff 没有被共享、克隆时调用
+ * @return 是否成功
+ */
+extern bool pb_confine(struct pbuff *pb);
+
+/**
+ * 解除限定，交给其他线程之前必须调用，pb_queue_push() 会自动调用
+ * 同时解除数据区及其引用的分片的限定，同一线程中共享数据区的其他 pbuff
+ * 之后也使用原子操作访问 dataref
+ */
+extern void pb_unconfine(struct pbuff *pb);
+
+static inline bool pb_confined(const struct pbuff *pb)
+{
+	return pb->confined;
+}
+
 /*浅拷贝*/
 extern struct pbuff *pb_clone(struct pbuff*);
 /*深拷贝*/
@@ -199,13 +379,77 @@ static inline void pb_reserve(struct pbuff *pb, size_t len)
 	BUG_ON(pb->tail > pb->end);
 }
 
-/*从尾部截断数据为指定长度*/
+/*从尾部截断数据为指定长度，包括分片数据*/
 static inline void pb_trimdata(struct pbuff *pb, size_t len)
 {
-	if (pb_headlen(pb) > len)
+	if (pb_headlen(pb) >= len) {
 		pb->tail = pb->data + len;
+		pb->data_len = 0;
+	} else if (pb_len(pb) > len) {
+		pb->data_len = (uint32_t)(len - pb_headlen(pb));
+	}
 }
 
+/*
+ * 从头部消费数据，线性数据消费完后继续消费分片数据
+ * @return 实际消费的长度
+ */
+static inline size_t pb_consume(struct pbuff *pb, size_t len)
+{
+	size_t n = min_t(size_t, len, pb_headlen(pb));
+	pb->data += n;
+	if (skp_unlikely(len > n && pb->data_len)) {
+		uint32_t m = (uint32_t)min_t(size_t, len - n, pb->data_len);
+		pb->frag_off += m;
+		pb->data_len -= m;
+		n += m;
+	}
+	return n;
+}
+
+/**
+ * 添加分片，引用 src 中从 pb_data(src) 起偏移 offset、长度为 len 的数据，不复制
+ * 与上一个分片在同一数据区且连续时合并
+ * 分片添加在所有数据之后，所以 pb 不能被截断、消费过分片数据或共享数据区
+ * 不能引用自身的数据区，也不能形成循环引用
+ * @return 0 成功，-ENOSPC 分片已满，或其他负值的错误号
+ */
+extern int pb_add_frag(struct pbuff *pb, struct pbuff *src, size_t offset,
+	size_t len);
+
+/**
+ * 将分片数据复制到线性区域，必要时扩展数据区
+ * 之后 pb_data() 包含全部数据
+ * @return 0 成功，或负值的错误号
+ */
+extern int __pb_linearize(struct pbuff *pb);
+
+static inline int pb_linearize(struct pbuff *pb)
+{
+	if (skp_likely(!pb_is_nonlinear(pb)))
+		return 0;
+	return __pb_linearize(pb);
+}
+
+struct iovec;
+/**
+ * 按顺序将线性数据与分片数据填入 iov，用于 writev()
+ * iov 不足时只填入前面的部分
+ * @return 填入的数量
+ */
+extern int pb_to_iovec(const struct pbuff *pb, struct iovec *iov, int nr);
+
+/**
+ * 按顺序计算线性数据与分片数据的 Internet 校验和部分和，见 csum_partial()
+ * 结果用 csum_fold() 折叠
+ */
+extern uint32_t pb_csum(const struct pbuff *pb, uint32_t sum);
+
+/**
+ * 按顺序计算线性数据与分片数据的 CRC32C，见 crc32c()
+ */
+extern uint32_t pb_crc32c(const struct pbuff *pb, uint32_t crc);
+
 ////////////////////////////////////////////////////////////////////////////////
 // 一般性读写辅助，读头、写尾。
 // intel x86 平台运行进行 未对齐指针的解引用操作
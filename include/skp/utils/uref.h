@@ -91,6 +91,19 @@ static inline bool __uref_put(uref_t *uref)
 	return false;
 }
 
+/*只被一个线程访问时使用，不是原子操作*/
+static inline void uref_get_local(uref_t *uref)
+{
+	atomic_set(&uref->refcount, atomic_read(&uref->refcount) + 1);
+}
+
+static inline bool __uref_put_local(uref_t *uref)
+{
+	int c = atomic_read(&uref->refcount) - 1;
+	atomic_set(&uref->refcount, c);
+	return c == 0;
+}
+
 /*@return true then dec ref to zero and hold lock*/
 static inline bool __uref_put_lock(uref_t *uref, spinlock_t *lock)
 {
@@ -360,6 +360,8 @@ extern time_t parse_time(const char *tm_str, const char *format);
 extern int get_cpu_cores(void);
 extern int thread_bind(int which);
 extern int thread_cpu(void);
+/*当前线程所在的 CPU，未绑定时查询系统，失败返回 -1*/
+extern int thread_getcpu(void);
 extern int get_thread_id(void);
 extern int get_process_id(void);
 
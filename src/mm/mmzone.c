@@ -36,6 +36,41 @@ struct node_config {
 };
 
 #include <sys/mman.h>
+#include <sys/syscall.h>
+#include <fcntl.h>
+
+/*伙伴系统内存块的数量上限，内存块都按自身大小对齐*/
+#define MAX_MEMBLOCKS (VADDR_END / BUDDY_BLKSIZE)
+
+/*
+ * 记录已映射的内存块及其大页方式，用于统计
+ * 回收内存块时按位图扣除对应的统计，都由 big_lock 保护
+ */
+static DECLARE_BITMAP(memblock_map, MAX_MEMBLOCKS);
+static DECLARE_BITMAP(memblock_hugetlb, MAX_MEMBLOCKS);
+static DECLARE_BITMAP(memblock_advised, MAX_MEMBLOCKS);
+static struct hpage_stat memblock_stat;
+
+#define memblock_idx(addr) ((uintptr_t)(addr) / BUDDY_BLKSIZE)
+
+static void memblock_mark(unsigned long *map, void *addr, size_t size)
+{
+	for (uintptr_t i = (uintptr_t)addr; i < (uintptr_t)addr + size;
+			i += BUDDY_BLKSIZE)
+		set_bit(memblock_idx(i), map);
+}
+
+/*清除标记，返回清除前已标记的字节数*/
+static size_t memblock_unmark(unsigned long *map, void *addr, size_t size)
+{
+	size_t bytes = 0;
+	for (uintptr_t i = (uintptr_t)addr; i < (uintptr_t)addr + size;
+			i += BUDDY_BLKSIZE) {
+		if (test_and_clear_bit(memblock_idx(i), map))
+			bytes += min(size, (size_t)BUDDY_BLKSIZE);
+	}
+	return bytes;
+}
 
 #ifndef MAP_NORESERVE
 # define MAP_NORESERVE 0
@@ -43,10 +78,20 @@ struct node_config {
 
 #define PROT_FLAGS (PROT_READ|PROT_WRITE)
 
+/*指定地址映射时，地址已被占用则失败，旧的内核会忽略该标志而作为建议地址*/
+#if defined(__linux__) && !defined(MAP_FIXED_NOREPLACE)
+# define MAP_FIXED_NOREPLACE 0x100000
+#endif
+#ifdef MAP_FIXED_NOREPLACE
+# define MAP_HINT(fixed) ((fixed) ? MAP_FIXED_NOREPLACE : 0)
+#else
+# define MAP_HINT(fixed) (0)
+#endif
+
 #ifdef CONFIG_BUDDY_FILEMMAP
 static inline void *os_mmap(void *fixed, size_t size)
 {
-	int fd;
+	int fd, err;
 	void *addr;
 	char path[128];
 
@@ -59,7 +104,9 @@ static inline void *os_mmap(void *fixed, size_t size)
 	snprintf(path, sizeof(path), "%s", CONFIG_BUDDY_TEMPFILE);
 	fd = mkstemp(path);
 	if (skp_unlikely(fd < 0)) {
-		log_error("create tempfile failed : %s", strerror_local());
+		err = errno;
+		log_error("create tempfile failed : %s", __strerror_local(err));
+		errno = err;
 		return NULL;
 	}
 	truncate(path, size);
@@ -68,10 +115,14 @@ static inline void *os_mmap(void *fixed, size_t size)
 	 *TODO:启动成功后，使用 map_fixed 解决多余一倍内存映射再
 	 *解映射来取对齐段的方式
 	 */
-	addr = mmap(0, size, PROT_FLAGS, MAP_FLAGS, fd, 0);
+	addr = mmap(fixed, size, PROT_FLAGS, MAP_FLAGS | MAP_HINT(fixed), fd, 0);
+	err = errno;
 	close(fd);
-
-	return addr == MAP_FAILED ? NULL : addr;
+	if (skp_unlikely(addr == MAP_FAILED)) {
+		errno = err;
+		return NULL;
+	}
+	return addr;
 }
 #else
 static inline void *os_mmap(void *fixed, size_t size)
@@ -81,7 +132,8 @@ static inline void *os_mmap(void *fixed, size_t size)
 #else
 # define MAP_FLAGS (MAP_ANON | MAP_PRIVATE | MAP_NORESERVE)
 #endif
-	void *addr = mmap(fixed, size, PROT_FLAGS, MAP_FLAGS, -1, 0);
+	void *addr = mmap(fixed, size, PROT_FLAGS, MAP_FLAGS | MAP_HINT(fixed),
+			-1, 0);
 	return skp_unlikely(addr == MAP_FAILED) ? NULL : addr;
 }
 #endif
@@ -91,6 +143,89 @@ static inline int os_munmap(void *ptr, size_t size)
 	return munmap(ptr, size);
 }
 
+#ifdef CONFIG_BUDDY_HUGEPAGE
+/*
+ * 1. 虚拟页不小于大页时，页框回收时解映射的长度总是大页的整数倍，
+ *    才能使用 hugetlb 映射
+ * 2. hugetlb 的内存在映射时就预留，不能使用 MAP_NORESERVE，
+ *    否则缺页时可能因为大页池耗尽而收到 SIGBUS
+ */
+# if defined(MAP_HUGETLB) && !defined(CONFIG_BUDDY_FILEMMAP) && \
+	(VPAGE_SHIFT >= HPAGE_SHIFT)
+#  define BUDDY_HUGETLB
+#  ifdef MAP_HUGE_SHIFT
+#   define MAP_HUGE_FLAGS (MAP_HUGETLB | (HPAGE_SHIFT << MAP_HUGE_SHIFT))
+#  else
+#   define MAP_HUGE_FLAGS (MAP_HUGETLB)
+#  endif
+# endif
+
+#ifdef BUDDY_HUGETLB
+/*大页池不足时不再尝试*/
+static bool hugetlb_disabled = false;
+
+/*
+ * 先以 PROT_NONE 占据两倍大小的地址空间（指定了对齐的地址时只需一倍），
+ * 取出对齐的部分后再以 MAP_FIXED 将其替换为 hugetlb 映射
+ */
+static void *hugetlb_mmap(void *hint, size_t size)
+{
+	void *addr;
+	uintptr_t area, start;
+	size_t len = hint ? size : size << 1;
+
+	if (READ_ONCE(hugetlb_disabled))
+		return NULL;
+
+	addr = mmap(hint, len, PROT_NONE,
+			MAP_ANON | MAP_PRIVATE | MAP_NORESERVE | MAP_HINT(hint), -1, 0);
+	if (skp_unlikely(addr == MAP_FAILED))
+		return NULL;
+	if (skp_unlikely(hint && addr != hint)) {
+		BUG_ON(os_munmap(addr, len));
+		return NULL;
+	}
+
+	area = (uintptr_t)addr;
+	start = ALIGN(area, size);
+	addr = mmap((void*)start, size, PROT_FLAGS,
+			MAP_ANON | MAP_PRIVATE | MAP_FIXED | MAP_HUGE_FLAGS, -1, 0);
+	if (skp_unlikely(addr == MAP_FAILED)) {
+		int err = errno;
+		log_info("map hugetlb memory block failed : %s, "
+			"fall back to transparent huge page", __strerror_local(err));
+		WRITE_ONCE(hugetlb_disabled, true);
+		BUG_ON(os_munmap((void*)area, len));
+		return NULL;
+	}
+
+	if (start != area)
+		BUG_ON(os_munmap((void*)area, start - area));
+	if (start + size != area + len)
+		BUG_ON(os_munmap((void*)(start + size), area + len - start - size));
+
+	return (void*)start;
+}
+#else
+# define hugetlb_mmap(hint, size) ((void)(hint), (void)(size), NULL)
+#endif
+
+/*透明大页，缺页时由内核决定是否使用大页*/
+static inline void hugepage_advise(void *addr, size_t size)
+{
+#ifdef MADV_HUGEPAGE
+	if (skp_unlikely(madvise(addr, size, MADV_HUGEPAGE))) {
+		int err = errno;
+		log_warn("advise huge page for [%p, %p) failed : %s", addr,
+			(void*)((uintptr_t)addr + size), __strerror_local(err));
+		return;
+	}
+	memblock_stat.advised += size;
+	memblock_mark(memblock_advised, addr, size);
+#endif
+}
+#endif
+
 /*获取内存节点分布图*/
 static void init_node_config(struct node_config node_cfg[])
 {
@@ -138,34 +273,48 @@ static void init_node_config(struct node_config node_cfg[])
 	}
 }
 
-/**分配一个伙伴系统所需的最大内存块，用于补充某个节点中的伙伴系统的内存*/
-static void *alloc_memblock(size_t size)
+/**
+ * 映射一个按自身大小对齐的内存块
+ * @param hint 不为空时，只映射到该地址（已对齐），被占用则失败
+ */
+static void *__alloc_memblock(void *hint, size_t size)
 {
 	uintptr_t addr, start;
-	static unsigned long total_vm = 0;
 
-	size = ALIGN(size, VPAGE_SIZE);
-	addr = (uintptr_t)os_mmap(0, size);
-	if (skp_unlikely(!addr)) {
-		log_error("mmap to [%zu]MB failed : %s[%d], total vm : %lu\n",
-			size >> 20, strerror_local(), errno, total_vm);
+#ifdef CONFIG_BUDDY_HUGEPAGE
+	addr = (uintptr_t)hugetlb_mmap(hint, size);
+	if (addr) {
+		log_info("alloc one buddy block with hugetlb : [%p, %p)",
+			(void*)addr, (void*)(addr + size));
+		memblock_stat.hugetlb += size;
+		memblock_mark(memblock_hugetlb, (void*)addr, size);
+		return (void*)addr;
+	}
+#endif
+
+	addr = (uintptr_t)os_mmap(hint, size);
+	if (skp_unlikely(!addr))
+		return NULL;
+
+	/*指定地址时不能放在其他位置*/
+	if (hint && (void*)addr != hint) {
+		BUG_ON(os_munmap((void*)addr, size));
+		errno = EEXIST;
 		return NULL;
 	}
 
 	if (skp_likely(IS_ALIGNED(addr, size))) {
 		log_debug("alloc one buddy block : buddy [%p, %p)",
 			addr, (void*)((uintptr_t)addr + BUDDY_BLKSIZE));
-		return (void*)addr;
+		start = addr;
+		goto advise;
 	}
 
 /*slow path*/
 	BUG_ON(os_munmap((void*)addr, size));
 	addr = (uintptr_t)os_mmap(0, size << 1);
-	if (skp_unlikely(!addr)) {
-		log_error("mmap to [%zu]MB failed : %s[%d], total vm : %lu\n",
-			size >> 20, strerror_local(), errno, total_vm);
+	if (skp_unlikely(!addr))
 		return NULL;
-	}
 
 	/*取对齐的部分*/
 	start = ALIGN(addr, size);
@@ -176,11 +325,259 @@ static void *alloc_memblock(size_t size)
 		BUG_ON(os_munmap((void*)addr, start - addr));
 	BUG_ON(os_munmap((void*)(start + size), addr + size - start));
 
-	/*todo:buddy中总的页数统计*/
-	total_vm += size;
+advise:
+#ifdef CONFIG_BUDDY_HUGEPAGE
+	hugepage_advise((void*)start, size);
+#endif
 	return (void*)start;
 }
 
+#if CONFIG_BUDDY_NUMA
+struct numa_topology numa_topo;
+/*每个物理节点下次尝试映射的内存块在其伙伴系统节点中的序号*/
+static uint32_t numa_cursor[MAX_NUMA_NODES];
+/*
+ * 物理节点对应的地址范围已用完，回收内存块后再尝试
+ * 只在 big_lock 中修改，但 node_supply_memory() 加锁前会读取，
+ * 故以 READ_ONCE/WRITE_ONCE 访问所在的字
+ */
+static DECLARE_BITMAP(numa_full, MAX_NUMA_NODES);
+
+static inline bool numa_is_full(int numa)
+{
+	return READ_ONCE(numa_full[BIT_WORD(numa)]) & BIT_MASK(numa);
+}
+
+static inline void numa_set_full(int numa, bool full)
+{
+	unsigned long *word = &numa_full[BIT_WORD(numa)];
+	WRITE_ONCE(*word, full ? *word | BIT_MASK(numa) :
+		*word & ~BIT_MASK(numa));
+}
+
+#define NUMA_SYSFS "/sys/devices/system/node"
+#define MEMBLOCKS_PER_NODE ((VPAGES_PER_NODE << VPAGE_SHIFT) / BUDDY_BLKSIZE)
+
+/*
+ * 1. 默认使用 MPOL_PREFERRED，本地节点内存不足时由系统从其他节点分配
+ * 2. CONFIG_BUDDY_NUMA_STRICT 使用 MPOL_BIND，本地节点内存不足时失败
+ */
+#ifndef MPOL_PREFERRED
+# define MPOL_PREFERRED 1
+#endif
+#ifndef MPOL_BIND
+# define MPOL_BIND 2
+#endif
+#ifdef CONFIG_BUDDY_NUMA_STRICT
+# define NUMA_MPOL MPOL_BIND
+#else
+# define NUMA_MPOL MPOL_PREFERRED
+#endif
+
+/*读取 sysfs 中的小文件，不使用 stdio 以避免在初始化时分配内存*/
+static ssize_t read_sysfs(const char *path, char *buf, size_t size)
+{
+	ssize_t bytes;
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -errno;
+	bytes = read(fd, buf, size - 1);
+	if (bytes < 0)
+		bytes = -errno;
+	close(fd);
+	if (bytes < 0)
+		return bytes;
+	buf[bytes] = '\0';
+	return bytes;
+}
+
+/*解析 CPU 列表，如 "0-3,8-11"*/
+static void parse_cpulist(const char *str, int numa)
+{
+	char *end;
+	unsigned long first, last;
+
+	while (*str) {
+		first = strtoul(str, &end, 10);
+		if (end == str)
+			break;
+		last = first;
+		if (*end == '-')
+			last = strtoul(end + 1, &end, 10);
+		for (unsigned long cpu = first; cpu <= last &&
+				cpu < CONFIG_NUMA_MAX_CPUS; cpu++)
+			numa_topo.cpu_node[cpu] = (uint8_t)numa;
+		str = *end == ',' ? end + 1 : end;
+	}
+}
+
+/*获取物理节点、CPU 分布以及节点间距离，并按距离排列回退节点*/
+static void init_numa_topology(void)
+{
+	char path[128], buf[1024];
+	static uint8_t distance[MAX_NUMA_NODES][MAX_NUMA_NODES];
+	uint32_t nr = 0;
+
+	BUILD_BUG_ON(MAX_NUMA_NODES > 256);
+	BUILD_BUG_ON(NUMA_NID_BASE + MAX_NUMA_NODES > MAX_NUMNODES / 2);
+
+	for (int numa = 0; numa < (int)MAX_NUMA_NODES; numa++) {
+		snprintf(path, sizeof(path), NUMA_SYSFS "/node%d/cpulist", numa);
+		if (read_sysfs(path, buf, sizeof(buf)) < 0)
+			continue;
+		/*先以首个节点为所有 CPU 的默认节点*/
+		if (!nr)
+			memset(numa_topo.cpu_node, numa, sizeof(numa_topo.cpu_node));
+		parse_cpulist(buf, numa);
+		numa_topo.nodes[nr++] = (uint8_t)numa;
+	}
+
+	if (!nr) {
+		log_info("numa topology is not available, disable numa binding");
+		return;
+	}
+
+	/*距离按在线节点的顺序排列*/
+	for (uint32_t i = 0; i < nr; i++) {
+		const char *str = buf;
+		int numa = numa_topo.nodes[i];
+
+		memset(distance[i], 0xff, sizeof(distance[i]));
+		snprintf(path, sizeof(path), NUMA_SYSFS "/node%d/distance", numa);
+		if (read_sysfs(path, buf, sizeof(buf)) < 0)
+			buf[0] = '\0';
+		for (uint32_t j = 0; j < nr; j++) {
+			char *end;
+			unsigned long dist = strtoul(str, &end, 10);
+			if (end == str)
+				break;
+			distance[i][j] = (uint8_t)min(dist, 0xfeUL);
+			str = end;
+		}
+		/*自身总是最近的*/
+		distance[i][i] = 0;
+	}
+
+	/*插入排序，距离相同时按节点编号*/
+	for (uint32_t i = 0; i < nr; i++) {
+		uint8_t *fallback = numa_topo.fallback[numa_topo.nodes[i]];
+		uint8_t order[MAX_NUMA_NODES];
+
+		for (uint32_t j = 0; j < nr; j++) {
+			uint32_t k = j;
+			while (k > 0 && distance[i][order[k - 1]] > distance[i][j]) {
+				order[k] = order[k - 1];
+				k--;
+			}
+			order[k] = (uint8_t)j;
+		}
+		for (uint32_t j = 0; j < nr; j++)
+			fallback[j] = numa_topo.nodes[order[j]];
+
+		log_info("numa node [%d] : buddy node [%d], nearest fallback node [%d]",
+			numa_topo.nodes[i], numa_to_nid(numa_topo.nodes[i]),
+			nr > 1 ? fallback[1] : -1);
+	}
+
+	WRITE_ONCE(numa_topo.nr_nodes, nr);
+}
+
+static void numa_bind_memblock(void *addr, size_t size, int numa)
+{
+#ifdef __NR_mbind
+	unsigned long mask[BITS_TO_LONGS(MAX_NUMA_NODES)] = { 0 };
+
+	__set_bit(numa, mask);
+	/*maxnode 按内核的约定需要多加一*/
+	if (skp_unlikely(syscall(__NR_mbind, addr, size, NUMA_MPOL, mask,
+			MAX_NUMA_NODES + 1, 0))) {
+		int err = errno;
+		log_warn("bind memory block [%p, %p) to numa node [%d] failed : %s",
+			addr, (void*)((uintptr_t)addr + size), numa,
+			__strerror_local(err));
+	}
+#endif
+}
+
+/*
+ * 在物理节点对应的伙伴系统节点的地址范围内映射内存块，并绑定到物理节点
+ * 从上次成功的位置开始，依次尝试节点内所有的内存块位置
+ */
+static void *numa_alloc_memblock(int nid, size_t size)
+{
+	void *addr;
+	uint32_t slot;
+	int numa = nid_to_numa(nid);
+	uintptr_t base = (uintptr_t)nid * (VPAGES_PER_NODE << VPAGE_SHIFT);
+
+	if (numa < 0 || !READ_ONCE(numa_topo.nr_nodes) || numa_is_full(numa))
+		return NULL;
+	if (WARN_ON(size != BUDDY_BLKSIZE))
+		return NULL;
+
+	for (uint32_t i = 0; i < MEMBLOCKS_PER_NODE; i++) {
+		slot = (numa_cursor[numa] + i) % MEMBLOCKS_PER_NODE;
+		addr = __alloc_memblock((void*)(base + slot * size), size);
+		if (!addr)
+			continue;
+		numa_cursor[numa] = slot + 1;
+		numa_bind_memblock(addr, size, numa);
+		return addr;
+	}
+
+	log_warn("no address space left on numa node [%d], "
+		"fall back to unbound memory", numa);
+	numa_set_full(numa, true);
+	return NULL;
+}
+
+static inline bool numa_has_space(int nid)
+{
+	int numa = nid_to_numa(nid);
+	return numa > NUMA_NO_NODE && !numa_is_full(numa);
+}
+
+static inline void numa_free_memblock(int nid)
+{
+	int numa = nid_to_numa(nid);
+	if (numa > NUMA_NO_NODE)
+		numa_set_full(numa, false);
+}
+#else
+# define init_numa_topology() do {} while (0)
+# define numa_alloc_memblock(nid, size) ((void)(nid), (void)(size), NULL)
+# define numa_has_space(nid) ((void)(nid), false)
+# define numa_free_memblock(nid) ((void)(nid))
+#endif
+
+/**
+ * 分配一个伙伴系统所需的最大内存块，用于补充某个节点中的伙伴系统的内存
+ * 优先放在 nid 节点的地址范围内，strict 为真时只能放在 nid 节点中
+ */
+static void *alloc_memblock(size_t size, int nid, bool strict)
+{
+	int err;
+	void *addr;
+
+	size = ALIGN(size, VPAGE_SIZE);
+	addr = numa_alloc_memblock(nid, size);
+	if (!addr) {
+		if (strict)
+			return NULL;
+		addr = __alloc_memblock(NULL, size);
+	}
+	if (skp_unlikely(!addr)) {
+		err = errno;
+		log_error("mmap to [%zu]MB failed : %s[%d], total vm : %lu\n",
+			size >> 20, __strerror_local(err), err, memblock_stat.mapped);
+		return NULL;
+	}
+
+	memblock_stat.mapped += size;
+	memblock_mark(memblock_map, addr, size);
+	return addr;
+}
+
 /* 初始化node中的虚地址对应的页描述符
  * Todo : 不能多次初始化
  */
@@ -195,6 +592,8 @@ static inline void init_vpage(struct vpage *page, int nid, bool reserve)
 	__SetPageInited(page);
 	if (reserve)
 		__SetPageReserved(page);
+	else /*新映射的内存内容为零*/
+		__SetPageClean(page);
 
 	uref_set(&page->count, 0);
 	set_page_node(page, nid);
@@ -304,7 +703,7 @@ static void __node_supply_memory(void *addr, size_t size)
 /*映射一段内存，然后启动该段内存对应的node区域的虚拟页管理器*/
 static inline void startup_first_node(void)
 {
-	void *addr = alloc_memblock(BUDDY_BLKSIZE);
+	void *addr = alloc_memblock(BUDDY_BLKSIZE, numa_local_nid(), false);
 	BUG_ON(!addr);
 	__node_supply_memory(addr, BUDDY_BLKSIZE);
 }
@@ -371,6 +770,7 @@ void __setup_memory(void)
 
 	init_node_config(node_cfg);
 	init_pg_data(node_cfg);
+	init_numa_topology();
 	startup_first_node();
 	smp_mb();
 	WRITE_ONCE(node_up, true);
@@ -379,34 +779,57 @@ void __setup_memory(void)
 	return;
 }
 
-int node_supply_memory(int order)
+int node_supply_memory(int nid, int order)
 {
 	void *addr;
-	unsigned long nid;
+	unsigned long free_nid;
 
 	ZONE_BUG_ON(!READ_ONCE(node_up));
 
+	if (nid > NUMA_NO_NODE && !numa_has_space(nid))
+		return -ENOMEM;
+
 	big_lock();
 	/*加锁再次检查*/
-	for_each_free_node(nid) {
-		if(node_has_freepg((int)nid, order))
+	if (nid > NUMA_NO_NODE) {
+		if (node_has_freepg(nid, order))
 			goto out;
+	} else {
+		for_each_free_node(free_nid) {
+			if(node_has_freepg((int)free_nid, order)) {
+				nid = (int)free_nid;
+				goto out;
+			}
+		}
 	}
 
-	addr = alloc_memblock(BUDDY_BLKSIZE);
-	if (skp_unlikely(!addr)) {
-		log_warn("TOO MUCH PAGES WAS IN BUDDY SYSTEM, OUT OF MEMORY");
-		big_unlock();
-		return -ENOMEM;
+	if (nid > NUMA_NO_NODE) {
+		/*指定的节点没有地址空间时，由调用者从其他节点分配*/
+		addr = alloc_memblock(BUDDY_BLKSIZE, nid, true);
+		if (!addr) {
+			big_unlock();
+			return -ENOMEM;
+		}
+	} else {
+		addr = alloc_memblock(BUDDY_BLKSIZE, numa_local_nid(), false);
+		if (skp_unlikely(!addr)) {
+			log_warn("TOO MUCH PAGES WAS IN BUDDY SYSTEM, OUT OF MEMORY");
+			big_unlock();
+			return -ENOMEM;
+		}
 	}
+	nid = (int)pfn_to_nid(virt_to_pfn(addr));
 	__node_supply_memory(addr, BUDDY_BLKSIZE);
 out:
 	big_unlock();
-	return (int)nid;
+	return nid;
 }
 
 void node_reclaim_memory(struct vpage *page, int order)
 {
+	void *addr = page_to_virt(page);
+	size_t size = VPAGE_SIZE << order;
+
 	log_debug("reclaim memory from buddy system, nid [%d] ...",
 		page_to_nid(page));
 
@@ -414,5 +837,131 @@ void node_reclaim_memory(struct vpage *page, int order)
 		__ClearPageInited(page + i);
 	}
 
-	os_munmap(page_to_virt(page), VPAGE_SIZE << order);
+	/*
+	 * 调用者已释放了 zone 锁，在 big_lock 中解映射并扣除统计，
+	 * 以免同一地址被重新映射后标记被错误地清除
+	 */
+	big_lock();
+	BUG_ON(os_munmap(addr, size));
+	memblock_stat.mapped -= memblock_unmark(memblock_map, addr, size);
+	memblock_stat.hugetlb -= memblock_unmark(memblock_hugetlb, addr, size);
+	memblock_stat.advised -= memblock_unmark(memblock_advised, addr, size);
+	/*页描述符不在被解除映射的内存中*/
+	numa_free_memblock(page_to_nid(page));
+	big_unlock();
+}
+
+/*
+ * 1. 私有映射使用 MADV_DONTNEED，再次访问时得到零页
+ * 2. 共享映射的内容由文件或共享内存保存，需要 MADV_REMOVE 才能释放
+ */
+#if defined(CONFIG_BUDDY_SHAREDMMAP)
+# define SCAVENGE_ADVICE MADV_REMOVE
+#elif defined(CONFIG_BUDDY_SCAVENGE_LAZY) && defined(MADV_FREE)
+# define SCAVENGE_ADVICE MADV_FREE
+#else
+# define SCAVENGE_ADVICE MADV_DONTNEED
+#endif
+
+int node_scavenge_memory(struct vpage *page, int order)
+{
+	void *addr = page_to_virt(page);
+	size_t size = VPAGE_SIZE << order;
+
+	if (skp_unlikely(madvise(addr, size, SCAVENGE_ADVICE))) {
+		int rc = -errno;
+		log_warn("scavenge memory [%p, %p) failed : %s", addr,
+			(void*)((uintptr_t)addr + size), __strerror_local(-rc));
+		return rc;
+	}
+
+	log_debug("scavenge memory from buddy system, nid [%d], [%p, %p) ...",
+		page_to_nid(page), addr, (void*)((uintptr_t)addr + size));
+	return 0;
+}
+
+bool node_memblock_hugetlb(const void *addr)
+{
+#ifdef BUDDY_HUGETLB
+	return test_bit(memblock_idx(addr), memblock_hugetlb);
+#else
+	return false;
+#endif
+}
+
+/*按行读取 smaps，不使用 stdio 以避免在统计时分配内存*/
+static ssize_t smaps_getline(int fd, char *buf, size_t size, size_t *off,
+		size_t *len, char *line, size_t max)
+{
+	size_t n = 0;
+	for (;;) {
+		if (*off == *len) {
+			ssize_t bytes = read(fd, buf, size);
+			if (bytes < 0) {
+				if (errno == EINTR)
+					continue;
+				return -errno;
+			}
+			if (!bytes)
+				break;
+			*off = 0;
+			*len = (size_t)bytes;
+		}
+		char c = buf[(*off)++];
+		if (c == '\n')
+			break;
+		if (n < max - 1)
+			line[n++] = c;
+	}
+	line[n] = '\0';
+	return (ssize_t)n;
+}
+
+static unsigned long smaps_kbytes(const char *line, const char *key)
+{
+	size_t klen = strlen(key);
+	if (strncmp(line, key, klen) || line[klen] != ':')
+		return 0;
+	return strtoul(line + klen + 1, NULL, 10) << 10;
+}
+
+int node_hpage_stat(struct hpage_stat *stat)
+{
+	int fd;
+	ssize_t rc;
+	bool ours = false;
+	size_t off = 0, len = 0;
+	char buf[4096], line[256];
+	unsigned long start, end, hugetlb;
+
+	big_lock();
+	*stat = memblock_stat;
+	big_unlock();
+
+	stat->resident = 0;
+	stat->huge_backed = 0;
+
+	fd = open("/proc/self/smaps", O_RDONLY | O_CLOEXEC);
+	if (skp_unlikely(fd < 0))
+		return -errno;
+
+	while ((rc = smaps_getline(fd, buf, sizeof(buf), &off, &len,
+			line, sizeof(line))) > 0) {
+		/*映射区域的首行：start-end perms ...*/
+		if (sscanf(line, "%lx-%lx ", &start, &end) == 2) {
+			ours = start < VADDR_END &&
+				test_bit(memblock_idx(start), memblock_map);
+			continue;
+		}
+		if (!ours)
+			continue;
+		/*hugetlb 的内存不计入 Rss*/
+		hugetlb = smaps_kbytes(line, "Private_Hugetlb") +
+			smaps_kbytes(line, "Shared_Hugetlb");
+		stat->resident += smaps_kbytes(line, "Rss") + hugetlb;
+		stat->huge_backed += smaps_kbytes(line, "AnonHugePages") + hugetlb;
+	}
+	close(fd);
+
+	return rc < 0 ? (int)rc : 0;
 }
@@ -7,6 +7,7 @@
 
 #include <skp/mm/pgalloc.h>
 #include <skp/process/thread.h>
+#include <skp/process/workqueue.h>
 
 #include <skp/mm/slab.h>
 
@@ -89,8 +90,8 @@ static inline void prep_new_page(struct vpage *page, int order)
 	BUDDY_BUG_ON(!(page->flags & (1UL << PG_inited)));
 	BUDDY_BUG_ON(page->flags &(
 		1UL << PG_locked | 1UL << PG_slab | 1UL << PG_compound));
-	page->flags &= ~(
-		1UL << PG_locked | 1UL << PG_slab | 1UL << PG_compound);
+	page->flags &= ~(1UL << PG_locked | 1UL << PG_slab |
+		1UL << PG_compound | 1UL << PG_idle);
 	page->data = NULL;
 	uref_init(&page->count);
 }
@@ -151,7 +152,10 @@ static inline void prep_block_page(struct vpage *page, int order, int gfp_flags)
 static __always_inline void prep_zero_page(struct vpage *page, int order,
 		int gfp_flags)
 {
-	if (!(gfp_flags & __GFP_ZERO))
+	/*干净的块内容全为零，无需再次清零*/
+	bool clean = PageClean(page);
+	__ClearPageClean(page);
+	if (!(gfp_flags & __GFP_ZERO) || (BUDDY_SCAVENGE_ZEROED && clean))
 		return;
 	for(int i = 0; i < (1 << order); i++)
 		memset(page_to_virt(page + i), 0, VPAGE_SIZE);
@@ -168,6 +172,7 @@ static inline void destroy_block_page(struct vpage *page, int order)
 static __always_inline
 void __free_pages_bulk(struct vpage *page, struct zone *zone, int order)
 {
+	bool clean = PageClean(page);
 	unsigned long page_idx, buddy_idx;
 	struct free_area *area = &zone->free_area[order];
 	struct vpage *buddy, *base = mem_map(page_to_nid(page));
@@ -184,6 +189,8 @@ void __free_pages_bulk(struct vpage *page, struct zone *zone, int order)
 		set_bit(page_to_nid(page), node_map.has_free);
 
 	zone->free_pages += (1U << order);
+	/*只有头页的标志有效，合并后由新的头页记录*/
+	page->flags &= ~(1UL << PG_clean | 1UL << PG_idle);
 	while (order < MAX_ORDER-1) {
 		buddy_idx = (page_idx ^ (1UL << order));
 		buddy = base + buddy_idx;
@@ -196,6 +203,9 @@ void __free_pages_bulk(struct vpage *page, struct zone *zone, int order)
 		area->nr_free--;
 		rmv_page_order(buddy);
 		del_page_from_list(buddy);
+		/*两个伙伴都干净，合并后才是干净的*/
+		clean = clean && PageClean(buddy);
+		buddy->flags &= ~(1UL << PG_clean | 1UL << PG_idle);
 
 		order++;
 		area++;
@@ -204,6 +214,8 @@ void __free_pages_bulk(struct vpage *page, struct zone *zone, int order)
 
 	area->nr_free++;
 	set_page_order(base + page_idx, order);
+	if (clean)
+		__SetPageClean(base + page_idx);
 	add_page_to_list(base + page_idx, &area->free_list);
 
 	if (skp_likely(order < MAX_ORDER-1))
@@ -392,6 +404,9 @@ struct vpage *expand(struct zone *zone, struct vpage *page, int low, int high,
 		area->nr_free++;
 		/*设置每组连续页框的头框的private字段为对应的阶值*/
 		set_page_order(&page[size], high);
+		/*分裂后的块继承原块的状态*/
+		page[size].flags &= ~(1UL << PG_clean | 1UL << PG_idle);
+		page[size].flags |= page->flags & (1UL << PG_clean | 1UL << PG_idle);
 		/*后半部分插入伙伴系统中*/
 		add_page_to_list_tail(&page[size], &area->free_list);
 	}
@@ -485,12 +500,56 @@ prep:
 	return page;
 }
 
+static __always_inline struct vpage *rmqueue_node(int nid, int order,
+		int gfp_flags)
+{
+	if (!test_bit(nid, node_map.has_free))
+		return NULL;
+	/*分配巨页时，提前查看该节点是否满足分配*/
+	if (skp_unlikely(order > MAX_ORDER/2) && !node_has_freepg(nid, order))
+		return NULL;
+	return buffered_rmqueue(NODE_ZONE(nid), order, gfp_flags);
+}
+
+/*
+ * 1. 首先从本地节点分配，不足时为本地节点补充一次内存
+ * 2. 仍然失败，则按距离由近到远从其他物理节点分配
+ */
+static struct vpage *numa_rmqueue(int local, int order, int gfp_flags,
+		bool *supplied)
+{
+	struct vpage *page;
+	const uint8_t *fallback;
+	uint32_t nr = READ_ONCE(numa_topo.nr_nodes);
+
+	page = rmqueue_node(local, order, gfp_flags);
+	if (skp_likely(page))
+		return page;
+
+	if (!*supplied) {
+		*supplied = true;
+		if (node_supply_memory(local, order) > NUMA_NO_NODE) {
+			page = rmqueue_node(local, order, gfp_flags);
+			if (skp_likely(page))
+				return page;
+		}
+	}
+
+	fallback = numa_topo.fallback[nid_to_numa(local)];
+	for (uint32_t i = 1; i < nr; i++) {
+		page = rmqueue_node(numa_to_nid(fallback[i]), order, gfp_flags);
+		if (page)
+			return page;
+	}
+	return NULL;
+}
+
 struct vpage * __alloc_pages(int gfp_flags, int order)
 {
 	/*每次分配顶多回收一次*/
-	int rc = 0;
+	int rc = 0, local;
 	unsigned long nid;
-	bool shrink = false;
+	bool shrink = false, supplied = false;
 	struct vpage *page = NULL;
 	static __thread uint64_t last_shrink = 0;
 
@@ -504,14 +563,24 @@ struct vpage * __alloc_pages(int gfp_flags, int order)
 		WARN_ON(in_atomic());
 #endif
 
-	/*如果是单页，首先查看0号节点 是否满足*/
+	local = numa_local_nid();
+
+	/*如果是单页，首先查看本地节点（未启用 NUMA 时为 0 号节点）是否满足*/
 	if (!order) {
-		page = buffered_rmqueue(NODE_ZONE(0), order, gfp_flags);
+		page = buffered_rmqueue(NODE_ZONE(local > NUMA_NO_NODE ? local : 0),
+				order, gfp_flags);
 		if (skp_likely(page))
 			return page;
 	}
 
 	do {
+		if (local > NUMA_NO_NODE) {
+			page = numa_rmqueue(local, order, gfp_flags, &supplied);
+			if (skp_likely(page))
+				return page;
+		}
+
+		/*其余有空闲页的节点*/
 		for_each_free_node(nid) {
 			/*分配巨页时，提前查看该节点是否满足分配*/
 			if (skp_unlikely(order > MAX_ORDER/2) &&
@@ -535,7 +604,7 @@ struct vpage * __alloc_pages(int gfp_flags, int order)
 		}
 
 		/*需要补充内存*/
-		rc = node_supply_memory(order);
+		rc = node_supply_memory(NUMA_NO_NODE, order);
 	} while (skp_likely(rc > -1));
 
 #if BITS_PER_LONG == 32
@@ -545,6 +614,118 @@ struct vpage * __alloc_pages(int gfp_flags, int order)
 	return page;
 }
 
+/*
+ * 在 zone 中查找不小于 order 阶的空闲块并归还给系统，每阶分为两遍
+ * 1. 归还已标记空闲的块，取出后解锁，归还后再放回伙伴系统中
+ * 2. 标记其余未标记的块，如果之后被分配或合并，则标记被清除
+ * hugetlb 内存块中的空闲块不能归还，直接跳过
+ * 解锁前记下链表中的下一个块，加锁后如果它仍在本阶的空闲链表中，则从它继续，
+ * 否则从头开始，因为第一遍不做标记，重新扫描时不会归还本次刚标记的块
+ */
+static unsigned long zone_scavenge(struct zone *zone, int order)
+{
+	int rc;
+	unsigned long nr = 0;
+	struct vpage *page, *next;
+	struct free_area *area;
+
+	zone_lock(zone);
+	for (int k = MAX_ORDER - 1; k >= order; k--) {
+		area = &zone->free_area[k];
+		page = __first_page_on_list(&area->free_list);
+		for (; &page->lru != &area->free_list; page = next) {
+			next = list_next_entry(page, lru);
+			if (!PageIdle(page) || PageClean(page) ||
+					node_memblock_hugetlb(page_to_virt(page)))
+				continue;
+
+			area->nr_free--;
+			rmv_page_order(page);
+			del_page_from_list(page);
+			zone->free_pages -= 1U << k;
+			if (!zone->free_pages)
+				clear_bit(page_to_nid(page), node_map.has_free);
+			/*
+			 * 可以解锁归还
+			 * 1. 该块已不在空闲链表中，不会被分配
+			 * 2. 伙伴的 order 标志已经清除，不会被合并
+			 */
+			zone_unlock(zone);
+			rc = node_scavenge_memory(page, k);
+			zone_lock(zone);
+
+			if (skp_likely(!rc)) {
+				__SetPageClean(page);
+				nr += 1UL << k;
+			}
+			__free_pages_bulk(page, zone, k);
+			if (skp_unlikely(rc))
+				goto out;
+			/*
+			 * 解锁期间下一个块可能已被分配、合并或回收（回收时从链表中
+			 * 摘除但保留了 order 标志），此时从头开始
+			 */
+			if (&next->lru != &area->free_list && (page_order(next) != k ||
+					list_empty(&next->lru)))
+				next = __first_page_on_list(&area->free_list);
+		}
+
+		/*不解锁，标记留到下一个回收周期*/
+		list_for_each_entry(page, &area->free_list, lru) {
+			if (PageIdle(page) || PageClean(page) ||
+					node_memblock_hugetlb(page_to_virt(page)))
+				continue;
+			__SetPageIdle(page);
+		}
+	}
+out:
+	zone_unlock(zone);
+	return nr;
+}
+
+unsigned long buddy_scavenge(int order)
+{
+	unsigned long nid, nr = 0;
+
+	if (!READ_ONCE(node_up))
+		return 0;
+
+	order = clamp(order, 0, MAX_ORDER - 1);
+	for_each_set_bit(nid, node_map.has_up, MAX_NUMNODES)
+		nr += zone_scavenge(NODE_ZONE(nid), order);
+
+	if (nr)
+		log_debug("scavenge %lu pages from buddy system", nr);
+	return nr;
+}
+
+static int scavenge_order = 0;
+static uint32_t scavenge_age = 0;
+
+static void buddy_scavenge_work(struct work_struct *work)
+{
+	uint32_t age;
+
+	buddy_scavenge(READ_ONCE(scavenge_order));
+
+	age = READ_ONCE(scavenge_age);
+	if (age)
+		schedule_delayed_work(to_delayed_work(work), age);
+}
+
+static DECLARE_DELAYED_WORK(scavenge_work, buddy_scavenge_work);
+
+void buddy_set_scavenger(int order, uint32_t age)
+{
+	WRITE_ONCE(scavenge_order, clamp(order, 0, MAX_ORDER - 1));
+	WRITE_ONCE(scavenge_age, age);
+	if (age) {
+		modify_delayed_work(&scavenge_work, age);
+	} else {
+		cancel_delayed_work_sync(&scavenge_work);
+	}
+}
+
 static int sync_page(wait_queue_t *wait)
 {
 	wait_on(wait);
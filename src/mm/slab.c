@@ -1803,9 +1803,15 @@ void * __urealloc(const void *src, size_t size, const char *file, int line)
 
 void *__ucalloc(size_t n, size_t size, const char *file, int line)
 {
+	void *ptr;
+
 	if (n != 0 && size > ULONG_MAX / n)
 		return NULL;
-	return __umalloc(n * size, file, line);
+	/*从 slab 中分配的对象不一定是干净的*/
+	ptr = __umalloc(n * size, file, line);
+	if (skp_likely(ptr))
+		memset(ptr, 0, n * size);
+	return ptr;
 }
 
 static void slabtls_reclaim(struct slab_tls *tls)
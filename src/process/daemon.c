@@ -20,6 +20,19 @@
 #define PIDFILE_MODE (S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH)
 
 bool isdaemon = false;
+bool isrestart = false;
+
+static int pidfile_write(int fd)
+{
+	int rc;
+	char strpid[32];
+
+	snprintf(strpid, sizeof(strpid), "%ld", (long)getpid());
+	rc = ftruncate(fd, 0);
+	if (skp_likely(!rc))
+		rc = (int)pwrite(fd, strpid, strlen(strpid) + 1, 0);
+	return rc < 0 ? -errno : 0;
+}
 
 static int already_running(const char *cmd)
 {
@@ -48,6 +61,11 @@ static int already_running(const char *cmd)
 				exit(1);
 			}
 			sscanf(strpid, "%ld", &pid);
+			/*热重启时由旧进程交接后释放锁 @see daemon_pidfile_lock()*/
+			if (isrestart) {
+				__log_info("%s restart, take over from pid : %ld", cmd, pid);
+				return fd;
+			}
 			__log_warn("%s daemon already running, pid : %ld", p, pid);
 			return -1;
 		}
@@ -55,12 +73,33 @@ static int already_running(const char *cmd)
 		exit(1);
 	}
 
-	ftruncate(fd, 0);
-	snprintf(strpid, sizeof(strpid), "%ld", pid);
-	write(fd, strpid, strlen(strpid) + 1);
+	pidfile_write(fd);
 	return fd;
 }
 
+int daemon_pidfile_lock(int lfd, int timeout)
+{
+	int rc;
+
+	if (WARN_ON(lfd < 0))
+		return -EINVAL;
+
+	while ((rc = flock(lfd, LOCK_EX|LOCK_NB)) < 0) {
+		if (errno != EWOULDBLOCK || timeout <= 0)
+			return -errno;
+		usleep(10000);
+		timeout -= 10;
+	}
+	return pidfile_write(lfd);
+}
+
+int daemon_pidfile_unlock(int lfd)
+{
+	if (WARN_ON(lfd < 0))
+		return -EINVAL;
+	return flock(lfd, LOCK_UN) < 0 ? -errno : 0;
+}
+
 int daemonize(int argc, char *argv[])
 {
 	pid_t pid;
@@ -69,6 +108,7 @@ int daemonize(int argc, char *argv[])
 	int i, fd0, fd1, fd2, lfd, rc, opt;
 	struct option long_opts[] = {
 		{ "daemon", no_argument, NULL, 'D' },
+		{ "restart", no_argument, NULL, 'R' },
 		{ NULL, 0, NULL, 0 }
 	};
 
@@ -76,11 +116,14 @@ int daemonize(int argc, char *argv[])
 	cmd = cmd ? cmd + 1 : argv[0];
 
 	optind = 0;
-	while ((opt = getopt_long(argc, argv, ":D", long_opts, NULL)) != -1) {
+	while ((opt = getopt_long(argc, argv, ":DR", long_opts, NULL)) != -1) {
 		switch (opt) {
 		case 'D':
 			isdaemon = true;
 			break;
+		case 'R':
+			isrestart = true;
+			break;
 		default:
 			break;
 		}
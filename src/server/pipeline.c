@@ -0,0 +1,506 @@
+//
+//  pipeline.c
+//  test
+//
+//  Created by 周凯 on 2020/01/14.
+//  Copyright © 2020 zhoukai. All rights reserved.
+//
+
+#include <sys/uio.h>
+#include <skp/utils/utils.h>
+#include <skp/server/pipeline.h>
+
+#define TXQ_MASK (CONFIG_XPRT_PIPELINE_TXQ - 1)
+#define TXQ_IOV (CONFIG_XPRT_PIPELINE_TXQ * 2)
+
+/*接收时预留的读缓存，上次读取时未使用，下次继续使用*/
+struct pipeline_rx {
+	struct pbuff *spare;
+};
+
+static inline uint32_t pipeline_txq_len(const struct xprt_pipeline *pl)
+{
+	return pl->tx_tail - pl->tx_head;
+}
+
+static void pipeline_txq_purge(struct xprt_pipeline *pl)
+{
+	while (pl->tx_head != pl->tx_tail)
+		free_pb(pl->txq[pl->tx_head++ & TXQ_MASK]);
+}
+
+/*按顺序发出发送队列中的数据，返回 0 全部发出，-EAGAIN 仍有剩余*/
+static int pipeline_txq_flush(struct xprt_pipeline *pl)
+{
+	ssize_t rc;
+	uint32_t i;
+	int n = 0;
+	struct pbuff *pb;
+	struct xprt *xprt = &pl->clnt.xprt;
+	/*带有分片的缓存占用多个，不足时只发出前面的部分*/
+	struct iovec iov[TXQ_IOV];
+
+	while (pl->tx_head != pl->tx_tail) {
+		/*限速时逐段经过 xprt_write() 消耗令牌*/
+		if (skp_unlikely(READ_ONCE(xprt->rate))) {
+			pb = pl->txq[pl->tx_head & TXQ_MASK];
+			BUG_ON(pb_to_iovec(pb, iov, 1) != 1);
+			rc = xprt_write(xprt, iov[0].iov_base, iov[0].iov_len);
+			if (skp_unlikely(rc < 0))
+				return (int)rc;
+		} else {
+			for (i = pl->tx_head, n = 0; i != pl->tx_tail && n < TXQ_IOV; i++)
+				n += pb_to_iovec(pl->txq[i & TXQ_MASK], iov + n, TXQ_IOV - n);
+			do {
+				rc = writev(xprt_fd(xprt), iov, n);
+			} while (rc < 0 && errno == EINTR);
+			if (skp_unlikely(rc < 0))
+				return (int)__xprt_write_errno();
+			xprt_stat_tx(xprt, rc);
+		}
+
+		/*按顺序消费，发完的释放*/
+		while (rc > 0) {
+			pb = pl->txq[pl->tx_head & TXQ_MASK];
+			rc -= pb_consume(pb, rc);
+			if (pb_len(pb))
+				break;
+			free_pb(pb);
+			pl->tx_head++;
+		}
+		if (pl->tx_head != pl->tx_tail && !READ_ONCE(xprt->rate) &&
+				n < TXQ_IOV)
+			return -EAGAIN;
+	}
+	return 0;
+}
+
+/*写事件是单次触发，仍有剩余则需要重新开启*/
+static int pipeline_txq_wait(struct xprt_pipeline *pl)
+{
+	int rc = xprt_event_enable(&pl->clnt.xprt, EVENT_WRITE);
+	if (skp_unlikely(rc < 0))
+		return skp_unlikely(rc==-EAGAIN)?-ECONNABORTED:rc;
+	return 0;
+}
+
+/*出站到达头部，写入套接字*/
+static int pipeline_xmit(struct xprt_pipeline *pl, struct pbuff *pb)
+{
+	int rc;
+	struct xprt *xprt = &pl->clnt.xprt;
+
+	if (skp_unlikely(!pb_len(pb))) {
+		free_pb(pb);
+		return 0;
+	}
+
+	if (skp_unlikely(xprt_status(xprt) & (XPRT_CLOSED|XPRT_SHUTWR))) {
+		free_pb(pb);
+		return -EPIPE;
+	}
+
+	if (skp_unlikely(pipeline_txq_len(pl) >= CONFIG_XPRT_PIPELINE_TXQ)) {
+		free_pb(pb);
+		return -ENOBUFS;
+	}
+
+	pl->txq[pl->tx_tail++ & TXQ_MASK] = pb;
+	/*队列不为空时一定在等待写事件*/
+	if (pipeline_txq_len(pl) > 1)
+		return 0;
+
+	rc = pipeline_txq_flush(pl);
+	if (skp_likely(!rc))
+		return 0;
+	if (skp_likely(rc == -EAGAIN))
+		return pipeline_txq_wait(pl);
+
+	pipeline_txq_purge(pl);
+	return rc;
+}
+
+static int pipeline_inbound(struct xprt_pipeline *pl, uint32_t from,
+		struct pbuff *pb)
+{
+	const struct xprt_handler *handler;
+
+	for (uint32_t i = from; i < pl->desc->nr_handlers; i++) {
+		handler = pl->ctx[i].handler;
+		if (handler->inbound)
+			return handler->inbound(&pl->ctx[i], pb);
+	}
+	/*没有处理器消费，丢弃*/
+	free_pb(pb);
+	return 0;
+}
+
+static int pipeline_outbound(struct xprt_pipeline *pl, int32_t from,
+		struct pbuff *pb)
+{
+	const struct xprt_handler *handler;
+
+	for (int32_t i = from; i >= 0; i--) {
+		handler = pl->ctx[i].handler;
+		if (handler->outbound)
+			return handler->outbound(&pl->ctx[i], pb);
+	}
+	return pipeline_xmit(pl, pb);
+}
+
+static void pipeline_changed(struct xprt_pipeline *pl, unsigned long stats)
+{
+	const struct xprt_handler *handler;
+
+	for (uint32_t i = 0; i < pl->desc->nr_handlers; i++) {
+		handler = pl->ctx[i].handler;
+		if (handler->changed)
+			handler->changed(&pl->ctx[i], stats);
+	}
+}
+
+int xprt_fire_inbound(struct xprt_handler_ctx *ctx, struct pbuff *pb)
+{
+	BUG_ON(!ctx || !pb);
+	return pipeline_inbound(ctx->pipeline, ctx->index + 1, pb);
+}
+
+int xprt_fire_outbound(struct xprt_handler_ctx *ctx, struct pbuff *pb)
+{
+	BUG_ON(!ctx || !pb);
+	return pipeline_outbound(ctx->pipeline, (int32_t)ctx->index - 1, pb);
+}
+
+int xprt_pipeline_write(struct xprt *xprt, struct pbuff *pb)
+{
+	struct xprt_pipeline *pl = xprt_to_pipeline(xprt);
+	BUG_ON(!pl || !pb);
+	return pipeline_outbound(pl, (int32_t)pl->desc->nr_handlers - 1, pb);
+}
+
+struct xprt_handler_ctx *xprt_pipeline_lookup(struct xprt *xprt,
+		const char *name)
+{
+	struct xprt_pipeline *pl = xprt_to_pipeline(xprt);
+	BUG_ON(!pl || !name);
+
+	for (uint32_t i = 0; i < pl->desc->nr_handlers; i++) {
+		const char *hname = pl->ctx[i].handler->name;
+		if (hname && !strcmp(hname, name))
+			return &pl->ctx[i];
+	}
+	return NULL;
+}
+
+static void pipeline_fini(struct xprt_pipeline *pl, uint32_t nr)
+{
+	/*逆序销毁*/
+	while (nr--) {
+		if (pl->ctx[nr].handler->fini)
+			pl->ctx[nr].handler->fini(&pl->ctx[nr]);
+	}
+}
+
+static inline struct pipeline_rx *pipeline_rx(struct xprt_pipeline *pl)
+{
+	return (struct pipeline_rx*)&pl->ctx[pl->desc->nr_handlers];
+}
+
+static struct xprt *pipeline_constructor(struct server *serv,
+		unsigned long opt, void *user)
+{
+	int rc;
+	size_t size, off;
+	struct xprt_pipeline *pl;
+	const struct xprt_handler *handler;
+	const struct xprt_pipeline_desc *desc = user;
+
+	BUILD_BUG_ON_NOT_POWER_OF_2(CONFIG_XPRT_PIPELINE_TXQ);
+
+	/*被动端的用户数据为侦听对象*/
+	if ((opt & XPRT_TYPE_MASK) == XPRT_TCPTEMP)
+		desc = user ? ((struct xprt*)user)->user : NULL;
+	if (WARN_ON(!desc || (desc->nr_handlers && !desc->handlers)))
+		return NULL;
+
+	/*上下文、接收缓存、各处理器的私有数据依次连续分配*/
+	size = sizeof(*pl) + sizeof(pl->ctx[0]) * desc->nr_handlers +
+		sizeof(struct pipeline_rx);
+	for (uint32_t i = 0; i < desc->nr_handlers; i++)
+		size = ALIGN(size, sizeof(void*)) + desc->handlers[i]->privsize;
+
+	pl = malloc(size);
+	if (skp_unlikely(!pl))
+		return NULL;
+	memset(pl, 0, size);
+
+	pl->clnt.xprt.user = user;
+	pl->desc = desc;
+
+	off = sizeof(*pl) + sizeof(pl->ctx[0]) * desc->nr_handlers +
+		sizeof(struct pipeline_rx);
+	for (uint32_t i = 0; i < desc->nr_handlers; i++) {
+		handler = desc->handlers[i];
+		off = ALIGN(off, sizeof(void*));
+		pl->ctx[i].handler = handler;
+		pl->ctx[i].pipeline = pl;
+		pl->ctx[i].index = i;
+		pl->ctx[i].priv = handler->privsize ? (char*)pl + off : NULL;
+		off += handler->privsize;
+		pl->headroom += handler->headroom;
+	}
+
+	for (uint32_t i = 0; i < desc->nr_handlers; i++) {
+		handler = desc->handlers[i];
+		if (!handler->init)
+			continue;
+		rc = handler->init(&pl->ctx[i]);
+		if (skp_unlikely(rc)) {
+			log_warn("pipeline handler [%s] init failed : %s",
+				handler->name ? : "", __strerror_local(-rc));
+			pipeline_fini(pl, i);
+			free(pl);
+			return NULL;
+		}
+	}
+
+	return &pl->clnt.xprt;
+}
+
+static void pipeline_destructor(struct xprt *xprt)
+{
+	struct xprt_pipeline *pl = xprt_to_pipeline(xprt);
+	if (skp_unlikely(!pl))
+		return;
+	pipeline_txq_purge(pl);
+	free_pb(pipeline_rx(pl)->spare);
+	pipeline_fini(pl, pl->desc->nr_handlers);
+	free(pl);
+}
+
+static void pipeline_on_recv(struct xprt *xprt, unsigned long stats)
+{
+	ssize_t rc;
+	struct pbuff *pb;
+	struct xprt_pipeline *pl = xprt_to_pipeline(xprt);
+	struct pipeline_rx *rx = pipeline_rx(pl);
+
+	while (1) {
+		/*处理器可能关闭了传输对象*/
+		if (xprt_status(xprt) & (XPRT_CLOSED|XPRT_SHUTRD))
+			return;
+
+		pb = rx->spare;
+		rx->spare = NULL;
+		if (!pb) {
+			pb = alloc_pb(CONFIG_XPRT_PIPELINE_RXSIZE);
+			if (skp_unlikely(!pb)) {
+				rc = -ENOMEM;
+				break;
+			}
+		}
+
+		rc = xprt_read(xprt, pb_tail(pb), pb_tailroom(pb));
+		if (skp_unlikely(rc <= 0)) {
+			/*没有读到数据，留给下次使用*/
+			rx->spare = pb;
+			if (skp_likely(rc == -EAGAIN))
+				return;
+			break;
+		}
+		pb_putdata(pb, rc);
+
+		/*读缓存的所有权交给处理器*/
+		rc = pipeline_inbound(pl, 0, pb);
+		if (skp_unlikely(rc)) {
+			log_warn("pipeline inbound failed : sfd [%d] : %s", xprt_fd(xprt),
+				__strerror_local(-(int)rc));
+			break;
+		}
+	}
+
+	/*对端关闭或出错*/
+	shutdown_xprt(xprt, SHUT_RDWR);
+}
+
+static void pipeline_on_send(struct xprt *xprt, unsigned long stats)
+{
+	/*发送队列已清空，通知处理器继续写入*/
+	pipeline_changed(xprt_to_pipeline(xprt), stats);
+}
+
+static void pipeline_on_changed(struct xprt *xprt, unsigned long stats)
+{
+	if (stats & XPRT_OPENED)
+		xprt_event_enable(xprt, EVENT_READ);
+	pipeline_changed(xprt_to_pipeline(xprt), stats);
+}
+
+static int pipeline_do_flush(struct xprt *xprt)
+{
+	int rc;
+	struct xprt_pipeline *pl = xprt_to_pipeline(xprt);
+
+	if (skp_likely(!pipeline_txq_len(pl)))
+		return 0;
+
+	rc = pipeline_txq_flush(pl);
+	if (skp_likely(rc != -EAGAIN))
+		return rc;
+
+	rc = pipeline_txq_wait(pl);
+	return skp_likely(!rc) ? -EAGAIN : rc;
+}
+
+const struct xprt_operations xprt_pipeline_ops = {
+	.constructor = pipeline_constructor,
+	.destructor = pipeline_destructor,
+	.on_recv = pipeline_on_recv,
+	.on_send = pipeline_on_send,
+	.on_changed = pipeline_on_changed,
+	.do_flush = pipeline_do_flush,
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// 长度前缀的帧
+////////////////////////////////////////////////////////////////////////////////
+
+struct lenframe {
+	/*跨越读取边界的帧，以及它的长度*/
+	struct pbuff *cum;
+	uint32_t len;
+	/*跨越读取边界的前缀*/
+	uint32_t hdr;
+	uint8_t nhdr;
+};
+
+static void lenframe_fini(struct xprt_handler_ctx *ctx)
+{
+	struct lenframe *lf = ctx->priv;
+	free_pb(lf->cum);
+	lf->cum = NULL;
+}
+
+static int lenframe_inbound(struct xprt_handler_ctx *ctx, struct pbuff *pb)
+{
+	int rc = 0;
+	size_t n;
+	uint32_t len;
+	struct pbuff *frame;
+	struct lenframe *lf = ctx->priv;
+
+	while (pb && pb_headlen(pb)) {
+		/*补齐上次不完整的帧，只有这种情况会复制*/
+		if (lf->cum) {
+			n = min_t(size_t, lf->len - pb_headlen(lf->cum), pb_headlen(pb));
+			__pb_write_bytes(lf->cum, pb_pulldata(pb, n), n);
+			if (pb_headlen(lf->cum) < lf->len)
+				break;
+			frame = lf->cum;
+			lf->cum = NULL;
+			xprt_stat_msgs(xprt_handler_xprt(ctx), 1, 0);
+			rc = xprt_fire_inbound(ctx, frame);
+			if (skp_unlikely(rc))
+				break;
+			continue;
+		}
+
+		if (skp_likely(!lf->nhdr && pb_headlen(pb) >= sizeof(len))) {
+			__pb_read_uint32(pb, &len);
+		} else {
+			n = min_t(size_t, sizeof(lf->hdr) - lf->nhdr, pb_headlen(pb));
+			memcpy((uint8_t*)&lf->hdr + lf->nhdr, pb_pulldata(pb, n), n);
+			lf->nhdr += n;
+			if (lf->nhdr < sizeof(lf->hdr))
+				break;
+			lf->nhdr = 0;
+			len = ntohl(lf->hdr);
+		}
+
+		if (skp_unlikely(len > CONFIG_XPRT_LENFRAME_MAX)) {
+			rc = -EMSGSIZE;
+			break;
+		}
+
+		/*不完整的帧，复制到独立的缓存中等待补齐*/
+		if (len > pb_headlen(pb)) {
+			lf->cum = alloc_pb(len);
+			if (skp_unlikely(!lf->cum)) {
+				rc = -ENOMEM;
+				break;
+			}
+			lf->len = len;
+			continue;
+		}
+
+		/*恰好是最后一帧则直接传递，否则共享底层数据*/
+		if (len == pb_headlen(pb)) {
+			frame = pb;
+			pb = NULL;
+		} else if (!len) {
+			frame = alloc_pb(0);
+		} else {
+			frame = pb_share(pb, len, pb->user, pb->pb_ops);
+			if (skp_likely(frame))
+				pb_pulldata(pb, len);
+		}
+		if (skp_unlikely(!frame)) {
+			rc = -ENOMEM;
+			break;
+		}
+
+		xprt_stat_msgs(xprt_handler_xprt(ctx), 1, 0);
+		rc = xprt_fire_inbound(ctx, frame);
+		if (skp_unlikely(rc))
+			break;
+	}
+
+	free_pb(pb);
+	return rc;
+}
+
+static int lenframe_outbound(struct xprt_handler_ctx *ctx, struct pbuff *pb)
+{
+	int rc;
+	struct pbuff *hdr;
+	uint32_t len = (uint32_t)pb_len(pb);
+
+	if (skp_unlikely(len > CONFIG_XPRT_LENFRAME_MAX)) {
+		free_pb(pb);
+		return -EMSGSIZE;
+	}
+
+	xprt_stat_msgs(xprt_handler_xprt(ctx), 0, 1);
+	len = htonl(len);
+	if (skp_likely(pb_headroom(pb) >= sizeof(len) && !pb_cloned(pb) &&
+			!pb_shared(pb))) {
+		memcpy(pb_pushdata(pb, sizeof(len)), &len, sizeof(len));
+		return xprt_fire_outbound(ctx, pb);
+	}
+
+	/*共享的数据不能修改，前缀独立传递，发送时与数据合并为一次 writev*/
+	hdr = alloc_pb(sizeof(len));
+	if (skp_unlikely(!hdr)) {
+		free_pb(pb);
+		return -ENOMEM;
+	}
+	__pb_write_bytes(hdr, &len, sizeof(len));
+
+	rc = xprt_fire_outbound(ctx, hdr);
+	if (skp_unlikely(rc)) {
+		free_pb(pb);
+		return rc;
+	}
+	return xprt_fire_outbound(ctx, pb);
+}
+
+const struct xprt_handler xprt_lenframe_handler = {
+	.name = "lenframe",
+	.privsize = sizeof(struct lenframe),
+	.headroom = sizeof(uint32_t),
+	.init = NULL,
+	.fini = lenframe_fini,
+	.inbound = lenframe_inbound,
+	.outbound = lenframe_outbound,
+	.changed = NULL,
+};
@@ -0,0 +1,467 @@
+//
+//  prefork.c
+//  test
+//
+//  Created by 周凯 on 2020/01/16.
+//  Copyright © 2020 zhoukai. All rights reserved.
+//
+
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <skp/utils/utils.h>
+#include <skp/process/signal.h>
+#include <skp/process/daemon.h>
+#include <skp/server/socket.h>
+#include <skp/server/prefork.h>
+
+/*有等待重新创建的工作进程时，检查的周期，毫秒*/
+#define PREFORK_TICK (10)
+
+/*主进程私有的状态*/
+struct prefork_slot {
+	bool pending; /*等待重新创建*/
+	uint32_t delay; /*下次崩溃后的延迟*/
+	uint64_t spawn_at; /*创建或重新创建的时间，毫秒*/
+};
+
+struct prefork_worker *__prefork_self = NULL;
+
+static int prefork_nr = 0;
+static struct prefork_worker *prefork_workers = NULL;
+static volatile sig_atomic_t prefork_stopping = 0;
+
+static uint32_t prefork_nr_fds = 0;
+/*主进程中为第一个工作进程的侦听套接字，工作进程中为自己的侦听套接字*/
+static int prefork_fds[CONFIG_PREFORK_MAX_LISTENERS];
+static union inet_address prefork_addrs[CONFIG_PREFORK_MAX_LISTENERS];
+/*
+ * 其余工作进程的侦听套接字，[(工作进程 - 1) * prefork_nr_fds + 侦听序号]
+ * 都以 SO_REUSEPORT 绑定在同一地址上，由内核分配连接，避免惊群，
+ * 由主进程持有，工作进程重新创建前到达的连接仍然排队在其中
+ */
+static int *prefork_socks = NULL;
+/*第一个工作进程不再重新创建时，主进程中的侦听套接字被暂停*/
+static bool prefork_paused = false;
+
+static inline uint64_t prefork_now(void)
+{
+	return abstime(NULL, 0) / 1000000;
+}
+
+static void prefork_setopt(int fd, void *user)
+{
+	int *rc = user;
+	*rc = sockopt_reuseport(fd);
+}
+
+int prefork_listen(const struct service_address *addr)
+{
+	int sfd, rc = 0;
+	socklen_t slen = sizeof(prefork_addrs[0]);
+
+	if (WARN_ON(__prefork_self || prefork_workers))
+		return -EPERM;
+	if (skp_unlikely(prefork_nr_fds >= CONFIG_PREFORK_MAX_LISTENERS))
+		return -ENOSPC;
+
+	sfd = tcp_listen(addr, prefork_setopt, &rc);
+	if (skp_unlikely(sfd < 0))
+		return sfd;
+	if (skp_unlikely(rc)) {
+		close(sfd);
+		return rc;
+	}
+
+	rc = getsockname(sfd, &prefork_addrs[prefork_nr_fds].sock_addr, &slen);
+	if (skp_unlikely(rc)) {
+		rc = -errno;
+		close(sfd);
+		return rc;
+	}
+	prefork_fds[prefork_nr_fds++] = sfd;
+	return 0;
+}
+
+int prefork_inherit(const struct service_address *addr)
+{
+	int fd = -ENOENT;
+	struct addrinfo *ai;
+
+	if (!READ_ONCE(__prefork_self) || !prefork_nr_fds)
+		return -ENOENT;
+
+	ai = sock_getaddrinfo(addr, AI_PASSIVE, AF_UNSPEC, SOCK_STREAM);
+	if (skp_unlikely(!ai))
+		return -ENOENT;
+
+	for (struct addrinfo *tmp = ai; tmp && fd == -ENOENT; tmp = tmp->ai_next) {
+		for (uint32_t i = 0; i < prefork_nr_fds; i++) {
+			if (!inet_address_equal(&prefork_addrs[i], tmp->ai_addr))
+				continue;
+			/*每个侦听对象拥有一个副本，销毁时不影响主进程与其他侦听对象*/
+			fd = fcntl(prefork_fds[i], F_DUPFD_CLOEXEC, 0);
+			if (skp_unlikely(fd < 0))
+				fd = -errno;
+			break;
+		}
+	}
+
+	sock_freeaddrinfo(ai);
+	return fd;
+}
+
+/*以相同的地址创建其余工作进程的侦听套接字*/
+static int prefork_clone(const union inet_address *addr)
+{
+	int sfd, rc;
+	socklen_t slen = addr->sock_addr.sa_family == AF_INET ?
+		sizeof(addr->sin_addr) : sizeof(addr->sin6_addr);
+
+	sfd = socket(addr->sock_addr.sa_family, SOCK_STREAM, 0);
+	if (skp_unlikely(sfd < 0))
+		return -errno;
+	sockopt_reuseaddress(sfd);
+	rc = sockopt_reuseport(sfd);
+	if (skp_likely(!rc)) {
+		rc = bind(sfd, &addr->sock_addr, slen);
+		if (skp_likely(!rc))
+			rc = listen(sfd, CONFIG_LISTENQ);
+		if (skp_unlikely(rc))
+			rc = -errno;
+	}
+	if (skp_unlikely(rc)) {
+		close(sfd);
+		return rc;
+	}
+	return sfd;
+}
+
+static void prefork_close_socks(int nr)
+{
+	if (!prefork_socks)
+		return;
+	for (int i = 0; i < nr; i++) {
+		if (prefork_socks[i] > -1)
+			close(prefork_socks[i]);
+	}
+	free(prefork_socks);
+	prefork_socks = NULL;
+}
+
+static int prefork_create_socks(int nr)
+{
+	int fd, total = (nr - 1) * prefork_nr_fds;
+
+	if (!total)
+		return 0;
+
+	prefork_socks = malloc(sizeof(*prefork_socks) * total);
+	if (skp_unlikely(!prefork_socks))
+		return -ENOMEM;
+
+	for (int i = 0; i < total; i++) {
+		fd = prefork_clone(&prefork_addrs[i % prefork_nr_fds]);
+		if (skp_unlikely(fd < 0)) {
+			__log_error("listen for worker %d failed : %s",
+				i / prefork_nr_fds + 1, __strerror_local(-fd));
+			prefork_close_socks(i);
+			return fd;
+		}
+		prefork_socks[i] = fd;
+	}
+	return 0;
+}
+
+/*
+ * 工作进程不再重新创建，释放它的侦听套接字，否则内核仍会把连接分配到
+ * 无人接受的队列中；第一个工作进程的套接字由 prefork_listen() 创建，
+ * 只停止侦听保留绑定，下次运行时重新侦听
+ */
+static void prefork_release_socks(int index)
+{
+	int *socks;
+
+	if (!index) {
+		for (uint32_t i = 0; i < prefork_nr_fds; i++)
+			shutdown(prefork_fds[i], SHUT_RD);
+		prefork_paused = true;
+		return;
+	}
+
+	if (!prefork_socks)
+		return;
+	socks = &prefork_socks[(index - 1) * prefork_nr_fds];
+	for (uint32_t i = 0; i < prefork_nr_fds; i++) {
+		if (socks[i] > -1)
+			close(socks[i]);
+		socks[i] = -1;
+	}
+}
+
+static int prefork_resume_socks(void)
+{
+	if (!prefork_paused)
+		return 0;
+	for (uint32_t i = 0; i < prefork_nr_fds; i++) {
+		if (skp_unlikely(listen(prefork_fds[i], CONFIG_LISTENQ)))
+			return -errno;
+	}
+	prefork_paused = false;
+	return 0;
+}
+
+/*工作进程只保留自己的侦听套接字*/
+static void prefork_own_socks(int index)
+{
+	int *socks;
+
+	if (!prefork_socks)
+		return;
+
+	if (index > 0) {
+		socks = &prefork_socks[(index - 1) * prefork_nr_fds];
+		for (uint32_t i = 0; i < prefork_nr_fds; i++) {
+			close(prefork_fds[i]);
+			prefork_fds[i] = socks[i];
+			socks[i] = -1;
+		}
+	}
+	prefork_close_socks((prefork_nr - 1) * prefork_nr_fds);
+}
+
+static void prefork_signal(int signo)
+{
+	prefork_stop();
+}
+
+void prefork_stop(void)
+{
+	int nr = prefork_nr;
+	struct prefork_worker *workers = prefork_workers;
+
+	prefork_stopping = 1;
+	if (!workers || __prefork_self)
+		return;
+	/*只使用异步信号安全的函数*/
+	for (int i = 0; i < nr; i++) {
+		pid_t pid = READ_ONCE(workers[i].pid);
+		if (pid > 0)
+			kill(pid, SIGTERM);
+	}
+}
+
+static pid_t prefork_spawn(struct prefork_worker *worker,
+		struct prefork_slot *slot, prefork_fn fn, void *arg)
+{
+	pid_t pid;
+	int err;
+
+	/*工作进程中可以读取到本次的创建次数*/
+	worker->nr_spawns++;
+	pid = fork();
+	if (skp_unlikely(pid < 0)) {
+		err = errno;
+		worker->nr_spawns--;
+		__log_error("fork worker %d failed : %s", worker->index,
+			__strerror_local(err));
+		return -err;
+	}
+
+	if (!pid) {
+		/*工作进程恢复默认的信号处理，由用户重新安装*/
+		signal_setup(SIGTERM, SIG_DFL);
+		signal_setup(SIGINT, SIG_DFL);
+		prefork_own_socks(worker->index);
+		WRITE_ONCE(__prefork_self, worker);
+		exit(fn(worker->index, arg));
+	}
+
+	WRITE_ONCE(worker->pid, pid);
+	slot->pending = false;
+	slot->spawn_at = prefork_now();
+	return pid;
+}
+
+/*工作进程退出，返回 true 表示需要重新创建*/
+static bool prefork_reap(struct prefork_worker *worker,
+		struct prefork_slot *slot, int status)
+{
+	uint64_t now = prefork_now();
+
+	WRITE_ONCE(worker->pid, 0);
+	if (WIFEXITED(status) && !WEXITSTATUS(status)) {
+		__log_info("worker %d exit", worker->index);
+		return false;
+	}
+
+	if (WIFSIGNALED(status)) {
+		__log_warn("worker %d was killed by signal %d", worker->index,
+			WTERMSIG(status));
+	} else {
+		__log_warn("worker %d exit with %d", worker->index,
+			WEXITSTATUS(status));
+	}
+
+	if (prefork_stopping)
+		return false;
+
+	/*长时间运行后再崩溃，不认为是连续崩溃*/
+	if (now - slot->spawn_at > CONFIG_PREFORK_RESPAWN_MAX)
+		slot->delay = CONFIG_PREFORK_RESPAWN_DELAY;
+	slot->pending = true;
+	slot->spawn_at = now + slot->delay;
+	slot->delay = min_t(uint32_t, slot->delay * 2, CONFIG_PREFORK_RESPAWN_MAX);
+	return true;
+}
+
+int prefork_run(int nr, prefork_fn fn, void *arg)
+{
+	pid_t pid;
+	int rc = 0, status, alive = 0, pending = 0;
+	struct prefork_slot *slots;
+	struct prefork_worker *workers;
+	size_t size = sizeof(*workers) * nr;
+
+	if (WARN_ON(nr < 1 || nr > CONFIG_PREFORK_MAX_WORKERS || !fn))
+		return -EINVAL;
+	if (WARN_ON(__prefork_self))
+		return -EPERM;
+
+	slots = calloc(nr, sizeof(*slots));
+	if (skp_unlikely(!slots))
+		return -ENOMEM;
+
+	rc = prefork_resume_socks();
+	if (skp_likely(!rc))
+		rc = prefork_create_socks(nr);
+	if (skp_unlikely(rc)) {
+		free(slots);
+		return rc;
+	}
+
+	/*上次运行的统计在这里释放*/
+	if (prefork_workers)
+		munmap(prefork_workers, sizeof(*workers) * prefork_nr);
+
+	workers = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_ANONYMOUS,
+		-1, 0);
+	if (skp_unlikely(workers == MAP_FAILED)) {
+		rc = -errno;
+		prefork_workers = NULL;
+		prefork_close_socks((nr - 1) * prefork_nr_fds);
+		free(slots);
+		return rc;
+	}
+
+	for (int i = 0; i < nr; i++) {
+		workers[i].index = i;
+		slots[i].delay = CONFIG_PREFORK_RESPAWN_DELAY;
+	}
+
+	prefork_nr = nr;
+	prefork_stopping = 0;
+	WRITE_ONCE(prefork_workers, workers);
+	/*中断 waitpid()，及时转发信号*/
+	signal_intr_setup(SIGTERM, prefork_signal);
+	signal_intr_setup(SIGINT, prefork_signal);
+
+	for (int i = 0; i < nr; i++) {
+		rc = prefork_spawn(&workers[i], &slots[i], fn, arg);
+		if (skp_unlikely(rc < 0)) {
+			prefork_stop();
+			for (int j = i; j < nr; j++)
+				prefork_release_socks(j);
+			break;
+		}
+		alive++;
+	}
+	rc = rc < 0 ? rc : 0;
+
+	__log_info("master %ld start %d workers", (long)getpid(), alive);
+
+	while (alive || pending) {
+		/*有等待重新创建的工作进程时不能一直阻塞*/
+		pid = waitpid(-1, &status, pending ? WNOHANG : 0);
+		if (pid > 0) {
+			for (int i = 0; i < nr; i++) {
+				if (workers[i].pid != pid)
+					continue;
+				alive--;
+				if (prefork_reap(&workers[i], &slots[i], status))
+					pending++;
+				else
+					prefork_release_socks(i);
+				break;
+			}
+			continue;
+		} else if (pid < 0 && errno != EINTR) {
+			if (WARN_ON(errno != ECHILD))
+				__log_error("wait workers failed : %s", strerror_local());
+			break;
+		}
+
+		if (prefork_stopping) {
+			/*停止时不再重新创建*/
+			for (int i = 0; i < nr; i++) {
+				if (!slots[i].pending)
+					continue;
+				slots[i].pending = false;
+				prefork_release_socks(i);
+			}
+			pending = 0;
+			continue;
+		}
+
+		if (!pending)
+			continue;
+
+		for (int i = 0; i < nr; i++) {
+			if (!slots[i].pending || prefork_now() < slots[i].spawn_at)
+				continue;
+			pending--;
+			if (prefork_spawn(&workers[i], &slots[i], fn, arg) > 0) {
+				__log_info("respawn worker %d : %ld", i, (long)workers[i].pid);
+				alive++;
+			} else {
+				/*失败后按照连续崩溃处理*/
+				slots[i].spawn_at = prefork_now() + slots[i].delay;
+				slots[i].pending = true;
+				pending++;
+			}
+		}
+		if (pending)
+			usleep(PREFORK_TICK * 1000);
+	}
+
+	signal_setup(SIGTERM, SIG_DFL);
+	signal_setup(SIGINT, SIG_DFL);
+	prefork_close_socks((nr - 1) * prefork_nr_fds);
+	free(slots);
+
+	__log_info("master %ld all workers exit", (long)getpid());
+	return rc;
+}
+
+int prefork_stats(uint64_t counters[CONFIG_PREFORK_NR_COUNTERS])
+{
+	struct prefork_worker *workers = READ_ONCE(prefork_workers);
+
+	memset(counters, 0, sizeof(uint64_t) * CONFIG_PREFORK_NR_COUNTERS);
+	if (!workers)
+		return 0;
+
+	for (int i = 0; i < prefork_nr; i++) {
+		for (int j = 0; j < CONFIG_PREFORK_NR_COUNTERS; j++)
+			counters[j] += __atomic_load_n(&workers[i].counters[j],
+				__ATOMIC_RELAXED);
+	}
+	return prefork_nr;
+}
+
+const struct prefork_worker *prefork_worker(int index)
+{
+	struct prefork_worker *workers = READ_ONCE(prefork_workers);
+	if (!workers || index < 0 || index >= prefork_nr)
+		return NULL;
+	return &workers[index];
+}
@@ -0,0 +1,536 @@
+//
+//  resolver.c
+//  test
+//
+//  Created by 周凯 on 2020/01/06.
+//  Copyright © 2020 zhoukai. All rights reserved.
+//
+
+#include <time.h>
+#include <skp/utils/utils.h>
+#include <skp/utils/hash.h>
+#include <skp/utils/spinlock.h>
+#include <skp/adt/hlist_table.h>
+#include <skp/process/workqueue.h>
+#include <skp/server/socket.h>
+#include <skp/server/resolver.h>
+
+#ifndef CONFIG_RESOLV_SHARDS
+# define CONFIG_RESOLV_SHARDS (16)
+#endif
+
+/*每个分片最多缓存的名称数量，超过则淘汰最旧的*/
+#ifndef CONFIG_RESOLV_SHARD_MAX
+# define CONFIG_RESOLV_SHARD_MAX (1024)
+#endif
+
+/*
+ * 解析结果的有效期，秒
+ * getaddrinfo() 不提供记录的 TTL，所以使用统一的有效期
+ */
+#ifndef CONFIG_RESOLV_TTL
+# define CONFIG_RESOLV_TTL (60)
+#endif
+
+/*解析失败的结果的有效期，秒*/
+#ifndef CONFIG_RESOLV_NEG_TTL
+# define CONFIG_RESOLV_NEG_TTL (5)
+#endif
+
+/*过期后仍然可以使用的时长，秒，期间在后台刷新*/
+#ifndef CONFIG_RESOLV_STALE
+# define CONFIG_RESOLV_STALE (30)
+#endif
+
+#define RESOLV_BUCKETS (64)
+
+struct resolv_entry {
+	struct hlist_node hnode;
+	struct list_head lru; /*按照插入的顺序*/
+	struct list_head waiters; /*等待解析完成的请求*/
+	struct work_struct work;
+	time_t expires;
+	int err; /*缓存的错误*/
+	bool resolving; /*正在工作队列中解析，不能被释放*/
+	uint32_t hash;
+	uint32_t klen;
+	struct resolv_result result;
+	/*地址族 + 主机名 + '\0' + 服务名 + '\0'*/
+	char key[0];
+};
+
+struct resolv_shard {
+	spinlock_t lock;
+	uint32_t nr;
+	struct list_head lru;
+	struct hlist_head table[RESOLV_BUCKETS];
+} __cacheline_aligned;
+
+static bool resolv_inited = false;
+static struct resolv_shard resolv_shards[CONFIG_RESOLV_SHARDS];
+static struct workqueue_struct *resolv_wq;
+
+static void __resolv_init(void)
+{
+	big_lock();
+	if (skp_unlikely(resolv_inited)) {
+		big_unlock();
+		return;
+	}
+	for (int i = 0; i < CONFIG_RESOLV_SHARDS; i++) {
+		struct resolv_shard *shard = &resolv_shards[i];
+		spin_lock_init(&shard->lock);
+		shard->nr = 0;
+		INIT_LIST_HEAD(&shard->lru);
+		for (int j = 0; j < RESOLV_BUCKETS; j++)
+			INIT_HLIST_HEAD(&shard->table[j]);
+	}
+	WRITE_ONCE(resolv_inited, true);
+	big_unlock();
+}
+
+static inline void resolv_init(void)
+{
+	if (skp_likely(READ_ONCE(resolv_inited)))
+		return;
+	__resolv_init();
+}
+
+static struct workqueue_struct *__resolv_wq_init(void)
+{
+	struct workqueue_struct *wq, *old;
+
+	wq = alloc_workqueue("resolver", WQ_UNBOUND, 0);
+	if (WARN_ON(!wq))
+		return NULL;
+	old = cmpxchg_val_ptr(&resolv_wq, NULL, wq);
+	if (skp_unlikely(old)) {
+		destroy_workqueue(wq);
+		return old;
+	}
+	return wq;
+}
+
+static inline struct workqueue_struct *resolv_wq_init(void)
+{
+	struct workqueue_struct *wq = READ_ONCE(resolv_wq);
+	if (skp_likely(wq))
+		return wq;
+	return __resolv_wq_init();
+}
+
+/*单调时钟，秒*/
+static inline time_t resolv_now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+	return ts.tv_sec;
+}
+
+static inline struct resolv_shard *resolv_shard(uint32_t hash)
+{
+	return &resolv_shards[hash & (CONFIG_RESOLV_SHARDS - 1)];
+}
+
+static inline struct hlist_head *
+resolv_bucket(struct resolv_shard *shard, uint32_t hash)
+{
+	/*低位用于选择分片*/
+	return &shard->table[(hash >> ilog2(CONFIG_RESOLV_SHARDS)) &
+		(RESOLV_BUCKETS - 1)];
+}
+
+/*
+ * 构造键
+ * @return 键的长度，0 表示名称过长
+ */
+static uint32_t resolv_key(const struct service_address *addr, int family,
+		char *key, size_t size)
+{
+	int n = snprintf(key, size, "%c%s%c%s", (char)family, addr->host, 0,
+				addr->serv);
+	if (skp_unlikely(n < 0 || (size_t)n >= size))
+		return 0;
+	return n + 1;
+}
+
+/*数字地址直接转换*/
+static bool resolv_numeric(const struct service_address *addr, int family,
+		struct resolv_result *result)
+{
+	char *end;
+	unsigned long port;
+	union inet_address *inet = &result->addrs[0];
+
+	port = strtoul(addr->serv, &end, 10);
+	if (*end || end == addr->serv || port > U16_MAX)
+		return false;
+
+	memset(inet, 0, sizeof(*inet));
+	if ((family == AF_UNSPEC || family == AF_INET) &&
+			inet_pton(AF_INET, addr->host, &inet->sin_addr.sin_addr) == 1) {
+		inet->sin_addr.sin_family = AF_INET;
+		inet->sin_addr.sin_port = htons((uint16_t)port);
+	} else if ((family == AF_UNSPEC || family == AF_INET6) &&
+			inet_pton(AF_INET6, addr->host, &inet->sin6_addr.sin6_addr) == 1) {
+		inet->sin6_addr.sin6_family = AF_INET6;
+		inet->sin6_addr.sin6_port = htons((uint16_t)port);
+	} else {
+		return false;
+	}
+	result->nr = 1;
+	return true;
+}
+
+/*阻塞解析*/
+static int resolv_getaddrinfo(const char *host, const char *serv, int family,
+		struct resolv_result *result)
+{
+	struct addrinfo *ai;
+	const struct service_address addr = {
+		.host = host,
+		.serv = serv,
+	};
+
+	ai = sock_getaddrinfo(&addr, 0, family, SOCK_STREAM);
+	if (skp_unlikely(!ai))
+		return -ENXIO;
+
+	result->nr = 0;
+	for (struct addrinfo *tmp = ai; tmp &&
+			result->nr < CONFIG_RESOLV_MAX_ADDRS; tmp = tmp->ai_next) {
+		if (tmp->ai_family != AF_INET && tmp->ai_family != AF_INET6)
+			continue;
+		fill_inet_address(&result->addrs[result->nr++], tmp->ai_addr,
+			tmp->ai_addrlen);
+	}
+	sock_freeaddrinfo(ai);
+
+	/*保留系统的地址选择顺序，交错地址族便于并行连接*/
+	inet_address_interleave(result->addrs, result->nr);
+	return skp_likely(result->nr) ? 0 : -EAFNOSUPPORT;
+}
+
+static struct resolv_entry *resolv_lookup_locked(struct resolv_shard *shard,
+		const char *key, uint32_t klen, uint32_t hash)
+{
+	struct resolv_entry *entry;
+	hlist_for_each_entry(entry, resolv_bucket(shard, hash), hnode) {
+		if (entry->hash == hash && entry->klen == klen &&
+				!memcmp(entry->key, key, klen))
+			return entry;
+	}
+	return NULL;
+}
+
+static inline void resolv_unlink(struct resolv_shard *shard,
+		struct resolv_entry *entry, struct list_head *dead)
+{
+	hlist_del(&entry->hnode);
+	list_move(&entry->lru, dead);
+	shard->nr--;
+}
+
+static void resolv_free_list(struct list_head *dead)
+{
+	struct resolv_entry *entry, *n;
+	list_for_each_entry_safe(entry, n, dead, lru)
+		free(entry);
+}
+
+/*淘汰超出可用期的和超出容量的，正在解析的不能淘汰*/
+static void resolv_evict_locked(struct resolv_shard *shard, time_t now,
+		struct list_head *dead)
+{
+	struct resolv_entry *entry, *n;
+	list_for_each_entry_safe(entry, n, &shard->lru, lru) {
+		if (entry->expires + CONFIG_RESOLV_STALE > now &&
+				shard->nr < CONFIG_RESOLV_SHARD_MAX)
+			break;
+		if (entry->resolving)
+			continue;
+		resolv_unlink(shard, entry, dead);
+	}
+}
+
+static inline void resolv_fill_locked(struct resolv_entry *entry, int err,
+		const struct resolv_result *result, time_t now)
+{
+	entry->err = err;
+	if (skp_likely(!err)) {
+		entry->result = *result;
+		entry->expires = now + CONFIG_RESOLV_TTL;
+	} else {
+		entry->expires = now + CONFIG_RESOLV_NEG_TTL;
+	}
+}
+
+static void resolv_work(struct work_struct *work);
+
+static struct resolv_entry *resolv_entry_alloc(const char *key, uint32_t klen,
+		uint32_t hash)
+{
+	struct resolv_entry *entry = malloc(sizeof(*entry) + klen);
+	if (skp_unlikely(!entry))
+		return NULL;
+	entry->hash = hash;
+	entry->klen = klen;
+	entry->err = 0;
+	entry->expires = 0;
+	entry->resolving = false;
+	entry->result.nr = 0;
+	INIT_LIST_HEAD(&entry->waiters);
+	INIT_WORK(&entry->work, resolv_work);
+	memcpy(entry->key, key, klen);
+	return entry;
+}
+
+/*插入或更新同步解析的结果*/
+static void resolv_insert(const char *key, uint32_t klen, uint32_t hash,
+		int err, const struct resolv_result *result)
+{
+	LIST__HEAD(dead);
+	time_t now = resolv_now();
+	struct resolv_shard *shard = resolv_shard(hash);
+	struct resolv_entry *entry, *nentry;
+
+	nentry = resolv_entry_alloc(key, klen, hash);
+	if (skp_unlikely(!nentry))
+		return;
+
+	spin_lock(&shard->lock);
+	entry = resolv_lookup_locked(shard, key, klen, hash);
+	if (entry) {
+		/*就地更新，正在后台刷新的条目也可以更新*/
+		resolv_fill_locked(entry, err, result, now);
+		list_move_tail(&entry->lru, &shard->lru);
+	} else {
+		resolv_evict_locked(shard, now, &dead);
+		resolv_fill_locked(nentry, err, result, now);
+		hlist_add_head(&nentry->hnode, resolv_bucket(shard, hash));
+		list_add_tail(&nentry->lru, &shard->lru);
+		shard->nr++;
+		nentry = NULL;
+	}
+	spin_unlock(&shard->lock);
+
+	resolv_free_list(&dead);
+	free(nentry);
+}
+
+static void resolv_work(struct work_struct *work)
+{
+	int err;
+	time_t now;
+	LIST__HEAD(waiters);
+	struct resolv_req *req, *n;
+	struct resolv_result result;
+	struct resolv_entry *entry = container_of(work, struct resolv_entry, work);
+	struct resolv_shard *shard = resolv_shard(entry->hash);
+	const char *host = &entry->key[1];
+	const char *serv = host + strlen(host) + 1;
+
+	err = resolv_getaddrinfo(host, serv, entry->key[0], &result);
+
+	now = resolv_now();
+	spin_lock(&shard->lock);
+	resolv_fill_locked(entry, err, &result, now);
+	list_move_tail(&entry->lru, &shard->lru);
+	list_splice_init(&entry->waiters, &waiters);
+	WRITE_ONCE(entry->resolving, false);
+	spin_unlock(&shard->lock);
+
+	/*解锁后条目可能被淘汰，不能再访问*/
+	list_for_each_entry_safe(req, n, &waiters, node) {
+		list_del_init(&req->node);
+		if (skp_likely(!err))
+			req->result = result;
+		req->done(req, err);
+	}
+}
+
+/*
+ * 查询缓存，过期不久的结果在返回的同时发起后台刷新
+ * @param req 不为空，则未命中时加入等待队列并发起异步解析
+ * @return 0 命中，-ENOENT 未命中，-EINPROGRESS 已加入等待队列，其他为缓存的错误
+ */
+static int resolv_find(const char *key, uint32_t klen, uint32_t hash,
+		struct resolv_result *result, struct resolv_req *req)
+{
+	int rc = -ENOENT;
+	bool refresh = false;
+	LIST__HEAD(dead);
+	time_t now = resolv_now();
+	struct resolv_shard *shard = resolv_shard(hash);
+	struct resolv_entry *entry, *nentry = NULL;
+	struct workqueue_struct *wq = resolv_wq_init();
+
+	if (skp_unlikely(!wq))
+		return -ENOMEM;
+
+	/*在锁外预分配*/
+	if (req) {
+		nentry = resolv_entry_alloc(key, klen, hash);
+		if (skp_unlikely(!nentry))
+			return -ENOMEM;
+	}
+
+	spin_lock(&shard->lock);
+	entry = resolv_lookup_locked(shard, key, klen, hash);
+	if (entry) {
+		if (entry->expires > now) {
+			rc = entry->err;
+		} else if (!entry->err && entry->expires + CONFIG_RESOLV_STALE > now) {
+			/*过期不久，继续使用，并在后台刷新*/
+			rc = 0;
+			refresh = true;
+		}
+		if (!rc)
+			*result = entry->result;
+	}
+
+	if (rc == -ENOENT ? !req : !refresh)
+		goto unlock;
+
+	if (!entry) {
+		resolv_evict_locked(shard, now, &dead);
+		entry = nentry;
+		nentry = NULL;
+		hlist_add_head(&entry->hnode, resolv_bucket(shard, hash));
+		list_add_tail(&entry->lru, &shard->lru);
+		shard->nr++;
+	}
+
+	/*需要等待解析结果*/
+	if (rc == -ENOENT) {
+		list_add_tail(&req->node, &entry->waiters);
+		rc = -EINPROGRESS;
+	}
+
+	/*同一名称只会发起一次解析*/
+	if (!entry->resolving) {
+		entry->resolving = true;
+		WARN_ON(!queue_work(wq, &entry->work));
+	}
+
+unlock:
+	spin_unlock(&shard->lock);
+
+	resolv_free_list(&dead);
+	free(nentry);
+	return rc;
+}
+
+int resolv_cached(const struct service_address *addr, int family,
+		struct resolv_result *result)
+{
+	uint32_t klen;
+	char key[NI_MAXHOST + NI_MAXSERV + 2];
+
+	if (skp_unlikely(!addr || !addr->host || !addr->serv || !result))
+		return -EINVAL;
+
+	if (resolv_numeric(addr, family, result))
+		return 0;
+
+	klen = resolv_key(addr, family, key, sizeof(key));
+	if (skp_unlikely(!klen))
+		return -ENAMETOOLONG;
+
+	resolv_init();
+	return resolv_find(key, klen, jhash(key, klen, 0), result, NULL);
+}
+
+int resolv_lookup(const struct service_address *addr, int family,
+		struct resolv_result *result)
+{
+	int rc;
+	uint32_t klen, hash;
+	char key[NI_MAXHOST + NI_MAXSERV + 2];
+
+	if (skp_unlikely(!addr || !addr->host || !addr->serv || !result))
+		return -EINVAL;
+
+	if (resolv_numeric(addr, family, result))
+		return 0;
+
+	klen = resolv_key(addr, family, key, sizeof(key));
+	if (skp_unlikely(!klen))
+		return -ENAMETOOLONG;
+
+	resolv_init();
+	hash = jhash(key, klen, 0);
+	rc = resolv_find(key, klen, hash, result, NULL);
+	if (rc != -ENOENT)
+		return rc;
+
+	rc = resolv_getaddrinfo(addr->host, addr->serv, family, result);
+	resolv_insert(key, klen, hash, rc, result);
+	return rc;
+}
+
+int resolv_cache_insert(const struct service_address *addr, int family,
+		const struct resolv_result *result)
+{
+	uint32_t klen;
+	char key[NI_MAXHOST + NI_MAXSERV + 2];
+
+	if (skp_unlikely(!addr || !addr->host || !addr->serv || !result ||
+			!result->nr || result->nr > CONFIG_RESOLV_MAX_ADDRS))
+		return -EINVAL;
+
+	klen = resolv_key(addr, family, key, sizeof(key));
+	if (skp_unlikely(!klen))
+		return -ENAMETOOLONG;
+
+	resolv_init();
+	resolv_insert(key, klen, jhash(key, klen, 0), 0, result);
+	return 0;
+}
+
+int resolv_async(const struct service_address *addr, int family,
+		struct resolv_req *req, resolv_fn done)
+{
+	uint32_t klen;
+	char key[NI_MAXHOST + NI_MAXSERV + 2];
+
+	if (skp_unlikely(!addr || !addr->host || !addr->serv || !req || !done))
+		return -EINVAL;
+
+	if (resolv_numeric(addr, family, &req->result))
+		return 0;
+
+	klen = resolv_key(addr, family, key, sizeof(key));
+	if (skp_unlikely(!klen))
+		return -ENAMETOOLONG;
+
+	resolv_init();
+	INIT_LIST_HEAD(&req->node);
+	req->done = done;
+	return resolv_find(key, klen, jhash(key, klen, 0), &req->result, req);
+}
+
+void resolv_cache_flush(void)
+{
+	if (!READ_ONCE(resolv_inited))
+		return;
+
+	for (int i = 0; i < CONFIG_RESOLV_SHARDS; i++) {
+		LIST__HEAD(dead);
+		struct resolv_entry *entry, *n;
+		struct resolv_shard *shard = &resolv_shards[i];
+
+		spin_lock(&shard->lock);
+		list_for_each_entry_safe(entry, n, &shard->lru, lru) {
+			/*正在解析的，由工作队列更新结果*/
+			if (entry->resolving) {
+				entry->expires = 0;
+				continue;
+			}
+			resolv_unlink(shard, entry, &dead);
+		}
+		spin_unlock(&shard->lock);
+
+		resolv_free_list(&dead);
+	}
+}
@@ -0,0 +1,515 @@
+//
+//  restart.c
+//  test
+//
+//  Created by 周凯 on 2020/01/15.
+//  Copyright © 2020 zhoukai. All rights reserved.
+//
+
+#define _GNU_SOURCE
+#include <sys/un.h>
+#include <sys/stat.h>
+#include <skp/utils/utils.h>
+#include <skp/utils/spinlock.h>
+#include <skp/process/event.h>
+#include <skp/process/daemon.h>
+#include <skp/process/workqueue.h>
+#include <skp/server/xprt.h>
+#include <skp/server/restart.h>
+
+#define RESTART_MAGIC (0x534b5052U)
+#define RESTART_ACK ('A')
+/*旧进程检查连接是否结束的周期，毫秒*/
+#define RESTART_DRAIN_TICK (100)
+
+/*交接的消息，套接字由 SCM_RIGHTS 附带，顺序与地址相同*/
+struct restart_msg {
+	uint32_t magic;
+	uint32_t nr;
+	union inet_address addrs[CONFIG_RESTART_MAX_FDS];
+};
+
+/*旧进程*/
+struct restart_serv {
+	struct server *serv;
+	int lfd;
+	struct uev_stream stream;
+	struct work_struct work;
+	struct delayed_work drain;
+	uint32_t drain_left;
+};
+
+static DEFINE_SPINLOCK(restart_lock);
+static struct restart_serv *restart_serv = NULL;
+
+/*新进程继承的套接字*/
+static uint32_t restart_nr = 0;
+static int restart_fds[CONFIG_RESTART_MAX_FDS];
+static union inet_address restart_addrs[CONFIG_RESTART_MAX_FDS];
+
+static int restart_path(const char *name, union unix_address *uaddr, char *dir)
+{
+	const char *p = strrchr(name, '/');
+	int l;
+
+	name = p ? p + 1 : name;
+	if (WARN_ON(!*name))
+		return -EINVAL;
+
+	l = snprintf(dir, sizeof(uaddr->sock_un.sun_path), CONFIG_RESTART_DIR, name);
+	if (skp_unlikely(l >= sizeof(uaddr->sock_un.sun_path)))
+		return -ENAMETOOLONG;
+
+	memset(uaddr, 0, sizeof(*uaddr));
+	uaddr->sock_un.sun_family = AF_UNIX;
+	l = snprintf(uaddr->sock_un.sun_path, sizeof(uaddr->sock_un.sun_path),
+		"%s/" CONFIG_RESTART_SOCKET, dir);
+	if (skp_unlikely(l >= sizeof(uaddr->sock_un.sun_path)))
+		return -ENAMETOOLONG;
+	return 0;
+}
+
+/*目录必须是自己的，且其他用户没有任何权限，防止被替换或抢先创建*/
+static int restart_dir_check(const char *dir, bool create)
+{
+	struct stat st;
+
+	if (create && mkdir(dir, S_IRWXU) && errno != EEXIST)
+		return -errno;
+	if (skp_unlikely(lstat(dir, &st)))
+		return -errno;
+	if (skp_unlikely(!S_ISDIR(st.st_mode) || st.st_uid != geteuid() ||
+			(st.st_mode & (S_IRWXG | S_IRWXO)))) {
+		log_warn("restart directory %s is not private", dir);
+		return -EPERM;
+	}
+	return 0;
+}
+
+/*只与有效用户相同的进程交接*/
+static int restart_peer_check(int fd)
+{
+	struct ucred cred;
+	socklen_t len = sizeof(cred);
+
+	if (skp_unlikely(getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len)))
+		return -errno;
+	if (skp_unlikely(cred.uid != geteuid())) {
+		log_warn("restart peer [%d] uid [%u] does not match",
+			(int)cred.pid, (unsigned)cred.uid);
+		return -EPERM;
+	}
+	return 0;
+}
+
+static void restart_timeo(int fd)
+{
+	sockopt_set_timeval(fd, SOL_SOCKET, SO_RCVTIMEO,
+		CONFIG_RESTART_TIMEOUT * 1000L);
+	sockopt_set_timeval(fd, SOL_SOCKET, SO_SNDTIMEO,
+		CONFIG_RESTART_TIMEOUT * 1000L);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// 旧进程
+////////////////////////////////////////////////////////////////////////////////
+
+/*已有的连接都结束或者超时，退出主循环*/
+static void restart_drain_work(struct work_struct *work)
+{
+	struct restart_serv *rs =
+		container_of(to_delayed_work(work), struct restart_serv, drain);
+	uint32_t nr = READ_ONCE(rs->serv->nr_xprts);
+
+	if (nr && rs->drain_left > RESTART_DRAIN_TICK) {
+		rs->drain_left -= RESTART_DRAIN_TICK;
+		schedule_delayed_work(&rs->drain, RESTART_DRAIN_TICK);
+		return;
+	}
+
+	if (nr)
+		log_warn("restart drain timed out, %u xprts left", nr);
+	else
+		log_info("restart drain finished");
+	server_pause(rs->serv);
+}
+
+/*收集所有侦听对象，并持有引用*/
+static uint32_t restart_collect(struct server *serv, struct xprt **xprts,
+		struct restart_msg *msg)
+{
+	uint32_t nr = 0;
+	struct xprt *xprt;
+
+	spin_lock(&serv->lock);
+	list_for_each_entry(xprt, &serv->xprt_list, node) {
+		if (xprt_type(xprt) != XPRT_TCPSERV ||
+				(xprt_status(xprt) & XPRT_CLOSED))
+			continue;
+		if (WARN_ON(nr >= CONFIG_RESTART_MAX_FDS))
+			break;
+		msg->addrs[nr] = xprt_to_tcpserv(xprt)->lstn_address;
+		xprts[nr++] = xprt_get(xprt);
+	}
+	spin_unlock(&serv->lock);
+	return nr;
+}
+
+static int restart_send(int cfd, struct xprt **xprts, struct restart_msg *msg)
+{
+	ssize_t rc;
+	char ack = 0;
+	struct msghdr mhdr;
+	struct cmsghdr *cmsg;
+	struct iovec iov = {
+		.iov_base = msg,
+		.iov_len = offsetof(struct restart_msg, addrs[msg->nr]),
+	};
+	union {
+		char buff[CMSG_SPACE(sizeof(int) * CONFIG_RESTART_MAX_FDS)];
+		struct cmsghdr align;
+	} ctl;
+
+	memset(&mhdr, 0, sizeof(mhdr));
+	mhdr.msg_iov = &iov;
+	mhdr.msg_iovlen = 1;
+	if (skp_likely(msg->nr)) {
+		mhdr.msg_control = ctl.buff;
+		mhdr.msg_controllen = CMSG_SPACE(sizeof(int) * msg->nr);
+		cmsg = CMSG_FIRSTHDR(&mhdr);
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SCM_RIGHTS;
+		cmsg->cmsg_len = CMSG_LEN(sizeof(int) * msg->nr);
+		for (uint32_t i = 0; i < msg->nr; i++)
+			((int*)CMSG_DATA(cmsg))[i] = xprt_fd(xprts[i]);
+	}
+
+	do {
+		rc = sendmsg(cfd, &mhdr, MSG_NOSIGNAL);
+	} while (rc < 0 && errno == EINTR);
+	if (skp_unlikely(rc != iov.iov_len))
+		return rc < 0 ? -errno : -EIO;
+
+	/*新进程确认收到后才能销毁侦听对象*/
+	do {
+		rc = read(cfd, &ack, 1);
+	} while (rc < 0 && errno == EINTR);
+	if (skp_unlikely(rc != 1 || ack != RESTART_ACK))
+		return rc < 0 ? -errno : -EPROTO;
+	return 0;
+}
+
+static void restart_handoff(struct work_struct *work)
+{
+	int rc, cfd;
+	struct restart_msg *msg;
+	struct xprt *xprts[CONFIG_RESTART_MAX_FDS];
+	struct restart_serv *rs = container_of(work, struct restart_serv, work);
+
+	cfd = accept(uev_stream_fd(&rs->stream), NULL, NULL);
+	if (skp_unlikely(cfd < 0)) {
+		if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+			log_warn("restart accept failed : %s", strerror_local());
+		goto again;
+	}
+
+	rc = restart_peer_check(cfd);
+	if (skp_unlikely(rc)) {
+		close(cfd);
+		goto again;
+	}
+
+	msg = malloc(sizeof(*msg));
+	if (skp_unlikely(!msg)) {
+		close(cfd);
+		goto again;
+	}
+
+	restart_timeo(cfd);
+	msg->magic = RESTART_MAGIC;
+	msg->nr = restart_collect(rs->serv, xprts, msg);
+	rc = restart_send(cfd, xprts, msg);
+	if (skp_unlikely(rc)) {
+		log_warn("restart handoff failed : %s", __strerror_local(-rc));
+		for (uint32_t i = 0; i < msg->nr; i++)
+			xprt_put(xprts[i]);
+		free(msg);
+		close(cfd);
+		goto again;
+	}
+
+	/*不再响应交接，也不再接受新连接，销毁时不会关闭套接字的读端*/
+	uev_stream_delete_sync(&rs->stream);
+	uev_stream_closefd(&rs->stream);
+	for (uint32_t i = 0; i < msg->nr; i++)
+		destroy_xprt(xprts[i]);
+	log_info("restart handoff %u listeners", msg->nr);
+	free(msg);
+
+	/*新进程在连接关闭后获取 pid 文件锁*/
+	if (rs->lfd >= 0)
+		daemon_pidfile_unlock(rs->lfd);
+	close(cfd);
+
+	rs->drain_left = CONFIG_RESTART_DRAIN;
+	schedule_delayed_work(&rs->drain, 0);
+	return;
+
+again:
+	uev_stream_enable(&rs->stream, EVENT_READ);
+}
+
+/*在事件线程中不做阻塞的交接*/
+static void restart_stream_cb(struct uev_stream *stream, uint16_t mask)
+{
+	struct restart_serv *rs = container_of(stream, struct restart_serv, stream);
+	uev_stream_disable(stream, EVENT_READ);
+	schedule_work(&rs->work);
+}
+
+int restart_serve(struct server *serv, const char *name, int lfd)
+{
+	int rc, fd;
+	struct restart_serv *rs;
+	union unix_address uaddr;
+	char dir[sizeof(uaddr.sock_un.sun_path)];
+
+	BUG_ON(!serv || !name);
+
+	rc = restart_path(name, &uaddr, dir);
+	if (skp_unlikely(rc))
+		return rc;
+
+	rs = malloc(sizeof(*rs));
+	if (skp_unlikely(!rs))
+		return -ENOMEM;
+
+	rc = restart_dir_check(dir, true);
+	if (skp_unlikely(rc))
+		goto fail;
+
+	fd = socket(AF_UNIX, SOCK_STREAM|SOCK_NONBLOCK|SOCK_CLOEXEC, 0);
+	if (skp_unlikely(fd < 0)) {
+		rc = -errno;
+		goto fail;
+	}
+
+	/*上一次交接后残留的路径*/
+	unlink(uaddr.sock_un.sun_path);
+	if (skp_unlikely(bind(fd, &uaddr.sock_addr, sizeof(uaddr.sock_un)) ||
+			chmod(uaddr.sock_un.sun_path, S_IRUSR | S_IWUSR) ||
+			listen(fd, 1))) {
+		rc = -errno;
+		close(fd);
+		goto fail;
+	}
+
+	rs->serv = serv;
+	rs->lfd = lfd;
+	rs->drain_left = 0;
+	INIT_WORK(&rs->work, restart_handoff);
+	INIT_DELAYED_WORK(&rs->drain, restart_drain_work);
+	uev_stream_init(&rs->stream, fd, restart_stream_cb);
+
+	spin_lock(&restart_lock);
+	if (skp_unlikely(restart_serv)) {
+		spin_unlock(&restart_lock);
+		close(fd);
+		rc = -EBUSY;
+		goto fail;
+	}
+	restart_serv = rs;
+	spin_unlock(&restart_lock);
+
+	rc = uev_stream_add(&rs->stream, EVENT_READ);
+	if (skp_unlikely(rc < 0)) {
+		spin_lock(&restart_lock);
+		restart_serv = NULL;
+		spin_unlock(&restart_lock);
+		close(fd);
+		goto fail;
+	}
+	return 0;
+fail:
+	log_warn("restart serve on %s failed : %s", uaddr.sock_un.sun_path,
+		__strerror_local(-rc));
+	free(rs);
+	return rc;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// 新进程
+////////////////////////////////////////////////////////////////////////////////
+
+static int restart_recv(int cfd, struct restart_msg *msg, int *fds)
+{
+	ssize_t rc;
+	uint32_t nfds = 0;
+	struct msghdr mhdr;
+	struct cmsghdr *cmsg;
+	struct iovec iov = { .iov_base = msg, .iov_len = sizeof(*msg), };
+	union {
+		char buff[CMSG_SPACE(sizeof(int) * CONFIG_RESTART_MAX_FDS)];
+		struct cmsghdr align;
+	} ctl;
+
+	memset(&mhdr, 0, sizeof(mhdr));
+	mhdr.msg_iov = &iov;
+	mhdr.msg_iovlen = 1;
+	mhdr.msg_control = ctl.buff;
+	mhdr.msg_controllen = sizeof(ctl.buff);
+
+	do {
+		rc = recvmsg(cfd, &mhdr, MSG_CMSG_CLOEXEC);
+	} while (rc < 0 && errno == EINTR);
+	if (skp_unlikely(rc < 0))
+		return -errno;
+
+	for (cmsg = CMSG_FIRSTHDR(&mhdr); cmsg; cmsg = CMSG_NXTHDR(&mhdr, cmsg)) {
+		if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+			continue;
+		nfds = (uint32_t)((cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int));
+		memcpy(fds, CMSG_DATA(cmsg), sizeof(int) * nfds);
+		break;
+	}
+
+	/*消息不完整也要关闭已收到的套接字*/
+	if (skp_unlikely(rc < offsetof(struct restart_msg, addrs) ||
+			msg->magic != RESTART_MAGIC || msg->nr != nfds ||
+			rc != offsetof(struct restart_msg, addrs[nfds]) ||
+			(mhdr.msg_flags & MSG_CTRUNC))) {
+		for (uint32_t i = 0; i < nfds; i++)
+			close(fds[i]);
+		return -EPROTO;
+	}
+	return (int)nfds;
+}
+
+int restart_takeover(const char *name, int lfd)
+{
+	int rc, cfd, nr;
+	char c = RESTART_ACK;
+	struct restart_msg *msg;
+	union unix_address uaddr;
+	int fds[CONFIG_RESTART_MAX_FDS];
+	char dir[sizeof(uaddr.sock_un.sun_path)];
+
+	BUG_ON(!name);
+
+	rc = restart_path(name, &uaddr, dir);
+	if (skp_unlikely(rc))
+		return rc;
+
+	/*没有旧进程*/
+	if (access(dir, F_OK) && errno == ENOENT)
+		goto none;
+	rc = restart_dir_check(dir, false);
+	if (skp_unlikely(rc))
+		return rc;
+
+	cfd = socket(AF_UNIX, SOCK_STREAM|SOCK_CLOEXEC, 0);
+	if (skp_unlikely(cfd < 0))
+		return -errno;
+
+	if (connect(cfd, &uaddr.sock_addr, sizeof(uaddr.sock_un))) {
+		rc = errno;
+		close(cfd);
+		if (rc == ENOENT || rc == ECONNREFUSED)
+			goto none;
+		return -rc;
+	}
+
+	rc = restart_peer_check(cfd);
+	if (skp_unlikely(rc)) {
+		close(cfd);
+		return rc;
+	}
+
+	msg = malloc(sizeof(*msg));
+	if (skp_unlikely(!msg)) {
+		close(cfd);
+		return -ENOMEM;
+	}
+
+	restart_timeo(cfd);
+	nr = restart_recv(cfd, msg, fds);
+	if (skp_unlikely(nr < 0))
+		goto out;
+
+	if (skp_unlikely(write(cfd, &c, 1) != 1)) {
+		rc = -errno;
+		for (int i = 0; i < nr; i++)
+			close(fds[i]);
+		nr = rc;
+		goto out;
+	}
+
+	spin_lock(&restart_lock);
+	for (int i = 0; i < nr; i++) {
+		if (WARN_ON(restart_nr >= CONFIG_RESTART_MAX_FDS)) {
+			close(fds[i]);
+			continue;
+		}
+		restart_addrs[restart_nr] = msg->addrs[i];
+		restart_fds[restart_nr++] = fds[i];
+	}
+	spin_unlock(&restart_lock);
+
+	/*旧进程释放 pid 文件锁后关闭连接*/
+	while (read(cfd, &c, 1) < 0 && errno == EINTR);
+	if (lfd >= 0) {
+		rc = daemon_pidfile_lock(lfd, CONFIG_RESTART_TIMEOUT);
+		if (skp_unlikely(rc))
+			log_warn("restart lock pid file failed : %s", __strerror_local(-rc));
+	}
+	log_info("take over %d listeners", nr);
+out:
+	free(msg);
+	close(cfd);
+	return nr;
+none:
+	log_info("no process to take over from %s", uaddr.sock_un.sun_path);
+	return lfd >= 0 ? daemon_pidfile_lock(lfd, 0) : 0;
+}
+
+int restart_inherit(const struct service_address *addr)
+{
+	int fd = -ENOENT;
+	struct addrinfo *ai;
+
+	if (!READ_ONCE(restart_nr))
+		return -ENOENT;
+
+	ai = sock_getaddrinfo(addr, AI_PASSIVE, AF_UNSPEC, SOCK_STREAM);
+	if (skp_unlikely(!ai))
+		return -ENOENT;
+
+	spin_lock(&restart_lock);
+	for (struct addrinfo *tmp = ai; tmp && fd < 0; tmp = tmp->ai_next) {
+		for (uint32_t i = 0; i < restart_nr; i++) {
+			if (!inet_address_equal(&restart_addrs[i], tmp->ai_addr))
+				continue;
+			fd = restart_fds[i];
+			/*用最后一个填补空位*/
+			restart_nr--;
+			restart_fds[i] = restart_fds[restart_nr];
+			restart_addrs[i] = restart_addrs[restart_nr];
+			break;
+		}
+	}
+	spin_unlock(&restart_lock);
+
+	sock_freeaddrinfo(ai);
+	return fd;
+}
+
+void restart_release(void)
+{
+	spin_lock(&restart_lock);
+	while (restart_nr) {
+		restart_nr--;
+		log_warn("close unused inherited listener : %d", restart_fds[restart_nr]);
+		close(restart_fds[restart_nr]);
+	}
+	spin_unlock(&restart_lock);
+}
@@ -2,6 +2,41 @@
 #include <skp/server/server.h>
 #include <skp/mm/slab.h>
 
+static void server_tcpinfo_work(struct work_struct *work)
+{
+	uint32_t period, nr, n = 0;
+	struct xprt *xprt, **xprts;
+	struct server *serv = container_of(to_delayed_work(work), struct server,
+		tcpinfo_work);
+
+	/*持有锁时只收集引用，释放锁后再逐个 getsockopt()*/
+	nr = READ_ONCE(serv->nr_xprts);
+	xprts = nr ? malloc(sizeof(*xprts) * nr) : NULL;
+	if (skp_likely(xprts)) {
+		spin_lock(&serv->lock);
+		list_for_each_entry(xprt, &serv->xprt_list, node) {
+			/*之后加入的在下个周期采样*/
+			if (n == nr)
+				break;
+			/*连接完成之前没有描述符*/
+			if (xprt_is_tcpclnt(xprt) && !xprt_is_connecting(xprt))
+				xprts[n++] = xprt_get(xprt);
+		}
+		spin_unlock(&serv->lock);
+
+		/*持有引用，描述符不会被关闭*/
+		for (uint32_t i = 0; i < n; i++) {
+			xprt_tcpinfo_sample(xprts[i]);
+			xprt_put(xprts[i]);
+		}
+		free(xprts);
+	}
+
+	period = READ_ONCE(serv->tcpinfo_period);
+	if (period)
+		schedule_delayed_work(&serv->tcpinfo_work, period);
+}
+
 static inline int init_server(struct server *serv, uint32_t max_xprts,
 		uint32_t opt)
 {
@@ -14,6 +49,8 @@ static inline int init_server(struct server *serv, uint32_t max_xprts,
 	spin_lock_init(&serv->lock);
 	INIT_LIST_HEAD(&serv->xprt_list);
 	init_waitqueue_head(&serv->waitqueue);
+	serv->tcpinfo_period = 0;
+	INIT_DELAYED_WORK(&serv->tcpinfo_work, server_tcpinfo_work);
 
 	return 0;
 }
@@ -73,6 +110,10 @@ void destroy_server(struct server *serv)
 {
 	uint32_t stats;
 
+	/*采样的工作没有持有引用，必须先停止*/
+	if (READ_ONCE(serv->tcpinfo_period))
+		server_set_tcpinfo(serv, 0);
+
 	spin_lock(&serv->lock);
 	stats = server_set_stats(serv, SERVER_DESTROYED);
 	if (WARN_ON(stats == SERVER_DESTROYED)) {
@@ -150,3 +191,30 @@ void __server_stop(struct server *serv, bool destroy_xprts)
 unlock:
 	spin_unlock(&serv->lock);
 }
+
+int server_for_each_xprt(struct server *serv,
+		int (*fn)(struct xprt *, void *), void *arg)
+{
+	int rc = 0;
+	struct xprt *xprt;
+
+	spin_lock(&serv->lock);
+	/*在链表中的传输对象一定还没有关闭描述符 @see detach_xprt()*/
+	list_for_each_entry(xprt, &serv->xprt_list, node) {
+		rc = fn(xprt, arg);
+		if (rc)
+			break;
+	}
+	spin_unlock(&serv->lock);
+	return rc;
+}
+
+void server_set_tcpinfo(struct server *serv, uint32_t period)
+{
+	WRITE_ONCE(serv->tcpinfo_period, period);
+	if (period) {
+		modify_delayed_work(&serv->tcpinfo_work, period);
+	} else {
+		cancel_delayed_work_sync(&serv->tcpinfo_work);
+	}
+}
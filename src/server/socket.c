@@ -6,12 +6,10 @@
 //  Copyright © 2018 zhoukai. All rights reserved.
 //
 #include <sys/select.h>
+#include <poll.h>
 #include <skp/utils/utils.h>
 #include <skp/server/socket.h>
-
-#ifndef CONFIG_LISTENQ
-# define CONFIG_LISTENQ (1024)
-#endif
+#include <skp/server/resolver.h>
 
 #undef NEG
 #define NEG(x) ((x) > 0 ? -(x) : (x))
@@ -309,24 +307,169 @@ int tcp_listen(const struct service_address *addr, sockfd_setopt action,
 	return rc;
 }
 
-int tcp_connect(const struct service_address *address, sockfd_setopt action,
-		void *user, int *pflags, union inet_address *pinetaddr)
+void inet_address_interleave(union inet_address *addrs, uint32_t nr)
 {
-	struct addrinfo *ai;
-	union inet_address inetaddr;
-	int flags = 0, sfd = -EINVAL, rc = 0;
+	union inet_address tmp;
 
-	ai = sock_getaddrinfo(address, 0, AF_UNSPEC, SOCK_STREAM);
-	if (skp_unlikely(!ai))
-		return -EINVAL;
+	for (uint32_t i = 1, j; i < nr; i++) {
+		sa_family_t family = addrs[i - 1].sock_addr.sa_family;
+		if (addrs[i].sock_addr.sa_family != family)
+			continue;
+		/*查找下一个不同地址族的地址，并移动到当前位置*/
+		for (j = i + 1; j < nr; j++) {
+			if (addrs[j].sock_addr.sa_family != family)
+				break;
+		}
+		if (j == nr)
+			break;
+		tmp = addrs[j];
+		memmove(&addrs[i + 1], &addrs[i], (j - i) * sizeof(*addrs));
+		addrs[i] = tmp;
+	}
+}
+
+static inline uint64_t tcp_connect_clock(void)
+{
+	return abstime(NULL, 0) / 1000000;
+}
+
+/*
+ * 阻塞套接字的并行连接（RFC 8305）
+ * 每隔 CONFIG_TCP_CONNECT_DELAY 毫秒，或上一个尝试失败时，
+ * 发起下一个地址的非阻塞连接，第一个成功的连接胜出，其余的被关闭
+ * @param sfd 第一个地址已经创建并设置了选项的套接字
+ * @param fl 套接字原始的文件标志，胜出的套接字将被恢复
+ */
+static int tcp_connect_race(const union inet_address *addrs, uint32_t nr,
+		int sfd, int fl, sockfd_setopt action, void *user,
+		union inet_address *pinetaddr)
+{
+	struct sock_address saddr;
+	struct pollfd pfds[CONFIG_TCP_CONNECT_RACE];
+	uint32_t which[CONFIG_TCP_CONNECT_RACE];
+	uint32_t next = 0, n = 0, win = 0;
+	uint64_t until = 0, now;
+	int rc = -EINVAL, err, timeo;
+
+	do {
+		/*发起下一个尝试*/
+		if (next < nr && n < ARRAY_SIZE(pfds) &&
+				(!n || tcp_connect_clock() >= until)) {
+			const union inet_address *addr = &addrs[next++];
+			if (skp_unlikely(!inet_address2sock(addr, &saddr)))
+				goto next;
+			if (sfd < 0) {
+				sfd = socket(saddr.sock_addr.sa_family, SOCK_STREAM, 0);
+				if (skp_unlikely(sfd < 0)) {
+					rc = -errno;
+					continue;
+				}
+				if (action)
+					action(sfd, user);
+			}
+
+			if (skp_unlikely(enable_fd_flag(sfd, O_NONBLOCK))) {
+				rc = -errno;
+				goto next;
+			}
+
+			if (!connect(sfd, &saddr.sock_addr, saddr.length)) {
+				pfds[n].fd = sfd;
+				which[n] = next - 1;
+				win = n++;
+				goto out;
+			}
+			if (skp_unlikely(errno != EINPROGRESS)) {
+				rc = -errno;
+				goto next;
+			}
+
+			pfds[n].fd = sfd;
+			pfds[n].events = POLLOUT;
+			pfds[n].revents = 0;
+			which[n++] = next - 1;
+			sfd = -1;
+			until = tcp_connect_clock() + CONFIG_TCP_CONNECT_DELAY;
+			continue;
+next:
+			if (sfd > -1)
+				close(sfd);
+			sfd = -1;
+			until = 0;
+			continue;
+		}
+
+		/*全部失败*/
+		if (!n)
+			break;
+
+		timeo = -1;
+		if (next < nr && n < ARRAY_SIZE(pfds)) {
+			now = tcp_connect_clock();
+			timeo = until > now ? (int)(until - now) : 0;
+		}
+
+		err = poll(pfds, n, timeo);
+		if (skp_unlikely(err < 0)) {
+			if (errno == EINTR)
+				continue;
+			rc = -errno;
+			break;
+		}
+
+		for (uint32_t i = 0; err > 0 && i < n; i++) {
+			if (!pfds[i].revents)
+				continue;
+			err--;
+			rc = -sockopt_get_sockerr(pfds[i].fd);
+			if (skp_likely(!rc)) {
+				win = i;
+				goto out;
+			}
+			/*失败的尝试立即发起下一个*/
+			close(pfds[i].fd);
+			pfds[i] = pfds[--n];
+			which[i--] = which[n];
+			until = 0;
+		}
+	} while (1);
+
+	for (uint32_t i = 0; i < n; i++)
+		close(pfds[i].fd);
+	if (!rc)
+		rc = -ECONNREFUSED;
+	errno = -rc;
+	return rc;
+
+out:
+	for (uint32_t i = 0; i < n; i++) {
+		if (i != win)
+			close(pfds[i].fd);
+	}
+	sfd = pfds[win].fd;
+	*pinetaddr = addrs[which[win]];
+	if (!(fl & O_NONBLOCK))
+		WARN_ON(disable_fd_flag(sfd, O_NONBLOCK));
+	return sfd;
+}
+
+int tcp_connect_inet(const union inet_address *addrs, uint32_t nr,
+		sockfd_setopt action, void *user, int *pflags,
+		union inet_address *pinetaddr)
+{
+	struct sock_address saddr;
+	union inet_address inetaddr;
+	int fl, flags = 0, sfd = -EINVAL, rc = -EINVAL;
 
 	if (skp_unlikely(!pflags))
 		pflags = &flags;
 	if (skp_unlikely(!pinetaddr))
 		pinetaddr= &inetaddr;
 
-	for (struct addrinfo *tmp = ai; tmp; tmp = tmp->ai_next) {
-		sfd = socket(tmp->ai_family, tmp->ai_socktype, tmp->ai_protocol);
+	for (uint32_t i = 0; i < nr; i++) {
+		if (skp_unlikely(!inet_address2sock(&addrs[i], &saddr)))
+			continue;
+		sfd = socket(saddr.sock_addr.sa_family, SOCK_STREAM, 0);
 		if (skp_unlikely(sfd < 0)) {
 			rc = -errno;
 			continue;
@@ -334,8 +477,16 @@ int tcp_connect(const struct service_address *address, sockfd_setopt action,
 		if (action)
 			action(sfd, user);
 
-		fill_inet_address(pinetaddr, tmp->ai_addr, tmp->ai_addrlen);
-		rc = connect(sfd, tmp->ai_addr, tmp->ai_addrlen);
+		/*阻塞的套接字还有备选地址，并行连接，避免在不可达的地址上等待超时*/
+		fl = fcntl(sfd, F_GETFL);
+		if (i + 1 < nr && fl > -1 && !(fl & O_NONBLOCK)) {
+			*pflags = 0;
+			return tcp_connect_race(&addrs[i], nr - i, sfd, fl, action,
+					user, pinetaddr);
+		}
+
+		*pinetaddr = addrs[i];
+		rc = connect(sfd, &saddr.sock_addr, saddr.length);
 		if (skp_likely(!rc)) {
 			*pflags = 0;
 			break;
@@ -350,11 +501,28 @@ int tcp_connect(const struct service_address *address, sockfd_setopt action,
 		close(sfd);
 	}
 
-	sock_freeaddrinfo(ai);
 	if (skp_likely(!rc))
 		return sfd;
+	errno = -rc;
+	return rc;
+}
+
+int tcp_connect(const struct service_address *address, sockfd_setopt action,
+		void *user, int *pflags, union inet_address *pinetaddr)
+{
+	int rc;
+	struct resolv_result result;
+
+	rc = resolv_lookup(address, AF_UNSPEC, &result);
+	if (skp_unlikely(rc))
+		return -EINVAL;
+
+	rc = tcp_connect_inet(result.addrs, result.nr, action, user, pflags,
+			pinetaddr);
+	if (skp_likely(rc >= 0))
+		return rc;
 	log_warn("connecting [%s:%s] address failed : %s",
-		address->host, address->serv, strerror_local());
+		address->host, address->serv, __strerror_local(-rc));
 	return rc;
 }
 
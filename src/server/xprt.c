@@ -2,6 +2,9 @@
 #include <skp/server/xprt.h>
 #include <skp/server/server.h>
 #include <skp/server/socket.h>
+#include <skp/server/resolver.h>
+#include <skp/server/restart.h>
+#include <skp/server/prefork.h>
 #include <skp/process/event.h>
 #include <skp/process/thread.h>
 #include <skp/mm/slab.h>
@@ -99,1244 +102,3967 @@ do { 														\
 
 static void process_xprt_event(struct uev_stream *ev, uint16_t mask);
 
-/**
- * 安装传输对象，服务器对象管理所有的传输对象，并持有一个引用计数
- */
-static int attach_xprt(struct xprt *xprt, int fd, unsigned long flags,
-	struct server *serv, const struct xprt_operations *ops)
-{
-	int rc = 0;
+////////////////////////////////////////////////////////////////////////////////
+// 超时管理
+// 每个事件槽位一个粗粒度的时间轮，由一个与槽位绑定的定时器驱动，
+// 活动时仅刷新时间戳，滴答时才检查并重新放置到对应的槽位中
+////////////////////////////////////////////////////////////////////////////////
 
-	/*添加到管理容器的动作第一置于最后，方便错误回滚*/
-	server_get(serv);
+/*时间轮的滴答，毫秒*/
+#ifndef CONFIG_XPRT_TIMEO_TICK
+# define CONFIG_XPRT_TIMEO_TICK (100)
+#endif
 
-	/*初始化一些字段*/
-	xprt->flags = flags;
-	xprt->server = serv;
-	xprt->xprt_ops = ops;
-	uref_init(&xprt->refs);
-	INIT_LIST_HEAD(&xprt->node);
+/*时间轮的槽位数量，必须是 2 的幂*/
+#ifndef CONFIG_XPRT_TIMEO_SLOTS
+# define CONFIG_XPRT_TIMEO_SLOTS (256)
+#endif
 
-	/*初始化事件*/
-	uev_stream_init(xprt_ev(xprt), fd, process_xprt_event);
+#define XPRT_TIMEO_TICK CONFIG_XPRT_TIMEO_TICK
+#define XPRT_TIMEO_SLOTS CONFIG_XPRT_TIMEO_SLOTS
+#define XPRT_TIMEO_MASK (XPRT_TIMEO_SLOTS - 1)
 
-	/*TODO:处理停止状态*/
-	spin_lock(&serv->lock);
-	if (!__server_has_fulled(serv)) {
-		serv->nr_xprts++;
-		/*增加引用计数，防止异步释放 xprt*/
-		if (xprt_is_tcpserv(xprt_get(xprt))) {
-			/*方便优先杀掉侦听套接字，终止外部新连接*/
-			list_add(&xprt->node , &serv->xprt_list);
-		} else {
-			list_add_tail(&xprt->node, &serv->xprt_list);
-		}
-		XPRT_BUG_ON(__test_and_set_bit(XPRT_ATTACHED_BIT, &xprt->flags));
-	} else {
-		rc = -EMFILE;
-		__server_put(xchg_ptr(&xprt->server, NULL));
-	}
-	spin_unlock(&serv->lock);
+struct xprt_wheel {
+	spinlock_t lock;
+	uint32_t now; /**< 当前滴答*/
+	uint32_t nr_xprts; /**< 在时间轮中的传输对象数量*/
+	bool armed; /**< 定时器已启动或正在回调*/
+	uint64_t nr_ticks; /**< 定时器回调的次数*/
+	uint64_t nr_slots; /**< 回调中遍历的槽位数*/
+	struct uev_timer timer;
+	struct list_head slots[XPRT_TIMEO_SLOTS];
+} __cacheline_aligned;
 
-	/*尚未初始化完成，不能在此启动事件*/
+static bool xprt_wheel_inited = false;
+static DEFINE_PER_CPU_AIGNED(struct xprt_wheel, xprt_wheels);
 
-	return rc;
+static void xprt_wheel_timer_cb(struct uev_timer *);
+
+static inline uint32_t xprt_wheel_clock(void)
+{
+	return (uint32_t)(uev_timer_future(0) / (XPRT_TIMEO_TICK * 1000000ULL));
 }
 
-static bool detach_xprt(struct xprt *xprt)
+/*转换为滴答，多加一个滴答，因为时间戳最多滞后一个滴答*/
+static inline uint32_t xprt_timeo_ticks(uint32_t ms)
 {
-	struct server *serv = READ_ONCE(xprt->server);
+	return ms ? DIV_ROUND_UP(ms, XPRT_TIMEO_TICK) + 1 : 0;
+}
 
-	if (skp_unlikely(!serv))
-		return false;
-	if (!test_and_clear_bit(XPRT_ATTACHED_BIT, &xprt->flags))
-		return false;
+static void __xprt_wheel_init(void)
+{
+	int cpu;
 
-	spin_lock(&serv->lock);
-	XPRT_BUG_ON(xprt->server != serv);
-	XPRT_BUG_ON(list_empty(&xprt->node));
-	serv->nr_xprts--;
-	list_del_init(&xprt->node);
-	spin_unlock(&serv->lock);
-	return true;
+	sysevent_init(false);
+
+	big_lock();
+	if (skp_unlikely(xprt_wheel_inited)) {
+		big_unlock();
+		return;
+	}
+
+	for_each_possible_cpu(cpu) {
+		struct xprt_wheel *wheel = &per_cpu(xprt_wheels, cpu);
+		spin_lock_init(&wheel->lock);
+		wheel->nr_xprts = 0;
+		wheel->armed = false;
+		wheel->nr_ticks = 0;
+		wheel->nr_slots = 0;
+		wheel->now = xprt_wheel_clock();
+		uev_timer_init(&wheel->timer, xprt_wheel_timer_cb);
+		uev_timer_setcpu(&wheel->timer, cpu);
+		for (int i = 0; i < XPRT_TIMEO_SLOTS; i++)
+			INIT_LIST_HEAD(&wheel->slots[i]);
+	}
+
+	WRITE_ONCE(xprt_wheel_inited, true);
+	big_unlock();
 }
 
-static inline void barrier_xprt(struct xprt *xprt)
+static inline void xprt_wheel_init(void)
 {
-	struct server *serv = READ_ONCE(xprt->server);
-	if (skp_unlikely(!serv))
+	if (skp_likely(READ_ONCE(xprt_wheel_inited)))
 		return;
-	spin_lock(&serv->lock);
-	spin_unlock(&serv->lock);
+	__xprt_wheel_init();
 }
 
-static void xprt_dict_free(struct xprt* xprt)
+static inline void xprt_timeo_init(struct xprt_timeo *timeo)
 {
-	struct xprt *lstn;
-	struct xprt_tcpclnt *clnt;
-	struct server *serv = READ_ONCE(xprt->server);
+	memset(timeo, 0, sizeof(*timeo));
+	INIT_LIST_HEAD(&timeo->node);
+}
 
-#ifdef XPRT_DEBUG
-	WARN_ON(xprt_event_delete(xprt) > 0);
-#endif
+static inline void xprt_timeo_nearest(uint32_t *next, uint32_t v, uint32_t now)
+{
+	/*防止回绕*/
+	if ((int32_t)(v - *next) < 0)
+		*next = v;
+}
 
-	/*关闭描述符，在此之前一定要删除事件*/
-	if (skp_likely(xprt_fd(xprt) > -1)) {
-		bool wuwk = false;
-		if ((xprt->flags & XPRT_OPT_TCPLARGELINGER) && xprt_is_tcpclnt(xprt)) {
-			set_fd_block(xprt_fd(xprt));
-			sockopt_set_linger(xprt_fd(xprt), true, 4096);
-			wuwk = true;
-			XPRT_WARN_ON(current_ev_worker());
-			wq_worker_sleeping();
+/*
+ * 检查超时，返回到期的超时事件，0 表示没有到期
+ * next 返回最近的一个未到期的滴答，
+ * 未开启读写事件时读写超时不生效，但需要在一个超时周期后再次检查
+ */
+static unsigned long xprt_timeo_check(struct xprt *xprt, uint32_t now,
+		uint32_t *next)
+{
+	unsigned long status = 0;
+	struct xprt_timeo *timeo = &xprt->timeo;
+	uint16_t mask = uev_stream_mask(xprt_ev(xprt));
+	uint32_t rd_stamp = READ_ONCE(timeo->rd_stamp);
+	uint32_t wr_stamp = READ_ONCE(timeo->wr_stamp);
+	uint32_t deadline;
+
+	*next = now + XPRT_TIMEO_MASK;
+
+	if (timeo->rdtmo) {
+		deadline = (mask & EVENT_READ) ? rd_stamp + timeo->rdtmo :
+			now + timeo->rdtmo;
+		if ((int32_t)(deadline - now) <= 0) {
+			status |= XPRT_TIMEDOUT | EVENT_READ;
+		} else {
+			xprt_timeo_nearest(next, deadline, now);
 		}
-		close(xprt_fd(xprt));
-		if (wuwk)
-			wq_worker_waking_up();
 	}
 
-	/*没有按照正确的流程 销毁 xprt*/
-#ifdef XPRT_DEBUG
-	WARN_ON(detach_xprt(xprt));
-#endif
-
-	/*释放对创建xprt的引用*/
-	if (xprt_type(xprt) != XPRT_TCPTEMP)
-		goto out;
-
-	/*@see xprt_move()*/
-	clnt = xprt_to_tcpclnt(xprt);
-	if (!clnt->lstn_xprt)
-		goto out;
-
-	lstn = xchg_ptr(&clnt->lstn_xprt, NULL);
-	XPRT_BUG_ON(!lstn);
+	if (timeo->wrtmo) {
+		deadline = (mask & EVENT_WRITE) ? wr_stamp + timeo->wrtmo :
+			now + timeo->wrtmo;
+		if ((int32_t)(deadline - now) <= 0) {
+			status |= XPRT_TIMEDOUT | EVENT_WRITE;
+		} else {
+			xprt_timeo_nearest(next, deadline, now);
+		}
+	}
 
-	if (xprt_to_tcpserv(lstn)->cool_down) {
-		/*必须加锁，与 destroy_xprt() 有竞争*/
-		spin_lock(&serv->lock);
-		/*enable read event*/
-		if (skp_likely(!xprt_flags_closed(lstn->flags) &&
-				!xprt_flags_detached(lstn->flags) &&
-				xprt_to_tcpserv(lstn)->cool_down))
-		{
-			uint8_t mask = xprt_ev(lstn)->mask;
-			/*如果失败也不关心，说明用户管理这个xprt的读写*/
-			xprt_to_tcpserv(lstn)->cool_down = false;
-			int rc = uev_stream_add(xprt_ev(lstn), mask|EVENT_READ);
-			if (skp_unlikely(rc<0))
-				LOG_XPRT_CHANGED_EVENT(lstn, EVENT_READ, ADD);
+	/*读写超时优先于空闲超时*/
+	if (timeo->idle && !status) {
+		deadline = (int32_t)(rd_stamp - wr_stamp) > 0 ? rd_stamp : wr_stamp;
+		deadline += timeo->idle;
+		if ((int32_t)(deadline - now) <= 0) {
+			status |= XPRT_TIMEDOUT;
+		} else {
+			xprt_timeo_nearest(next, deadline, now);
 		}
-		spin_unlock(&serv->lock);
 	}
 
-	xprt_put(lstn);
+	return status;
+}
 
-out:
-	XPRT_WARN_ON(uref_read(&xprt->refs));
-	XPRT_WARN_ON(xprt->flags & XPRT_ATTACHED);
-	XPRT_WARN_ON(xprt->flags & XPRT_SHUT_RDWR);
-	XPRT_WARN_ON(!(xprt->flags & XPRT_CLOSED));
-	XPRT_WARN_ON(xprt->flags & XPRT_CONNECTING);
+/*放置到时间轮中，返回 true 表示需要启动定时器*/
+static bool xprt_wheel_link_locked(struct xprt_wheel *wheel,
+		struct xprt_timeo *timeo, uint32_t expires)
+{
+	bool arm = false;
+	int32_t delta = (int32_t)(expires - wheel->now);
+
+	if (delta < 1)
+		delta = 1;
+	if (delta > XPRT_TIMEO_MASK)
+		delta = XPRT_TIMEO_MASK;
+
+	if (list_empty(&timeo->node))
+		wheel->nr_xprts++;
+	timeo->expires = wheel->now + delta;
+	list_move_tail(&timeo->node, &wheel->slots[timeo->expires&XPRT_TIMEO_MASK]);
+
+	if (!wheel->armed) {
+		wheel->armed = true;
+		arm = true;
+	}
+	return arm;
+}
 
-	/*释放内存*/
-	xprt->xprt_ops->destructor(xprt);
+static inline void xprt_wheel_unlink_locked(struct xprt_wheel *wheel,
+		struct xprt_timeo *timeo)
+{
+	if (list_empty(&timeo->node))
+		return;
+	XPRT_BUG_ON(!wheel->nr_xprts);
+	wheel->nr_xprts--;
+	list_del_init(&timeo->node);
+}
 
-	/*xprt 的内存释放时，可能还使用 serv 所以不能提前解除引用*/
-	if (skp_likely(serv))
-		server_put(serv);
+static inline void xprt_wheel_arm(struct xprt_wheel *wheel)
+{
+	int rc = uev_timer_modify(&wheel->timer, XPRT_TIMEO_TICK);
+	WARN_ON(rc < 0);
 }
 
-static void xprt_rcu_free(void *ptr)
+/*重新计算最近的到期滴答并放置*/
+static bool xprt_timeo_relink_locked(struct xprt_wheel *wheel, struct xprt *xprt)
 {
-	struct xprt *xprt = ptr;
-	if (WARN_ON(!xprt))
-		return;
-	xprt_dict_free(xprt);
+	uint32_t next;
+	unsigned long status = xprt_timeo_check(xprt, wheel->now, &next);
+	return xprt_wheel_link_locked(wheel, &xprt->timeo,
+		status ? wheel->now + 1 : next);
 }
 
-/*仅关闭状态*/
-static bool shutdown_xprt_stats(struct xprt *xprt, int how)
+/*销毁或关闭超时管理时，从时间轮中移除*/
+static void xprt_timeo_detach(struct xprt *xprt)
 {
-	bool rc;
-	uint8_t ev = 0;
-	unsigned long nflags, flags, mask = 0;
+	struct xprt_wheel *wheel = READ_ONCE(xprt->timeo.wheel);
+	if (skp_likely(!wheel))
+		return;
+	spin_lock(&wheel->lock);
+	xprt_wheel_unlink_locked(wheel, &xprt->timeo);
+	WRITE_ONCE(xprt->timeo.wheel, NULL);
+	spin_unlock(&wheel->lock);
+}
 
-	/*计算需要关闭的事件和置位的状态*/
-	/*0->1, 1->2, 2->3*/
-	how++; /*@see inet_shutdown()*/
-	if (how & (SHUT_RD + 1)) {
-		mask |= XPRT_SHUTRD;
-		ev |= EVENT_READ;
+static void xprt_timeo_expired(struct xprt *xprt, unsigned long status)
+{
+	log_debug("xprt [%p] timedout : %lx", xprt, status);
+	if (xprt->xprt_ops->on_timeout) {
+		xprt->xprt_ops->on_timeout(xprt, status);
+		xprt_write_flush(xprt);
+	} else {
+		shutdown_xprt(xprt, SHUT_RDWR);
 	}
-	if (how & (SHUT_WR + 1)) {
-		mask |= XPRT_SHUTWR;
-		ev |= EVENT_WRITE;
+}
+
+static void xprt_wheel_timer_cb(struct uev_timer *timer)
+{
+	LIST__HEAD(expired);
+	bool rearm;
+	uint32_t lapsed, next, now = xprt_wheel_clock();
+	struct xprt *xprt;
+	struct xprt_timeo *timeo, *n;
+	struct xprt_wheel *wheel = container_of(timer, struct xprt_wheel, timer);
+
+	spin_lock(&wheel->lock);
+	/*定时器可能延迟，遍历所有流失的滴答对应的槽位，最多一圈*/
+	lapsed = (int32_t)(now - wheel->now) > 0 ?
+		min(now - wheel->now, (uint32_t)XPRT_TIMEO_SLOTS) : 0;
+	wheel->nr_ticks++;
+	for (uint32_t i = 0; i < lapsed; i++) {
+		struct list_head *slot;
+		/*每一步前进一个滴答*/
+		wheel->now++;
+		wheel->nr_slots++;
+		slot = &wheel->slots[wheel->now & XPRT_TIMEO_MASK];
+		list_for_each_entry_safe(timeo, n, slot, node) {
+			unsigned long status;
+			if ((int32_t)(timeo->expires - now) > 0)
+				continue;
+			xprt = container_of(timeo, struct xprt, timeo);
+			/*已关闭，不再管理*/
+			if (xprt_has_closed(xprt)) {
+				xprt_wheel_unlink_locked(wheel, timeo);
+				continue;
+			}
+			status = xprt_timeo_check(xprt, now, &next);
+			if (!status) {
+				/*活动过，仅仅需要重新放置*/
+				timeo->expires = next;
+				list_move_tail(&timeo->node,
+					&wheel->slots[next & XPRT_TIMEO_MASK]);
+				continue;
+			}
+			/*到期的超时重新计时*/
+			if (status & EVENT_READ || !(status & EVENT_WRITE))
+				WRITE_ONCE(timeo->rd_stamp, now);
+			if (status & EVENT_WRITE || !(status & EVENT_READ))
+				WRITE_ONCE(timeo->wr_stamp, now);
+			/*借用 expires 存储到期的事件*/
+			timeo->expires = (uint32_t)status;
+			list_move_tail(&timeo->node, &expired);
+		}
 	}
+	/*流失超过一圈时，剩余的滴答已在上面的一圈中处理*/
+	wheel->now = now;
+
+	rearm = !!wheel->nr_xprts;
+	if (!rearm)
+		wheel->armed = false;
+	spin_unlock(&wheel->lock);
 
+	if (rearm)
+		xprt_wheel_arm(wheel);
+
+	/*
+	 * 在锁外回调，每次从私有链表上摘下一个，因为其他路径可能修改超时，
+	 * 销毁路径会在锁内将其从私有链表上移除，所以在锁内获取引用是安全的
+	 */
 	do {
-		flags = READ_ONCE(xprt->flags);
-		/*已经关闭或已经设置了*/
-		if (skp_unlikely((flags & XPRT_CLOSED)) ||
-				((flags & mask) == mask) ||
-				((mask != XPRT_SHUT_RDWR) && (mask & flags)))
+		unsigned long status = 0;
+
+		spin_lock(&wheel->lock);
+		timeo = list_first_entry_or_null(&expired, struct xprt_timeo, node);
+		if (!timeo) {
+			spin_unlock(&wheel->lock);
 			break;
-		/* 关闭掉正在连接标志 */
-		nflags = flags | mask;
-		if (mask == XPRT_SHUT_RDWR)
-			nflags &= ~ XPRT_CONNECTING;
-		rc = cmpxchg(&xprt->flags, flags, nflags);
-		if (skp_unlikely(!rc)) {
-			LOG_XPRT_CHANGED_BIT(xprt, mask);
-			continue;
 		}
+		xprt = container_of(timeo, struct xprt, timeo);
+		xprt_wheel_unlink_locked(wheel, timeo);
+		if (uref_get_unless_zero(&xprt->refs))
+			status = timeo->expires;
+		spin_unlock(&wheel->lock);
+
+		/*正在销毁*/
+		if (!status)
+			continue;
 
-		/*
-		 * 如果是在事件线程内调用，则还需要关闭相应的事件
-		 * 因为内部回调函数可以处理相应的收尾工作
-		 * 不需要保留事件来传递关闭
-		 */
-		if (current_ev_stream() == xprt_ev(xprt)) {
-			int rc = uev_stream_disable(&xprt->event, ev);
-			if (skp_unlikely(rc<0))
-				LOG_XPRT_CHANGED_EVENT(xprt, ev, disable);
-		}
+		xprt_timeo_expired(xprt, status);
 
-		xprt_ops_call(xprt, on_shutdown, how - 1);
+		/*没有关闭，继续管理*/
+		rearm = false;
+		spin_lock(&wheel->lock);
+		if (!xprt_has_closed(xprt) && READ_ONCE(timeo->wheel) == wheel &&
+				list_empty(&timeo->node))
+			rearm = xprt_timeo_relink_locked(wheel, xprt);
+		spin_unlock(&wheel->lock);
 
-		return true;
-	} while (1);
+		if (rearm)
+			xprt_wheel_arm(wheel);
 
-	return false;
+		xprt_put(xprt);
+	} while (1);
 }
 
-static __always_inline void eat_xprt_open(struct xprt *xprt, uint16_t mask)
+void xprt_timeo_stat(struct xprt_timeo_stat *stat)
 {
-	bool rc;
-	unsigned long flags;
-	do {
-		flags = READ_ONCE(xprt->flags);
-		/*第一次变为可读/可写 ： 没有设置 opened ，且还没有被关闭*/
-		if (skp_likely(flags & XPRT_OPENED))
-			return;
-		if (skp_unlikely(xprt_flags_closed(flags)))
-			return;
+	int cpu;
 
-		rc = cmpxchg(&xprt->flags, flags, flags | XPRT_OPENED);
-		if (skp_likely(rc)) {
-			/*invoke opened*/
-			xprt_ops_call(xprt, on_changed, XPRT_OPENED | mask);
-			return;
-		}
-		LOG_XPRT_CHANGED_BIT(xprt, XPRT_OPENED);
-	} while (1);
+	memset(stat, 0, sizeof(*stat));
+	if (!READ_ONCE(xprt_wheel_inited))
+		return;
+
+	for_each_possible_cpu(cpu) {
+		struct xprt_wheel *wheel = &per_cpu(xprt_wheels, cpu);
+		spin_lock(&wheel->lock);
+		stat->nr_ticks += wheel->nr_ticks;
+		stat->nr_slots += wheel->nr_slots;
+		spin_unlock(&wheel->lock);
+	}
 }
 
-/*返回非0值，关闭成功，需要销毁*/
-static __always_inline int eat_xprt_close(struct xprt *xprt, uint16_t mask)
+void __xprt_timeo_touch(struct xprt *xprt, uint16_t mask)
 {
-	int rc;
-	unsigned long rflags, flags;
-	do {
-		flags = READ_ONCE(xprt->flags);
-		/*已关闭*/
-		if (skp_unlikely(flags & XPRT_CLOSED))
-			return -ECONNABORTED;
-		/*半关闭*/
-		if (skp_likely((flags & XPRT_SHUT_RDWR) != XPRT_SHUT_RDWR))
-			break;
+	uint32_t now;
+	struct xprt_wheel *wheel = READ_ONCE(xprt->timeo.wheel);
+	if (skp_unlikely(!wheel))
+		return;
+	now = READ_ONCE(wheel->now);
+	if (mask & (EVENT_READ | EVENT_EOF | EVENT_ERROR))
+		WRITE_ONCE(xprt->timeo.rd_stamp, now);
+	if (mask & EVENT_WRITE)
+		WRITE_ONCE(xprt->timeo.wr_stamp, now);
+}
 
-		/*完全关闭*/
-		rflags = cmpxchg_val(&xprt->flags, flags,
-			(flags & ~(XPRT_SHUT_RDWR)) | XPRT_CLOSED);
+int xprt_set_timeouts(struct xprt *xprt, uint32_t idle_ms, uint32_t rd_ms,
+		uint32_t wr_ms)
+{
+	int cpu;
+	bool arm = false;
+	struct xprt_wheel *wheel;
+	struct xprt_timeo *timeo;
 
-		if (skp_unlikely(rflags != flags)) {
-			LOG_XPRT_CHANGED_BIT(xprt, XPRT_CLOSED);
-			continue;
-		}
+	if (WARN_ON(!xprt))
+		return -EINVAL;
 
-		/*必须触发过打开过才能触发关闭*/
-		if (skp_likely(rflags & (XPRT_OPENED | XPRT_CONNREFUSED))) {
-			/*invoke closed*/
-			xprt_ops_call(xprt, on_changed, (rflags & XPRT_OPENED?
-					XPRT_CLOSED:XPRT_CONNREFUSED) | mask);
-			/*异步/同步删除*/
-			rc = xprt_event_delete(xprt);
-			if (skp_unlikely(rc<0))
-				LOG_XPRT_CHANGED_EVENT(xprt, mask, delete);
-		}
+	timeo = &xprt->timeo;
+	if (!idle_ms && !rd_ms && !wr_ms) {
+		xprt_timeo_detach(xprt);
+		return 0;
+	}
+
+	if (xprt_has_closed(xprt))
 		return -ECONNABORTED;
-	} while (1);
+
+	xprt_wheel_init();
+
+	/*时间轮必须与传输对象在同一个事件线程上*/
+	cpu = uev_stream_setcpu(xprt_ev(xprt), -1);
+	if (skp_unlikely(cpu < 0))
+		return cpu;
+
+	wheel = &per_cpu(xprt_wheels, cpu);
+	if (WARN_ON(timeo->wheel && timeo->wheel != wheel))
+		return -EINVAL;
+
+	spin_lock(&wheel->lock);
+	/*时间轮没有运转，校准时间*/
+	if (!wheel->armed)
+		wheel->now = xprt_wheel_clock();
+	if (!timeo->wheel) {
+		timeo->rd_stamp = wheel->now;
+		timeo->wr_stamp = wheel->now;
+	}
+	timeo->idle = xprt_timeo_ticks(idle_ms);
+	timeo->rdtmo = xprt_timeo_ticks(rd_ms);
+	timeo->wrtmo = xprt_timeo_ticks(wr_ms);
+	WRITE_ONCE(timeo->wheel, wheel);
+	arm = xprt_timeo_relink_locked(wheel, xprt);
+	spin_unlock(&wheel->lock);
+
+	if (arm)
+		xprt_wheel_arm(wheel);
 
 	return 0;
 }
 
-static __always_inline void eat_xprt_rdready(struct xprt *xprt, uint16_t mask)
+/*移动语义，替身继承超时管理*/
+static void xprt_timeo_move(struct xprt *alias, struct xprt *src)
 {
-	/*除了写事件，其他任何事件都需要通知读回调，因为缓存区内可能还有数据待处理*/
-	if (!(mask & (EVENT_READ | EVENT_EOF | EVENT_ERROR)) || /*读端被关闭了*/
-			skp_unlikely(xprt_status(xprt) & (XPRT_CLOSED|XPRT_SHUTRD)))
+	bool arm = false;
+	struct xprt_wheel *wheel = READ_ONCE(src->timeo.wheel);
+
+	if (!wheel)
 		return;
 
-	/*invoke recv*/
-	xprt_ops_call(xprt, on_recv, XPRT_RDREADY | mask);
+	spin_lock(&wheel->lock);
+	xprt_wheel_unlink_locked(wheel, &src->timeo);
+	WRITE_ONCE(src->timeo.wheel, NULL);
+	alias->timeo.idle = src->timeo.idle;
+	alias->timeo.rdtmo = src->timeo.rdtmo;
+	alias->timeo.wrtmo = src->timeo.wrtmo;
+	alias->timeo.rd_stamp = src->timeo.rd_stamp;
+	alias->timeo.wr_stamp = src->timeo.wr_stamp;
+	WRITE_ONCE(alias->timeo.wheel, wheel);
+	arm = xprt_timeo_relink_locked(wheel, alias);
+	spin_unlock(&wheel->lock);
+
+	if (arm)
+		xprt_wheel_arm(wheel);
 }
 
-static __always_inline void eat_xprt_wrready(struct xprt *xprt, uint16_t mask)
-{
-	/*尽可写才通知写回调*/
-	if (!(mask & (EVENT_WRITE | EVENT_ERROR)) || /*写端被关闭了*/
-			skp_unlikely(xprt_status(xprt) & (XPRT_CLOSED|XPRT_SHUTWR)))
-		return;
-	/*invoke send*/
-	xprt_ops_call(xprt, on_send, XPRT_WRREADY | mask);
+////////////////////////////////////////////////////////////////////////////////
+// 限速与公平调度
+// 接收方向为懒惰补充的令牌桶，发送方向为按轮次的加权公平分配（DRR），
+// 每个事件槽位一个补充滴答，仅在有被暂停的传输对象时运转
+// DRR 的轮次也按槽位维护，只在同一事件循环上的传输对象之间公平，
+// 不跨槽位汇总同一服务器的连接 @see xprt_set_weight()
+////////////////////////////////////////////////////////////////////////////////
+
+/*补充滴答，毫秒*/
+#ifndef CONFIG_XPRT_RATE_TICK
+# define CONFIG_XPRT_RATE_TICK (20)
+#endif
 
-	/*shutdown read&write when socket got EVENT_ERROR*/
-	if (skp_unlikely(mask & EVENT_ERROR))
-		shutdown_xprt(xprt, SHUT_RDWR);
-}
+/*令牌桶的容量，以多少毫秒的速率计*/
+#ifndef CONFIG_XPRT_RATE_BURST
+# define CONFIG_XPRT_RATE_BURST (100)
+#endif
 
-/*发起内部关闭*/
-static __always_inline int intl_xprt_shutdown(struct xprt *xprt, uint16_t mask)
+struct xprt_shaper {
+	spinlock_t lock;
+	bool armed; /**< 定时器已启动或正在回调*/
+	uint32_t round; /**< 当前的轮次*/
+	uint32_t nr_active; /**< 本轮发送过的传输对象数量*/
+	uint32_t nr_spent; /**< 本轮已经用完份额的传输对象数量*/
+	struct list_head paused;
+	struct uev_timer timer;
+} __cacheline_aligned;
+
+struct xprt_rate {
+	struct list_head node; /**< 暂停时在槽位的链表上*/
+	struct xprt *xprt;
+	struct xprt_shaper *shaper;
+	uint64_t stamp; /**< 最后补充令牌的毫秒时间戳*/
+	int64_t rx_bytes;
+	int64_t rx_msgs;
+	uint32_t bytes_rem; /**< 不足一个令牌的余量，单位为 令牌 * 毫秒*/
+	uint32_t msgs_rem;
+	uint32_t bytes_ps;
+	uint32_t msgs_ps;
+	int64_t deficit; /**< 本轮剩余的发送份额*/
+	uint32_t round;
+	uint16_t weight;
+	uint8_t paused; /**< 被暂停，需要恢复的事件*/
+	uint8_t resume; /**< 即将被恢复的事件*/
+};
+
+static bool xprt_shaper_inited = false;
+static DEFINE_PER_CPU_AIGNED(struct xprt_shaper, xprt_shapers);
+
+static void xprt_shaper_timer_cb(struct uev_timer *);
+
+static inline uint64_t xprt_clock(void)
 {
-	set_bit(XPRT_CONNREFUSED_BIT, &xprt->flags);
-	shutdown_xprt(xprt, SHUT_RDWR);
-	return eat_xprt_close(xprt, EVENT_ERROR);
+	return uev_timer_future(0) / 1000000;
 }
 
-/*
- * @return 0 success, -EAGAIN in connecting , other error
- */
-static int __eat_xprt_connecting(struct xprt *xprt, uint16_t mask)
+static void __xprt_shaper_init(void)
 {
-	int rc = 0;
-	struct sock_address sockaddr;
-	struct xprt_tcpclnt *tcpclnt = xprt_to_tcpclnt(xprt);
+	int cpu;
 
-	if (skp_unlikely(xprt_flags_closed(READ_ONCE(xprt->flags)))) {
-		log_warn("nonblock connecting has been shutdown : %p/%lu",
-			 xprt, xprt_status(xprt));
-		return -ECONNABORTED;
-	}
-
-	XPRT_WARN_ON(!(xprt_opt(xprt) & XPRT_OPT_NONBLOCK));
-
-	if (skp_unlikely(mask & EVENT_ERROR)) {
-		rc = errno = sockopt_get_sockerr(xprt_fd(xprt));
-		goto fail;
-	}
+	sysevent_init(false);
 
-	inet_address2sock(&tcpclnt->remote, &sockaddr);
-	/*try to do connecting again*/
-	rc = connect(xprt_fd(xprt), &sockaddr.sock_addr, sockaddr.length);
-	/*还处于连接状态？ EALREADY*/
-	if (skp_likely(rc)) {
-		rc = errno;
-		if (skp_unlikely(rc==EALREADY))
-			return -EAGAIN;
-		if (skp_unlikely(rc!=EISCONN))
-			goto fail;
+	big_lock();
+	if (skp_unlikely(xprt_shaper_inited)) {
+		big_unlock();
+		return;
 	}
-#ifdef XPRT_DEBUG
-	{
-		struct sock_address saddr;
-		char paddr[INET_ADDRESS_STRLEN];
-		size_t l = inet_address2sock(&tcpclnt->local, &saddr);
-		if (skp_likely(l) && skp_likely(!sockaddr_ntop(&saddr, paddr, sizeof(paddr)))) {
-			log_info("active socket established : sfd [%d] -- local [%s:%u]",
-				xprt_fd(xprt), paddr, inet_address_port(&tcpclnt->local));
-		}
 
-		l = inet_address2sock(&tcpclnt->remote, &saddr);
-		if (skp_likely(l) && skp_likely(!sockaddr_ntop(&saddr, paddr, sizeof(paddr)))) {
-			log_info("active socket established : sfd [%d] -- remote [%s:%u]",
-				xprt_fd(xprt), paddr, inet_address_port(&tcpclnt->remote));
-		}
+	for_each_possible_cpu(cpu) {
+		struct xprt_shaper *shaper = &per_cpu(xprt_shapers, cpu);
+		spin_lock_init(&shaper->lock);
+		shaper->armed = false;
+		shaper->round = 0;
+		shaper->nr_active = 0;
+		shaper->nr_spent = 0;
+		INIT_LIST_HEAD(&shaper->paused);
+		uev_timer_init(&shaper->timer, xprt_shaper_timer_cb);
+		uev_timer_setcpu(&shaper->timer, cpu);
 	}
-#endif
 
-	/*非阻塞连接成功，调用可写回调*/
-	return 0;
-fail:
-	log_warn("nonblocking connection failed : sfd [%d] : %s", xprt_fd(xprt),
-		strerror_local());
-	return intl_xprt_shutdown(xprt, EVENT_ERROR);
+	WRITE_ONCE(xprt_shaper_inited, true);
+	big_unlock();
 }
 
-static __always_inline int eat_xprt_connecting(struct xprt *xprt, uint16_t mask)
+static inline void xprt_shaper_init(void)
 {
-	/*使用非 lock 指令预判断 减少cache sync*/
-	if (!test_bit(XPRT_CONNECTING_BIT, &xprt->flags))
-		return 0;
-
-	/*查明阻塞连接或已连接*/
-	if (!test_and_clear_bit(XPRT_CONNECTING_BIT, &xprt->flags))
-		return 0;
+	if (skp_likely(READ_ONCE(xprt_shaper_inited)))
+		return;
+	__xprt_shaper_init();
+}
 
-	if (skp_unlikely(xprt_type(xprt) != XPRT_TCPCLNT)) {
-		log_warn("nonblock connection is not suspported : %p/%lu",
-			 xprt, xprt_type(xprt));
-		return 0;
-	}
+static inline int64_t xprt_rate_burst(uint32_t ps)
+{
+	uint64_t burst = (uint64_t)ps * CONFIG_XPRT_RATE_BURST / 1000;
+	return burst ? (int64_t)burst : 1;
+}
 
-	return __eat_xprt_connecting(xprt, mask);
+/*按流逝的时间计算补充的令牌，不足一个令牌的余量累积到下一次*/
+static inline int64_t xprt_rate_tokens(uint32_t ps, uint64_t elapse,
+		uint32_t *rem)
+{
+	uint64_t units = elapse * ps + *rem;
+	*rem = (uint32_t)(units % 1000);
+	return (int64_t)(units / 1000);
 }
 
-/*握手*/
-static __always_inline int __do_xprt_handshake(struct xprt *xprt, uint16_t mask)
+/*每个桶各自保存余量，时间戳总是前移，同一段时间不会被重复计入*/
+static void xprt_rate_refill_locked(struct xprt_rate *rate, uint64_t now)
 {
-	if (skp_unlikely(xprt_flags_closed(READ_ONCE(xprt->flags)))) {
-		log_warn("connection has been shutdown : %p/%lu",
-			 xprt, xprt_status(xprt));
-		return -ECONNABORTED;
+	int64_t burst;
+	uint64_t elapse = now - rate->stamp;
+
+	if ((int64_t)elapse <= 0)
+		return;
+	rate->stamp = now;
+
+	if (rate->bytes_ps) {
+		burst = xprt_rate_burst(rate->bytes_ps);
+		rate->rx_bytes += xprt_rate_tokens(rate->bytes_ps, elapse,
+			&rate->bytes_rem);
+		/*满桶时丢弃余量*/
+		if (rate->rx_bytes >= burst) {
+			rate->rx_bytes = burst;
+			rate->bytes_rem = 0;
+		}
+	}
+	if (rate->msgs_ps) {
+		burst = xprt_rate_burst(rate->msgs_ps);
+		rate->rx_msgs += xprt_rate_tokens(rate->msgs_ps, elapse,
+			&rate->msgs_rem);
+		if (rate->rx_msgs >= burst) {
+			rate->rx_msgs = burst;
+			rate->msgs_rem = 0;
+		}
 	}
-	xprt_ops_call_ret(xprt, do_handshake, mask);
 }
 
-static __always_inline int do_xprt_handshake(struct xprt *xprt, uint16_t mask)
+static inline bool xprt_rate_rxok_locked(const struct xprt_rate *rate)
 {
-	if (test_bit(XPRT_HANDSHAKED_BIT, &xprt->flags))
-		return 0;
-	int rc = __do_xprt_handshake(xprt, mask);
-	if (skp_likely(!rc)) {
-		set_bit(XPRT_HANDSHAKED_BIT, &xprt->flags);
-		return 0;
-	} if (skp_likely(rc==-EAGAIN))
-		return rc;
+	return (!rate->bytes_ps || rate->rx_bytes > 0) &&
+		(!rate->msgs_ps || rate->rx_msgs > 0);
+}
 
-	/*
-	 * 握手失败与连接都属于内部流程，如果失败则删除事件
-	 * @see eat_xprt_close() 中的 on_change() 回调
-	 */
-	log_warn("xprt handshake failed : sfd [%d] : %s", xprt_fd(xprt),
-		__strerror_local(-rc));
-	return intl_xprt_shutdown(xprt, EVENT_ERROR);
+/*加入本轮，重新计算发送份额，超发的部分从新的份额中扣除*/
+static inline void xprt_rate_join_locked(struct xprt_shaper *shaper,
+		struct xprt_rate *rate)
+{
+	if (rate->round == shaper->round)
+		return;
+	rate->round = shaper->round;
+	rate->deficit = min(rate->deficit, (int64_t)0) +
+		(int64_t)rate->weight * CONFIG_XPRT_DRR_QUANTUM;
+	shaper->nr_active++;
 }
 
-static void process_xprt_event(struct uev_stream *ptr, uint16_t mask)
+/*暂停事件，返回 true 表示需要启动定时器*/
+static bool xprt_rate_pause_locked(struct xprt_shaper *shaper,
+		struct xprt_rate *rate, uint8_t mask)
 {
-	int rc = 0;
-	struct xprt *xprt = container_of(ptr, struct xprt, event);
+	rate->paused |= mask;
+	rate->resume &= ~mask;
+	if (list_empty(&rate->node))
+		list_add_tail(&rate->node, &shaper->paused);
+	if (shaper->armed)
+		return false;
+	shaper->armed = true;
+	return true;
+}
 
-#ifdef XPRT_DEBUG
-	xprt = xprt_get(xprt);
-	if (WARN_ON(!xprt))
+static inline void xprt_rate_unpause_locked(struct xprt_rate *rate,
+		uint8_t mask, struct list_head *resume)
+{
+	mask &= rate->paused;
+	if (!mask)
 		return;
-#endif
-	/*
-	 * eat_xprt_connecting()/do_xprt_handshake() 如果没有成功都发起内部关闭
-	 * 如果成功关闭则返回0，后续的流程都不运行，如果与 shutdown_xprt()/destroy_xprt()
-	 * 发送竞争则会关闭失败，返回非 -EAGAIN 负值
-	 * 即如果外部已经关闭套接字，则可以结束内部流程的运转，转 shut 标签处剥离 xprt
-	 */
-	/*消费各类事件*/
-	rc = eat_xprt_connecting(xprt, mask);
-	if (WARN_ON(rc == -EAGAIN))
-		goto out;
-	if (skp_unlikely(rc))
-		goto shut;
+	rate->paused &= ~mask;
+	rate->resume |= mask;
+	list_move_tail(&rate->node, resume);
+}
 
-	/*握手 @see xprt_ssl_handshake()*/
-	rc = do_xprt_handshake(xprt, mask);
-	if (rc == -EAGAIN)
-		goto out;
-	if (skp_unlikely(rc))
-		goto shut;
+/*
+ * 开始新的一轮，恢复所有暂停了写事件的传输对象，
+ * 它们仍有数据待发送，直接加入新的一轮，否则先获得写事件的一方会独占新的轮次
+ */
+static void xprt_shaper_round_locked(struct xprt_shaper *shaper,
+		struct list_head *resume)
+{
+	struct xprt_rate *rate, *n;
 
-	eat_xprt_open(xprt, mask);
-	/*读优先*/
-	eat_xprt_rdready(xprt, mask);
-	eat_xprt_wrready(xprt, mask);
-	rc = eat_xprt_close(xprt, mask);
-	if (skp_likely(!rc))
-		goto out;
-shut:
-	/*TODO:支持重连?*/
-	/*成功关闭*/
-	if (detach_xprt(xprt)) {
-		/*TODO:此路径是否需要延迟释放*/
-#ifdef XPRT_DEBUG
-		XPRT_BUG_ON(uref_read(&xprt->refs) < 2);
-		XPRT_BUG_ON(__uref_put(&xprt->refs));
-#else
-		XPRT_BUG_ON(uref_read(&xprt->refs) < 1);
-		xprt_put(xprt);
-#endif
+	shaper->round++;
+	shaper->nr_active = 0;
+	shaper->nr_spent = 0;
+	list_for_each_entry_safe(rate, n, &shaper->paused, node) {
+		if (!(rate->paused & EVENT_WRITE))
+			continue;
+		xprt_rate_join_locked(shaper, rate);
+		xprt_rate_unpause_locked(rate, EVENT_WRITE, resume);
 	}
-out:
-#ifdef XPRT_DEBUG
-	xprt_put(xprt);
-#endif
-	return;
 }
 
-static void xprt_tcp_setopt(int sfd, void *user)
+static inline void xprt_shaper_arm(struct xprt_shaper *shaper, uint32_t expires)
 {
-	unsigned long opt = *(unsigned long*)user;
-	if (skp_likely(opt & XPRT_OPT_NONBLOCK))
-		XPRT_BUG_ON(set_fd_nonblock(sfd));
-	if (opt & XPRT_OPT_TCPKEEPALIVE)
-		sockopt_enable_keepalive(sfd, 1, 30, 12);
-	if (opt & XPRT_OPT_TCPNAGLEOFF)
-		sockopt_enable_nodelay(sfd);
-	if (opt & XPRT_OPT_TCPLINGEROFF)
-		sockopt_set_linger(sfd, false, 0);
+	int rc = uev_timer_modify(&shaper->timer, expires);
+	WARN_ON(rc < 0);
 }
 
-int create_xprt_tcpserv(struct xprt* xprt, struct server *serv,
-		const struct service_address *addr, unsigned long opt,
-		const struct xprt_operations *lstn_ops,
-		const struct xprt_operations *clnt_ops)
+/*
+ * 在锁外恢复事件，每次从私有链表上摘下一个，
+ * 销毁路径会在锁内将其从私有链表上移除，所以在锁内获取引用是安全的
+ */
+static void xprt_shaper_resume(struct xprt_shaper *shaper,
+		struct list_head *resume)
 {
-	int rc, sfd = 0;
-	struct xprt_tcpserv *lstn = xprt_to_tcpserv(xprt);
-	socklen_t slen = sizeof(lstn->lstn_address);
-
-	if ((opt & XPRT_TYPE_MASK) != XPRT_TCPSERV)
-		return -EINVAL;
+	do {
+		uint8_t mask = 0;
+		struct xprt *xprt;
+		struct xprt_rate *rate;
+
+		spin_lock(&shaper->lock);
+		rate = list_first_entry_or_null(resume, struct xprt_rate, node);
+		if (!rate) {
+			spin_unlock(&shaper->lock);
+			break;
+		}
+		list_del_init(&rate->node);
+		/*恢复前又被暂停了*/
+		if (rate->paused)
+			list_add_tail(&rate->node, &shaper->paused);
+		xprt = rate->xprt;
+		if (uref_get_unless_zero(&xprt->refs))
+			mask = rate->resume;
+		rate->resume = 0;
+		spin_unlock(&shaper->lock);
+
+		if (!mask)
+			continue;
 
-	sfd = tcp_listen(addr, xprt_tcp_setopt, &opt);
-	if (skp_unlikely(sfd < 0))
-		return sfd;
+		xprt_event_enable(xprt, mask);
+		xprt_put(xprt);
+	} while (1);
+}
 
-	/*初始化tcpserv的字段和特定状态*/
-	lstn->cool_down = false;
-	lstn->clnt_xprt_ops = clnt_ops;
-	/*获取本地地址*/
-	rc = getsockname(sfd, &lstn->lstn_address.sock_addr, &slen);
-	if (skp_unlikely(rc)) {
-		rc = -errno;
-		goto fail;
+static void xprt_shaper_timer_cb(struct uev_timer *timer)
+{
+	LIST__HEAD(resume);
+	bool rearm;
+	uint64_t now = xprt_clock();
+	struct xprt_rate *rate, *n;
+	struct xprt_shaper *shaper = container_of(timer, struct xprt_shaper, timer);
+
+	spin_lock(&shaper->lock);
+	/*到达滴答时，即使还有参与者没有用完份额也开始新的一轮*/
+	xprt_shaper_round_locked(shaper, &resume);
+	list_for_each_entry_safe(rate, n, &shaper->paused, node) {
+		if (!(rate->paused & EVENT_READ))
+			continue;
+		xprt_rate_refill_locked(rate, now);
+		if (xprt_rate_rxok_locked(rate))
+			xprt_rate_unpause_locked(rate, EVENT_READ, &resume);
 	}
+	rearm = !list_empty(&shaper->paused);
+	if (!rearm)
+		shaper->armed = false;
+	spin_unlock(&shaper->lock);
 
-#ifdef XPRT_DEBUG
-{
-	struct sock_address saddr;
-	char paddr[INET_ADDRESS_STRLEN];
-	size_t l = inet_address2sock(&lstn->lstn_address, &saddr);
-	if (skp_likely(l) && skp_likely(!sockaddr_ntop(&saddr, paddr, sizeof(paddr)))) {
-		log_debug("create listener socket : %d -- [%s:%u]",
-			sfd, paddr, inet_address_port(&lstn->lstn_address));
-	}
-}
-#endif
-
-	/*安装时就关闭写端，这样写事件永远不会触发*/
-	rc = attach_xprt(&lstn->xprt, sfd, XPRT_SHUTWR | opt, serv, lstn_ops);
-	if (skp_unlikely(rc))
-		goto fail;
+	if (rearm)
+		xprt_shaper_arm(shaper, CONFIG_XPRT_RATE_TICK);
 
-	return 0;
-fail:
-	close(sfd);
-	return rc;
+	xprt_shaper_resume(shaper, &resume);
 }
 
-/*关闭服务*/
-void shutdown_xprt_tcpserv(struct xprt* xprt, int how)
+static struct xprt_rate *xprt_rate_alloc(struct xprt *xprt)
 {
-	/*tcp服务器只需要关闭写/读端？*/
-	struct xprt_tcpserv *txprt = xprt_to_tcpserv(xprt);
-	if (shutdown_xprt_stats(&txprt->xprt, SHUT_RDWR))
-		shutdown(xprt_fd(&txprt->xprt), SHUT_RD);
-}
+	int cpu;
+	struct xprt_shaper *shaper;
+	struct xprt_rate *rate = READ_ONCE(xprt->rate), *old;
 
-static inline void xprt_tcpserv_cooldown(struct xprt *xlstn)
-{
-	struct xprt_tcpserv *lstn = xprt_to_tcpserv(xlstn);
-	if (skp_likely(!lstn->cool_down)) {
-		struct server *serv = READ_ONCE(xlstn->server);
-		if (WARN_ON(!serv))
-			return;;
-		spin_lock(&serv->lock);
-		if (skp_likely(!lstn->cool_down)) {
-			lstn->cool_down = true;
-			int rc = xprt_event_delete(xlstn);
-			if (skp_unlikely(rc < 0))
-				LOG_XPRT_CHANGED_EVENT(xlstn, EVENT_READ, DELETE);
-		}
-		spin_unlock(&serv->lock);
-	}
-}
+	if (skp_likely(rate))
+		return rate;
 
-struct xprt *xprt_tcpserv_accept(struct xprt *xlstn, unsigned long stats)
-{
-	socklen_t slen;
-	int rc, cfd = 0;
-	unsigned long flags;
-	struct xprt *xclnt = NULL;
-	struct xprt_tcpclnt *clnt = NULL;
-	struct xprt_tcpserv *lstn = xprt_to_tcpserv(xlstn);
-	const struct xprt_operations *clntopt = lstn->clnt_xprt_ops;
+	xprt_shaper_init();
 
-	/*accept client*/
-	if (xprt_has_closed(xlstn)) {
-		errno = ENOTCONN;
-		/*shutdown()不会参于实际的动作，主要是为了打印*/
+	/*补充滴答必须与传输对象在同一个事件线程上*/
+	cpu = uev_stream_setcpu(xprt_ev(xprt), -1);
+	if (skp_unlikely(cpu < 0)) {
+		errno = -cpu;
 		return NULL;
 	}
 
-	if (xprt_opt_check(clntopt)) {
-		errno = EINVAL;
+	rate = malloc(sizeof(*rate));
+	if (skp_unlikely(!rate)) {
+		errno = ENOMEM;
 		return NULL;
 	}
 
-	cfd = tcp_accept(xprt_fd(xlstn), NULL);
-	if (skp_unlikely(cfd < 0)) {
-		if (skp_unlikely(cfd == -EMFILE)) {
-			errno = EAGAIN;
-			xprt_tcpserv_cooldown(xlstn);
-		}
-		return NULL;
+	shaper = &per_cpu(xprt_shapers, cpu);
+	memset(rate, 0, sizeof(*rate));
+	INIT_LIST_HEAD(&rate->node);
+	rate->xprt = xprt;
+	rate->shaper = shaper;
+	rate->stamp = xprt_clock();
+	rate->round = READ_ONCE(shaper->round) - 1;
+
+	old = cmpxchg_val_ptr(&xprt->rate, NULL, rate);
+	if (skp_unlikely(old)) {
+		free(rate);
+		return old;
 	}
+	return rate;
+}
 
-	/*准备安装*/
-	flags = xprt_opt(xlstn) | XPRT_TCPTEMP;
-	/*分配内存并初始化用户的子类*/
-	xclnt = clntopt->constructor(xlstn->server, flags, xlstn);
-	if (skp_unlikely(!xclnt))
-		goto alloc_fail;
+/*销毁时，从槽位中移除*/
+static void xprt_rate_detach(struct xprt *xprt)
+{
+	struct xprt_shaper *shaper;
+	struct xprt_rate *rate = xchg_ptr(&xprt->rate, NULL);
 
-	clnt = xprt_to_tcpclnt(xclnt);
-	clnt->lstn_xprt = xprt_get(xlstn);
+	if (skp_likely(!rate))
+		return;
+	shaper = rate->shaper;
+	spin_lock(&shaper->lock);
+	list_del_init(&rate->node);
+	spin_unlock(&shaper->lock);
+	free(rate);
+}
 
-	/*初始化 xprt_tcpclnt 字段*/
-	/*获取本地地址*/
-	slen = sizeof(clnt->local);
-	rc = getsockname(cfd, &clnt->local.sock_addr, &slen);
-	if (skp_unlikely(rc))
-		goto setup_fail;
+/*移动语义，替身继承令牌和份额，但不继承暂停的事件*/
+static void xprt_rate_move(struct xprt *alias, struct xprt *src)
+{
+	struct xprt_shaper *shaper;
+	struct xprt_rate *rate = xchg_ptr(&src->rate, NULL);
 
-	/*获取远程地址*/
-	slen = sizeof(clnt->remote);
-	rc = getpeername(cfd, &clnt->remote.sock_addr, &slen);
-	if (skp_unlikely(rc))
-		goto setup_fail;
+	WRITE_ONCE(alias->rate, rate);
+	if (!rate)
+		return;
+	shaper = rate->shaper;
+	spin_lock(&shaper->lock);
+	list_del_init(&rate->node);
+	rate->paused = 0;
+	rate->resume = 0;
+	rate->xprt = alias;
+	spin_unlock(&shaper->lock);
+}
 
-#ifdef XPRT_DEBUG
+int xprt_set_rate(struct xprt *xprt, uint32_t bytes_ps, uint32_t msgs_ps)
 {
-	struct sock_address saddr;
-	char paddr[INET_ADDRESS_STRLEN];
-	char laddr[INET_ADDRESS_STRLEN];
-	size_t l = inet_address2sock(&lstn->lstn_address, &saddr);
-	if (skp_likely(l) && skp_likely(!sockaddr_ntop(&saddr, laddr, sizeof(laddr)))) {
-		l = inet_address2sock(&clnt->local, &saddr);
-		if (skp_likely(l) && skp_likely(!sockaddr_ntop(&saddr, paddr, sizeof(paddr)))) {
-			log_debug("create passive socket by %s : sfd [%d] -- local [%s:%u]",
-				laddr, cfd, paddr, inet_address_port(&clnt->local));
-		}
+	LIST__HEAD(resume);
+	struct xprt_rate *rate;
+	struct xprt_shaper *shaper;
 
-		l = inet_address2sock(&clnt->remote, &saddr);
-		if (skp_likely(l) && skp_likely(!sockaddr_ntop(&saddr, paddr, sizeof(paddr)))) {
-			log_debug("create passive socket by %s : sfd [%d] -- remote [%s:%u]",
-				laddr, cfd, paddr, inet_address_port(&clnt->remote));
-		}
+	if (WARN_ON(!xprt))
+		return -EINVAL;
+	if (xprt_has_closed(xprt))
+		return -ECONNABORTED;
+
+	rate = xprt_rate_alloc(xprt);
+	if (skp_unlikely(!rate))
+		return -errno;
+
+	shaper = rate->shaper;
+	spin_lock(&shaper->lock);
+	xprt_rate_refill_locked(rate, xprt_clock());
+	/*新的速率从满桶开始*/
+	if (rate->bytes_ps != bytes_ps) {
+		rate->rx_bytes = xprt_rate_burst(bytes_ps);
+		rate->bytes_rem = 0;
 	}
+	if (rate->msgs_ps != msgs_ps) {
+		rate->rx_msgs = xprt_rate_burst(msgs_ps);
+		rate->msgs_rem = 0;
+	}
+	rate->bytes_ps = bytes_ps;
+	rate->msgs_ps = msgs_ps;
+	if (xprt_rate_rxok_locked(rate))
+		xprt_rate_unpause_locked(rate, EVENT_READ, &resume);
+	spin_unlock(&shaper->lock);
+
+	xprt_shaper_resume(shaper, &resume);
+	return 0;
 }
-#endif
 
-	/*linux 没有继承标志？*/
-	xprt_tcp_setopt(cfd, &flags);
+int xprt_set_weight(struct xprt *xprt, uint16_t weight)
+{
+	LIST__HEAD(resume);
+	struct xprt_rate *rate;
+	struct xprt_shaper *shaper;
 
-	/*安装*/
-	rc = attach_xprt(xclnt, cfd, flags, xlstn->server, clntopt);
-	if (skp_unlikely(rc)) {
-		xprt_tcpserv_cooldown(xlstn);
-		goto setup_fail;
-	}
+	if (WARN_ON(!xprt))
+		return -EINVAL;
+	if (xprt_has_closed(xprt))
+		return -ECONNABORTED;
 
-	/*返回此对象，引用计数由上层管理*/
-	return xclnt;
+	rate = xprt_rate_alloc(xprt);
+	if (skp_unlikely(!rate))
+		return -errno;
 
-setup_fail:
-	/*除此路径，其他路径不可能知晓xprtclnt的存在，可以直接销毁*/
-	if (xchg_ptr(&clnt->lstn_xprt, NULL))
-		xprt_put(xlstn);
-	clntopt->destructor(xclnt);
+	shaper = rate->shaper;
+	spin_lock(&shaper->lock);
+	rate->weight = weight;
+	/*在下一次发送时重新加入*/
+	rate->round = shaper->round - 1;
+	rate->deficit = 0;
+	xprt_rate_unpause_locked(rate, EVENT_WRITE, &resume);
+	spin_unlock(&shaper->lock);
 
-alloc_fail:
-	log_warn("construct or setup clnt failed : %s", strerror_local());
-	close(cfd);
-	/*TODO:安装失败都忽略错误*/
-	errno = EAGAIN;
-	return NULL;
+	xprt_shaper_resume(shaper, &resume);
+	return 0;
 }
 
-/*为侦听套接字预实现的操作，仅需直接使用或包裹使用*/
-void xprt_tcpserv_recv(struct xprt *lstn, unsigned long stats)
+uint8_t __xprt_rate_filter(struct xprt *xprt, uint8_t mask, bool enable)
 {
-	int rc;
-	uint32_t nr_accepts = 0;
-	struct xprt *clnt = NULL;
+	struct xprt_shaper *shaper;
+	struct xprt_rate *rate = READ_ONCE(xprt->rate);
 
-	do {
-		if (skp_unlikely(nr_accepts >= CONFIG_MAX_ACCEPTS)) {
-			/*TODO : startup timer and try again when timer was timedout
-			 * 防止独占事件处理线程
-			 * 流控？短时间大量连接判定为攻击？
-			 * 保存上次满连接的时间戳？
-			 */
-			log_warn("!!!TOO MANY TCPXPRT CLIENT HAS "
-					 "BEEN ALREADY, COOL DOWN THIS LISTENER!!!");
-			break;
-		}
-		clnt = xprt_tcpserv_accept(lstn, stats);
-		if (skp_unlikely(!clnt)) {
-			if (skp_unlikely(errno != EAGAIN)) {
-				log_warn("listener xprt [%p] occured error : %s",
-					lstn, strerror_local());
-				shutdown_xprt(lstn, SHUT_RDWR);
-			}
-			break;
-		}
-		/*启动读，失败则立即销毁传输对象*/
-		rc = uev_stream_add(xprt_ev(clnt), EVENT_READ);
-		if (WARN_ON(rc)) {
-			destroy_xprt(clnt);
-			continue;
-		}
-		xprt_put(clnt);
-		nr_accepts++;
-	} while (1);
+	if (skp_unlikely(!rate))
+		return mask;
 
-	return;
+	shaper = rate->shaper;
+	spin_lock(&shaper->lock);
+	if (enable) {
+		mask &= ~rate->paused;
+	} else {
+		/*使用者关闭了事件，不再恢复*/
+		rate->paused &= ~mask;
+		rate->resume &= ~mask;
+		if (!rate->paused && !rate->resume)
+			list_del_init(&rate->node);
+	}
+	spin_unlock(&shaper->lock);
+	return mask;
 }
 
-void xprt_tcpserv_send(struct xprt *xprt, unsigned long stats)
+/*在锁外暂停事件*/
+static inline void xprt_rate_pause(struct xprt *xprt, struct xprt_shaper *shaper,
+		uint8_t mask, bool arm)
 {
-	log_warn("impossible! it nerver invoke this function");
+	uev_stream_disable(xprt_ev(xprt), mask);
+	if (arm)
+		xprt_shaper_arm(shaper, CONFIG_XPRT_RATE_TICK);
 }
 
-void xprt_tcpserv_changed(struct xprt *xprt, unsigned long stats)
+void __xprt_rate_charge(struct xprt *xprt, uint32_t msgs)
 {
-	log_debug("xprt tcpserv's status has been changed : %p -> %lx",
-			  xprt, stats & XPRT_STATS_MASK);
-	return;
-}
+	bool arm = false, pause = false;
+	struct xprt_shaper *shaper;
+	struct xprt_rate *rate = READ_ONCE(xprt->rate);
 
-/*TODO:内存池*/
-struct xprt *xprt_tcpserv_constructor(struct server *server, unsigned long opt, void *user)
-{
-	struct xprt_tcpserv *tcpxprt = malloc(sizeof(*tcpxprt));
-	if (skp_unlikely(!tcpxprt))
-		return NULL;
-	memset(tcpxprt, 0, sizeof(*tcpxprt));
-	tcpxprt->xprt.user = user;
-	return &tcpxprt->xprt;
-}
+	if (skp_unlikely(!rate) || !rate->msgs_ps)
+		return;
 
-void xprt_tcpserv_destructor(struct xprt *xprt)
-{
-	struct xprt_tcpserv * tcpxprt = xprt_to_tcpserv(xprt);
-	if (skp_likely(xprt))
-		free(tcpxprt);
-}
+	shaper = rate->shaper;
+	spin_lock(&shaper->lock);
+	rate->rx_msgs -= msgs;
+	if (!xprt_rate_rxok_locked(rate)) {
+		pause = true;
+		arm = xprt_rate_pause_locked(shaper, rate, EVENT_READ);
+	}
+	spin_unlock(&shaper->lock);
 
-const struct xprt_operations xprt_tcpserv_ops = {
-	.constructor = xprt_tcpserv_constructor,
-	.destructor = xprt_tcpserv_destructor,
-	.do_handshake = NULL,
-	.on_recv = xprt_tcpserv_recv,
-	.on_send = xprt_tcpserv_send,
-	.on_changed = xprt_tcpserv_changed,
-	.on_shutdown = NULL,
-};
+	if (pause)
+		xprt_rate_pause(xprt, shaper, EVENT_READ, arm);
+}
 
-int create_xprt_tcpclnt(struct xprt *xprt, struct server *serv,
-	const struct service_address *addr, unsigned long opt,
-	const struct xprt_operations *clnt_ops)
+ssize_t __xprt_rate_read(const struct xprt *x, void *b, size_t s)
 {
-	socklen_t slen;
-	int flags, rc, sfd = 0;
-	struct xprt_tcpclnt *clnt = xprt_to_tcpclnt(xprt);
+	ssize_t rc;
+	bool arm = false, pause = false;
+	struct xprt *xprt = (struct xprt*)x;
+	struct xprt_rate *rate = READ_ONCE(xprt->rate);
+	struct xprt_shaper *shaper = rate->shaper;
+
+	spin_lock(&shaper->lock);
+	xprt_rate_refill_locked(rate, xprt_clock());
+	if (skp_unlikely(!xprt_rate_rxok_locked(rate))) {
+		arm = xprt_rate_pause_locked(shaper, rate, EVENT_READ);
+		spin_unlock(&shaper->lock);
+		xprt_rate_pause(xprt, shaper, EVENT_READ, arm);
+		return -EAGAIN;
+	}
+	if (rate->bytes_ps && (int64_t)s > rate->rx_bytes)
+		s = (size_t)rate->rx_bytes;
+	spin_unlock(&shaper->lock);
 
-	if ((opt & XPRT_TYPE_MASK) != XPRT_TCPCLNT)
-		return -EINVAL;
+	rc = read(xprt_fd(xprt), b, s);
+	if (skp_unlikely(rc < 0))
+		return -errno;
+	xprt_stat_rx(xprt, rc);
+	if (!rc || !rate->bytes_ps)
+		return rc;
 
-	sfd = tcp_connect(addr, xprt_tcp_setopt, &opt, &flags, &clnt->remote);
-	if (skp_unlikely(sfd < 0))
-		return sfd;
+	spin_lock(&shaper->lock);
+	rate->rx_bytes -= rc;
+	if (!xprt_rate_rxok_locked(rate)) {
+		pause = true;
+		arm = xprt_rate_pause_locked(shaper, rate, EVENT_READ);
+	}
+	spin_unlock(&shaper->lock);
 
-	/*非阻塞连接的处理，紧接connect之后，防止修改errno？*/
-	if (skp_likely(opt & XPRT_OPT_NONBLOCK) && (flags == EINPROGRESS))
-		XPRT_BUG_ON(__test_and_set_bit(XPRT_CONNECTING_BIT, &opt));
+	if (pause)
+		xprt_rate_pause(xprt, shaper, EVENT_READ, arm);
+	return rc;
+}
 
-	/*初始化其他字段*/
-	clnt->lstn_xprt = NULL;
+static ssize_t xprt_rate_send(struct xprt *xprt, const void *b, size_t s,
+		int flags)
+{
+	ssize_t rc;
+	bool arm = false, pause = false, expedite = false;
+	struct xprt_rate *rate = READ_ONCE(xprt->rate);
+	struct xprt_shaper *shaper = rate->shaper;
+
+	if (!READ_ONCE(rate->weight))
+		goto write;
+
+	spin_lock(&shaper->lock);
+	xprt_rate_join_locked(shaper, rate);
+	if (skp_unlikely(rate->deficit <= 0)) {
+		arm = xprt_rate_pause_locked(shaper, rate, EVENT_WRITE);
+		spin_unlock(&shaper->lock);
+		xprt_rate_pause(xprt, shaper, EVENT_WRITE, arm);
+		return -EAGAIN;
+	}
+	if ((int64_t)s > rate->deficit)
+		s = (size_t)rate->deficit;
+	spin_unlock(&shaper->lock);
 
-	/*获取本地地址*/
-	slen = sizeof(clnt->local);
-	rc = getsockname(sfd, &clnt->local.sock_addr, &slen);
-	if (skp_unlikely(rc)) {
-		rc = -errno;
-		goto fail;
+write:
+	rc = flags ? send(xprt_fd(xprt), b, s, flags) : write(xprt_fd(xprt), b, s);
+	if (skp_unlikely(rc < 0))
+		return __xprt_write_errno();
+	xprt_stat_tx(xprt, rc);
+	if (!rc || !READ_ONCE(rate->weight))
+		return rc;
+
+	spin_lock(&shaper->lock);
+	rate->deficit -= rc;
+	if (rate->deficit <= 0 && rate->round == shaper->round) {
+		pause = true;
+		arm = xprt_rate_pause_locked(shaper, rate, EVENT_WRITE);
+		/*
+		 * 所有参与者都用完了份额，立即开始新的一轮，
+		 * 但要先返回事件循环，让其他已就绪的传输对象有机会加入
+		 */
+		if (++shaper->nr_spent >= shaper->nr_active) {
+			shaper->armed = true;
+			expedite = true;
+		}
 	}
+	spin_unlock(&shaper->lock);
 
-	/*获取远程地址*/
-#ifdef XPRT_DEBUG
+	if (pause)
+		xprt_rate_pause(xprt, shaper, EVENT_WRITE, arm && !expedite);
+	if (expedite)
+		xprt_shaper_arm(shaper, 0);
+	return rc;
+}
+
+ssize_t __xprt_rate_write(const struct xprt *x, const void *b, size_t s)
 {
-	struct sock_address saddr;
-	char paddr[INET_ADDRESS_STRLEN];
-	size_t l = inet_address2sock(&clnt->local, &saddr);
+	return xprt_rate_send((struct xprt*)x, b, s, 0);
+}
+
+ssize_t xprt_write_more(struct xprt *xprt, const void *b, size_t s)
+{
+	ssize_t rc;
+
+	if (skp_unlikely(READ_ONCE(xprt->rate))) {
+		rc = xprt_rate_send(xprt, b, s, MSG_MORE);
+	} else {
+		rc = send(xprt_fd(xprt), b, s, MSG_MORE);
+		if (skp_unlikely(rc < 0))
+			return __xprt_write_errno();
+		xprt_stat_tx(xprt, rc);
+	}
+	/*避免每次写入都修改标志*/
+	if (skp_likely(rc > 0) && !test_bit(XPRT_CORKED_BIT, &xprt->flags))
+		set_bit(XPRT_CORKED_BIT, &xprt->flags);
+	return rc;
+}
+
+int __xprt_write_flush(struct xprt *xprt)
+{
+	if (!test_and_clear_bit(XPRT_CORKED_BIT, &xprt->flags))
+		return 0;
+	/*已完全关闭，积攒的数据随 FIN 发出或被丢弃*/
+	if (skp_unlikely(xprt_status(xprt) & XPRT_CLOSED))
+		return 0;
+	/*关闭 TCP_CORK 会推送发送队列中等待合并的尾部分节*/
+	return sockopt_disable_cork(xprt_fd(xprt));
+}
+
+/**
+ * 安装传输对象，服务器对象管理所有的传输对象，并持有一个引用计数
+ */
+static int attach_xprt(struct xprt *xprt, int fd, unsigned long flags,
+	struct server *serv, const struct xprt_operations *ops)
+{
+	int rc = 0;
+
+	/*添加到管理容器的动作第一置于最后，方便错误回滚*/
+	server_get(serv);
+
+	/*初始化一些字段*/
+	xprt->flags = flags;
+	xprt->server = serv;
+	xprt->xprt_ops = ops;
+	uref_init(&xprt->refs);
+	INIT_LIST_HEAD(&xprt->node);
+	xprt_timeo_init(&xprt->timeo);
+	xprt->rate = NULL;
+	memset(&xprt->stats, 0, sizeof(xprt->stats));
+	if (xprt_is_tcpclnt(xprt)) {
+		struct xprt_tcpclnt *clnt = xprt_to_tcpclnt(xprt);
+		memset(&clnt->tcpinfo, 0, sizeof(clnt->tcpinfo));
+		clnt->race = NULL;
+	}
+
+	/*初始化事件*/
+	uev_stream_init(xprt_ev(xprt), fd, process_xprt_event);
+
+	/*TODO:处理停止状态*/
+	spin_lock(&serv->lock);
+	if (!__server_has_fulled(serv)) {
+		serv->nr_xprts++;
+		/*增加引用计数，防止异步释放 xprt*/
+		if (xprt_is_tcpserv(xprt_get(xprt))) {
+			/*方便优先杀掉侦听套接字，终止外部新连接*/
+			list_add(&xprt->node , &serv->xprt_list);
+		} else {
+			list_add_tail(&xprt->node, &serv->xprt_list);
+		}
+		XPRT_BUG_ON(__test_and_set_bit(XPRT_ATTACHED_BIT, &xprt->flags));
+	} else {
+		rc = -EMFILE;
+		__server_put(xchg_ptr(&xprt->server, NULL));
+	}
+	spin_unlock(&serv->lock);
+
+	/*尚未初始化完成，不能在此启动事件*/
+
+	return rc;
+}
+
+static bool detach_xprt(struct xprt *xprt)
+{
+	struct server *serv = READ_ONCE(xprt->server);
+
+	if (skp_unlikely(!serv))
+		return false;
+	if (!test_and_clear_bit(XPRT_ATTACHED_BIT, &xprt->flags))
+		return false;
+
+	spin_lock(&serv->lock);
+	XPRT_BUG_ON(xprt->server != serv);
+	XPRT_BUG_ON(list_empty(&xprt->node));
+	serv->nr_xprts--;
+	list_del_init(&xprt->node);
+	spin_unlock(&serv->lock);
+	return true;
+}
+
+static inline void barrier_xprt(struct xprt *xprt)
+{
+	struct server *serv = READ_ONCE(xprt->server);
+	if (skp_unlikely(!serv))
+		return;
+	spin_lock(&serv->lock);
+	spin_unlock(&serv->lock);
+}
+
+static void xprt_dict_free(struct xprt* xprt)
+{
+	struct xprt *lstn;
+	struct xprt_tcpclnt *clnt;
+	struct server *serv = READ_ONCE(xprt->server);
+
+#ifdef XPRT_DEBUG
+	WARN_ON(xprt_event_delete(xprt) > 0);
+#endif
+
+	/*从时间轮和限速的槽位中移除*/
+	xprt_timeo_detach(xprt);
+	xprt_rate_detach(xprt);
+
+	/*关闭描述符，在此之前一定要删除事件*/
+	if (skp_likely(xprt_fd(xprt) > -1)) {
+		bool wuwk = false;
+		if ((xprt->flags & XPRT_OPT_TCPLARGELINGER) && xprt_is_tcpclnt(xprt)) {
+			set_fd_block(xprt_fd(xprt));
+			sockopt_set_linger(xprt_fd(xprt), true, 4096);
+			wuwk = true;
+			XPRT_WARN_ON(current_ev_worker());
+			wq_worker_sleeping();
+		}
+		close(xprt_fd(xprt));
+		if (wuwk)
+			wq_worker_waking_up();
+	}
+
+	/*没有按照正确的流程 销毁 xprt*/
+#ifdef XPRT_DEBUG
+	WARN_ON(detach_xprt(xprt));
+#endif
+
+	/*释放对创建xprt的引用*/
+	if (xprt_type(xprt) != XPRT_TCPTEMP)
+		goto out;
+
+	prefork_stat_inc(PREFORK_STAT_CLOSED);
+	/*@see xprt_move()*/
+	clnt = xprt_to_tcpclnt(xprt);
+	if (!clnt->lstn_xprt)
+		goto out;
+
+	lstn = xchg_ptr(&clnt->lstn_xprt, NULL);
+	XPRT_BUG_ON(!lstn);
+
+	if (xprt_to_tcpserv(lstn)->cool_down) {
+		/*必须加锁，与 destroy_xprt() 有竞争*/
+		spin_lock(&serv->lock);
+		/*enable read event*/
+		if (skp_likely(!xprt_flags_closed(lstn->flags) &&
+				!xprt_flags_detached(lstn->flags) &&
+				xprt_to_tcpserv(lstn)->cool_down))
+		{
+			uint8_t mask = xprt_ev(lstn)->mask;
+			/*如果失败也不关心，说明用户管理这个xprt的读写*/
+			xprt_to_tcpserv(lstn)->cool_down = false;
+			int rc = uev_stream_add(xprt_ev(lstn), mask|EVENT_READ);
+			if (skp_unlikely(rc<0))
+				LOG_XPRT_CHANGED_EVENT(lstn, EVENT_READ, ADD);
+		}
+		spin_unlock(&serv->lock);
+	}
+
+	xprt_put(lstn);
+
+out:
+	XPRT_WARN_ON(uref_read(&xprt->refs));
+	XPRT_WARN_ON(xprt->flags & XPRT_ATTACHED);
+	XPRT_WARN_ON(xprt->flags & XPRT_SHUT_RDWR);
+	XPRT_WARN_ON(!(xprt->flags & XPRT_CLOSED));
+	XPRT_WARN_ON(xprt->flags & XPRT_CONNECTING);
+
+	/*释放内存*/
+	xprt->xprt_ops->destructor(xprt);
+
+	/*xprt 的内存释放时，可能还使用 serv 所以不能提前解除引用*/
+	if (skp_likely(serv))
+		server_put(serv);
+}
+
+static void xprt_rcu_free(void *ptr)
+{
+	struct xprt *xprt = ptr;
+	if (WARN_ON(!xprt))
+		return;
+	xprt_dict_free(xprt);
+}
+
+/*仅关闭状态*/
+static bool shutdown_xprt_stats(struct xprt *xprt, int how)
+{
+	bool rc;
+	uint8_t ev = 0;
+	unsigned long nflags, flags, mask = 0;
+
+	/*计算需要关闭的事件和置位的状态*/
+	/*0->1, 1->2, 2->3*/
+	how++; /*@see inet_shutdown()*/
+	if (how & (SHUT_RD + 1)) {
+		mask |= XPRT_SHUTRD;
+		ev |= EVENT_READ;
+	}
+	if (how & (SHUT_WR + 1)) {
+		mask |= XPRT_SHUTWR;
+		ev |= EVENT_WRITE;
+	}
+
+	do {
+		flags = READ_ONCE(xprt->flags);
+		/*已经关闭或已经设置了*/
+		if (skp_unlikely((flags & XPRT_CLOSED)) ||
+				((flags & mask) == mask) ||
+				((mask != XPRT_SHUT_RDWR) && (mask & flags)))
+			break;
+		/* 关闭掉正在连接标志 */
+		nflags = flags | mask;
+		if (mask == XPRT_SHUT_RDWR)
+			nflags &= ~ XPRT_CONNECTING;
+		rc = cmpxchg(&xprt->flags, flags, nflags);
+		if (skp_unlikely(!rc)) {
+			LOG_XPRT_CHANGED_BIT(xprt, mask);
+			continue;
+		}
+
+		/*
+		 * 如果是在事件线程内调用，则还需要关闭相应的事件
+		 * 因为内部回调函数可以处理相应的收尾工作
+		 * 不需要保留事件来传递关闭
+		 */
+		if (current_ev_stream() == xprt_ev(xprt)) {
+			int rc = uev_stream_disable(&xprt->event, ev);
+			if (skp_unlikely(rc<0))
+				LOG_XPRT_CHANGED_EVENT(xprt, ev, disable);
+		}
+
+		xprt_ops_call(xprt, on_shutdown, how - 1);
+
+		return true;
+	} while (1);
+
+	return false;
+}
+
+static __always_inline void eat_xprt_open(struct xprt *xprt, uint16_t mask)
+{
+	bool rc;
+	unsigned long flags;
+	do {
+		flags = READ_ONCE(xprt->flags);
+		/*第一次变为可读/可写 ： 没有设置 opened ，且还没有被关闭*/
+		if (skp_likely(flags & XPRT_OPENED))
+			return;
+		if (skp_unlikely(xprt_flags_closed(flags)))
+			return;
+
+		rc = cmpxchg(&xprt->flags, flags, flags | XPRT_OPENED);
+		if (skp_likely(rc)) {
+			/*invoke opened*/
+			xprt_ops_call(xprt, on_changed, XPRT_OPENED | mask);
+			return;
+		}
+		LOG_XPRT_CHANGED_BIT(xprt, XPRT_OPENED);
+	} while (1);
+}
+
+/*返回非0值，关闭成功，需要销毁*/
+static __always_inline int eat_xprt_close(struct xprt *xprt, uint16_t mask)
+{
+	int rc;
+	unsigned long rflags, flags;
+	do {
+		flags = READ_ONCE(xprt->flags);
+		/*已关闭*/
+		if (skp_unlikely(flags & XPRT_CLOSED))
+			return -ECONNABORTED;
+		/*半关闭*/
+		if (skp_likely((flags & XPRT_SHUT_RDWR) != XPRT_SHUT_RDWR))
+			break;
+
+		/*完全关闭*/
+		rflags = cmpxchg_val(&xprt->flags, flags,
+			(flags & ~(XPRT_SHUT_RDWR)) | XPRT_CLOSED);
+
+		if (skp_unlikely(rflags != flags)) {
+			LOG_XPRT_CHANGED_BIT(xprt, XPRT_CLOSED);
+			continue;
+		}
+
+		/*必须触发过打开过才能触发关闭*/
+		if (skp_likely(rflags & (XPRT_OPENED | XPRT_CONNREFUSED))) {
+			/*invoke closed*/
+			xprt_ops_call(xprt, on_changed, (rflags & XPRT_OPENED?
+					XPRT_CLOSED:XPRT_CONNREFUSED) | mask);
+			/*异步/同步删除*/
+			rc = xprt_event_delete(xprt);
+			if (skp_unlikely(rc<0))
+				LOG_XPRT_CHANGED_EVENT(xprt, mask, delete);
+		}
+		return -ECONNABORTED;
+	} while (1);
+
+	return 0;
+}
+
+static __always_inline void eat_xprt_rdready(struct xprt *xprt, uint16_t mask)
+{
+	/*除了写事件，其他任何事件都需要通知读回调，因为缓存区内可能还有数据待处理*/
+	if (!(mask & (EVENT_READ | EVENT_EOF | EVENT_ERROR)) || /*读端被关闭了*/
+			skp_unlikely(xprt_status(xprt) & (XPRT_CLOSED|XPRT_SHUTRD)))
+		return;
+
+	/*invoke recv*/
+	xprt_ops_call(xprt, on_recv, XPRT_RDREADY | mask);
+}
+
+static __always_inline void eat_xprt_wrready(struct xprt *xprt, uint16_t mask)
+{
+	/*尽可写才通知写回调*/
+	if (!(mask & (EVENT_WRITE | EVENT_ERROR)) || /*写端被关闭了*/
+			skp_unlikely(xprt_status(xprt) & (XPRT_CLOSED|XPRT_SHUTWR)))
+		return;
+	/*invoke send*/
+	xprt_ops_call(xprt, on_send, XPRT_WRREADY | mask);
+
+	/*shutdown read&write when socket got EVENT_ERROR*/
+	if (skp_unlikely(mask & EVENT_ERROR))
+		shutdown_xprt(xprt, SHUT_RDWR);
+}
+
+/*刷新传输层缓存的待发送数据，返回新的事件掩码*/
+static __always_inline uint16_t eat_xprt_flush(struct xprt *xprt, uint16_t mask)
+{
+	int rc;
+
+	if (!(mask & EVENT_WRITE) || !xprt->xprt_ops->do_flush ||
+			skp_unlikely(xprt_status(xprt) & (XPRT_CLOSED|XPRT_SHUTWR)))
+		return mask;
+
+	rc = xprt->xprt_ops->do_flush(xprt);
+	if (skp_likely(!rc))
+		return mask;
+	/*仍有数据待发送，写事件已重新开启，本次不通知写回调*/
+	if (skp_likely(rc == -EAGAIN))
+		return mask & ~EVENT_WRITE;
+
+	log_warn("xprt flush failed : sfd [%d] : %s", xprt_fd(xprt),
+		__strerror_local(-rc));
+	return mask | EVENT_ERROR;
+}
+
+/*发起内部关闭*/
+static __always_inline int intl_xprt_shutdown(struct xprt *xprt, uint16_t mask)
+{
+	set_bit(XPRT_CONNREFUSED_BIT, &xprt->flags);
+	shutdown_xprt(xprt, SHUT_RDWR);
+	return eat_xprt_close(xprt, EVENT_ERROR);
+}
+
+/*
+ * @return 0 success, -EAGAIN in connecting , other error
+ */
+static int __eat_xprt_connecting(struct xprt *xprt, uint16_t mask)
+{
+	int rc = 0;
+	struct sock_address sockaddr;
+	struct xprt_tcpclnt *tcpclnt = xprt_to_tcpclnt(xprt);
+
+	if (skp_unlikely(xprt_flags_closed(READ_ONCE(xprt->flags)))) {
+		log_warn("nonblock connecting has been shutdown : %p/%lu",
+			 xprt, xprt_status(xprt));
+		return -ECONNABORTED;
+	}
+
+	XPRT_WARN_ON(!(xprt_opt(xprt) & XPRT_OPT_NONBLOCK));
+
+	/*异步解析或连接失败 @see xprt_resolv_done()*/
+	if (skp_unlikely(tcpclnt->remote.sock_addr.sa_family == AF_UNSPEC)) {
+		rc = errno = EHOSTUNREACH;
+		goto fail;
+	}
+
+	if (skp_unlikely(mask & EVENT_ERROR)) {
+		rc = errno = sockopt_get_sockerr(xprt_fd(xprt));
+		goto fail;
+	}
+
+	inet_address2sock(&tcpclnt->remote, &sockaddr);
+	/*try to do connecting again*/
+	rc = connect(xprt_fd(xprt), &sockaddr.sock_addr, sockaddr.length);
+	/*还处于连接状态？ EALREADY*/
+	if (skp_likely(rc)) {
+		rc = errno;
+		if (skp_unlikely(rc==EALREADY))
+			return -EAGAIN;
+		if (skp_unlikely(rc!=EISCONN))
+			goto fail;
+	}
+#ifdef XPRT_DEBUG
+	{
+		struct sock_address saddr;
+		char paddr[INET_ADDRESS_STRLEN];
+		size_t l = inet_address2sock(&tcpclnt->local, &saddr);
+		if (skp_likely(l) && skp_likely(!sockaddr_ntop(&saddr, paddr, sizeof(paddr)))) {
+			log_info("active socket established : sfd [%d] -- local [%s:%u]",
+				xprt_fd(xprt), paddr, inet_address_port(&tcpclnt->local));
+		}
+
+		l = inet_address2sock(&tcpclnt->remote, &saddr);
+		if (skp_likely(l) && skp_likely(!sockaddr_ntop(&saddr, paddr, sizeof(paddr)))) {
+			log_info("active socket established : sfd [%d] -- remote [%s:%u]",
+				xprt_fd(xprt), paddr, inet_address_port(&tcpclnt->remote));
+		}
+	}
+#endif
+
+	/*非阻塞连接成功，调用可写回调*/
+	return 0;
+fail:
+	log_warn("nonblocking connection failed : sfd [%d] : %s", xprt_fd(xprt),
+		strerror_local());
+	return intl_xprt_shutdown(xprt, EVENT_ERROR);
+}
+
+static __always_inline int eat_xprt_connecting(struct xprt *xprt, uint16_t mask)
+{
+	/*使用非 lock 指令预判断 减少cache sync*/
+	if (!test_bit(XPRT_CONNECTING_BIT, &xprt->flags))
+		return 0;
+
+	/*查明阻塞连接或已连接*/
+	if (!test_and_clear_bit(XPRT_CONNECTING_BIT, &xprt->flags))
+		return 0;
+
+	if (skp_unlikely(xprt_type(xprt) != XPRT_TCPCLNT)) {
+		log_warn("nonblock connection is not suspported : %p/%lu",
+			 xprt, xprt_type(xprt));
+		return 0;
+	}
+
+	return __eat_xprt_connecting(xprt, mask);
+}
+
+/*握手*/
+static __always_inline int __do_xprt_handshake(struct xprt *xprt, uint16_t mask)
+{
+	if (skp_unlikely(xprt_flags_closed(READ_ONCE(xprt->flags)))) {
+		log_warn("connection has been shutdown : %p/%lu",
+			 xprt, xprt_status(xprt));
+		return -ECONNABORTED;
+	}
+	xprt_ops_call_ret(xprt, do_handshake, mask);
+}
+
+static __always_inline int do_xprt_handshake(struct xprt *xprt, uint16_t mask)
+{
+	if (test_bit(XPRT_HANDSHAKED_BIT, &xprt->flags))
+		return 0;
+	int rc = __do_xprt_handshake(xprt, mask);
+	if (skp_likely(rc >= 0)) {
+		set_bit(XPRT_HANDSHAKED_BIT, &xprt->flags);
+		return rc;
+	} if (skp_likely(rc==-EAGAIN))
+		return rc;
+
+	/*
+	 * 握手失败与连接都属于内部流程，如果失败则删除事件
+	 * @see eat_xprt_close() 中的 on_change() 回调
+	 */
+	log_warn("xprt handshake failed : sfd [%d] : %s", xprt_fd(xprt),
+		__strerror_local(-rc));
+	return intl_xprt_shutdown(xprt, EVENT_ERROR);
+}
+
+static void process_xprt_event(struct uev_stream *ptr, uint16_t mask)
+{
+	int rc = 0;
+	struct xprt *xprt = container_of(ptr, struct xprt, event);
+
+#ifdef XPRT_DEBUG
+	xprt = xprt_get(xprt);
+	if (WARN_ON(!xprt))
+		return;
+#endif
+	/*
+	 * eat_xprt_connecting()/do_xprt_handshake() 如果没有成功都发起内部关闭
+	 * 如果成功关闭则返回0，后续的流程都不运行，如果与 shutdown_xprt()/destroy_xprt()
+	 * 发送竞争则会关闭失败，返回非 -EAGAIN 负值
+	 * 即如果外部已经关闭套接字，则可以结束内部流程的运转，转 shut 标签处剥离 xprt
+	 */
+	/*消费各类事件*/
+	rc = eat_xprt_connecting(xprt, mask);
+	if (WARN_ON(rc == -EAGAIN))
+		goto out;
+	if (skp_unlikely(rc))
+		goto shut;
+
+	/*握手 @see xprt_ssl_handshake()*/
+	if (!test_bit(XPRT_HANDSHAKED_BIT, &xprt->flags)) {
+		rc = do_xprt_handshake(xprt, mask);
+		if (rc == -EAGAIN)
+			goto out;
+		if (skp_unlikely(rc < 0))
+			goto shut;
+		/*
+		 * 握手层已预读了应用数据，而套接字上不会再有可读事件，
+		 * 所以如果开启了读事件，则需要通知一次读回调
+		 */
+		if (rc > 0 && (uev_stream_mask(xprt_ev(xprt)) & EVENT_READ))
+			mask |= EVENT_READ;
+	}
+
+	/*刷新超时的时间戳*/
+	xprt_timeo_touch(xprt, mask);
+
+	eat_xprt_open(xprt, mask);
+	/*读优先*/
+	eat_xprt_rdready(xprt, mask);
+	mask = eat_xprt_flush(xprt, mask);
+	eat_xprt_wrready(xprt, mask);
+	/*合并本次回调中 xprt_write_more() 的写入后统一发出*/
+	xprt_write_flush(xprt);
+	rc = eat_xprt_close(xprt, mask);
+	if (skp_likely(!rc))
+		goto out;
+shut:
+	/*TODO:支持重连?*/
+	/*成功关闭*/
+	if (detach_xprt(xprt)) {
+		/*TODO:此路径是否需要延迟释放*/
+#ifdef XPRT_DEBUG
+		XPRT_BUG_ON(uref_read(&xprt->refs) < 2);
+		XPRT_BUG_ON(__uref_put(&xprt->refs));
+#else
+		XPRT_BUG_ON(uref_read(&xprt->refs) < 1);
+		xprt_put(xprt);
+#endif
+	}
+out:
+#ifdef XPRT_DEBUG
+	xprt_put(xprt);
+#endif
+	return;
+}
+
+static void xprt_tcp_setopt(int sfd, void *user)
+{
+	unsigned long opt = *(unsigned long*)user;
+	unsigned long type = opt & XPRT_TYPE_MASK;
+	if (skp_likely(opt & XPRT_OPT_NONBLOCK))
+		XPRT_BUG_ON(set_fd_nonblock(sfd));
+	if (opt & XPRT_OPT_TCPKEEPALIVE)
+		sockopt_enable_keepalive(sfd, 1, 30, 12);
+	if (opt & XPRT_OPT_TCPNAGLEOFF)
+		sockopt_enable_nodelay(sfd);
+	if (opt & XPRT_OPT_TCPLINGEROFF)
+		sockopt_set_linger(sfd, false, 0);
+	/*侦听套接字在 listen() 之前设置，被动连接不需要*/
+	if (opt & XPRT_OPT_TCPFASTOPEN) {
+		if (type == XPRT_TCPSERV) {
+			sockopt_enable_fastopen(sfd, CONFIG_XPRT_TFO_QLEN);
+		} else if (type == XPRT_TCPCLNT) {
+			/*connect() 立即返回，握手推迟到第一次写入*/
+			sockopt_enable_fastopen_connect(sfd);
+		}
+	}
+	if ((opt & XPRT_OPT_TCPDEFERACCEPT) && type == XPRT_TCPSERV)
+		sockopt_set_defer_accept(sfd, CONFIG_XPRT_DEFER_ACCEPT);
+	if ((opt & XPRT_OPT_TCPNOTSENTLOWAT) && type != XPRT_TCPSERV)
+		sockopt_set_notsent_lowat(sfd, CONFIG_XPRT_NOTSENT_LOWAT);
+}
+
+static void xprt_admission_timer_cb(struct uev_timer *);
+
+int create_xprt_tcpserv(struct xprt* xprt, struct server *serv,
+		const struct service_address *addr, unsigned long opt,
+		const struct xprt_operations *lstn_ops,
+		const struct xprt_operations *clnt_ops)
+{
+	int rc, sfd = 0;
+	struct xprt_tcpserv *lstn = xprt_to_tcpserv(xprt);
+	socklen_t slen = sizeof(lstn->lstn_address);
+
+	if ((opt & XPRT_TYPE_MASK) != XPRT_TCPSERV)
+		return -EINVAL;
+
+	/*热重启时优先使用从旧进程继承的套接字，保留内核中的连接队列*/
+	sfd = restart_inherit(addr);
+	/*多进程模式下使用主进程侦听套接字的副本*/
+	if (sfd < 0)
+		sfd = prefork_inherit(addr);
+	if (sfd < 0) {
+		sfd = tcp_listen(addr, xprt_tcp_setopt, &opt);
+		if (skp_unlikely(sfd < 0))
+			return sfd;
+	} else {
+		xprt_tcp_setopt(sfd, &opt);
+	}
+
+	/*初始化tcpserv的字段和特定状态*/
+	lstn->cool_down = false;
+	memset(&lstn->admission, 0, sizeof(lstn->admission));
+	uev_timer_init(&lstn->admission.timer, xprt_admission_timer_cb);
+	lstn->clnt_xprt_ops = clnt_ops;
+	/*获取本地地址*/
+	rc = getsockname(sfd, &lstn->lstn_address.sock_addr, &slen);
+	if (skp_unlikely(rc)) {
+		rc = -errno;
+		goto fail;
+	}
+
+#ifdef XPRT_DEBUG
+{
+	struct sock_address saddr;
+	char paddr[INET_ADDRESS_STRLEN];
+	size_t l = inet_address2sock(&lstn->lstn_address, &saddr);
+	if (skp_likely(l) && skp_likely(!sockaddr_ntop(&saddr, paddr, sizeof(paddr)))) {
+		log_debug("create listener socket : %d -- [%s:%u]",
+			sfd, paddr, inet_address_port(&lstn->lstn_address));
+	}
+}
+#endif
+
+	/*安装时就关闭写端，这样写事件永远不会触发*/
+	rc = attach_xprt(&lstn->xprt, sfd, XPRT_SHUTWR | opt, serv, lstn_ops);
+	if (skp_unlikely(rc))
+		goto fail;
+
+	return 0;
+fail:
+	close(sfd);
+	return rc;
+}
+
+/*关闭服务*/
+void shutdown_xprt_tcpserv(struct xprt* xprt, int how)
+{
+	/*tcp服务器只需要关闭写/读端？*/
+	struct xprt_tcpserv *txprt = xprt_to_tcpserv(xprt);
+	if (shutdown_xprt_stats(&txprt->xprt, SHUT_RDWR))
+		shutdown(xprt_fd(&txprt->xprt), SHUT_RD);
+}
+
+static inline void xprt_tcpserv_cooldown(struct xprt *xlstn)
+{
+	struct xprt_tcpserv *lstn = xprt_to_tcpserv(xlstn);
+	if (skp_likely(!lstn->cool_down)) {
+		struct server *serv = READ_ONCE(xlstn->server);
+		if (WARN_ON(!serv))
+			return;;
+		spin_lock(&serv->lock);
+		if (skp_likely(!lstn->cool_down)) {
+			lstn->cool_down = true;
+			int rc = xprt_event_delete(xlstn);
+			if (skp_unlikely(rc < 0))
+				LOG_XPRT_CHANGED_EVENT(xlstn, EVENT_READ, DELETE);
+		}
+		spin_unlock(&serv->lock);
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// 准入控制
+// 每个事件槽位一个循环延迟的探针，侦听对象按周期评估是否过载，
+// 过载时暂停或拒绝新连接，或关闭低优先级的已有连接，让部分客户端可控的降级
+////////////////////////////////////////////////////////////////////////////////
+
+struct xprt_probe {
+	uint64_t stamp; /**< 最后一次触发的毫秒时间戳*/
+	uint32_t lag; /**< 平滑后的延迟，毫秒*/
+	struct uev_timer timer;
+} __cacheline_aligned;
+
+static uint32_t xprt_probe_users = 0; /**< 开启了准入控制的侦听对象数量*/
+static bool xprt_probe_stopping = false; /**< 正在锁外同步删除探针*/
+static uint32_t xprt_probe_lag = 0;
+static DEFINE_PER_CPU_AIGNED(struct xprt_probe, xprt_probes);
+
+static void xprt_probe_timer_cb(struct uev_timer *timer)
+{
+	int cpu, rc;
+	uint32_t lag = 0;
+	uint64_t now = xprt_clock();
+	struct xprt_probe *probe = container_of(timer, struct xprt_probe, timer);
+	int64_t sample = (int64_t)(now - probe->stamp) - CONFIG_XPRT_ADMIT_PROBE;
+
+	/*指数加权平均，平滑偶发的抖动*/
+	if (sample < 0)
+		sample = 0;
+	WRITE_ONCE(probe->lag, (uint32_t)((probe->lag * 3 + sample) / 4));
+	probe->stamp = now;
+	rc = uev_timer_modify(timer, CONFIG_XPRT_ADMIT_PROBE);
+	WARN_ON(rc < 0);
+
+	for_each_possible_cpu(cpu)
+		lag = max(lag, READ_ONCE(per_cpu(xprt_probes, cpu).lag));
+	WRITE_ONCE(xprt_probe_lag, lag);
+}
+
+/*第一个使用者启动每个槽位的探针*/
+static void xprt_probe_get(void)
+{
+	int cpu, rc;
+
+	sysevent_init(false);
+
+	big_lock();
+	/*上一次停止还在同步删除探针，等待其完成后才能重新初始化*/
+	while (skp_unlikely(xprt_probe_stopping)) {
+		big_unlock();
+		sched_yield();
+		big_lock();
+	}
+	if (xprt_probe_users++) {
+		big_unlock();
+		return;
+	}
+
+	for_each_possible_cpu(cpu) {
+		struct xprt_probe *probe = &per_cpu(xprt_probes, cpu);
+		probe->lag = 0;
+		uev_timer_init(&probe->timer, xprt_probe_timer_cb);
+		/*单线程模式下所有的探针都映射到同一个槽位，只需要一个*/
+		if (uev_timer_setcpu(&probe->timer, cpu) != cpu)
+			continue;
+		probe->stamp = xprt_clock();
+		rc = uev_timer_add(&probe->timer, CONFIG_XPRT_ADMIT_PROBE);
+		WARN_ON(rc < 0);
+	}
+	big_unlock();
+}
+
+/*
+ * 最后一个使用者停止所有的探针
+ * 在锁内摘下探针并标记正在停止，然后在锁外同步删除，
+ * 以免与其他事件线程上需要 big_lock 的路径相互等待
+ * 可能在其他准入控制的定时器回调中调用，但探针不会是当前正在执行的定时器
+ */
+static void xprt_probe_put(void)
+{
+	int cpu;
+
+	big_lock();
+	BUG_ON(!xprt_probe_users);
+	if (--xprt_probe_users) {
+		big_unlock();
+		return;
+	}
+
+	xprt_probe_stopping = true;
+	for_each_possible_cpu(cpu)
+		uev_timer_delete_async(&per_cpu(xprt_probes, cpu).timer);
+	WRITE_ONCE(xprt_probe_lag, 0);
+	big_unlock();
+
+	/*正在执行的回调可能重新启动了探针，同步删除会再次摘下并等待其结束*/
+	for_each_possible_cpu(cpu)
+		uev_timer_delete_sync(&per_cpu(xprt_probes, cpu).timer);
+
+	big_lock();
+	WRITE_ONCE(xprt_probe_lag, 0);
+	xprt_probe_stopping = false;
+	big_unlock();
+}
+
+uint32_t xprt_loop_lag(void)
+{
+	return READ_ONCE(xprt_probe_lag);
+}
+
+/*评估是否过载，进入与退出的阈值不同，防止频繁的切换*/
+static bool xprt_admission_eval(const struct xprt_admission *adm)
+{
+	uint32_t lag = xprt_loop_lag();
+	uint32_t max_lag = READ_ONCE(adm->max_lag);
+	uint32_t max_congested = READ_ONCE(adm->max_congested);
+	struct workqueue_struct *wq = READ_ONCE(adm->wq);
+	uint32_t congested = wq ? workqueue_congested(wq) : 0;
+
+	if (!adm->overloaded)
+		return (max_lag && lag > max_lag) || congested > max_congested;
+	return (max_lag && lag > max_lag / 2) || congested > max_congested;
+}
+
+/*暂停或恢复接受新连接，必须加锁，与 xprt_tcpserv_cooldown() 和 destroy_xprt() 有竞争*/
+static void xprt_admission_defer(struct xprt *xlstn, bool defer)
+{
+	int rc = 0;
+	struct xprt_tcpserv *lstn = xprt_to_tcpserv(xlstn);
+	struct server *serv = READ_ONCE(xlstn->server);
+
+	if (skp_unlikely(!serv))
+		return;
+
+	spin_lock(&serv->lock);
+	if (!defer && !lstn->admission.deferred)
+		goto unlock;
+	lstn->admission.deferred = defer;
+	/*冷却中的侦听对象由被动连接的销毁恢复，恢复后会再次检查*/
+	if (lstn->cool_down || xprt_flags_closed(xlstn->flags) ||
+			xprt_flags_detached(xlstn->flags))
+		goto unlock;
+	if (defer) {
+		rc = uev_stream_disable(xprt_ev(xlstn), EVENT_READ);
+		if (skp_unlikely(rc < 0))
+			LOG_XPRT_CHANGED_EVENT(xlstn, EVENT_READ, disable);
+	} else {
+		rc = uev_stream_enable(xprt_ev(xlstn), EVENT_READ);
+		if (skp_unlikely(rc < 0))
+			LOG_XPRT_CHANGED_EVENT(xlstn, EVENT_READ, enable);
+	}
+unlock:
+	spin_unlock(&serv->lock);
+}
+
+/*过载时处理新连接，返回 true 表示没有接受新连接*/
+static bool xprt_admission_refuse(struct xprt *xlstn)
+{
+	int cfd;
+	struct xprt_admission *adm = &xprt_to_tcpserv(xlstn)->admission;
+	uint8_t policy = READ_ONCE(adm->policy);
+
+	if (policy & XPRT_ADMIT_DEFER) {
+		xprt_admission_defer(xlstn, true);
+		return true;
+	}
+	if (!(policy & XPRT_ADMIT_REJECT))
+		return false;
+
+	cfd = tcp_accept(xprt_fd(xlstn), NULL);
+	if (skp_likely(cfd >= 0)) {
+		/*发送 RST 快速失败，客户端可以立即尝试其他的服务器*/
+		sockopt_set_linger(cfd, true, 0);
+		close(cfd);
+		__atomic_add_fetch(&adm->nr_rejected, 1, __ATOMIC_RELAXED);
+	} else if (skp_unlikely(cfd == -EMFILE)) {
+		xprt_tcpserv_cooldown(xlstn);
+	}
+	/*每次事件只拒绝一个，电平触发会再次通知，不会独占事件线程*/
+	return true;
+}
+
+static inline bool xprt_passive_of(struct xprt *xprt, struct xprt *xlstn)
+{
+	return xprt_type(xprt) == XPRT_TCPTEMP &&
+		READ_ONCE(xprt_to_tcpclnt(xprt)->lstn_xprt) == xlstn;
+}
+
+/*关闭本侦听对象接受的优先级最低的被动连接，新的连接优先*/
+static void xprt_admission_shed(struct xprt *xlstn)
+{
+	int nr = 0;
+	uint32_t prio = U8_MAX + 1;
+	struct xprt *xprt, *victims[CONFIG_XPRT_ADMIT_SHED];
+	struct xprt_admission *adm = &xprt_to_tcpserv(xlstn)->admission;
+	struct server *serv = READ_ONCE(xlstn->server);
+
+	if (skp_unlikely(!serv))
+		return;
+
+	spin_lock(&serv->lock);
+	list_for_each_entry(xprt, &serv->xprt_list, node) {
+		if (xprt_passive_of(xprt, xlstn) && !xprt_has_closed(xprt))
+			prio = min(prio, (uint32_t)READ_ONCE(xprt_to_tcpclnt(xprt)->priority));
+	}
+	list_for_each_entry_reverse(xprt, &serv->xprt_list, node) {
+		if (nr >= ARRAY_SIZE(victims))
+			break;
+		if (!xprt_passive_of(xprt, xlstn) || xprt_has_closed(xprt) ||
+				READ_ONCE(xprt_to_tcpclnt(xprt)->priority) != prio)
+			continue;
+		if (uref_get_unless_zero(&xprt->refs))
+			victims[nr++] = xprt;
+	}
+	spin_unlock(&serv->lock);
+
+	if (!nr)
+		return;
+
+	log_warn("listener xprt [%p] is overloaded, shed %d connections "
+		"with priority %u", xlstn, nr, prio);
+	for (int i = 0; i < nr; i++) {
+		shutdown_xprt(victims[i], SHUT_RDWR);
+		xprt_put(victims[i]);
+	}
+	__atomic_add_fetch(&adm->nr_shed, nr, __ATOMIC_RELAXED);
+}
+
+/*定时器持有侦听对象的一个引用，在关闭准入控制或侦听对象后释放*/
+static void xprt_admission_timer_cb(struct uev_timer *timer)
+{
+	int rc;
+	bool stop, overloaded;
+	uint8_t policy;
+	struct xprt_admission *adm =
+		container_of(timer, struct xprt_admission, timer);
+	struct xprt *xlstn = &container_of(adm, struct xprt_tcpserv, admission)->xprt;
+	struct server *serv = READ_ONCE(xlstn->server);
+
+	/*侦听对象已脱离服务器，只能停止*/
+	if (skp_unlikely(!serv)) {
+		policy = 0;
+		stop = true;
+		adm->armed = false;
+	} else {
+		spin_lock(&serv->lock);
+		policy = adm->policy;
+		stop = !policy || xprt_flags_closed(xlstn->flags);
+		if (stop)
+			adm->armed = false;
+		spin_unlock(&serv->lock);
+	}
+
+	if (stop) {
+		WRITE_ONCE(adm->overloaded, false);
+		xprt_admission_defer(xlstn, false);
+		xprt_probe_put();
+		xprt_put(xlstn);
+		return;
+	}
+
+	overloaded = xprt_admission_eval(adm);
+	if (overloaded != adm->overloaded) {
+		log_warn("listener xprt [%p] %s overload : loop lag %u ms",
+			xlstn, overloaded ? "enter" : "leave", xprt_loop_lag());
+		if (overloaded)
+			__atomic_add_fetch(&adm->nr_overloads, 1, __ATOMIC_RELAXED);
+		WRITE_ONCE(adm->overloaded, overloaded);
+	}
+
+	if (!overloaded || !(policy & XPRT_ADMIT_DEFER))
+		xprt_admission_defer(xlstn, false);
+	if (overloaded && (policy & XPRT_ADMIT_SHED))
+		xprt_admission_shed(xlstn);
+
+	rc = uev_timer_modify(timer, CONFIG_XPRT_ADMIT_PROBE);
+	WARN_ON(rc < 0);
+}
+
+int xprt_tcpserv_set_admission(struct xprt *xlstn, uint8_t policy,
+		uint32_t max_lag, struct workqueue_struct *wq, uint32_t max_congested)
+{
+	int rc, cpu;
+	bool arm = false;
+	struct server *serv;
+	struct xprt_admission *adm;
+
+	if (WARN_ON(!xlstn || !xprt_is_tcpserv(xlstn)))
+		return -EINVAL;
+	if (xprt_has_closed(xlstn))
+		return -ECONNABORTED;
+	serv = READ_ONCE(xlstn->server);
+	if (skp_unlikely(!serv))
+		return -ECONNABORTED;
+
+	adm = &xprt_to_tcpserv(xlstn)->admission;
+	spin_lock(&serv->lock);
+	WRITE_ONCE(adm->wq, wq);
+	WRITE_ONCE(adm->max_lag, max_lag);
+	WRITE_ONCE(adm->max_congested, max_congested);
+	WRITE_ONCE(adm->policy, policy);
+	if (policy && !adm->armed) {
+		adm->armed = true;
+		arm = true;
+		xprt_get(xlstn);
+	}
+	spin_unlock(&serv->lock);
+
+	if (!arm)
+		return 0;
+
+	/*每个开启的定时器持有探针的一个引用*/
+	xprt_probe_get();
+
+	/*与侦听对象在同一个事件线程上，减少与接受连接的竞争*/
+	cpu = uev_stream_setcpu(xprt_ev(xlstn), -1);
+	if (skp_likely(cpu >= 0))
+		uev_timer_setcpu(&adm->timer, cpu);
+	rc = uev_timer_add(&adm->timer, CONFIG_XPRT_ADMIT_PROBE);
+	if (WARN_ON(rc < 0)) {
+		spin_lock(&serv->lock);
+		adm->armed = false;
+		spin_unlock(&serv->lock);
+		xprt_probe_put();
+		xprt_put(xlstn);
+		return rc;
+	}
+	return 0;
+}
+
+struct xprt *xprt_tcpserv_accept(struct xprt *xlstn, unsigned long stats)
+{
+	socklen_t slen;
+	int rc, cfd = 0;
+	unsigned long flags;
+	struct xprt *xclnt = NULL;
+	struct xprt_tcpclnt *clnt = NULL;
+	struct xprt_tcpserv *lstn = xprt_to_tcpserv(xlstn);
+	const struct xprt_operations *clntopt = lstn->clnt_xprt_ops;
+
+	/*accept client*/
+	if (xprt_has_closed(xlstn)) {
+		errno = ENOTCONN;
+		/*shutdown()不会参于实际的动作，主要是为了打印*/
+		return NULL;
+	}
+
+	if (xprt_opt_check(clntopt)) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	if (skp_unlikely(xprt_tcpserv_overloaded(xlstn)) &&
+			xprt_admission_refuse(xlstn)) {
+		errno = EAGAIN;
+		return NULL;
+	}
+
+	cfd = tcp_accept(xprt_fd(xlstn), NULL);
+	if (skp_unlikely(cfd < 0)) {
+		if (skp_unlikely(cfd == -EMFILE)) {
+			errno = EAGAIN;
+			xprt_tcpserv_cooldown(xlstn);
+		}
+		return NULL;
+	}
+	prefork_stat_inc(PREFORK_STAT_ACCEPTED);
+
+	/*准备安装*/
+	flags = xprt_opt(xlstn) | XPRT_TCPTEMP;
+	/*分配内存并初始化用户的子类*/
+	xclnt = clntopt->constructor(xlstn->server, flags, xlstn);
+	if (skp_unlikely(!xclnt))
+		goto alloc_fail;
+
+	clnt = xprt_to_tcpclnt(xclnt);
+	clnt->lstn_xprt = xprt_get(xlstn);
+
+	/*初始化 xprt_tcpclnt 字段*/
+	/*获取本地地址*/
+	slen = sizeof(clnt->local);
+	rc = getsockname(cfd, &clnt->local.sock_addr, &slen);
+	if (skp_unlikely(rc))
+		goto setup_fail;
+
+	/*获取远程地址*/
+	slen = sizeof(clnt->remote);
+	rc = getpeername(cfd, &clnt->remote.sock_addr, &slen);
+	if (skp_unlikely(rc))
+		goto setup_fail;
+
+#ifdef XPRT_DEBUG
+{
+	struct sock_address saddr;
+	char paddr[INET_ADDRESS_STRLEN];
+	char laddr[INET_ADDRESS_STRLEN];
+	size_t l = inet_address2sock(&lstn->lstn_address, &saddr);
+	if (skp_likely(l) && skp_likely(!sockaddr_ntop(&saddr, laddr, sizeof(laddr)))) {
+		l = inet_address2sock(&clnt->local, &saddr);
+		if (skp_likely(l) && skp_likely(!sockaddr_ntop(&saddr, paddr, sizeof(paddr)))) {
+			log_debug("create passive socket by %s : sfd [%d] -- local [%s:%u]",
+				laddr, cfd, paddr, inet_address_port(&clnt->local));
+		}
+
+		l = inet_address2sock(&clnt->remote, &saddr);
+		if (skp_likely(l) && skp_likely(!sockaddr_ntop(&saddr, paddr, sizeof(paddr)))) {
+			log_debug("create passive socket by %s : sfd [%d] -- remote [%s:%u]",
+				laddr, cfd, paddr, inet_address_port(&clnt->remote));
+		}
+	}
+}
+#endif
+
+	/*linux 没有继承标志？*/
+	xprt_tcp_setopt(cfd, &flags);
+
+	/*安装*/
+	rc = attach_xprt(xclnt, cfd, flags, xlstn->server, clntopt);
+	if (skp_unlikely(rc)) {
+		xprt_tcpserv_cooldown(xlstn);
+		goto setup_fail;
+	}
+
+	/*返回此对象，引用计数由上层管理*/
+	return xclnt;
+
+setup_fail:
+	/*除此路径，其他路径不可能知晓xprtclnt的存在，可以直接销毁*/
+	if (xchg_ptr(&clnt->lstn_xprt, NULL))
+		xprt_put(xlstn);
+	clntopt->destructor(xclnt);
+
+alloc_fail:
+	log_warn("construct or setup clnt failed : %s", strerror_local());
+	close(cfd);
+	/*TODO:安装失败都忽略错误*/
+	errno = EAGAIN;
+	return NULL;
+}
+
+/*为侦听套接字预实现的操作，仅需直接使用或包裹使用*/
+void xprt_tcpserv_recv(struct xprt *lstn, unsigned long stats)
+{
+	int rc;
+	uint32_t nr_accepts = 0;
+	struct xprt *clnt = NULL;
+
+	do {
+		if (skp_unlikely(nr_accepts >= CONFIG_MAX_ACCEPTS)) {
+			/*TODO : startup timer and try again when timer was timedout
+			 * 防止独占事件处理线程
+			 * 流控？短时间大量连接判定为攻击？
+			 * 保存上次满连接的时间戳？
+			 */
+			log_warn("!!!TOO MANY TCPXPRT CLIENT HAS "
+					 "BEEN ALREADY, COOL DOWN THIS LISTENER!!!");
+			break;
+		}
+		clnt = xprt_tcpserv_accept(lstn, stats);
+		if (skp_unlikely(!clnt)) {
+			if (skp_unlikely(errno != EAGAIN)) {
+				log_warn("listener xprt [%p] occured error : %s",
+					lstn, strerror_local());
+				shutdown_xprt(lstn, SHUT_RDWR);
+			}
+			break;
+		}
+		/*启动读，失败则立即销毁传输对象*/
+		rc = uev_stream_add(xprt_ev(clnt), EVENT_READ);
+		if (WARN_ON(rc)) {
+			destroy_xprt(clnt);
+			continue;
+		}
+		xprt_put(clnt);
+		nr_accepts++;
+	} while (1);
+
+	return;
+}
+
+void xprt_tcpserv_send(struct xprt *xprt, unsigned long stats)
+{
+	log_warn("impossible! it nerver invoke this function");
+}
+
+void xprt_tcpserv_changed(struct xprt *xprt, unsigned long stats)
+{
+	log_debug("xprt tcpserv's status has been changed : %p -> %lx",
+			  xprt, stats & XPRT_STATS_MASK);
+	return;
+}
+
+/*TODO:内存池*/
+struct xprt *xprt_tcpserv_constructor(struct server *server, unsigned long opt, void *user)
+{
+	struct xprt_tcpserv *tcpxprt = malloc(sizeof(*tcpxprt));
+	if (skp_unlikely(!tcpxprt))
+		return NULL;
+	memset(tcpxprt, 0, sizeof(*tcpxprt));
+	tcpxprt->xprt.user = user;
+	return &tcpxprt->xprt;
+}
+
+void xprt_tcpserv_destructor(struct xprt *xprt)
+{
+	struct xprt_tcpserv * tcpxprt = xprt_to_tcpserv(xprt);
+	if (skp_likely(xprt))
+		free(tcpxprt);
+}
+
+const struct xprt_operations xprt_tcpserv_ops = {
+	.constructor = xprt_tcpserv_constructor,
+	.destructor = xprt_tcpserv_destructor,
+	.do_handshake = NULL,
+	.on_recv = xprt_tcpserv_recv,
+	.on_send = xprt_tcpserv_send,
+	.on_changed = xprt_tcpserv_changed,
+	.on_shutdown = NULL,
+};
+
+/*使用已解析的地址发起连接并安装*/
+static int __create_xprt_tcpclnt(struct xprt *xprt, struct server *serv,
+	const struct resolv_result *result, unsigned long opt,
+	const struct xprt_operations *clnt_ops)
+{
+	socklen_t slen;
+	int flags, rc, sfd = 0;
+	struct xprt_tcpclnt *clnt = xprt_to_tcpclnt(xprt);
+
+	sfd = tcp_connect_inet(result->addrs, result->nr, xprt_tcp_setopt, &opt,
+			&flags, &clnt->remote);
+	if (skp_unlikely(sfd < 0)) {
+		log_warn("connecting xprt [%p] failed : %s", xprt,
+			__strerror_local(-sfd));
+		return sfd;
+	}
+
+	/*非阻塞连接的处理，紧接connect之后，防止修改errno？*/
+	if (skp_likely(opt & XPRT_OPT_NONBLOCK) && (flags == EINPROGRESS))
+		XPRT_BUG_ON(__test_and_set_bit(XPRT_CONNECTING_BIT, &opt));
+
+	/*初始化其他字段*/
+	clnt->lstn_xprt = NULL;
+
+	/*获取本地地址*/
+	slen = sizeof(clnt->local);
+	rc = getsockname(sfd, &clnt->local.sock_addr, &slen);
+	if (skp_unlikely(rc)) {
+		rc = -errno;
+		goto fail;
+	}
+
+	/*获取远程地址*/
+#ifdef XPRT_DEBUG
+{
+	struct sock_address saddr;
+	char paddr[INET_ADDRESS_STRLEN];
+	size_t l = inet_address2sock(&clnt->local, &saddr);
 	if (skp_likely(l) && skp_likely(!sockaddr_ntop(&saddr, paddr, sizeof(paddr)))) {
 		log_info("create active socket : sfd [%d] -- local [%s:%u]",
 			sfd, paddr, inet_address_port(&clnt->local));
 	}
 
-	if (!test_bit(XPRT_CONNECTING_BIT, &opt)) {
-		l = inet_address2sock(&clnt->remote, &saddr);
-		if (skp_likely(l) && skp_likely(!sockaddr_ntop(&saddr, paddr, sizeof(paddr)))) {
-			log_info("create active socket : sfd [%d] -- remote [%s:%u]",
-				sfd, paddr, inet_address_port(&clnt->remote));
+	if (!test_bit(XPRT_CONNECTING_BIT, &opt)) {
+		l = inet_address2sock(&clnt->remote, &saddr);
+		if (skp_likely(l) && skp_likely(!sockaddr_ntop(&saddr, paddr, sizeof(paddr)))) {
+			log_info("create active socket : sfd [%d] -- remote [%s:%u]",
+				sfd, paddr, inet_address_port(&clnt->remote));
+		}
+	}
+}
+#endif
+
+	/*安装*/
+	rc = attach_xprt(xprt, sfd, opt, serv, clnt_ops);
+	if (skp_unlikely(rc))
+		goto fail;
+
+	return 0;
+fail:
+	close(sfd);
+	__clear_bit(XPRT_CONNECTING_BIT, &xprt->flags);
+	return rc;
+}
+
+int create_xprt_tcpclnt(struct xprt *xprt, struct server *serv,
+	const struct service_address *addr, unsigned long opt,
+	const struct xprt_operations *clnt_ops)
+{
+	int rc;
+	struct resolv_result result;
+
+	if ((opt & XPRT_TYPE_MASK) != XPRT_TCPCLNT)
+		return -EINVAL;
+
+	rc = resolv_lookup(addr, AF_UNSPEC, &result);
+	if (skp_unlikely(rc))
+		return rc;
+
+	return __create_xprt_tcpclnt(xprt, serv, &result, opt, clnt_ops);
+}
+
+/*
+ * 为已安装但还没有描述符的非阻塞客户端设置描述符并开启事件，释放本路径的引用
+ * sfd < 0 表示解析或连接失败，使用一个未连接的套接字，由事件线程报告连接失败
+ */
+static void xprt_tcpclnt_install(struct xprt *xprt, int sfd, bool connected,
+		uint16_t ev)
+{
+	socklen_t slen;
+	bool attached = false;
+	int rc = -ECONNABORTED;
+	struct xprt_tcpclnt *clnt = xprt_to_tcpclnt(xprt);
+	struct server *serv = READ_ONCE(xprt->server);
+
+	if (skp_unlikely(sfd < 0)) {
+		connected = false;
+		memset(&clnt->remote, 0, sizeof(clnt->remote));
+		sfd = socket(AF_INET, SOCK_STREAM|SOCK_NONBLOCK|SOCK_CLOEXEC, 0);
+	}
+
+	if (skp_likely(sfd > -1)) {
+		slen = sizeof(clnt->local);
+		if (skp_unlikely(getsockname(sfd, &clnt->local.sock_addr, &slen)))
+			memset(&clnt->local, 0, sizeof(clnt->local));
+	}
+
+	if (skp_likely(serv && sfd > -1)) {
+		/*与 destroy_xprt() 竞争，已经剥离的不能再开启事件*/
+		spin_lock(&serv->lock);
+		attached = test_bit(XPRT_ATTACHED_BIT, &xprt->flags);
+		if (skp_likely(attached)) {
+			if (connected)
+				clear_bit(XPRT_CONNECTING_BIT, &xprt->flags);
+			WRITE_ONCE(xprt_ev(xprt)->fd, sfd);
+			rc = uev_stream_add(xprt_ev(xprt), ev);
+			if (skp_unlikely(rc))
+				WRITE_ONCE(xprt_ev(xprt)->fd, -1);
+		}
+		spin_unlock(&serv->lock);
+	}
+
+	if (skp_unlikely(rc)) {
+		if (sfd > -1)
+			close(sfd);
+		/*无法通知，直接销毁，同时释放本路径的引用*/
+		if (attached) {
+			LOG_XPRT_CHANGED_EVENT(xprt, ev, add);
+			destroy_xprt(xprt);
+			return;
+		}
+	}
+
+	xprt_put(xprt);
+}
+
+/*
+ * 并行连接（RFC 8305）
+ * 每隔 CONFIG_TCP_CONNECT_DELAY 毫秒，或上一个尝试失败时，向下一个地址发起
+ * 非阻塞连接，第一个可写且没有错误的连接胜出，其余的被关闭。
+ * 所有的尝试与定时器都绑定在传输对象的事件线程上，所以不需要加锁，
+ * 只有关闭路径会在其他线程上唤醒定时器，由 serv->lock 保证状态仍然有效
+ */
+struct xprt_race;
+struct xprt_race_try {
+	struct uev_stream event;
+	struct xprt_race *race;
+};
+
+struct xprt_race {
+	struct xprt *xprt;
+	struct server *serv;
+	unsigned long opt;
+	uint16_t ev;
+	uint16_t next;
+	uint16_t nr_tries;
+	int cpu;
+	int err;
+	struct uev_timer timer;
+	struct resolv_result result;
+	struct xprt_race_try tries[CONFIG_RESOLV_MAX_ADDRS];
+};
+
+static void xprt_race_finish(struct xprt_race *race, struct xprt_race_try *win)
+{
+	int sfd = -1;
+	struct xprt *xprt = race->xprt;
+	struct xprt_race_try *try;
+
+	/*此后关闭路径不会再唤醒定时器*/
+	spin_lock(&race->serv->lock);
+	xprt_to_tcpclnt(xprt)->race = NULL;
+	spin_unlock(&race->serv->lock);
+
+	/*都在本线程上，异步删除后不会再被回调*/
+	uev_timer_delete_async(&race->timer);
+	for (uint16_t i = 0; i < race->next; i++) {
+		try = &race->tries[i];
+		if (try->event.fd < 0)
+			continue;
+		uev_stream_delete_async(&try->event);
+		if (try == win) {
+			sfd = try->event.fd;
+			xprt_to_tcpclnt(xprt)->remote = race->result.addrs[i];
+		} else {
+			close(try->event.fd);
+		}
+	}
+
+	if (skp_unlikely(!win)) {
+		log_warn("racing connection of xprt [%p] failed : %s", xprt,
+			__strerror_local(-race->err));
+	}
+
+	/*仍处于连接状态，由 __eat_xprt_connecting() 确认*/
+	xprt_tcpclnt_install(xprt, sfd, false, race->ev);
+	free(race);
+}
+
+static void xprt_race_stream(struct uev_stream *, uint16_t);
+
+/*发起下一个尝试，没有可以尝试的地址并且没有进行中的尝试则结束*/
+static void xprt_race_next(struct xprt_race *race)
+{
+	int sfd, rc;
+	/*
+	 * 并行的尝试不使用 TFO，否则 connect() 立即返回成功，
+	 * 握手推迟到第一次写入，无法区分哪个地址先连通
+	 */
+	unsigned long opt = race->opt & ~XPRT_OPT_TCPFASTOPEN;
+	struct sock_address saddr;
+	struct xprt_race_try *try;
+
+	while (race->next < race->result.nr) {
+		try = &race->tries[race->next];
+		try->race = race;
+		uev_stream_init(&try->event, -1, xprt_race_stream);
+		if (skp_unlikely(!inet_address2sock(&race->result.addrs[race->next++],
+				&saddr)))
+			continue;
+
+		sfd = socket(saddr.sock_addr.sa_family, SOCK_STREAM, 0);
+		if (skp_unlikely(sfd < 0)) {
+			race->err = -errno;
+			continue;
+		}
+		xprt_tcp_setopt(sfd, &opt);
+
+		rc = connect(sfd, &saddr.sock_addr, saddr.length);
+		if (skp_unlikely(rc) && skp_unlikely(errno != EINPROGRESS)) {
+			race->err = -errno;
+			close(sfd);
+			continue;
+		}
+
+		try->event.fd = sfd;
+		uev_stream_setcpu(&try->event, race->cpu);
+		rc = uev_stream_add(&try->event, EVENT_WRITE);
+		if (skp_unlikely(rc)) {
+			race->err = rc;
+			try->event.fd = -1;
+			close(sfd);
+			continue;
+		}
+
+		race->nr_tries++;
+		if (race->next < race->result.nr)
+			uev_timer_modify(&race->timer, CONFIG_TCP_CONNECT_DELAY);
+		return;
+	}
+
+	if (!race->nr_tries)
+		xprt_race_finish(race, NULL);
+}
+
+static void xprt_race_timer(struct uev_timer *timer)
+{
+	struct xprt_race *race = container_of(timer, struct xprt_race, timer);
+
+	if (skp_unlikely(xprt_flags_closed(READ_ONCE(race->xprt->flags)))) {
+		race->err = -ECONNABORTED;
+		xprt_race_finish(race, NULL);
+		return;
+	}
+
+	xprt_race_next(race);
+}
+
+static void xprt_race_stream(struct uev_stream *stream, uint16_t mask)
+{
+	int err;
+	struct xprt_race_try *try = container_of(stream, struct xprt_race_try, event);
+	struct xprt_race *race = try->race;
+
+	if (skp_unlikely(xprt_flags_closed(READ_ONCE(race->xprt->flags)))) {
+		race->err = -ECONNABORTED;
+		xprt_race_finish(race, NULL);
+		return;
+	}
+
+	err = sockopt_get_sockerr(stream->fd);
+	if (skp_likely(!err) && skp_likely(mask & EVENT_WRITE)) {
+		xprt_race_finish(race, try);
+		return;
+	}
+
+	/*失败的尝试立即发起下一个，不再等待间隔*/
+	race->err = err ? -err : -ECONNREFUSED;
+	race->nr_tries--;
+	uev_stream_delete_async(stream);
+	close(stream->fd);
+	stream->fd = -1;
+	xprt_race_next(race);
+}
+
+/*
+ * 向多个地址并行连接，传输对象已经安装，但还没有描述符和事件
+ * 胜出的连接由 xprt_tcpclnt_install() 安装，并接管本路径持有的引用
+ */
+static int xprt_tcpclnt_race(struct xprt *xprt, const struct resolv_result *result,
+	unsigned long opt, uint16_t ev)
+{
+	int rc;
+	struct xprt_race *race;
+
+	race = malloc(sizeof(*race));
+	if (skp_unlikely(!race))
+		return -ENOMEM;
+
+	race->xprt = xprt;
+	race->serv = xprt->server;
+	race->opt = opt;
+	race->ev = ev;
+	race->next = 0;
+	race->nr_tries = 0;
+	race->err = -ECONNREFUSED;
+	race->result = *result;
+	uev_timer_init(&race->timer, xprt_race_timer);
+
+	/*所有的尝试都在传输对象的事件线程上进行*/
+	race->cpu = uev_stream_setcpu(xprt_ev(xprt), -1);
+	if (skp_unlikely(race->cpu < 0)) {
+		rc = race->cpu;
+		goto fail;
+	}
+
+	spin_lock(&race->serv->lock);
+	xprt_to_tcpclnt(xprt)->race = race;
+	spin_unlock(&race->serv->lock);
+
+	uev_timer_setcpu(&race->timer, race->cpu);
+	rc = uev_timer_add(&race->timer, 0);
+	if (skp_unlikely(rc)) {
+		spin_lock(&race->serv->lock);
+		xprt_to_tcpclnt(xprt)->race = NULL;
+		spin_unlock(&race->serv->lock);
+		goto fail;
+	}
+
+	return 0;
+fail:
+	free(race);
+	return rc;
+}
+
+/*
+ * 所有的尝试都在等待连接且没有开启间隔定时器时，只有连接完成才会检查关闭状态，
+ * 所以立即唤醒定时器，由事件线程结束所有的尝试
+ */
+static void xprt_race_cancel(struct xprt *xprt)
+{
+	struct xprt_race *race;
+	struct server *serv = READ_ONCE(xprt->server);
+	struct xprt_tcpclnt *clnt = xprt_to_tcpclnt(xprt);
+
+	if (skp_likely(!READ_ONCE(clnt->race)) || skp_unlikely(!serv) ||
+			!xprt_flags_closed(READ_ONCE(xprt->flags)))
+		return;
+
+	spin_lock(&serv->lock);
+	race = clnt->race;
+	if (race)
+		uev_timer_modify(&race->timer, 0);
+	spin_unlock(&serv->lock);
+}
+
+struct xprt_resolv {
+	struct resolv_req req;
+	struct xprt *xprt;
+	unsigned long opt;
+	uint16_t ev;
+};
+
+/*
+ * 异步解析完成，在解析线程中发起连接并开启事件，多个地址时并行连接
+ * 失败时使用一个未连接的套接字，由事件线程报告连接失败
+ */
+static void xprt_resolv_done(struct resolv_req *ptr, int err)
+{
+	int flags = 0, sfd = -1;
+	struct xprt_resolv *req = container_of(ptr, struct xprt_resolv, req);
+	struct xprt *xprt = req->xprt;
+
+	if (skp_likely(!err)) {
+		if (skp_unlikely(xprt_flags_closed(READ_ONCE(xprt->flags)))) {
+			err = -ECONNABORTED;
+		} else if (ptr->result.nr > 1) {
+			err = xprt_tcpclnt_race(xprt, &ptr->result, req->opt, req->ev);
+			if (skp_likely(!err)) {
+				free(req);
+				return;
+			}
+		} else {
+			sfd = tcp_connect_inet(ptr->result.addrs, ptr->result.nr,
+					xprt_tcp_setopt, &req->opt, &flags,
+					&xprt_to_tcpclnt(xprt)->remote);
+			err = sfd < 0 ? sfd : 0;
+		}
+	}
+
+	if (skp_unlikely(err)) {
+		log_warn("resolve or connect xprt [%p] failed : %s", xprt,
+			__strerror_local(-err));
+		sfd = -1;
+	}
+
+	xprt_tcpclnt_install(xprt, sfd, flags != EINPROGRESS, req->ev);
+	free(req);
+}
+
+/*
+ * 异步解析主机名或并行连接，期间传输对象已经安装，但还没有描述符和事件，
+ * 完成后再开启 ev 指定的事件
+ * @param cached 已经命中缓存的多个地址，为空则异步解析
+ * @return -EINPROGRESS 已发起，其他为错误
+ */
+static int xprt_tcpclnt_resolve(struct xprt *xprt, struct server *serv,
+	const struct service_address *addr, const struct resolv_result *cached,
+	unsigned long opt, const struct xprt_operations *clnt_ops, uint16_t ev)
+{
+	int rc;
+	struct xprt_resolv *req;
+	struct xprt_tcpclnt *clnt = xprt_to_tcpclnt(xprt);
+
+	req = malloc(sizeof(*req));
+	if (skp_unlikely(!req))
+		return -ENOMEM;
+
+	clnt->lstn_xprt = NULL;
+	memset(&clnt->local, 0, sizeof(clnt->local));
+	memset(&clnt->remote, 0, sizeof(clnt->remote));
+
+	rc = attach_xprt(xprt, -1, opt | XPRT_CONNECTING, serv, clnt_ops);
+	if (skp_unlikely(rc)) {
+		free(req);
+		return rc;
+	}
+
+	req->xprt = xprt_get(xprt);
+	req->opt = opt;
+	req->ev = ev;
+	if (cached) {
+		req->req.result = *cached;
+		rc = 0;
+	} else {
+		rc = resolv_async(addr, AF_UNSPEC, &req->req, xprt_resolv_done);
+	}
+	/*竞争时可能已经命中缓存，或出现错误，都在此处完成*/
+	if (rc != -EINPROGRESS)
+		xprt_resolv_done(&req->req, rc);
+	return -EINPROGRESS;
+}
+
+void shutdown_xprt_tcpclnt(struct xprt *xprt, int how)
+{
+	/*需要再次引发事件，所以不关闭事件*/
+	switch(how) {
+		case SHUT_RD:
+		case SHUT_WR:
+		case SHUT_RDWR:
+			if (shutdown_xprt_stats(xprt, how))
+				shutdown(xprt_fd(xprt), how);
+			/*并行连接时还没有描述符*/
+			xprt_race_cancel(xprt);
+			break;
+		default:
+			log_warn("unknow operation passed to shutdown : %d", how);
+	}
+}
+
+/*TODO : 内存池*/
+struct xprt *xprt_tcpclnt_constructor(struct server *server, unsigned long opt,
+		void *user)
+{
+	struct xprt_tcpclnt *xprtclnt = malloc(sizeof(*xprtclnt));
+	if (skp_unlikely(!xprtclnt))
+		return NULL;
+	memset(xprtclnt, 0, sizeof(*xprtclnt));
+	xprtclnt->xprt.user = user;
+	return &xprtclnt->xprt;
+}
+
+void xprt_tcpclnt_destructor(struct xprt *xprt)
+{
+	struct xprt_tcpclnt *xprtclnt = xprt_to_tcpclnt(xprt);
+	if (skp_likely(xprt))
+		free(xprtclnt);
+}
+
+int xprt_tcpinfo_sample(struct xprt *xprt)
+{
+#ifdef TCP_INFO
+	struct tcp_info ti;
+	struct xprt_tcpinfo *info;
+	socklen_t len = sizeof(ti);
+
+	if (WARN_ON(!xprt_is_tcpclnt(xprt)))
+		return -EINVAL;
+	/*正在解析或连接时还没有可用的描述符*/
+	if (skp_unlikely(xprt_fd(xprt) < 0))
+		return -ENOTCONN;
+
+	if (skp_unlikely(getsockopt(xprt_fd(xprt), IPPROTO_TCP, TCP_INFO, &ti, &len)))
+		return -errno;
+
+	info = &xprt_to_tcpclnt(xprt)->tcpinfo;
+	info->rtt = ti.tcpi_rtt;
+	info->rttvar = ti.tcpi_rttvar;
+	info->snd_cwnd = ti.tcpi_snd_cwnd;
+	info->snd_mss = ti.tcpi_snd_mss;
+	info->unacked = ti.tcpi_unacked;
+	info->retransmits = ti.tcpi_retransmits;
+	info->total_retrans = ti.tcpi_total_retrans;
+	info->lost = ti.tcpi_lost;
+	info->state = ti.tcpi_state;
+	WRITE_ONCE(info->stamp, similar_abstime(NULL, 0) / 1000000);
+	return 0;
+#else
+	return -EOPNOTSUPP;
+#endif
+}
+
+struct xprt *create_xprt(struct server *serv, const struct service_address *addr,
+	unsigned long opt, const struct xprt_operations *xprt_ops, void *user, ...)
+{
+	int rc;
+	uint8_t ev = 0;
+	/*获取类型*/
+	struct xprt *xprt = NULL;
+	unsigned long type = opt & XPRT_TYPE_MASK;
+
+	if (opt & XPRT_RDREADY)
+		ev |= EVENT_READ;
+	if (opt & XPRT_WRREADY)
+		ev |= EVENT_WRITE;
+
+	/*关闭事件状态*/
+	opt &= ~(XPRT_RDREADY | XPRT_WRREADY);
+
+	rc = create_xprt_check(serv, addr, opt, xprt_ops);
+	if (skp_unlikely(rc))
+		goto fail;
+
+	rc = xprt_opt_check(xprt_ops);
+	if (skp_unlikely(rc))
+		goto fail;
+
+	if (__server_has_stopped(serv)) {
+		rc = -EINTR;
+		goto fail;
+	}
+
+	/* 不一定非得是分配内存
+	 * 也有可能从 user 参数中直接回去外部定义的（静态）内存
+	 */
+	xprt = xprt_ops->constructor(serv, opt, user);
+	if (skp_unlikely(!xprt)) {
+		rc = errno ? -errno : -ENOMEM;
+		goto fail;
+	}
+
+	rc = -EINVAL;
+	switch (type) {
+		case XPRT_TCPSERV:
+		{
+			va_list ap;
+			struct xprt_operations *clnt_ops;
+
+			/*解析变参*/
+			va_start(ap, user);
+			clnt_ops = va_arg(ap, struct xprt_operations*);
+			va_end(ap);
+
+			if (WARN_ON(!clnt_ops))
+				goto descon;
+
+			rc = create_xprt_tcpserv(xprt, serv, addr, opt, xprt_ops, clnt_ops);
+			if (skp_unlikely(rc))
+				goto descon;
+			/*侦听套接字不可能被写*/
+			ev &= ~EVENT_WRITE;
+			break;
+		}
+		case XPRT_TCPCLNT:
+		{
+			struct resolv_result result;
+
+			if ((opt & XPRT_OPT_NONBLOCK)) {
+				/*非阻塞的连接不能阻塞在主机名解析上*/
+				rc = resolv_cached(addr, AF_UNSPEC, &result);
+				if (rc == -ENOENT || (!rc && result.nr > 1)) {
+					/*未命中则异步解析，多个地址则并行连接*/
+					rc = xprt_tcpclnt_resolve(xprt, serv, addr, rc ? NULL : &result,
+							opt, xprt_ops, ev);
+					/*事件在解析或连接完成后开启*/
+					if (skp_likely(rc == -EINPROGRESS))
+						return xprt;
+					goto descon;
+				}
+			} else {
+				rc = resolv_lookup(addr, AF_UNSPEC, &result);
+			}
+			if (skp_unlikely(rc))
+				goto descon;
+
+			rc = __create_xprt_tcpclnt(xprt, serv, &result, opt, xprt_ops);
+			if (skp_unlikely(rc))
+				goto descon;
+			break;
+		}
+		case XPRT_TCPTEMP:
+			log_warn("not allow create temp xprt");
+			goto descon;
+			/*TODO:其他类型，完全由构造函数初始化？*/
+		default:
+			log_warn("unknow type of xprt %p : %lu", xprt, type);
+			goto descon;
+	}
+
+	XPRT_WARN_ON(ev && !(opt & XPRT_OPT_NONBLOCK));
+	if (ev && skp_unlikely(rc = uev_stream_add(xprt_ev(xprt), ev))) {
+		/*加入了容器，其他路径能看见此对象，所以必须安全销毁*/
+		destroy_xprt(xprt);
+		goto fail;
+	}
+
+	return xprt;
+
+descon:
+	/* 不一定是释放内存，也可以是通知持有静态内存的路径
+	 * 以后框架不再被访问此传输对象*/
+	xprt_ops->destructor(xprt);
+fail:
+	errno = -rc;
+	log_debug("create [%lu] xprt fail : %s", type, strerror_local());
+	return NULL;
+}
+
+void destroy_xprt(struct xprt *xprt)
+{
+	if (skp_unlikely(!xprt))
+		return;
+
+	maybe_sleep();
+	/*
+	 * 除非将下列所有操作加锁作为原子，否则可能与 xprt.event
+	 * 事件对象的开启和禁用操作同时出发
+	 */
+	if (detach_xprt(xprt)) {
+		XPRT_BUG_ON(uref_read(&xprt->refs) < 2);
+		/*detach 成功，释放容器持有的引用*/
+		XPRT_BUG_ON(__uref_put(&xprt->refs));
+		/*直接强制关闭描述符？*/
+	} else {
+		/*detach 失败可能有其他路径操作，添加一个 栅栏，保证
+		 *@see xprt_move() 的完成，然后才能销毁
+		 */
+		barrier_xprt(xprt);
+	}
+
+	/*同步停止事件，保证不会被事件线程引用*/
+	uev_stream_delete_sync(xprt_ev(xprt));
+
+	/*尝试强制关闭xprt*/
+	/*可能已经被关闭了*/
+	if (test_and_set_bit(XPRT_CLOSED_BIT, &xprt->flags))
+		goto out;
+
+	/*使用正确的情况下不会走以下路径*/
+	do {
+		/*强制停止*/
+		bool rc;
+		unsigned long flags = READ_ONCE(xprt->flags);
+		/*因为已经设置了 closed，所以不需要有 半关闭 标志位*/
+		rc = cmpxchg(&xprt->flags, flags, flags & (~XPRT_SHUT_RDWR));
+		/*不应该有任何回调发生或状态改变*/
+		if (skp_likely(rc))
+			break;
+		XPRT_WARN_ON(!uev_stream_delete_sync(xprt_ev(xprt)));
+	} while (1);
+
+	if (__test_and_clear_bit(XPRT_CONNECTING_BIT, &xprt->flags)) {
+		/*查看是否还处于连接状态，如果是，则不调用关闭事件回调*/
+		XPRT_WARN_ON(!(xprt->flags & XPRT_OPT_NONBLOCK));
+	} else if (skp_likely(xprt_status(xprt) & XPRT_OPENED)) {
+		if (xprt_status(xprt) & XPRT_HANDSHAKED)
+			xprt_ops_call(xprt, on_shutdown, XPRT_CLOSED|EVENT_EOF);
+		/*没有触发打开，则不会触发关闭*/
+		xprt_ops_call(xprt, on_changed, XPRT_CLOSED|EVENT_EOF);
+	}
+
+out:
+	/*释放该路径对 xprt 的引用*/
+	xprt_put(xprt);
+}
+
+/*
+ * 如果是在事件线程调用，则主动关闭对应的注册事件
+ */
+void shutdown_xprt(struct xprt *xprt, int how)
+{
+	unsigned long type;
+	if (skp_unlikely(!xprt))
+		return;
+	type = xprt_type(xprt);
+	switch (type) {
+		case XPRT_TCPSERV:
+			shutdown_xprt_tcpserv(xprt, how);
+			break;
+		case XPRT_TCPCLNT:
+		case XPRT_TCPTEMP:
+			shutdown_xprt_tcpclnt(xprt, how);
+			break;
+		default:
+			log_warn("unknow type of xprt %p : %lu", xprt, type);
+	}
+	return;
+}
+
+void __xprt_put(struct uref *ptr)
+{
+	struct xprt *xprt = container_of(ptr, struct xprt, refs);
+	if (skp_likely(!in_atomic())) {
+		xprt_dict_free(xprt);
+		return;
+	}
+	rcu_free(xprt, xprt_rcu_free);
+	return;
+}
+
+void xprt_tcpclnt_init(struct xprt_tcpclnt *clnt, unsigned long flags,
+		const struct xprt_operations * ops)
+{
+	struct xprt *xprt = &clnt->xprt;
+	unsigned long type = flags & XPRT_TYPE_MASK;
+
+	/*必须有销毁函数，否则 xprt_put() 将崩溃*/
+	XPRT_BUG_ON(!ops);
+	XPRT_BUG_ON(!ops->destructor);
+
+	memset(clnt, 0, sizeof(*clnt));
+
+	if (WARN_ON(type != XPRT_TCPCLNT && type != XPRT_TCPTEMP))
+		type = XPRT_TCPCLNT;
+
+	xprt->user = NULL;
+	xprt->server = NULL;
+	xprt->xprt_ops = ops;
+	uref_init(&xprt->refs);
+	INIT_LIST_HEAD(&xprt->node);
+	xprt_timeo_init(&xprt->timeo);
+	xprt->rate = NULL;
+	/*初始化时为关闭的*/
+	xprt->flags = type | XPRT_CLOSED;
+	uev_stream_init(xprt_ev(xprt), -1, process_xprt_event);
+}
+
+static bool xprt_move(struct xprt *alias, struct xprt *src)
+{
+	int cpu = xprt_getcpu(src);
+	unsigned long flags;
+	struct server *serv = READ_ONCE(src->server);
+	if (skp_unlikely(!serv))
+		return false;
+
+	XPRT_WARN_ON(cpu == EVENT_IDX_MAX);
+	/*尽量在事件回调中调用，否则可能出现未知的错误*/
+	if (current_ev_stream() == xprt_ev(src)) {
+		xprt_event_delete(src);
+	} else {
+		log_warn("please invoke this function in event callback of xprt ...");
+		xprt_event_delete_sync(src);
+	}
+
+	/*初始化*/
+
+	/*
+	 * 如果不处于附着状态，则表明已经处于销毁流程了
+	 * 加锁来抢占 attached 位，这样可以使它优先级低于 destory_xprt()
+	 * 更好的观察到 销毁流程
+	 */
+	spin_lock(&serv->lock);
+	if (!test_and_clear_bit(XPRT_ATTACHED_BIT, &src->flags)) {
+		spin_unlock(&serv->lock);
+		return false;
+	}
+
+	alias->user = src->user;
+	alias->flags = src->flags;
+	alias->server = src->server;
+	/*如果已经设置了操作回调，则不覆盖，否则使用相同的回调集合*/
+	if (!alias->xprt_ops)
+		alias->xprt_ops = src->xprt_ops;
+
+	uref_init(&alias->refs);
+	INIT_LIST_HEAD(&alias->node);
+	xprt_timeo_init(&alias->timeo);
+	alias->rate = NULL;
+	uev_stream_init(xprt_ev(alias), xprt_fd(src), process_xprt_event);
+	uev_stream_setcpu(xprt_ev(alias), cpu);
+
+	/*剥离旧的*/
+	XPRT_BUG_ON(list_empty(&src->node));
+	XPRT_WARN_ON(src->server != serv);
+	list_del_init(&src->node);
+
+	/*原子的设置为关闭状态，并再次检查是否有其他路径同时操作
+	 *@see destroy_xprt()
+	 */
+	flags = READ_ONCE(src->flags);
+	XPRT_BUG_ON(!cmpxchg(&src->flags, flags, XPRT_CLOSED|xprt_type(src)));
+
+	/*移除原 xprt 对描述符和 管理器的引用*/
+	/*回调需要保留，因为需要释放内存*/
+	src->user = NULL;
+	src->server = NULL;
+	uev_stream_init(xprt_ev(src), -1, NULL);
+
+	/*嫁接新的*/
+	xprt_get(alias);
+	list_add_tail(&alias->node, &serv->xprt_list);
+	XPRT_BUG_ON(__test_and_set_bit(XPRT_ATTACHED_BIT, &alias->flags));
+	/* detach 成功，释放容器持有的引用
+	 * 如果引用计数为0，不能马上释放，如果当前在事件回调中，则还会解引用
+	 * @see process_xprt_event()
+	 * 在锁内可以强制一个RCU异步释放
+	 */
+	xprt_put(src);
+
+	spin_unlock(&serv->lock);
+
+	return true;
+}
+
+bool xprt_tcpclnt_move(struct xprt_tcpclnt *alias, struct xprt_tcpclnt *src)
+{
+	if (!xprt_move(&alias->xprt, &src->xprt))
+		return false;
+
+	xprt_timeo_move(&alias->xprt, &src->xprt);
+	xprt_rate_move(&alias->xprt, &src->xprt);
+
+	alias->local = src->local;
+	alias->remote = src->remote;
+	alias->priority = src->priority;
+	alias->tcpinfo = src->tcpinfo;
+	alias->lstn_xprt = xchg_ptr(&src->lstn_xprt, NULL);
+
+	return true;
+}
+
+#ifdef ENABLE_SSL
+#include <sys/uio.h>
+#include <openssl/ssl.h>
+#include <openssl/bio.h>
+#include <openssl/err.h>
+#include <openssl/pem.h>
+#include <openssl/conf.h>
+#include <openssl/rand.h>
+#include <openssl/hmac.h>
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+#include <openssl/core_names.h>
+#endif
+#include <skp/adt/hlist_table.h>
+#include <skp/utils/hash.h>
+#include <skp/utils/pbuff.h>
+
+static bool ssl_inited = false;
+static struct ssl_ctx_st *ssl_clntctx;
+static struct ssl_ctx_st *ssl_servctx;
+static struct workqueue_struct *ssl_hswq; /*异步握手的工作队列*/
+static __thread char ssl_ebuff[128];
+static int process_tlsext_host_name(SSL *ssl, int *al, void *arg);
+static void ssl_handshake_work(struct work_struct *work);
+static void ssl_session_setup(void);
+static void ssl_pbio_setup(void);
+
+static const char *ssl_default_cer = "/tmp/ssl/certs/serverCert.cer";
+static const char *ssl_default_key = "/tmp/ssl/certs/serverKey.pem";
+static const char *ssl_gen_cerkey_sh = "\
+mkdir -p /tmp/ssl/certs && \
+cd /tmp/ssl/certs && \
+openssl req -newkey rsa:2048 -nodes -keyout serverKey.pem \
+-x509 -days 365 -out serverCert.cer \
+-subj \"/C=CN/ST=SH/L=SH/O=skp.default.cert/OU=skp.default.key\" && \
+cd -";
+
+static void __ssl_init_env(void)
+{
+	big_lock();
+
+	if (skp_unlikely(ssl_inited)) {
+		big_unlock();
+		return;
+	}
+
+	if (access(ssl_default_cer, R_OK) || access(ssl_default_key, R_OK)) {
+		log_error("please usage like this :\n\n%s\n\n"
+			"to generate default certificate file and private key file\n",
+			ssl_gen_cerkey_sh);
+		abort();
+	}
+
+	/*初始化环境*/
+	OPENSSL_config(NULL);
+	RAND_poll();
+	SSL_library_init();
+	SSL_load_error_strings();
+	ERR_load_crypto_strings();
+	OpenSSL_add_all_algorithms();
+
+	/*创建默认的服务器和客户端上下文*/
+	ssl_clntctx = SSL_CTX_new(SSLv23_client_method());
+	ssl_servctx = SSL_CTX_new(SSLv23_server_method());
+	if (skp_likely(ssl_clntctx)) {
+		SSL_CTX_set_read_ahead(ssl_clntctx, 1);
+		SSL_CTX_set_verify(ssl_servctx, SSL_VERIFY_NONE, NULL);
+	}
+	if (skp_likely(ssl_servctx)) {
+		int rc;
+		SSL_CTX_set_read_ahead(ssl_servctx, 1);
+		rc = SSL_CTX_use_certificate_file(ssl_servctx, ssl_default_cer,
+					SSL_FILETYPE_PEM);
+		if (skp_unlikely(rc!=1)) {
+			log_error("load certificate file [%s] failed : %s",
+									ssl_default_cer, ssl_stack_error());
+			abort();
+		}
+		rc = SSL_CTX_use_PrivateKey_file(ssl_servctx, ssl_default_key,
+					SSL_FILETYPE_PEM);
+		if (skp_unlikely(rc!=1)) {
+			log_error("user private key file [%s] failed : %s",
+									ssl_default_key, ssl_stack_error());
+			abort();
+		}
+		rc = SSL_CTX_check_private_key(ssl_servctx);
+		if (skp_unlikely(rc!=1)) {
+			log_error("check private key failed : %s", ssl_stack_error());
+			abort();
 		}
+		SSL_CTX_set_tlsext_servername_callback(ssl_servctx,
+			process_tlsext_host_name);
+	}
+
+	/*会话缓存与票据*/
+	if (skp_likely(ssl_clntctx && ssl_servctx))
+		ssl_session_setup();
+	ssl_pbio_setup();
+
+	WRITE_ONCE(ssl_inited, true);
+	big_unlock();
+
+	if (skp_unlikely(!ssl_clntctx)) {
+		log_warn("initial SSL_CTX for client failed : %s", ssl_stack_error());
+		abort();
+	}
+	if (skp_unlikely(!ssl_servctx)) {
+		log_warn("initial SSL_CTX for server failed : %s", ssl_stack_error());
+		abort();
 	}
 }
+
+static inline void ssl_init_env(void)
+{
+	if (skp_likely(READ_ONCE(ssl_inited)))
+		return;
+	__ssl_init_env();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// 会话复用
+// 1. 服务器端：分片的会话缓存（会话 ID）与轮换的票据密钥（无状态票据）
+// 2. 客户端：以上游地址（加 SNI）为键的会话存储，连接时尝试复用
+////////////////////////////////////////////////////////////////////////////////
+
+/*缓存分片数量，必须是 2 的幂*/
+#ifndef CONFIG_SSL_SESS_SHARDS
+# define CONFIG_SSL_SESS_SHARDS (16)
 #endif
 
-	/*安装*/
-	rc = attach_xprt(xprt, sfd, opt, serv, clnt_ops);
-	if (skp_unlikely(rc))
-		goto fail;
+/*每个分片的最大会话数量，超过则淘汰最旧的*/
+#ifndef CONFIG_SSL_SESS_SHARD_MAX
+# define CONFIG_SSL_SESS_SHARD_MAX (4096)
+#endif
 
-	return 0;
-fail:
-	close(sfd);
-	__clear_bit(XPRT_CONNECTING_BIT, &xprt->flags);
-	return rc;
+/*会话的有效期，秒*/
+#ifndef CONFIG_SSL_SESS_TTL
+# define CONFIG_SSL_SESS_TTL (300)
+#endif
+
+/*票据密钥的轮换周期，秒，同时保留的密钥数量决定旧票据的有效期*/
+#ifndef CONFIG_SSL_TICKET_ROTATE
+# define CONFIG_SSL_TICKET_ROTATE (3600)
+#endif
+
+#ifndef CONFIG_SSL_TICKET_KEYS
+# define CONFIG_SSL_TICKET_KEYS (3)
+#endif
+
+#define SSL_SESS_BUCKETS (64)
+/*客户端的键：地址族、端口、地址与完整的 SNI，openssl 拒绝更长的主机名*/
+#define SSL_CLNT_KEYLEN (2 + 2 + 16 + TLSEXT_MAXLEN_host_name)
+
+struct ssl_sess_entry {
+	struct hlist_node hnode;
+	struct list_head lru; /*按照插入的顺序，即过期的顺序*/
+	time_t expires;
+	uint32_t hash;
+	uint32_t klen;
+	SSL_SESSION *sess;
+	uint8_t key[0];
+};
+
+struct ssl_sess_shard {
+	spinlock_t lock;
+	uint32_t nr;
+	struct list_head lru;
+	struct hlist_head table[SSL_SESS_BUCKETS];
+} __cacheline_aligned;
+
+struct ssl_sess_cache {
+	struct ssl_sess_shard shards[CONFIG_SSL_SESS_SHARDS];
+};
+
+static struct ssl_sess_cache ssl_serv_sessions;
+static struct ssl_sess_cache ssl_clnt_sessions;
+
+static void ssl_sess_cache_init(struct ssl_sess_cache *cache)
+{
+	for (int i = 0; i < CONFIG_SSL_SESS_SHARDS; i++) {
+		struct ssl_sess_shard *shard = &cache->shards[i];
+		spin_lock_init(&shard->lock);
+		shard->nr = 0;
+		INIT_LIST_HEAD(&shard->lru);
+		for (int j = 0; j < SSL_SESS_BUCKETS; j++)
+			INIT_HLIST_HEAD(&shard->table[j]);
+	}
 }
 
-void shutdown_xprt_tcpclnt(struct xprt *xprt, int how)
+static inline struct ssl_sess_shard *
+ssl_sess_shard(struct ssl_sess_cache *cache, uint32_t hash)
 {
-	/*需要再次引发事件，所以不关闭事件*/
-	switch(how) {
-		case SHUT_RD:
-		case SHUT_WR:
-		case SHUT_RDWR:
-			if (shutdown_xprt_stats(xprt, how))
-				shutdown(xprt_fd(xprt), how);
-			break;
-		default:
-			log_warn("unknow operation passed to shutdown : %d", how);
+	return &cache->shards[hash & (CONFIG_SSL_SESS_SHARDS - 1)];
+}
+
+static inline struct hlist_head *
+ssl_sess_bucket(struct ssl_sess_shard *shard, uint32_t hash)
+{
+	/*低位用于选择分片*/
+	return &shard->table[(hash >> ilog2(CONFIG_SSL_SESS_SHARDS)) &
+		(SSL_SESS_BUCKETS - 1)];
+}
+
+/*在锁内摘除，锁外释放*/
+static inline void ssl_sess_unlink(struct ssl_sess_shard *shard,
+		struct ssl_sess_entry *entry, struct list_head *dead)
+{
+	hlist_del(&entry->hnode);
+	list_move(&entry->lru, dead);
+	shard->nr--;
+}
+
+static void ssl_sess_free_list(struct list_head *dead)
+{
+	struct ssl_sess_entry *entry, *n;
+	list_for_each_entry_safe(entry, n, dead, lru) {
+		SSL_SESSION_free(entry->sess);
+		free(entry);
 	}
 }
 
-/*TODO : 内存池*/
-struct xprt *xprt_tcpclnt_constructor(struct server *server, unsigned long opt,
-		void *user)
+static struct ssl_sess_entry *ssl_sess_lookup_locked(struct ssl_sess_shard *shard,
+		const uint8_t *key, uint32_t klen, uint32_t hash)
 {
-	struct xprt_tcpclnt *xprtclnt = malloc(sizeof(*xprtclnt));
-	if (skp_unlikely(!xprtclnt))
-		return NULL;
-	memset(xprtclnt, 0, sizeof(*xprtclnt));
-	xprtclnt->xprt.user = user;
-	return &xprtclnt->xprt;
+	struct ssl_sess_entry *entry;
+	hlist_for_each_entry(entry, ssl_sess_bucket(shard, hash), hnode) {
+		if (entry->hash == hash && entry->klen == klen &&
+				!memcmp(entry->key, key, klen))
+			return entry;
+	}
+	return NULL;
 }
 
-void xprt_tcpclnt_destructor(struct xprt *xprt)
+/*插入会话，接管 sess 的一个引用*/
+static void ssl_sess_insert(struct ssl_sess_cache *cache, const uint8_t *key,
+		uint32_t klen, SSL_SESSION *sess)
 {
-	struct xprt_tcpclnt *xprtclnt = xprt_to_tcpclnt(xprt);
-	if (skp_likely(xprt))
-		free(xprtclnt);
+	LIST__HEAD(dead);
+	time_t now = time(NULL);
+	uint32_t hash = jhash(key, klen, 0);
+	struct ssl_sess_shard *shard = ssl_sess_shard(cache, hash);
+	struct ssl_sess_entry *entry, *old;
+
+	entry = malloc(sizeof(*entry) + klen);
+	if (skp_unlikely(!entry)) {
+		SSL_SESSION_free(sess);
+		return;
+	}
+
+	entry->hash = hash;
+	entry->klen = klen;
+	entry->sess = sess;
+	entry->expires = now + CONFIG_SSL_SESS_TTL;
+	memcpy(entry->key, key, klen);
+
+	spin_lock(&shard->lock);
+	/*替换旧的*/
+	old = ssl_sess_lookup_locked(shard, key, klen, hash);
+	if (old)
+		ssl_sess_unlink(shard, old, &dead);
+	/*淘汰过期的和超出容量的*/
+	while ((old = list_first_entry_or_null(&shard->lru,
+				struct ssl_sess_entry, lru))) {
+		if (old->expires > now && shard->nr < CONFIG_SSL_SESS_SHARD_MAX)
+			break;
+		ssl_sess_unlink(shard, old, &dead);
+	}
+	hlist_add_head(&entry->hnode, ssl_sess_bucket(shard, hash));
+	list_add_tail(&entry->lru, &shard->lru);
+	shard->nr++;
+	spin_unlock(&shard->lock);
+
+	ssl_sess_free_list(&dead);
 }
 
-struct xprt *create_xprt(struct server *serv, const struct service_address *addr,
-	unsigned long opt, const struct xprt_operations *xprt_ops, void *user, ...)
+/*
+ * 查找会话，返回的会话已增加引用计数
+ * TLSv1.3 的票据是一次性的（RFC 8446 C.4），如果 once 为真则同时移除
+ */
+static SSL_SESSION *ssl_sess_find(struct ssl_sess_cache *cache,
+		const uint8_t *key, uint32_t klen, bool once)
 {
-	int rc;
-	uint8_t ev = 0;
-	/*获取类型*/
-	struct xprt *xprt = NULL;
-	unsigned long type = opt & XPRT_TYPE_MASK;
+	LIST__HEAD(dead);
+	SSL_SESSION *sess = NULL;
+	uint32_t hash = jhash(key, klen, 0);
+	struct ssl_sess_shard *shard = ssl_sess_shard(cache, hash);
+	struct ssl_sess_entry *entry;
+
+	spin_lock(&shard->lock);
+	entry = ssl_sess_lookup_locked(shard, key, klen, hash);
+	if (entry) {
+		if (entry->expires > time(NULL) &&
+				SSL_SESSION_is_resumable(entry->sess)) {
+			sess = entry->sess;
+			SSL_SESSION_up_ref(sess);
+			if (once && SSL_SESSION_get_protocol_version(sess) >= TLS1_3_VERSION)
+				ssl_sess_unlink(shard, entry, &dead);
+		} else {
+			ssl_sess_unlink(shard, entry, &dead);
+		}
+	}
+	spin_unlock(&shard->lock);
 
-	if (opt & XPRT_RDREADY)
-		ev |= EVENT_READ;
-	if (opt & XPRT_WRREADY)
-		ev |= EVENT_WRITE;
+	ssl_sess_free_list(&dead);
+	return sess;
+}
 
-	/*关闭事件状态*/
-	opt &= ~(XPRT_RDREADY | XPRT_WRREADY);
+static void ssl_sess_remove(struct ssl_sess_cache *cache, const uint8_t *key,
+		uint32_t klen)
+{
+	LIST__HEAD(dead);
+	uint32_t hash = jhash(key, klen, 0);
+	struct ssl_sess_shard *shard = ssl_sess_shard(cache, hash);
+	struct ssl_sess_entry *entry;
+
+	spin_lock(&shard->lock);
+	entry = ssl_sess_lookup_locked(shard, key, klen, hash);
+	if (entry)
+		ssl_sess_unlink(shard, entry, &dead);
+	spin_unlock(&shard->lock);
+
+	ssl_sess_free_list(&dead);
+}
 
-	rc = create_xprt_check(serv, addr, opt, xprt_ops);
-	if (skp_unlikely(rc))
-		goto fail;
+/*服务器端的会话 ID 缓存*/
+static int ssl_serv_sess_new(SSL *ssl, SSL_SESSION *sess)
+{
+	unsigned int len;
+	const uint8_t *id = SSL_SESSION_get_id(sess, &len);
+	if (skp_unlikely(!len))
+		return 0;
+	ssl_sess_insert(&ssl_serv_sessions, id, len, sess);
+	/*接管了引用*/
+	return 1;
+}
 
-	rc = xprt_opt_check(xprt_ops);
-	if (skp_unlikely(rc))
-		goto fail;
+static SSL_SESSION *ssl_serv_sess_get(SSL *ssl, const unsigned char *id,
+		int len, int *copy)
+{
+	/*已经增加了引用计数*/
+	*copy = 0;
+	return ssl_sess_find(&ssl_serv_sessions, id, len, false);
+}
 
-	if (__server_has_stopped(serv)) {
-		rc = -EINTR;
-		goto fail;
+static void ssl_serv_sess_remove(SSL_CTX *ctx, SSL_SESSION *sess)
+{
+	unsigned int len;
+	const uint8_t *id = SSL_SESSION_get_id(sess, &len);
+	if (skp_likely(len))
+		ssl_sess_remove(&ssl_serv_sessions, id, len);
+}
+
+/*客户端以上游的地址和 SNI 为键*/
+static uint32_t ssl_clnt_sess_key(const struct xprt_ssl *xptssl, uint8_t *key)
+{
+	uint32_t klen = 0;
+	const union inet_address *addr = &xptssl->tcp.remote;
+	const char *host = xptssl->tlsext_host_name;
+	uint16_t family = addr->sock_addr.sa_family;
+
+	memcpy(key, &family, sizeof(family));
+	klen += sizeof(family);
+	if (family == AF_INET) {
+		memcpy(key + klen, &addr->sin_addr.sin_port, 2);
+		memcpy(key + klen + 2, &addr->sin_addr.sin_addr, 4);
+		klen += 6;
+	} else if (family == AF_INET6) {
+		memcpy(key + klen, &addr->sin6_addr.sin6_port, 2);
+		memcpy(key + klen + 2, &addr->sin6_addr.sin6_addr, 16);
+		klen += 18;
+	} else {
+		return 0;
 	}
 
-	/* 不一定非得是分配内存
-	 * 也有可能从 user 参数中直接回去外部定义的（静态）内存
-	 */
-	xprt = xprt_ops->constructor(serv, opt, user);
-	if (skp_unlikely(!xprt)) {
-		rc = errno ? -errno : -ENOMEM;
-		goto fail;
+	/*截断会导致前缀相同的主机名复用错误的会话*/
+	if (host) {
+		size_t l = strlen(host);
+		if (skp_unlikely(l > TLSEXT_MAXLEN_host_name))
+			return 0;
+		memcpy(key + klen, host, l);
+		klen += l;
 	}
+	return klen;
+}
 
-	rc = -EINVAL;
-	switch (type) {
-		case XPRT_TCPSERV:
-		{
-			va_list ap;
-			struct xprt_operations *clnt_ops;
+static int ssl_clnt_sess_new(SSL *ssl, SSL_SESSION *sess)
+{
+	uint32_t klen;
+	uint8_t key[SSL_CLNT_KEYLEN];
+	struct xprt_ssl *xptssl = SSL_get_app_data(ssl);
 
-			/*解析变参*/
-			va_start(ap, user);
-			clnt_ops = va_arg(ap, struct xprt_operations*);
-			va_end(ap);
+	if (skp_unlikely(!xptssl || !SSL_SESSION_is_resumable(sess)))
+		return 0;
+	klen = ssl_clnt_sess_key(xptssl, key);
+	if (skp_unlikely(!klen))
+		return 0;
+	ssl_sess_insert(&ssl_clnt_sessions, key, klen, sess);
+	return 1;
+}
 
-			if (WARN_ON(!clnt_ops))
-				goto descon;
+/*客户端握手前，尝试复用该上游的会话*/
+static void ssl_clnt_sess_resume(struct xprt_ssl *xptssl)
+{
+	uint32_t klen;
+	uint8_t key[SSL_CLNT_KEYLEN];
+	SSL_SESSION *sess;
 
-			rc = create_xprt_tcpserv(xprt, serv, addr, opt, xprt_ops, clnt_ops);
-			if (skp_unlikely(rc))
-				goto descon;
-			/*侦听套接字不可能被写*/
-			ev &= ~EVENT_WRITE;
-			break;
-		}
-		case XPRT_TCPCLNT:
-			rc = create_xprt_tcpclnt(xprt, serv, addr, opt, xprt_ops);
-			if (skp_unlikely(rc))
-				goto descon;
-			break;
-		case XPRT_TCPTEMP:
-			log_warn("not allow create temp xprt");
-			goto descon;
-			/*TODO:其他类型，完全由构造函数初始化？*/
-		default:
-			log_warn("unknow type of xprt %p : %lu", xprt, type);
-			goto descon;
+	klen = ssl_clnt_sess_key(xptssl, key);
+	if (skp_unlikely(!klen))
+		return;
+	sess = ssl_sess_find(&ssl_clnt_sessions, key, klen, true);
+	if (!sess)
+		return;
+	if (WARN_ON(SSL_set_session(xptssl->ssl, sess) != 1))
+		ssl_stack_error_clear();
+	SSL_SESSION_free(sess);
+}
+
+/*票据密钥，使用当前密钥加密，保留的旧密钥仍可以解密*/
+struct ssl_ticket_key {
+	uint8_t name[16];
+	uint8_t aes_key[32];
+	uint8_t hmac_key[32];
+	time_t created;
+};
+
+static struct {
+	spinlock_t lock;
+	int current;
+	struct ssl_ticket_key keys[CONFIG_SSL_TICKET_KEYS];
+} ssl_tickets;
+
+static bool ssl_ticket_key_gen(struct ssl_ticket_key *key, time_t now)
+{
+	if (skp_unlikely(RAND_bytes(key->name, sizeof(key->name)) != 1 ||
+			RAND_bytes(key->aes_key, sizeof(key->aes_key)) != 1 ||
+			RAND_bytes(key->hmac_key, sizeof(key->hmac_key)) != 1)) {
+		log_warn("generate ticket key failed : %s", ssl_stack_error());
+		return false;
 	}
+	key->created = now;
+	return true;
+}
 
-	XPRT_WARN_ON(ev && !(opt & XPRT_OPT_NONBLOCK));
-	if (ev && skp_unlikely(rc = uev_stream_add(xprt_ev(xprt), ev))) {
-		/*加入了容器，其他路径能看见此对象，所以必须安全销毁*/
-		destroy_xprt(xprt);
-		goto fail;
+/*获取用于加密的当前密钥，到期则轮换*/
+static bool ssl_ticket_key_current(struct ssl_ticket_key *key)
+{
+	int cur;
+	bool rotated = false;
+	time_t now = time(NULL);
+	struct ssl_ticket_key fresh;
+
+	spin_lock(&ssl_tickets.lock);
+	*key = ssl_tickets.keys[ssl_tickets.current];
+	spin_unlock(&ssl_tickets.lock);
+
+	if (skp_likely(now - key->created < CONFIG_SSL_TICKET_ROTATE))
+		return true;
+
+	/*RAND_bytes() 可能耗时较长，在锁外生成新密钥*/
+	if (skp_unlikely(!ssl_ticket_key_gen(&fresh, now)))
+		return !!key->created;
+
+	spin_lock(&ssl_tickets.lock);
+	cur = ssl_tickets.current;
+	/*其他线程可能已经轮换过了*/
+	if (now - ssl_tickets.keys[cur].created >= CONFIG_SSL_TICKET_ROTATE) {
+		cur = (cur + 1) % CONFIG_SSL_TICKET_KEYS;
+		ssl_tickets.keys[cur] = fresh;
+		ssl_tickets.current = cur;
+		rotated = true;
 	}
+	*key = ssl_tickets.keys[cur];
+	spin_unlock(&ssl_tickets.lock);
+
+	if (rotated)
+		log_debug("ssl ticket key has been rotated");
+	return true;
+}
+
+/*根据名称查找用于解密的密钥，返回 1 当前密钥，2 旧密钥需要更新票据，0 没找到*/
+static int ssl_ticket_key_find(const uint8_t *name, struct ssl_ticket_key *key)
+{
+	int rc = 0;
+	time_t now = time(NULL);
 
-	return xprt;
+	spin_lock(&ssl_tickets.lock);
+	for (int i = 0; i < CONFIG_SSL_TICKET_KEYS; i++) {
+		struct ssl_ticket_key *k = &ssl_tickets.keys[i];
+		if (!k->created || memcmp(k->name, name, sizeof(k->name)))
+			continue;
+		/*超出保留期*/
+		if (now - k->created >= CONFIG_SSL_TICKET_ROTATE * CONFIG_SSL_TICKET_KEYS)
+			break;
+		*key = *k;
+		rc = (i == ssl_tickets.current) ? 1 : 2;
+		break;
+	}
+	spin_unlock(&ssl_tickets.lock);
 
-descon:
-	/* 不一定是释放内存，也可以是通知持有静态内存的路径
-	 * 以后框架不再被访问此传输对象*/
-	xprt_ops->destructor(xprt);
-fail:
-	errno = -rc;
-	log_debug("create [%lu] xprt fail : %s", type, strerror_local());
-	return NULL;
+	return rc;
 }
 
-void destroy_xprt(struct xprt *xprt)
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+static int ssl_ticket_key_cb(SSL *ssl, unsigned char *name, unsigned char *iv,
+		EVP_CIPHER_CTX *ectx, EVP_MAC_CTX *hctx, int enc)
 {
-	if (skp_unlikely(!xprt))
-		return;
-
-	maybe_sleep();
-	/*
-	 * 除非将下列所有操作加锁作为原子，否则可能与 xprt.event
-	 * 事件对象的开启和禁用操作同时出发
-	 */
-	if (detach_xprt(xprt)) {
-		XPRT_BUG_ON(uref_read(&xprt->refs) < 2);
-		/*detach 成功，释放容器持有的引用*/
-		XPRT_BUG_ON(__uref_put(&xprt->refs));
-		/*直接强制关闭描述符？*/
+	int rc = 1;
+	struct ssl_ticket_key key;
+	OSSL_PARAM params[3];
+
+	if (enc) {
+		if (skp_unlikely(!ssl_ticket_key_current(&key)))
+			return -1;
+		if (skp_unlikely(RAND_bytes(iv, EVP_MAX_IV_LENGTH) != 1))
+			return -1;
+		memcpy(name, key.name, sizeof(key.name));
+		if (skp_unlikely(!EVP_EncryptInit_ex(ectx, EVP_aes_256_cbc(), NULL,
+				key.aes_key, iv)))
+			return -1;
 	} else {
-		/*detach 失败可能有其他路径操作，添加一个 栅栏，保证
-		 *@see xprt_move() 的完成，然后才能销毁
-		 */
-		barrier_xprt(xprt);
+		rc = ssl_ticket_key_find(name, &key);
+		if (!rc)
+			return 0;
+		/*TLSv1.3 客户端的票据是一次性的，复用后需要签发新票据*/
+		if (SSL_version(ssl) >= TLS1_3_VERSION)
+			rc = 2;
+		if (skp_unlikely(!EVP_DecryptInit_ex(ectx, EVP_aes_256_cbc(), NULL,
+				key.aes_key, iv)))
+			return -1;
 	}
 
-	/*同步停止事件，保证不会被事件线程引用*/
-	uev_stream_delete_sync(xprt_ev(xprt));
+	params[0] = OSSL_PARAM_construct_octet_string(OSSL_MAC_PARAM_KEY,
+		key.hmac_key, sizeof(key.hmac_key));
+	params[1] = OSSL_PARAM_construct_utf8_string(OSSL_MAC_PARAM_DIGEST,
+		"sha256", 0);
+	params[2] = OSSL_PARAM_construct_end();
+	if (skp_unlikely(!EVP_MAC_CTX_set_params(hctx, params)))
+		return -1;
 
-	/*尝试强制关闭xprt*/
-	/*可能已经被关闭了*/
-	if (test_and_set_bit(XPRT_CLOSED_BIT, &xprt->flags))
-		goto out;
+	return rc;
+}
+#else
+static int ssl_ticket_key_cb(SSL *ssl, unsigned char *name, unsigned char *iv,
+		EVP_CIPHER_CTX *ectx, HMAC_CTX *hctx, int enc)
+{
+	int rc = 1;
+	struct ssl_ticket_key key;
+
+	if (enc) {
+		if (skp_unlikely(!ssl_ticket_key_current(&key)))
+			return -1;
+		if (skp_unlikely(RAND_bytes(iv, EVP_MAX_IV_LENGTH) != 1))
+			return -1;
+		memcpy(name, key.name, sizeof(key.name));
+		if (skp_unlikely(!EVP_EncryptInit_ex(ectx, EVP_aes_256_cbc(), NULL,
+				key.aes_key, iv)))
+			return -1;
+	} else {
+		rc = ssl_ticket_key_find(name, &key);
+		if (!rc)
+			return 0;
+		/*TLSv1.3 客户端的票据是一次性的，复用后需要签发新票据*/
+		if (SSL_version(ssl) >= TLS1_3_VERSION)
+			rc = 2;
+		if (skp_unlikely(!EVP_DecryptInit_ex(ectx, EVP_aes_256_cbc(), NULL,
+				key.aes_key, iv)))
+			return -1;
+	}
 
-	/*使用正确的情况下不会走以下路径*/
-	do {
-		/*强制停止*/
-		bool rc;
-		unsigned long flags = READ_ONCE(xprt->flags);
-		/*因为已经设置了 closed，所以不需要有 半关闭 标志位*/
-		rc = cmpxchg(&xprt->flags, flags, flags & (~XPRT_SHUT_RDWR));
-		/*不应该有任何回调发生或状态改变*/
-		if (skp_likely(rc))
-			break;
-		XPRT_WARN_ON(!uev_stream_delete_sync(xprt_ev(xprt)));
-	} while (1);
+	if (skp_unlikely(!HMAC_Init_ex(hctx, key.hmac_key, sizeof(key.hmac_key),
+			EVP_sha256(), NULL)))
+		return -1;
 
-	if (__test_and_clear_bit(XPRT_CONNECTING_BIT, &xprt->flags)) {
-		/*查看是否还处于连接状态，如果是，则不调用关闭事件回调*/
-		XPRT_WARN_ON(!(xprt->flags & XPRT_OPT_NONBLOCK));
-	} else if (skp_likely(xprt_status(xprt) & XPRT_OPENED)) {
-		if (xprt_status(xprt) & XPRT_HANDSHAKED)
-			xprt_ops_call(xprt, on_shutdown, XPRT_CLOSED|EVENT_EOF);
-		/*没有触发打开，则不会触发关闭*/
-		xprt_ops_call(xprt, on_changed, XPRT_CLOSED|EVENT_EOF);
-	}
+	return rc;
+}
+#endif
 
-out:
-	/*释放该路径对 xprt 的引用*/
-	xprt_put(xprt);
+/*在 big_lock() 内调用*/
+static void ssl_session_setup(void)
+{
+	static const unsigned char sid_ctx[] = "skp";
+
+	ssl_sess_cache_init(&ssl_serv_sessions);
+	ssl_sess_cache_init(&ssl_clnt_sessions);
+
+	spin_lock_init(&ssl_tickets.lock);
+	ssl_tickets.current = 0;
+	if (!ssl_ticket_key_gen(&ssl_tickets.keys[0], time(NULL)))
+		SSL_CTX_set_options(ssl_servctx, SSL_OP_NO_TICKET);
+
+	/*服务器端使用外部的分片缓存*/
+	SSL_CTX_set_session_id_context(ssl_servctx, sid_ctx, sizeof(sid_ctx) - 1);
+	SSL_CTX_set_session_cache_mode(ssl_servctx, SSL_SESS_CACHE_SERVER |
+		SSL_SESS_CACHE_NO_INTERNAL);
+	SSL_CTX_set_timeout(ssl_servctx, CONFIG_SSL_SESS_TTL);
+	SSL_CTX_sess_set_new_cb(ssl_servctx, ssl_serv_sess_new);
+	SSL_CTX_sess_set_get_cb(ssl_servctx, ssl_serv_sess_get);
+	SSL_CTX_sess_set_remove_cb(ssl_servctx, ssl_serv_sess_remove);
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+	SSL_CTX_set_tlsext_ticket_key_evp_cb(ssl_servctx, ssl_ticket_key_cb);
+#else
+	SSL_CTX_set_tlsext_ticket_key_cb(ssl_servctx, ssl_ticket_key_cb);
+#endif
+
+	/*客户端只需要获取新会话的通知*/
+	SSL_CTX_set_session_cache_mode(ssl_clntctx, SSL_SESS_CACHE_CLIENT |
+		SSL_SESS_CACHE_NO_INTERNAL_STORE);
+	SSL_CTX_sess_set_new_cb(ssl_clntctx, ssl_clnt_sess_new);
 }
 
 /*
- * 如果是在事件线程调用，则主动关闭对应的注册事件
+ * 内核 TLS 卸载，由 openssl 在设置密钥时通过 setsockopt(SOL_TLS) 完成，
+ * 需要 openssl 3.x 编译时开启 ktls，且内核加载了 tls 模块，
+ * 不支持的算法套件会静默的保持用户态加解密
  */
-void shutdown_xprt(struct xprt *xprt, int how)
+#if defined(SSL_OP_ENABLE_KTLS) && !defined(OPENSSL_NO_KTLS)
+# define XPRT_SSL_HAVE_KTLS
+#endif
+
+static inline void ssl_check_ktls(struct xprt_ssl *xptssl)
 {
-	unsigned long type;
-	if (skp_unlikely(!xprt))
-		return;
-	type = xprt_type(xprt);
-	switch (type) {
-		case XPRT_TCPSERV:
-			shutdown_xprt_tcpserv(xprt, how);
-			break;
-		case XPRT_TCPCLNT:
-		case XPRT_TCPTEMP:
-			shutdown_xprt_tcpclnt(xprt, how);
-			break;
-		default:
-			log_warn("unknow type of xprt %p : %lu", xprt, type);
-	}
-	return;
+	int ktls = 0;
+#ifdef XPRT_SSL_HAVE_KTLS
+	if (BIO_get_ktls_send(SSL_get_wbio(xptssl->ssl)))
+		ktls |= XPRT_SSL_KTLS_TX;
+	if (BIO_get_ktls_recv(SSL_get_rbio(xptssl->ssl)))
+		ktls |= XPRT_SSL_KTLS_RX;
+	if (ktls)
+		log_debug("xprt [%p] offload to kTLS : %c%c, cipher [%s]",
+			&xptssl->tcp.xprt, (ktls & XPRT_SSL_KTLS_TX) ? 'T' : '_',
+			(ktls & XPRT_SSL_KTLS_RX) ? 'R' : '_',
+			SSL_get_cipher_name(xptssl->ssl));
+#endif
+	WRITE_ONCE(xptssl->ktls, ktls);
 }
 
-void __xprt_put(struct uref *ptr)
+static struct workqueue_struct *__ssl_hswq_init(void)
 {
-	struct xprt *xprt = container_of(ptr, struct xprt, refs);
-	if (skp_likely(!in_atomic())) {
-		xprt_dict_free(xprt);
-		return;
+	struct workqueue_struct *wq, *old;
+
+	wq = alloc_workqueue("ssl_handshake", WQ_UNBOUND, 0);
+	if (WARN_ON(!wq))
+		return NULL;
+	old = cmpxchg_val_ptr(&ssl_hswq, NULL, wq);
+	if (skp_unlikely(old)) {
+		destroy_workqueue(wq);
+		return old;
 	}
-	rcu_free(xprt, xprt_rcu_free);
-	return;
+	return wq;
 }
 
-void xprt_tcpclnt_init(struct xprt_tcpclnt *clnt, unsigned long flags,
-		const struct xprt_operations * ops)
+static inline struct workqueue_struct *ssl_hswq_init(void)
 {
-	struct xprt *xprt = &clnt->xprt;
-	unsigned long type = flags & XPRT_TYPE_MASK;
+	struct workqueue_struct *wq = READ_ONCE(ssl_hswq);
+	if (skp_likely(wq))
+		return wq;
+	return __ssl_hswq_init();
+}
 
-	/*必须有销毁函数，否则 xprt_put() 将崩溃*/
-	XPRT_BUG_ON(!ops);
-	XPRT_BUG_ON(!ops->destructor);
+/*
+ * 基于 pbuff 发送链的 BIO
+ * 写：openssl 总是在自己的写缓存中加密，没有接口让它直接加密到分片的尾部空间中，
+ *     所以发送链为空时，密文直接从 openssl 的写缓存发出，不做拷贝；
+ *     只有套接字未接受的部分才追加到发送链，之后的记录也追加以保证顺序，
+ *     积压的分片在写就绪时使用一次 writev 发出，写入者不需要以相同的参数重试
+ *     真正的零拷贝需要内核卸载 @see XPRT_OPT_KTLS
+ * 读：直接读入 openssl 的记录缓存，配合预读，一次 read 可以获取多个记录
+ */
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+# define XPRT_SSL_HAVE_PBIO
+#endif
 
-	memset(clnt, 0, sizeof(*clnt));
+/*
+ * 将发送链中的数据通过一次 writev 发出
+ * @return 0 全部发出，-EAGAIN 仍有剩余，其他为错误
+ */
+static int ssl_txq_flush(struct xprt_ssl *xptssl)
+{
+	ssize_t rc;
+	uint32_t i, n = 0, empty = 0;
+	struct pbuff *pb;
+	struct pbuff *spare[CONFIG_XPRT_SSL_TXSEGS];
+	struct iovec iov[CONFIG_XPRT_SSL_TXSEGS];
 
-	if (WARN_ON(type != XPRT_TCPCLNT && type != XPRT_TCPTEMP))
-		type = XPRT_TCPCLNT;
+	if (!xptssl->txq_len)
+		return 0;
 
-	xprt->user = NULL;
-	xprt->server = NULL;
-	xprt->xprt_ops = ops;
-	uref_init(&xprt->refs);
-	INIT_LIST_HEAD(&xprt->node);
-	/*初始化时为关闭的*/
-	xprt->flags = type | XPRT_CLOSED;
-	uev_stream_init(xprt_ev(xprt), -1, process_xprt_event);
-}
+	for (i = 0; i < xptssl->txq_nr; i++) {
+		pb = xptssl->txq[i];
+		if (!pb_headlen(pb))
+			continue;
+		iov[n].iov_base = pb_data(pb);
+		iov[n++].iov_len = pb_headlen(pb);
+	}
 
-static bool xprt_move(struct xprt *alias, struct xprt *src)
-{
-	int cpu = xprt_getcpu(src);
-	unsigned long flags;
-	struct server *serv = READ_ONCE(src->server);
-	if (skp_unlikely(!serv))
-		return false;
+	do {
+		rc = writev(xprt_fd(&xptssl->tcp.xprt), iov, n);
+	} while (rc < 0 && errno == EINTR);
 
-	XPRT_WARN_ON(cpu == EVENT_IDX_MAX);
-	/*尽量在事件回调中调用，否则可能出现未知的错误*/
-	if (current_ev_stream() == xprt_ev(src)) {
-		xprt_event_delete(src);
-	} else {
-		log_warn("please invoke this function in event callback of xprt ...");
-		xprt_event_delete_sync(src);
+	if (skp_unlikely(rc < 0)) {
+		rc = __xprt_write_errno();
+		return rc == -EWOULDBLOCK ? -EAGAIN : rc;
 	}
 
-	/*初始化*/
+	xptssl->txq_len -= rc;
+	/*按顺序消费，发完的分片复位后轮换到链尾，继续用于追加*/
+	for (i = 0, n = 0; i < xptssl->txq_nr; i++) {
+		size_t l;
+		pb = xptssl->txq[i];
+		l = min_t(size_t, pb_headlen(pb), rc);
+		pb_pulldata(pb, l);
+		rc -= l;
+		if (!pb_headlen(pb) && n == i) {
+			pb_reset(pb);
+			spare[empty++] = pb;
+		} else {
+			xptssl->txq[n++] = pb;
+		}
+	}
+	for (i = 0; i < empty; i++)
+		xptssl->txq[n++] = spare[i];
 
-	/*
-	 * 如果不处于附着状态，则表明已经处于销毁流程了
-	 * 加锁来抢占 attached 位，这样可以使它优先级低于 destory_xprt()
-	 * 更好的观察到 销毁流程
-	 */
-	spin_lock(&serv->lock);
-	if (!test_and_clear_bit(XPRT_ATTACHED_BIT, &src->flags)) {
-		spin_unlock(&serv->lock);
-		return false;
+	return xptssl->txq_len ? -EAGAIN : 0;
+}
+
+/*获取链尾有剩余空间的分片，没有则分配，分片已用完则返回 NULL*/
+static struct pbuff *ssl_txq_tail(struct xprt_ssl *xptssl)
+{
+	struct pbuff *pb;
+
+	if (skp_likely(xptssl->txq_nr)) {
+		pb = xptssl->txq[xptssl->txq_nr - 1];
+		if (skp_likely(pb_tailroom(pb)))
+			return pb;
 	}
 
-	alias->user = src->user;
-	alias->flags = src->flags;
-	alias->server = src->server;
-	/*如果已经设置了操作回调，则不覆盖，否则使用相同的回调集合*/
-	if (!alias->xprt_ops)
-		alias->xprt_ops = src->xprt_ops;
+	if (skp_unlikely(xptssl->txq_nr >= CONFIG_XPRT_SSL_TXSEGS))
+		return NULL;
 
-	uref_init(&alias->refs);
-	INIT_LIST_HEAD(&alias->node);
-	uev_stream_init(xprt_ev(alias), xprt_fd(src), process_xprt_event);
-	uev_stream_setcpu(xprt_ev(alias), cpu);
+	pb = alloc_pb(CONFIG_XPRT_SSL_TXSEG_SIZE);
+	if (skp_unlikely(!pb))
+		return NULL;
+	xptssl->txq[xptssl->txq_nr++] = pb;
+	return pb;
+}
 
-	/*剥离旧的*/
-	XPRT_BUG_ON(list_empty(&src->node));
-	XPRT_WARN_ON(src->server != serv);
-	list_del_init(&src->node);
+static void ssl_txq_free(struct xprt_ssl *xptssl)
+{
+	for (uint32_t i = 0; i < xptssl->txq_nr; i++)
+		free_pb(xptssl->txq[i]);
+	xptssl->txq_nr = 0;
+	xptssl->txq_len = 0;
+}
 
-	/*原子的设置为关闭状态，并再次检查是否有其他路径同时操作
-	 *@see destroy_xprt()
-	 */
-	flags = READ_ONCE(src->flags);
-	XPRT_BUG_ON(!cmpxchg(&src->flags, flags, XPRT_CLOSED|xprt_type(src)));
+#ifdef XPRT_SSL_HAVE_PBIO
+static BIO_METHOD *ssl_pbio_method;
+static int ssl_pbio_type;
 
-	/*移除原 xprt 对描述符和 管理器的引用*/
-	/*回调需要保留，因为需要释放内存*/
-	src->user = NULL;
-	src->server = NULL;
-	uev_stream_init(xprt_ev(src), -1, NULL);
+static int ssl_pbio_write(BIO *bio, const char *b, int l)
+{
+	int n = 0;
+	ssize_t rc;
+	struct pbuff *pb;
+	struct xprt_ssl *xptssl = BIO_get_data(bio);
+
+	BIO_clear_retry_flags(bio);
+
+	/*没有积压时直接发出，不拷贝*/
+	if (skp_likely(!xptssl->txq_len)) {
+		do {
+			rc = send(xprt_fd(&xptssl->tcp.xprt), b, l, MSG_NOSIGNAL);
+		} while (rc < 0 && errno == EINTR);
+		if (skp_likely(rc == l))
+			return l;
+		if (rc < 0) {
+			rc = __xprt_write_errno();
+			if (rc != -EAGAIN && rc != -EWOULDBLOCK) {
+				errno = (int)-rc;
+				return -1;
+			}
+			rc = 0;
+		}
+		n = (int)rc;
+	}
 
-	/*嫁接新的*/
-	xprt_get(alias);
-	list_add_tail(&alias->node, &serv->xprt_list);
-	XPRT_BUG_ON(__test_and_set_bit(XPRT_ATTACHED_BIT, &alias->flags));
-	/* detach 成功，释放容器持有的引用
-	 * 如果引用计数为0，不能马上释放，如果当前在事件回调中，则还会解引用
-	 * @see process_xprt_event()
-	 * 在锁内可以强制一个RCU异步释放
-	 */
-	xprt_put(src);
+	/*套接字未接受的部分*/
+	while (n < l) {
+		pb = ssl_txq_tail(xptssl);
+		if (skp_unlikely(!pb)) {
+			/*发送链已满，尝试发出一部分*/
+			int rc = ssl_txq_flush(xptssl);
+			if (skp_likely(!rc))
+				continue;
+			if (skp_likely(rc == -EAGAIN)) {
+				if (ssl_txq_tail(xptssl))
+					continue;
+				if (n)
+					break;
+				BIO_set_retry_write(bio);
+				return -1;
+			}
+			if (n)
+				break;
+			errno = -rc;
+			return -1;
+		}
 
-	spin_unlock(&serv->lock);
+		size_t size = min_t(size_t, l - n, pb_tailroom(pb));
+		memcpy(pb_putdata(pb, size), b + n, size);
+		xptssl->txq_len += size;
+		n += size;
+	}
 
-	return true;
+	return n;
 }
 
-bool xprt_tcpclnt_move(struct xprt_tcpclnt *alias, struct xprt_tcpclnt *src)
+static int ssl_pbio_read(BIO *bio, char *b, int l)
 {
-	if (!xprt_move(&alias->xprt, &src->xprt))
-		return false;
-
-	alias->local = src->local;
-	alias->remote = src->remote;
-	alias->lstn_xprt = xchg_ptr(&src->lstn_xprt, NULL);
+	ssize_t rc;
+	struct xprt_ssl *xptssl = BIO_get_data(bio);
 
-	return true;
-}
+	BIO_clear_retry_flags(bio);
 
-#ifdef ENABLE_SSL
-#include <openssl/ssl.h>
-#include <openssl/bio.h>
-#include <openssl/err.h>
-#include <openssl/pem.h>
-#include <openssl/conf.h>
-#include <openssl/rand.h>
+	do {
+		rc = read(xprt_fd(&xptssl->tcp.xprt), b, l);
+	} while (rc < 0 && errno == EINTR);
 
-static bool ssl_inited = false;
-static struct ssl_ctx_st *ssl_clntctx;
-static struct ssl_ctx_st *ssl_servctx;
-static __thread char ssl_ebuff[128];
-static int process_tlsext_host_name(SSL *ssl, int *al, void *arg);
+	if (rc < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+		BIO_set_retry_read(bio);
+	return (int)rc;
+}
 
-static const char *ssl_default_cer = "/tmp/ssl/certs/serverCert.cer";
-static const char *ssl_default_key = "/tmp/ssl/certs/serverKey.pem";
-static const char *ssl_gen_cerkey_sh = "\
-mkdir -p /tmp/ssl/certs && \
-cd /tmp/ssl/certs && \
-openssl req -newkey rsa:2048 -nodes -keyout serverKey.pem \
--x509 -days 365 -out serverCert.cer \
--subj \"/C=CN/ST=SH/L=SH/O=skp.default.cert/OU=skp.default.key\" && \
-cd -";
+static long ssl_pbio_ctrl(BIO *bio, int cmd, long num, void *ptr)
+{
+	int rc;
+	struct xprt_ssl *xptssl = BIO_get_data(bio);
+
+	switch (cmd) {
+	case BIO_CTRL_FLUSH:
+		BIO_clear_retry_flags(bio);
+		rc = ssl_txq_flush(xptssl);
+		if (skp_likely(!rc))
+			return 1;
+		if (skp_likely(rc == -EAGAIN))
+			BIO_set_retry_write(bio);
+		else
+			errno = -rc;
+		return 0;
+	case BIO_CTRL_WPENDING:
+		return xptssl->txq_len;
+	case BIO_CTRL_GET_CLOSE:
+		return BIO_get_shutdown(bio);
+	case BIO_CTRL_SET_CLOSE:
+		BIO_set_shutdown(bio, (int)num);
+		return 1;
+	case BIO_CTRL_DUP:
+		return 1;
+	default:
+		return 0;
+	}
+}
 
-static void __ssl_init_env(void)
+static int ssl_pbio_create(BIO *bio)
 {
-	big_lock();
+	BIO_set_data(bio, NULL);
+	BIO_set_init(bio, 0);
+	return 1;
+}
 
-	if (skp_unlikely(ssl_inited)) {
-		big_unlock();
+/*发送链属于 xprt_ssl，由 xprt_ssl_finit() 释放*/
+static int ssl_pbio_destroy(BIO *bio)
+{
+	BIO_set_data(bio, NULL);
+	BIO_set_init(bio, 0);
+	return 1;
+}
+
+static void ssl_pbio_setup(void)
+{
+	BIO_METHOD *meth;
+	int type = BIO_get_new_index() | BIO_TYPE_SOURCE_SINK;
+	meth = BIO_meth_new(type, "skp pbuff chain");
+	if (WARN_ON(!meth))
 		return;
-	}
+	BIO_meth_set_write(meth, ssl_pbio_write);
+	BIO_meth_set_read(meth, ssl_pbio_read);
+	BIO_meth_set_ctrl(meth, ssl_pbio_ctrl);
+	BIO_meth_set_create(meth, ssl_pbio_create);
+	BIO_meth_set_destroy(meth, ssl_pbio_destroy);
+	ssl_pbio_type = type;
+	ssl_pbio_method = meth;
+}
 
-	if (access(ssl_default_cer, R_OK) || access(ssl_default_key, R_OK)) {
-		log_error("please usage like this :\n\n%s\n\n"
-			"to generate default certificate file and private key file\n",
-			ssl_gen_cerkey_sh);
-		abort();
-	}
+/*内核卸载需要套接字 BIO，没有刷新钩子则缓存的数据可能无法发出*/
+static int ssl_pbio_attach(struct xprt *xprt, struct xprt_ssl *xptssl)
+{
+	BIO *bio;
 
-	/*初始化环境*/
-	OPENSSL_config(NULL);
-	RAND_poll();
-	SSL_library_init();
-	SSL_load_error_strings();
-	ERR_load_crypto_strings();
-	OpenSSL_add_all_algorithms();
+	if (!ssl_pbio_method || !xprt->xprt_ops->do_flush ||
+			(xprt->flags & XPRT_OPT_KTLS))
+		return 0;
 
-	/*创建默认的服务器和客户端上下文*/
-	ssl_clntctx = SSL_CTX_new(SSLv23_client_method());
-	ssl_servctx = SSL_CTX_new(SSLv23_server_method());
-	if (skp_likely(ssl_clntctx)) {
-		SSL_CTX_set_read_ahead(ssl_clntctx, 1);
-		SSL_CTX_set_verify(ssl_servctx, SSL_VERIFY_NONE, NULL);
-	}
-	if (skp_likely(ssl_servctx)) {
-		int rc;
-		SSL_CTX_set_read_ahead(ssl_servctx, 1);
-		rc = SSL_CTX_use_certificate_file(ssl_servctx, ssl_default_cer,
-					SSL_FILETYPE_PEM);
-		if (skp_unlikely(rc!=1)) {
-			log_error("load certificate file [%s] failed : %s",
-									ssl_default_cer, ssl_stack_error());
-			abort();
-		}
-		rc = SSL_CTX_use_PrivateKey_file(ssl_servctx, ssl_default_key,
-					SSL_FILETYPE_PEM);
-		if (skp_unlikely(rc!=1)) {
-			log_error("user private key file [%s] failed : %s",
-									ssl_default_key, ssl_stack_error());
-			abort();
-		}
-		rc = SSL_CTX_check_private_key(ssl_servctx);
-		if (skp_unlikely(rc!=1)) {
-			log_error("check private key failed : %s", ssl_stack_error());
-			abort();
-		}
-		SSL_CTX_set_tlsext_servername_callback(ssl_servctx,
-			process_tlsext_host_name);
-	}
+	bio = BIO_new(ssl_pbio_method);
+	if (skp_unlikely(!bio))
+		return -ENOMEM;
+	BIO_set_data(bio, xptssl);
+	BIO_set_init(bio, 1);
+	/*读写为同一个 BIO 时，只转移一个引用*/
+	SSL_set_bio(xptssl->ssl, bio, bio);
+	SSL_set_read_ahead(xptssl->ssl, 1);
+	return 1;
+}
 
-	WRITE_ONCE(ssl_inited, true);
-	big_unlock();
+static inline void ssl_pbio_move(struct xprt_ssl *xptssl)
+{
+	BIO *bio = SSL_get_wbio(xptssl->ssl);
+	if (bio && ssl_pbio_method && BIO_method_type(bio) == ssl_pbio_type)
+		BIO_set_data(bio, xptssl);
+}
+#else
+static void ssl_pbio_setup(void)
+{
+}
 
-	if (skp_unlikely(!ssl_clntctx)) {
-		log_warn("initial SSL_CTX for client failed : %s", ssl_stack_error());
-		abort();
-	}
-	if (skp_unlikely(!ssl_servctx)) {
-		log_warn("initial SSL_CTX for server failed : %s", ssl_stack_error());
-		abort();
-	}
+static inline int ssl_pbio_attach(struct xprt *xprt, struct xprt_ssl *xptssl)
+{
+	return 0;
 }
 
-static inline void ssl_init_env(void)
+static inline void ssl_pbio_move(struct xprt_ssl *xptssl)
 {
-	if (skp_likely(READ_ONCE(ssl_inited)))
-		return;
-	__ssl_init_env();
 }
+#endif
 
 static inline const char *ssl_format_error(int rc0)
 {
@@ -1462,22 +4188,45 @@ int xprt_ssl_init(struct xprt_ssl *xprt, unsigned long opt, ...)
 	xprt->ev_mask = -1;
 	xprt->tlsext_host_name = NULL;
 	xprt->handshake_stat = XPRT_SSL_NONHANDSHAKE;
+	xprt->ktls = 0;
+	xprt->hs_state = XPRT_SSL_HS_IDLE;
+	xprt->hs_result = 0;
+	xprt->hs_rdmask = false;
+	INIT_WORK(&xprt->hs_work, ssl_handshake_work);
+	xprt->txq_nr = 0;
+	xprt->txq_len = 0;
 	/*初始化*/
 	SSL_set_app_data(xprt->ssl, xprt);
 
+	if (opt & XPRT_OPT_KTLS) {
+#ifdef XPRT_SSL_HAVE_KTLS
+		/*预读的数据会阻止接收方向的卸载*/
+		SSL_set_read_ahead(xprt->ssl, 0);
+		SSL_set_options(xprt->ssl, SSL_OP_ENABLE_KTLS);
+#else
+		log_debug("kTLS is not supported by this openssl, ignore it");
+#endif
+	}
+
 	return 0;
 }
 
 void xprt_ssl_finit(struct xprt_ssl *xprt)
 {
-	if (skp_unlikely(xprt))
+	if (skp_unlikely(!xprt))
 		return;
 	if (xprt->ssl)
 		SSL_free(xprt->ssl);
+	xprt->ssl = NULL;
+	ssl_txq_free(xprt);
 }
 
 bool xprt_ssl_move(struct xprt_ssl *alias, struct xprt_ssl *src)
 {
+	/*工作队列正在使用 ssl 对象*/
+	if (WARN_ON(READ_ONCE(src->hs_state) == XPRT_SSL_HS_RUNNING))
+		return false;
+
 	if (!xprt_tcpclnt_move(&alias->tcp, &src->tcp))
 		return false;
 
@@ -1485,6 +4234,22 @@ bool xprt_ssl_move(struct xprt_ssl *alias, struct xprt_ssl *src)
 	alias->ssl = xchg_ptr(&src->ssl, NULL);
 	alias->ev_mask = src->ev_mask;
 	alias->handshake_stat = src->handshake_stat;
+	alias->ktls = src->ktls;
+	alias->hs_state = src->hs_state;
+	alias->hs_result = src->hs_result;
+	alias->hs_rdmask = src->hs_rdmask;
+	INIT_WORK(&alias->hs_work, ssl_handshake_work);
+
+	/*发送链随之转移，BIO 与回调中引用的对象也需要更新*/
+	memcpy(alias->txq, src->txq, sizeof(src->txq));
+	alias->txq_nr = src->txq_nr;
+	alias->txq_len = src->txq_len;
+	src->txq_nr = 0;
+	src->txq_len = 0;
+	if (alias->ssl) {
+		SSL_set_app_data(alias->ssl, alias);
+		ssl_pbio_move(alias);
+	}
 
 	return true;
 }
@@ -1538,64 +4303,57 @@ out:
 		WARN_ON(rc==0);
 }
 
-int xprt_ssl_handshake(struct xprt *xprt, unsigned long event)
-{
-	int rc = 0;
-	int type = xprt_type(xprt);
-	bool is_clnt = !!(type == XPRT_TCPCLNT);
-	struct xprt_ssl *xptssl = xprt_to_ssl(xprt);
-	struct ssl_st *ssl = xptssl->ssl;
-
-	XPRT_BUG_ON(!ssl);
-	if (WARN_ON(type == XPRT_TCPSERV))
-		return -EINVAL;
-
-	if (WARN_ON(xptssl->handshake_stat == XPRT_SSL_HANDSHAKED))
-		return 0;
-
-	/*握手初始化*/
-	if (xptssl->handshake_stat == XPRT_SSL_NONHANDSHAKE) {
-#ifdef XPRT_DEBUG
-		ssl_stack_error_clear();
-#endif
-		rc = SSL_set_fd(ssl, xprt_fd(xprt));
-		if (skp_unlikely(rc!=1)) {
-			log_error("initial SSL handshake failed : %s",
-				xprt_ssl_error(xptssl, rc));
-			return -ECONNABORTED;
-		}
-		if (is_clnt) {
-			if (xptssl->tlsext_host_name)
-				SSL_set_tlsext_host_name(ssl,xptssl->tlsext_host_name);
-			SSL_set_connect_state(ssl);
-		} else {
-			SSL_set_accept_state(ssl);
-		}
-
-		/*首次由写触发，由于写事件只触发一次，所以需要保存，以便握手成功后恢复*/
-		xptssl->ev_mask = -1;
-		if (event & EVENT_WRITE)
-			xptssl->ev_mask = EVENT_WRITE;
-		xptssl->handshake_stat = XPRT_SSL_HANDSHAKING;
-	}
+/*握手的单步结果，除 ssl_check_ret() 的返回值外，还有完成*/
+#define SSL_HANDSHAKE_DONE 2
 
+/*执行一步握手，可能在事件线程或握手工作队列中运行*/
+static int ssl_handshake_step(struct xprt_ssl *xptssl)
+{
 #ifdef XPRT_DEBUG
 	ssl_stack_error_clear();
 #endif
 	/*可能发生多次握手*/
-	rc = SSL_do_handshake(ssl);
-	if (skp_likely(rc == 1)) {
+	int rc = SSL_do_handshake(xptssl->ssl);
+	if (skp_likely(rc == 1))
+		return SSL_HANDSHAKE_DONE;
+	/*返回值检查，错误栈是线程私有的，必须在同一个线程中检查*/
+	return ssl_check_ret(xptssl->ssl, rc, "xprt_ssl_handshake");
+}
+
+/*握手完成时，预读的记录中可能已有应用数据，有则返回 1*/
+static inline int ssl_rx_pending(const struct ssl_st *ssl)
+{
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+	return SSL_has_pending(ssl);
+#else
+	return SSL_pending(ssl) > 0;
+#endif
+}
+
+/*在事件线程中处理单步结果*/
+static int ssl_handshake_resume(struct xprt *xprt, struct xprt_ssl *xptssl,
+		int rc)
+{
+	struct ssl_st *ssl = xptssl->ssl;
+
+	if (skp_likely(rc == SSL_HANDSHAKE_DONE)) {
 		BUG_ON(xptssl->handshake_stat!=XPRT_SSL_HANDSHAKING);
 		xptssl->handshake_stat = XPRT_SSL_HANDSHAKED;
 		/* initial handshake done, disable renegotiation (CVE-2009-3555) */
+#if OPENSSL_VERSION_NUMBER < 0x10100000L
 		if (ssl->s3)
 			ssl->s3->flags |= SSL3_FLAGS_NO_RENEGOTIATE_CIPHERS;
+#elif defined(SSL_OP_NO_RENEGOTIATION)
+		SSL_set_options(ssl, SSL_OP_NO_RENEGOTIATION);
+#endif
+		/*检查内核是否接管了加解密*/
+		ssl_check_ktls(xptssl);
 
 		/*复原事件*/
 		int ev_mask = xptssl->ev_mask;
 		xptssl->ev_mask = -1;
 		if (skp_likely(ev_mask==-1))
-			return 0;
+			return ssl_rx_pending(ssl);
 		if (ev_mask & EVENT_WRITE) {
 			/*如果有写事件则使用者开启的应该启动，防止丢失*/
 			rc = xprt_event_enable(xprt, EVENT_WRITE);
@@ -1608,11 +4366,9 @@ int xprt_ssl_handshake(struct xprt *xprt, unsigned long event)
 			if (skp_unlikely(rc<0))
 				return skp_unlikely(rc==-EAGAIN)?-ECONNABORTED:rc;
 		}
-		return 0;
+		return ssl_rx_pending(ssl);
 	}
 
-	/*返回值检查*/
-	rc = ssl_check_ret(ssl, rc, __FUNCTION__);
 	if (skp_unlikely(rc<0))
 		return rc;
 
@@ -1633,6 +4389,131 @@ int xprt_ssl_handshake(struct xprt *xprt, unsigned long event)
 	return -EAGAIN;
 }
 
+static void ssl_handshake_work(struct work_struct *work)
+{
+	int rc = -ECONNABORTED;
+	struct xprt_ssl *xptssl = container_of(work, struct xprt_ssl, hs_work);
+	struct xprt *xprt = &xptssl->tcp.xprt;
+
+	if (skp_likely(!xprt_has_closed(xprt)))
+		rc = ssl_handshake_step(xptssl);
+
+	WRITE_ONCE(xptssl->hs_result, rc);
+	smp_wmb();
+	WRITE_ONCE(xptssl->hs_state, XPRT_SSL_HS_DONE);
+
+	/*写事件是单次触发的，用来唤醒事件线程继续握手*/
+	xprt_event_enable(xprt, EVENT_WRITE);
+	xprt_put(xprt);
+}
+
+/*
+ * 异步握手，每一步 SSL_do_handshake() 都在工作队列中执行，
+ * 执行期间关闭读事件，完成后通过单次触发的写事件回到事件线程
+ */
+static int ssl_handshake_async(struct xprt *xprt, struct xprt_ssl *xptssl,
+		unsigned long event)
+{
+	int rc;
+	struct workqueue_struct *wq;
+
+	switch (READ_ONCE(xptssl->hs_state)) {
+	case XPRT_SSL_HS_RUNNING:
+		/*工作线程持有引用，可以安全的关闭*/
+		if (skp_unlikely(event & (EVENT_ERROR|EVENT_EOF)))
+			return -ECONNABORTED;
+		return -EAGAIN;
+	case XPRT_SSL_HS_DONE:
+		smp_rmb();
+		rc = READ_ONCE(xptssl->hs_result);
+		xptssl->hs_state = XPRT_SSL_HS_IDLE;
+		/*恢复执行期间关闭的读事件*/
+		if (xptssl->hs_rdmask) {
+			xptssl->hs_rdmask = false;
+			int rc0 = xprt_event_enable(xprt, EVENT_READ);
+			if (skp_unlikely(rc0<0))
+				return skp_unlikely(rc0==-EAGAIN)?-ECONNABORTED:rc0;
+		}
+		return ssl_handshake_resume(xprt, xptssl, rc);
+	default:
+		break;
+	}
+
+	/*由于读事件是水平触发的，执行期间需要关闭*/
+	if (uev_stream_mask(xprt_ev(xprt)) & EVENT_READ) {
+		rc = xprt_event_disable(xprt, EVENT_READ);
+		if (skp_unlikely(rc<0))
+			return skp_unlikely(rc==-EAGAIN)?-ECONNABORTED:rc;
+		xptssl->hs_rdmask = true;
+	}
+
+	wq = ssl_hswq_init();
+	if (skp_unlikely(!wq))
+		return -ENOMEM;
+
+	xptssl->hs_state = XPRT_SSL_HS_RUNNING;
+	xprt_get(xprt);
+	if (WARN_ON(!queue_work(wq, &xptssl->hs_work))) {
+		xptssl->hs_state = XPRT_SSL_HS_IDLE;
+		xprt_put(xprt);
+		return -ECONNABORTED;
+	}
+	return -EAGAIN;
+}
+
+int xprt_ssl_handshake(struct xprt *xprt, unsigned long event)
+{
+	int rc = 0;
+	int type = xprt_type(xprt);
+	bool is_clnt = !!(type == XPRT_TCPCLNT);
+	struct xprt_ssl *xptssl = xprt_to_ssl(xprt);
+	struct ssl_st *ssl = xptssl->ssl;
+
+	XPRT_BUG_ON(!ssl);
+	if (WARN_ON(type == XPRT_TCPSERV))
+		return -EINVAL;
+
+	if (WARN_ON(xptssl->handshake_stat == XPRT_SSL_HANDSHAKED))
+		return 0;
+
+	/*握手初始化*/
+	if (xptssl->handshake_stat == XPRT_SSL_NONHANDSHAKE) {
+#ifdef XPRT_DEBUG
+		ssl_stack_error_clear();
+#endif
+		/*优先使用基于发送链的 BIO*/
+		rc = ssl_pbio_attach(xprt, xptssl);
+		if (!rc)
+			rc = SSL_set_fd(ssl, xprt_fd(xprt));
+		if (skp_unlikely(rc!=1)) {
+			log_error("initial SSL handshake failed : %s",
+				xprt_ssl_error(xptssl, rc));
+			return -ECONNABORTED;
+		}
+		if (is_clnt) {
+			if (xptssl->tlsext_host_name)
+				SSL_set_tlsext_host_name(ssl,xptssl->tlsext_host_name);
+			/*尝试复用该上游的会话*/
+			ssl_clnt_sess_resume(xptssl);
+			SSL_set_connect_state(ssl);
+		} else {
+			SSL_set_accept_state(ssl);
+		}
+
+		/*首次由写触发，由于写事件只触发一次，所以需要保存，以便握手成功后恢复*/
+		xptssl->ev_mask = -1;
+		if (event & EVENT_WRITE)
+			xptssl->ev_mask = EVENT_WRITE;
+		xptssl->handshake_stat = XPRT_SSL_HANDSHAKING;
+	}
+
+	if (xprt->flags & XPRT_OPT_SSLASYNC)
+		return ssl_handshake_async(xprt, xptssl, event);
+
+	rc = ssl_handshake_step(xptssl);
+	return ssl_handshake_resume(xprt, xptssl, rc);
+}
+
 ssize_t xprt_ssl_read(struct xprt *x, void *b, size_t s)
 {
 	XPRT_BUG_ON(!x);
@@ -1643,9 +4524,21 @@ ssize_t xprt_ssl_read(struct xprt *x, void *b, size_t s)
 
 	ssl_stack_error_clear();
 	int rc = SSL_read(xptssl->ssl, b, (int)s);
-	if (skp_likely(rc > 0))
+	/*错误栈与 errno 必须在刷新之前检查*/
+	if (skp_unlikely(rc <= 0))
+		rc = ssl_check_ret(xptssl->ssl, rc, __FUNCTION__) - 1;
+	/*读取期间可能产生需要回应的记录，比如密钥更新*/
+	if (skp_unlikely(xptssl->txq_len)) {
+		int rc0 = xprt_ssl_flush(x);
+		if (skp_unlikely(rc0 < 0 && rc0 != -EAGAIN))
+			return rc0==-EPIPE||rc0==-ECONNRESET ? 0 : rc0;
+	}
+	if (skp_likely(rc > 0)) {
+		xprt_stat_rx(x, rc);
 		return rc;
-	rc = ssl_check_ret(xptssl->ssl, rc, __FUNCTION__);
+	}
+	/*还原 ssl_check_ret() 的返回值*/
+	rc++;
 	if (skp_unlikely(rc < 0))
 		return rc==-ECONNRESET ? 0 : rc;
 	if (skp_unlikely(rc)) {
@@ -1664,10 +4557,35 @@ ssize_t xprt_ssl_write(struct xprt *x, const void *b, size_t s)
 
 	struct xprt_ssl *xptssl = xprt_to_ssl(x);
 
+	/*内核加密，直接写入套接字，省去用户态的加密与拷贝*/
+	if (xptssl->ktls & XPRT_SSL_KTLS_TX) {
+		ssize_t rc = send(xprt_fd(x), b, s, MSG_NOSIGNAL);
+		if (skp_likely(rc > 0)) {
+			xprt_stat_tx(x, rc);
+			return rc;
+		}
+		rc = __xprt_write_errno();
+		if (skp_likely(rc == -EAGAIN || rc == -EWOULDBLOCK)) {
+			rc = xprt_event_enable(x, EVENT_WRITE);
+			if (skp_unlikely(rc < 0))
+				return skp_unlikely(rc==-EAGAIN)?-ECONNABORTED:rc;
+			return -EAGAIN;
+		}
+		return rc==-EPIPE||rc==-ECONNRESET ? 0 : rc;
+	}
+
 	ssl_stack_error_clear();
 	int rc = SSL_write(xptssl->ssl, b, (int)s);
-	if (skp_likely(rc > 0))
+	if (skp_likely(rc > 0)) {
+		xprt_stat_tx(x, rc);
+		/*本次写入产生的所有记录，一次发出，剩余的在写就绪时发出*/
+		if (xptssl->txq_len) {
+			int rc0 = xprt_ssl_flush(x);
+			if (skp_unlikely(rc0 < 0 && rc0 != -EAGAIN))
+				return rc0==-EPIPE||rc0==-ECONNRESET ? 0 : rc0;
+		}
 		return rc;
+	}
 	rc = ssl_check_ret(xptssl->ssl, rc, __FUNCTION__);
 	if (skp_unlikely(rc < 0))
 		return rc==-ECONNRESET ? 0 : rc;
@@ -1678,4 +4596,59 @@ ssize_t xprt_ssl_write(struct xprt *x, const void *b, size_t s)
 	return -EAGAIN;
 }
 
+int xprt_ssl_flush(struct xprt *x)
+{
+	XPRT_BUG_ON(!x);
+
+	struct xprt_ssl *xptssl = xprt_to_ssl(x);
+	if (skp_likely(!xptssl->txq_len))
+		return 0;
+
+	int rc = ssl_txq_flush(xptssl);
+	if (skp_likely(rc != -EAGAIN))
+		return rc;
+
+	/*写事件是单次触发，仍有剩余则需要重新开启*/
+	rc = xprt_event_enable(x, EVENT_WRITE);
+	if (skp_unlikely(rc < 0))
+		return skp_unlikely(rc==-EAGAIN)?-ECONNABORTED:rc;
+	return -EAGAIN;
+}
+
+bool xprt_ssl_session_reused(const struct xprt *x)
+{
+	struct xprt_ssl *xptssl = xprt_to_ssl((struct xprt *)x);
+	XPRT_BUG_ON(!x);
+	return xptssl->ssl && SSL_session_reused(xptssl->ssl);
+}
+
+ssize_t xprt_ssl_sendfile(struct xprt *x, int fd, off_t off, size_t s)
+{
+	XPRT_BUG_ON(!x);
+	if (skp_unlikely(fd < 0 || s < 1))
+		return 0;
+
+	struct xprt_ssl *xptssl = xprt_to_ssl(x);
+	if (!(xptssl->ktls & XPRT_SSL_KTLS_TX))
+		return -EOPNOTSUPP;
+
+#ifdef XPRT_SSL_HAVE_KTLS
+	ssl_stack_error_clear();
+	ossl_ssize_t rc = SSL_sendfile(xptssl->ssl, fd, off, s, 0);
+	if (skp_likely(rc > 0)) {
+		xprt_stat_tx(x, rc);
+		return rc;
+	}
+	int rc0 = ssl_check_ret(xptssl->ssl, (int)rc, __FUNCTION__);
+	if (skp_unlikely(rc0 < 0))
+		return rc0==-ECONNRESET ? 0 : rc0;
+	rc0 = xprt_event_enable(x, skp_likely(!rc0) ? EVENT_READ: EVENT_WRITE);
+	if (skp_unlikely(rc0 < 0))
+		return skp_unlikely(rc0==-EAGAIN)?-ECONNABORTED:rc0;
+	return -EAGAIN;
+#else
+	return -EOPNOTSUPP;
+#endif
+}
+
 #endif
@@ -6,6 +6,7 @@
 # include <skp/utils/utils.h>
 int thread_bind(int which) { return 0; }
 int thread_cpu(void) { return -1; }
+int thread_getcpu(void) { return -1; }
 #else
 # ifndef __USE_GNU
 #  define __USE_GNU
@@ -51,6 +52,11 @@ int thread_bind(int which)
 	return rc;
 }
 int thread_cpu(void) { return current_cpu; }
+int thread_getcpu(void)
+{
+	int cpu = READ_ONCE(current_cpu);
+	return skp_likely(cpu > -1) ? cpu : sched_getcpu();
+}
 #endif
 
 /**
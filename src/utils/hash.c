@@ -1,3 +1,4 @@
+#include <skp/utils/utils.h>
 #include <skp/utils/hash.h>
 /* MurmurHash2, by Austin Appleby
  * Note - This code makes a few assumptions about how your machine behaves -
@@ -299,16 +300,371 @@ static const uint32_t crc32table[] = {
     0xbcb4666d, 0xb8757bda, 0xb5365d03, 0xb1f740b4
 };
 
+////////////////////////////////////////////////////////////////////////////////
+// 按 8 字节分片查表，运行时按 CPU 特性选择指令实现
+////////////////////////////////////////////////////////////////////////////////
+
+#if defined(__x86_64__) && defined(__GNUC__)
+# include <x86intrin.h>
+# define CSUM_HAVE_X86
+#endif
+
+typedef uint32_t (*crc_fn)(const void *, size_t, uint32_t);
+
+/*byteCrc32() 的多项式，不反射*/
+#define CRC32_POLY 0x04c11db7U
+/*Castagnoli 多项式的反射形式*/
+#define CRC32C_POLY 0x82f63b78U
+/*三路并行时每一路的长度*/
+#define CRC32C_STRIDE 1024
+
+static uint32_t crc32_slice[8][256];
+static uint32_t crc32c_slice[8][256];
+/*将 crc 寄存器向后移动 CRC32C_STRIDE、2 * CRC32C_STRIDE 字节的乘数*/
+static uint32_t crc32c_shift1, crc32c_shift2;
+/*
+ * 折叠常量，不反射，x^n mod P 按位 i 为 x^i 存放
+ * [0] 为 x^(512 + 64)、x^512，四路折叠；[1] 为 x^(128 + 64)、x^128，单路折叠
+ */
+static uint64_t crc32_fold_k[2][2];
+static bool crc_inited = false;
+
+static uint32_t crc32_resolve(const void *, size_t, uint32_t);
+static uint32_t crc32c_resolve(const void *, size_t, uint32_t);
+static uint32_t csum_resolve(const void *, size_t, uint32_t);
+
+static crc_fn crc32_impl = crc32_resolve;
+static crc_fn crc32c_impl = crc32c_resolve;
+static crc_fn csum_impl = csum_resolve;
+
+/*GF(2) 上的乘法，模 CRC32C_POLY，均为反射形式*/
+static uint32_t crc32c_multiply(uint32_t a, uint32_t b)
+{
+	uint32_t m = 1U << 31, p = 0;
+
+	for (;;) {
+		if (a & m) {
+			p ^= b;
+			if (!(a & (m - 1)))
+				break;
+		}
+		m >>= 1;
+		b = b & 1 ? (b >> 1) ^ CRC32C_POLY : b >> 1;
+	}
+	return p;
+}
+
+/*x^(8 * n) mod P*/
+static uint32_t crc32c_xpow8n(size_t n)
+{
+	/*x^1*/
+	uint32_t p = 1U << 31, x = 1U << 30;
+
+	for (n <<= 3; n; n >>= 1) {
+		if (n & 1)
+			p = crc32c_multiply(x, p);
+		x = crc32c_multiply(x, x);
+	}
+	return p;
+}
+
+/*x^n mod P，不反射*/
+static uint32_t crc32_xpow(uint32_t n)
+{
+	uint32_t r = 1;
+
+	while (n--)
+		r = r & (1U << 31) ? (r << 1) ^ CRC32_POLY : r << 1;
+	return r;
+}
+
+static void crc_tables_init(void)
+{
+	uint32_t c;
+
+	for (uint32_t i = 0; i < 256; i++) {
+		c = i;
+		for (int k = 0; k < 8; k++)
+			c = c & 1 ? (c >> 1) ^ CRC32C_POLY : c >> 1;
+		crc32c_slice[0][i] = c;
+		crc32_slice[0][i] = crc32table[i];
+	}
+
+	for (uint32_t i = 0; i < 256; i++) {
+		for (int k = 1; k < 8; k++) {
+			c = crc32c_slice[k - 1][i];
+			crc32c_slice[k][i] = (c >> 8) ^ crc32c_slice[0][c & 0xff];
+			c = crc32_slice[k - 1][i];
+			crc32_slice[k][i] = (c << 8) ^ crc32_slice[0][c >> 24];
+		}
+	}
+
+	crc32c_shift1 = crc32c_xpow8n(CRC32C_STRIDE);
+	crc32c_shift2 = crc32c_xpow8n(CRC32C_STRIDE * 2);
+
+	crc32_fold_k[0][0] = crc32_xpow(512);
+	crc32_fold_k[0][1] = crc32_xpow(512 + 64);
+	crc32_fold_k[1][0] = crc32_xpow(128);
+	crc32_fold_k[1][1] = crc32_xpow(128 + 64);
+}
+
+static inline uint32_t load_le32(const uint8_t *p)
+{
+	return (uint32_t)p[0] | (uint32_t)p[1] << 8 |
+		(uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static inline uint32_t load_be32(const uint8_t *p)
+{
+	return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 |
+		(uint32_t)p[2] << 8 | (uint32_t)p[3];
+}
+
+static uint32_t crc32_generic(const void *buf, size_t size, uint32_t crc)
+{
+	const uint8_t *p = buf;
+
+	for (; size >= 8; size -= 8, p += 8) {
+		crc ^= load_be32(p);
+		crc = crc32_slice[7][crc >> 24] ^
+			crc32_slice[6][(crc >> 16) & 0xff] ^
+			crc32_slice[5][(crc >> 8) & 0xff] ^
+			crc32_slice[4][crc & 0xff] ^
+			crc32_slice[3][p[4]] ^ crc32_slice[2][p[5]] ^
+			crc32_slice[1][p[6]] ^ crc32_slice[0][p[7]];
+	}
+
+	while (size--)
+		crc = (crc << 8) ^ crc32_slice[0][((crc >> 24) ^ *p++) & 0xff];
+	return crc;
+}
+
+/*crc 为寄存器的值，不包括首尾的取反*/
+static uint32_t crc32c_generic(const void *buf, size_t size, uint32_t crc)
+{
+	const uint8_t *p = buf;
+
+	for (; size >= 8; size -= 8, p += 8) {
+		crc ^= load_le32(p);
+		crc = crc32c_slice[7][crc & 0xff] ^
+			crc32c_slice[6][(crc >> 8) & 0xff] ^
+			crc32c_slice[5][(crc >> 16) & 0xff] ^
+			crc32c_slice[4][crc >> 24] ^
+			crc32c_slice[3][p[4]] ^ crc32c_slice[2][p[5]] ^
+			crc32c_slice[1][p[6]] ^ crc32c_slice[0][p[7]];
+	}
+
+	while (size--)
+		crc = (crc >> 8) ^ crc32c_slice[0][(crc ^ *p++) & 0xff];
+	return crc;
+}
+
+/*
+ * 反码和，32 位的字累加到 64 位中，不会溢出
+ * 与字节序无关，结果按内存顺序解释
+ */
+static uint32_t csum_generic(const void *buf, size_t size, uint32_t init)
+{
+	const uint8_t *p = buf;
+	uint64_t sum = init;
+	uint32_t v;
+
+	for (; size >= 16; size -= 16, p += 16) {
+		sum += __get_unaligned_cpu32(p);
+		sum += __get_unaligned_cpu32(p + 4);
+		sum += __get_unaligned_cpu32(p + 8);
+		sum += __get_unaligned_cpu32(p + 12);
+	}
+	for (; size >= 4; size -= 4, p += 4)
+		sum += __get_unaligned_cpu32(p);
+
+	if (size) {
+		v = 0;
+		memcpy(&v, p, size);
+		sum += v;
+	}
+
+	sum = (sum & 0xffffffff) + (sum >> 32);
+	sum = (sum & 0xffffffff) + (sum >> 32);
+	return (uint32_t)sum;
+}
+
+#ifdef CSUM_HAVE_X86
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_sse42(const void *buf, size_t size, uint32_t crc)
+{
+	const uint8_t *p = buf;
+	uint64_t c0, c1, c2;
+
+	/*指令的延迟为 3 个周期，三路并行后再合并*/
+	for (; size >= CRC32C_STRIDE * 3; size -= CRC32C_STRIDE * 3,
+			p += CRC32C_STRIDE * 3) {
+		c0 = crc;
+		c1 = c2 = 0;
+		for (size_t i = 0; i < CRC32C_STRIDE; i += 8) {
+			c0 = _mm_crc32_u64(c0, __get_unaligned_cpu64(p + i));
+			c1 = _mm_crc32_u64(c1,
+				__get_unaligned_cpu64(p + CRC32C_STRIDE + i));
+			c2 = _mm_crc32_u64(c2,
+				__get_unaligned_cpu64(p + CRC32C_STRIDE * 2 + i));
+		}
+		crc = crc32c_multiply(crc32c_shift2, (uint32_t)c0) ^
+			crc32c_multiply(crc32c_shift1, (uint32_t)c1) ^ (uint32_t)c2;
+	}
+
+	c0 = crc;
+	for (; size >= 8; size -= 8, p += 8)
+		c0 = _mm_crc32_u64(c0, __get_unaligned_cpu64(p));
+	crc = (uint32_t)c0;
+	while (size--)
+		crc = _mm_crc32_u8(crc, *p++);
+	return crc;
+}
+
+/*
+ * 128 位的块 X = H * x^64 + L 向后移动 D 位：H * (x^(D + 64) mod P) + L * (x^D mod P)
+ * 乘积不超过 96 位，与 D 位之后的块异或，结果模 P 不变
+ */
+__attribute__((target("pclmul,ssse3")))
+static inline __m128i crc32_fold(__m128i x, __m128i k)
+{
+	return _mm_xor_si128(_mm_clmulepi64_si128(x, k, 0x11),
+		_mm_clmulepi64_si128(x, k, 0x00));
+}
+
+/*
+ * 不反射的多项式，字节逆序后寄存器的位 i 就是 x^i 的系数
+ * 四路折叠到剩余不足 16 字节，最后的 128 位余式与 crc 同余，
+ * 作为 16 字节的消息查表归约，省去 Barrett 归约的常量
+ */
+__attribute__((target("pclmul,ssse3")))
+static uint32_t crc32_pclmul(const void *buf, size_t size, uint32_t crc)
+{
+	const uint8_t *p = buf;
+	const __m128i bswap = _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11,
+		12, 13, 14, 15);
+	const __m128i k4 = _mm_loadu_si128((const __m128i*)crc32_fold_k[0]);
+	const __m128i k1 = _mm_loadu_si128((const __m128i*)crc32_fold_k[1]);
+	__m128i x0, x1, x2, x3;
+	uint8_t rem[16];
+
+	if (size < 64)
+		return crc32_generic(buf, size, crc);
+
+#define CRC32_LOAD(off) \
+	_mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(p + (off))), bswap)
+
+	/*crc 与消息的前 4 个字节异或*/
+	x0 = _mm_xor_si128(CRC32_LOAD(0), _mm_set_epi32((int)crc, 0, 0, 0));
+	x1 = CRC32_LOAD(16);
+	x2 = CRC32_LOAD(32);
+	x3 = CRC32_LOAD(48);
+
+	for (p += 64, size -= 64; size >= 64; p += 64, size -= 64) {
+		x0 = _mm_xor_si128(crc32_fold(x0, k4), CRC32_LOAD(0));
+		x1 = _mm_xor_si128(crc32_fold(x1, k4), CRC32_LOAD(16));
+		x2 = _mm_xor_si128(crc32_fold(x2, k4), CRC32_LOAD(32));
+		x3 = _mm_xor_si128(crc32_fold(x3, k4), CRC32_LOAD(48));
+	}
+
+	x0 = _mm_xor_si128(crc32_fold(x0, k1), x1);
+	x0 = _mm_xor_si128(crc32_fold(x0, k1), x2);
+	x0 = _mm_xor_si128(crc32_fold(x0, k1), x3);
+	for (; size >= 16; p += 16, size -= 16)
+		x0 = _mm_xor_si128(crc32_fold(x0, k1), CRC32_LOAD(0));
+#undef CRC32_LOAD
+
+	_mm_storeu_si128((__m128i*)rem, _mm_shuffle_epi8(x0, bswap));
+	crc = crc32_generic(rem, sizeof(rem), 0);
+	return crc32_generic(p, size, crc);
+}
+
+__attribute__((target("avx2")))
+static uint32_t csum_avx2(const void *buf, size_t size, uint32_t init)
+{
+	const uint8_t *p = buf;
+	const __m256i zero = _mm256_setzero_si256();
+	__m256i v, acc0 = zero, acc1 = zero;
+	uint64_t sum;
+
+	/*32 位的字扩展为 64 位后累加*/
+	for (; size >= 32; size -= 32, p += 32) {
+		v = _mm256_loadu_si256((const __m256i*)p);
+		acc0 = _mm256_add_epi64(acc0, _mm256_unpacklo_epi32(v, zero));
+		acc1 = _mm256_add_epi64(acc1, _mm256_unpackhi_epi32(v, zero));
+	}
+
+	acc0 = _mm256_add_epi64(acc0, acc1);
+	sum = (uint64_t)_mm256_extract_epi64(acc0, 0) +
+		(uint64_t)_mm256_extract_epi64(acc0, 1) +
+		(uint64_t)_mm256_extract_epi64(acc0, 2) +
+		(uint64_t)_mm256_extract_epi64(acc0, 3);
+	sum = (sum & 0xffffffff) + (sum >> 32);
+	sum = (sum & 0xffffffff) + (sum >> 32);
+	sum += csum_generic(p, size, init);
+	sum = (sum & 0xffffffff) + (sum >> 32);
+	sum = (sum & 0xffffffff) + (sum >> 32);
+	return (uint32_t)sum;
+}
+#endif
+
+/*首次调用时初始化表格并选择实现，并发调用时结果相同*/
+static void crc_dispatch(void)
+{
+	crc_fn crc32 = crc32_generic, crc32c = crc32c_generic, csum = csum_generic;
+
+	big_lock();
+	if (crc_inited) {
+		big_unlock();
+		return;
+	}
+	crc_tables_init();
+#ifdef CSUM_HAVE_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("pclmul") && __builtin_cpu_supports("ssse3"))
+		crc32 = crc32_pclmul;
+	if (__builtin_cpu_supports("sse4.2"))
+		crc32c = crc32c_sse42;
+	if (__builtin_cpu_supports("avx2"))
+		csum = csum_avx2;
+#endif
+	smp_wmb();
+	WRITE_ONCE(crc32c_impl, crc32c);
+	WRITE_ONCE(csum_impl, csum);
+	WRITE_ONCE(crc32_impl, crc32);
+	crc_inited = true;
+	big_unlock();
+}
+
+static uint32_t crc32_resolve(const void *buf, size_t size, uint32_t init)
+{
+	crc_dispatch();
+	return crc32_impl(buf, size, init);
+}
+
+static uint32_t crc32c_resolve(const void *buf, size_t size, uint32_t init)
+{
+	crc_dispatch();
+	return crc32c_impl(buf, size, init);
+}
+
+static uint32_t csum_resolve(const void *buf, size_t size, uint32_t init)
+{
+	crc_dispatch();
+	return csum_impl(buf, size, init);
+}
+
 uint32_t byteCrc32(const void *buf, const size_t size, uint32_t init)
 {
-    uint32_t crc = init;
-    size_t count = size;
-    uint8_t *cursor = (uint8_t *)buf;
+	return READ_ONCE(crc32_impl)(buf, size, init);
+}
 
-    while (count--) {
-        crc = (crc << 8) ^ crc32table[((crc >> 24) ^ *cursor) & 255];
-        cursor++;
-    }
+uint32_t crc32c(const void *buf, size_t size, uint32_t crc)
+{
+	return ~READ_ONCE(crc32c_impl)(buf, size, ~crc);
+}
 
-    return crc;
-}
\ No newline at end of file
+uint32_t csum_partial(const void *buf, size_t size, uint32_t sum)
+{
+	return READ_ONCE(csum_impl)(buf, size, sum);
+}
@@ -0,0 +1,94 @@
+#include <skp/utils/pbcodec.h>
+
+#ifdef __SSE2__
+# include <emmintrin.h>
+#endif
+
+/*把 8 个字节中每个字节的低 7 位拼接起来*/
+static inline uint64_t varint_gather(uint64_t x)
+{
+	return (x & 0x000000000000007fULL) |
+		((x & 0x0000000000007f00ULL) >> 1) |
+		((x & 0x00000000007f0000ULL) >> 2) |
+		((x & 0x000000007f000000ULL) >> 3) |
+		((x & 0x0000007f00000000ULL) >> 4) |
+		((x & 0x00007f0000000000ULL) >> 5) |
+		((x & 0x007f000000000000ULL) >> 6) |
+		((x & 0x7f00000000000000ULL) >> 7);
+}
+
+/*
+ * 1. 用 SSE2 取出 16 个字节的最高位，一次复制之前连续的单字节整数
+ * 2. 不超过 8 个字节的整数，由最高位的掩码计算长度，无分支地拼接
+ * 3. 其余的情况，以及接近末尾时逐字节解码
+ */
+static __always_inline size_t __varint_decode_array(const uint8_t **pos,
+		const uint8_t *end, void *out, size_t n, bool wide)
+{
+	const uint8_t *p = *pos;
+	uint64_t x, stop;
+	uint32_t len;
+	size_t i = 0;
+
+	while (i < n) {
+#ifdef __SSE2__
+		if (end - p >= 16) {
+			__m128i v = _mm_loadu_si128((const __m128i*)p);
+			uint32_t mask = (uint32_t)_mm_movemask_epi8(v);
+			size_t k = mask ? (size_t)__builtin_ctz(mask) : 16;
+			if (k > n - i)
+				k = n - i;
+			if (k) {
+				for (size_t j = 0; j < k; j++) {
+					if (wide) {
+						((uint64_t*)out)[i + j] = p[j];
+					} else {
+						((uint32_t*)out)[i + j] = p[j];
+					}
+				}
+				p += k;
+				i += k;
+				continue;
+			}
+		}
+#endif
+		if (skp_likely(end - p >= 8)) {
+			x = get_le64(p);
+			stop = ~x & 0x8080808080808080ULL;
+			if (skp_likely(stop)) {
+				len = ((uint32_t)__builtin_ctzll(stop) >> 3) + 1;
+				x = varint_gather(len < 8 ? x & ((1ULL << (len * 8)) - 1) : x);
+				goto store;
+			}
+		}
+
+		len = varint_decode(p, end, &x);
+		if (skp_unlikely(!len))
+			break;
+store:
+		if (wide) {
+			((uint64_t*)out)[i] = x;
+		} else {
+			if (skp_unlikely(x > U32_MAX))
+				break;
+			((uint32_t*)out)[i] = (uint32_t)x;
+		}
+		p += len;
+		i++;
+	}
+
+	*pos = p;
+	return i;
+}
+
+size_t varint_decode_array(const uint8_t **pos, const uint8_t *end,
+		uint64_t *out, size_t n)
+{
+	return __varint_decode_array(pos, end, out, n, true);
+}
+
+size_t varint_decode_array32(const uint8_t **pos, const uint8_t *end,
+		uint32_t *out, size_t n)
+{
+	return __varint_decode_array(pos, end, out, n, false);
+}
@@ -0,0 +1,145 @@
+#include <skp/utils/pbqueue.h>
+#include <skp/utils/futex.h>
+#include <skp/adt/ring.h>
+#include <skp/process/event.h>
+
+int pb_queue_init(struct pb_queue *q, uint32_t capacity,
+		struct uev_async *async)
+{
+	memset(q, 0, sizeof(*q));
+	q->async = async;
+	if (!capacity)
+		return 0;
+
+	q->ring = ringb_create(capacity,
+		RINGB_F_SP_ENQ|RINGB_F_SC_DEQ|RINGB_F_EXACT_SZ);
+	if (skp_unlikely(!q->ring))
+		return -ENOMEM;
+	return 0;
+}
+
+void pb_queue_destroy(struct pb_queue *q)
+{
+	struct pbuff *pb;
+
+	while ((pb = pb_queue_pop(q)))
+		free_pb(pb);
+	if (q->ring)
+		ringb_free(q->ring);
+	q->ring = NULL;
+}
+
+static void pb_queue_notify(struct pb_queue *q)
+{
+	if (q->async)
+		uev_async_emit(q->async);
+	if (READ_ONCE(q->sleeping))
+		futex_set_signal(&q->sleeping, 0, 1);
+}
+
+int pb_queue_push(struct pb_queue *q, struct pbuff *pb)
+{
+	struct pbuff *old;
+
+	/*之后由其他线程访问*/
+	if (pb_confined(pb))
+		pb_unconfine(pb);
+
+	if (q->ring) {
+		if (skp_unlikely(!ringb_sp_enqueue(q->ring, pb)))
+			return -ENOSPC;
+		/*与消费者最后一次检查是否为空配对*/
+		smp_mb();
+		if (ringb_count(q->ring) == 1)
+			pb_queue_notify(q);
+		return 0;
+	}
+
+	old = READ_ONCE(q->stack);
+	do {
+		pb->next = old;
+	} while (!__atomic_compare_exchange_n(&q->stack, &old, pb, true,
+		__ATOMIC_SEQ_CST, __ATOMIC_RELAXED));
+
+	if (!old)
+		pb_queue_notify(q);
+	return 0;
+}
+
+/*整体取走生产者压入的对象，逆序后接在私有链表之后*/
+static bool pb_queue_grab(struct pb_queue *q)
+{
+	struct pbuff *pb, *next, *head = NULL;
+
+	if (!READ_ONCE(q->stack))
+		return false;
+
+	pb = __atomic_exchange_n(&q->stack, NULL, __ATOMIC_SEQ_CST);
+	for (; pb; pb = next) {
+		next = pb->next;
+		pb->next = head;
+		head = pb;
+	}
+	/*只在私有链表为空时调用*/
+	q->head = head;
+	return true;
+}
+
+uint32_t pb_queue_pop_bulk(struct pb_queue *q, struct pbuff **pbs, uint32_t n)
+{
+	uint32_t i = 0;
+	struct pbuff *pb;
+
+	if (q->ring) {
+		i = ringb_sc_dequeue_burst(q->ring, (void**)pbs, n, NULL);
+		if (!i && n) {
+			/*与生产者入队后的检查配对，否则可能遗漏唤醒*/
+			smp_mb();
+			i = ringb_sc_dequeue_burst(q->ring, (void**)pbs, n, NULL);
+		}
+		return i;
+	}
+
+	while (i < n) {
+		if (!q->head && !pb_queue_grab(q))
+			break;
+		pb = q->head;
+		q->head = pb->next;
+		pb->next = NULL;
+		pbs[i++] = pb;
+	}
+	return i;
+}
+
+bool pb_queue_empty(const struct pb_queue *q)
+{
+	if (q->ring)
+		return ringb_empty(q->ring);
+	return !q->head && !READ_ONCE(q->stack);
+}
+
+int pb_queue_wait(struct pb_queue *q, int timeout)
+{
+	int remain = timeout;
+	uint64_t now, deadline = 0;
+
+	if (timeout > 0)
+		deadline = abstime(NULL, 0) + (uint64_t)timeout * 1000000;
+
+	while (pb_queue_empty(q)) {
+		/*虚假唤醒后按剩余的时间继续等待，直到截止时间*/
+		if (timeout > 0) {
+			now = abstime(NULL, 0);
+			if (now >= deadline)
+				return -ETIMEDOUT;
+			remain = (int)((deadline - now + 999999) / 1000000);
+		} else if (!timeout) {
+			return -ETIMEDOUT;
+		}
+		xchg(&q->sleeping, 1);
+		if (pb_queue_empty(q))
+			futex_wait(&q->sleeping, 1, remain);
+		WRITE_ONCE(q->sleeping, 0);
+	}
+	return 0;
+}
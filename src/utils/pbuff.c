@@ -1,14 +1,284 @@
+#include <sys/uio.h>
 #include <skp/utils/pbuff.h>
+#include <skp/utils/hash.h>
+#include <skp/utils/spinlock.h>
+#include <skp/process/thread.h>
 #include <skp/mm/slab.h>
 
+////////////////////////////////////////////////////////////////////////////////
+// 缓存池
+////////////////////////////////////////////////////////////////////////////////
+
+static const uint32_t pb_pool_sizes[] = { CONFIG_PB_POOL_SIZES };
+
+#define PB_POOL_NR_SIZES ARRAY_SIZE(pb_pool_sizes)
+/*控制结构的等级在数据区的等级之后*/
+#define PB_POOL_HDR PB_POOL_NR_SIZES
+#define PB_POOL_NR_CLASSES (PB_POOL_NR_SIZES + 1)
+
+struct pb_cache;
+
+/*缓存池中的对象头部，之后是数据区与共享信息，或控制结构*/
+struct pb_chunk {
+	struct pb_chunk *next;
+	struct pb_cache *owner; /*为空则不缓存，直接释放*/
+	uint32_t class;
+} __aligned(PB_DATA_ALIGN);
+
+struct pb_magazine {
+	struct pb_chunk *head;
+	uint32_t nr;
+};
+
+struct pb_cache {
+	struct pb_magazine mags[PB_POOL_NR_CLASSES];
+	/*其他线程归还的对象，无锁栈，只由所属线程整体取走*/
+	struct pb_chunk *returned __cacheline_aligned;
+	/*本线程释放的属于同一个其他线程的对象*/
+	struct pb_cache *batch_owner __cacheline_aligned;
+	struct pb_chunk *batch_head;
+	struct pb_chunk *batch_tail;
+	uint32_t batch_nr;
+	/*所属线程退出后，在等待接管的链表中*/
+	struct list_head node;
+};
+
+static DEFINE_SPINLOCK(pb_orphans_lock);
+static LIST__HEAD(pb_orphans);
+static __thread struct pb_cache *pb_local = NULL;
+
+#define PB_CACHE_NONE ((struct pb_cache*)0x01UL)
+
+static inline size_t pb_chunk_size(uint32_t class)
+{
+	if (class == PB_POOL_HDR)
+		return sizeof(struct pb_chunk) + sizeof(struct pbuff);
+	return sizeof(struct pb_chunk) + pb_pool_sizes[class] +
+		sizeof(struct pb_shared_info);
+}
+
+static inline void *pb_chunk_data(struct pb_chunk *chunk)
+{
+	return chunk + 1;
+}
+
+static inline struct pb_chunk *pb_data_chunk(void *ptr)
+{
+	return (struct pb_chunk*)ptr - 1;
+}
+
+/*整体归还给所属线程*/
+static void pb_chunk_return(struct pb_cache *owner, struct pb_chunk *head,
+		struct pb_chunk *tail)
+{
+	struct pb_chunk *old = READ_ONCE(owner->returned);
+	do {
+		tail->next = old;
+	} while (!__atomic_compare_exchange_n(&owner->returned, &old, head, true,
+		__ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+static void pb_batch_flush(struct pb_cache *cache)
+{
+	if (!cache->batch_nr)
+		return;
+	pb_chunk_return(cache->batch_owner, cache->batch_head, cache->batch_tail);
+	cache->batch_owner = NULL;
+	cache->batch_head = cache->batch_tail = NULL;
+	cache->batch_nr = 0;
+}
+
+static inline bool pb_magazine_push(struct pb_cache *cache,
+		struct pb_chunk *chunk)
+{
+	struct pb_magazine *mag = &cache->mags[chunk->class];
+	if (skp_unlikely(mag->nr >= CONFIG_PB_POOL_MAGAZINE))
+		return false;
+	chunk->next = mag->head;
+	mag->head = chunk;
+	mag->nr++;
+	return true;
+}
+
+/*取回其他线程归还的对象，返回是否取回了指定等级的对象*/
+static bool pb_cache_drain(struct pb_cache *cache, uint32_t class)
+{
+	bool found = false;
+	struct pb_chunk *next, *chunk;
+
+	if (!READ_ONCE(cache->returned))
+		return false;
+
+	chunk = __atomic_exchange_n(&cache->returned, NULL, __ATOMIC_ACQUIRE);
+	for (; chunk; chunk = next) {
+		next = chunk->next;
+		if (pb_magazine_push(cache, chunk)) {
+			found |= chunk->class == class;
+		} else {
+			free(chunk);
+		}
+	}
+	return found;
+}
+
+static void pb_cache_release(void *ptr)
+{
+	struct pb_cache *cache = ptr;
+
+	/*此后本线程不再使用缓存池，不在这里释放内存，交给新的线程接管*/
+	pb_local = PB_CACHE_NONE;
+	pb_batch_flush(cache);
+
+	spin_lock(&pb_orphans_lock);
+	list_add_tail(&cache->node, &pb_orphans);
+	spin_unlock(&pb_orphans_lock);
+}
+
+static __always_inline struct pb_cache *pb_cache_acquire(void)
+{
+	struct pb_cache *cache = pb_local;
+
+	if (skp_likely(cache))
+		return skp_likely(cache != PB_CACHE_NONE) ? cache : NULL;
+
+	pb_local = PB_CACHE_NONE;
+
+	spin_lock(&pb_orphans_lock);
+	cache = list_first_entry_or_null(&pb_orphans, struct pb_cache, node);
+	if (cache)
+		list_del(&cache->node);
+	spin_unlock(&pb_orphans_lock);
+
+	if (!cache) {
+		cache = calloc(1, sizeof(*cache));
+		if (skp_unlikely(!cache))
+			return NULL;
+	}
+
+	pb_local = cache;
+	tlsclnr_register(pb_cache_release, cache);
+	return cache;
+}
+
+static void *pb_chunk_alloc(uint32_t class)
+{
+	struct pb_chunk *chunk;
+	struct pb_magazine *mag;
+	struct pb_cache *cache = pb_cache_acquire();
+
+	if (skp_likely(cache)) {
+		mag = &cache->mags[class];
+		if (skp_likely(mag->head) || pb_cache_drain(cache, class)) {
+			chunk = mag->head;
+			mag->head = chunk->next;
+			mag->nr--;
+			return pb_chunk_data(chunk);
+		}
+	}
+
+	chunk = malloc(pb_chunk_size(class));
+	if (skp_unlikely(!chunk))
+		return NULL;
+	chunk->owner = cache;
+	chunk->class = class;
+	return pb_chunk_data(chunk);
+}
+
+static void pb_chunk_free(void *ptr)
+{
+	struct pb_chunk *chunk = pb_data_chunk(ptr);
+	struct pb_cache *cache, *owner = chunk->owner;
+
+	if (skp_unlikely(!owner)) {
+		free(chunk);
+		return;
+	}
+
+	cache = pb_local;
+	if (skp_likely(cache == owner)) {
+		if (!pb_magazine_push(cache, chunk))
+			free(chunk);
+		return;
+	}
+
+	/*没有缓存的线程逐个归还*/
+	if (skp_unlikely(!cache || cache == PB_CACHE_NONE)) {
+		pb_chunk_return(owner, chunk, chunk);
+		return;
+	}
+
+	if (cache->batch_owner != owner)
+		pb_batch_flush(cache);
+	chunk->next = cache->batch_head;
+	cache->batch_head = chunk;
+	if (!cache->batch_nr++) {
+		cache->batch_owner = owner;
+		cache->batch_tail = chunk;
+	}
+	if (cache->batch_nr >= CONFIG_PB_POOL_BATCH)
+		pb_batch_flush(cache);
+}
+
+void pb_pool_reclaim(void)
+{
+	struct pb_chunk *chunk;
+	struct pb_cache *cache = pb_local;
+
+	if (!cache || cache == PB_CACHE_NONE)
+		return;
+
+	pb_batch_flush(cache);
+	pb_cache_drain(cache, PB_POOL_NR_CLASSES);
+	for (uint32_t i = 0; i < PB_POOL_NR_CLASSES; i++) {
+		struct pb_magazine *mag = &cache->mags[i];
+		while ((chunk = mag->head)) {
+			mag->head = chunk->next;
+			free(chunk);
+		}
+		mag->nr = 0;
+	}
+}
+
+/*
+ * 分配数据区与共享信息，size 为数据区的大小，可能向上调整到尺寸等级
+ * @return 数据区的起始位置
+ */
+static uint8_t *pb_data_alloc(size_t *size, uint16_t *pool)
+{
+	size_t l = ALIGN(*size, PB_DATA_ALIGN);
+
+	for (uint32_t i = 0; i < PB_POOL_NR_SIZES; i++) {
+		if (l > pb_pool_sizes[i])
+			continue;
+		*size = pb_pool_sizes[i];
+		*pool = (uint16_t)(i + 1);
+		return pb_chunk_alloc(i);
+	}
+
+	*size = l;
+	*pool = 0;
+	return malloc(l + sizeof(struct pb_shared_info));
+}
+
+static inline void pb_data_free(uint8_t *head, uint16_t pool)
+{
+	if (pool) {
+		pb_chunk_free(head);
+	} else {
+		free(head);
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
 static struct pbuff *__def_constructor(void *_)
 {
-	return malloc(sizeof(struct pbuff));
+	return pb_chunk_alloc(PB_POOL_HDR);
 }
 
 static void __def_destructor(struct pbuff *pb)
 {
-	free(pb);
+	pb_chunk_free(pb);
 }
 
 static const struct pb_ops pb_defops = {
@@ -24,6 +294,7 @@ struct pbuff *__alloc_pb(size_t size, const struct pb_ops *pb_ops,
 {
 	struct pbuff *pb;
 	uint8_t *data;
+	uint16_t pool;
 
 	pb_ops = pb_ops?:&pb_defops;
 	if (WARN_ON(!pb_ops->constructor))
@@ -37,8 +308,7 @@ struct pbuff *__alloc_pb(size_t size, const struct pb_ops *pb_ops,
 	/*user字段 完全由构造函数管理*/
 	pb->pb_ops = pb_ops;
 
-	size = ALIGN(size, sizeof(struct pb_shared_info));
-	data = malloc(size + sizeof(struct pb_shared_info));
+	data = pb_data_alloc(&size, &pool);
 	if (skp_unlikely(!data)) {
 		if (pb_ops->destructor)
 			pb_ops->destructor(pb);
@@ -50,25 +320,180 @@ struct pbuff *__alloc_pb(size_t size, const struct pb_ops *pb_ops,
 	pb->data = data;
 	pb->tail = data;
 	pb->end = data + size;
+	pb->shinfo = (struct pb_shared_info*)pb->end;
 	pb->flags = 0;
+	pb->data_len = 0;
+	pb->frag_off = 0;
 
 	uref_init(&(pb_shinfo(pb)->dataref));
 	pb_shinfo(pb)->datalen = (uint32_t)size;
+	pb_shinfo(pb)->nr_frags = 0;
+	pb_shinfo(pb)->pool = pool;
+	pb_shinfo(pb)->frags_len = 0;
+	pb_shinfo(pb)->external = false;
+	pb_shinfo(pb)->confined = false;
+	pb_shinfo(pb)->frags = NULL;
 
 	log_debug("alloc pb : %p/%p(%zu)", pb, data, size);
 
 	return pb;
 }
 
-static inline void pb_release_data(struct pbuff *pb)
+struct pbuff *__pb_attach_external(void *ptr, size_t len,
+		pb_ext_release release, void *arg, const struct pb_ops *pb_ops,
+		void *user)
+{
+	struct pbuff *pb;
+	struct pb_ext_shared_info *ext;
+
+	if (WARN_ON(!ptr || !release || len > U32_MAX))
+		return NULL;
+
+	pb_ops = pb_ops?:&pb_defops;
+	if (WARN_ON(!pb_ops->constructor))
+		return NULL;
+
+	ext = malloc(sizeof(*ext));
+	if (skp_unlikely(!ext))
+		return NULL;
+
+	pb = pb_ops->constructor(user);
+	if (skp_unlikely(!pb)) {
+		free(ext);
+		return NULL;
+	}
+
+	pb->pb_ops = pb_ops;
+
+	ext->head = ptr;
+	ext->release = release;
+	ext->arg = arg;
+
+	uref_init(&pb->users);
+	pb->data = ptr;
+	pb->tail = pb->end = (uint8_t*)ptr + len;
+	pb->shinfo = &ext->shinfo;
+	pb->flags = 0;
+	pb->data_len = 0;
+	pb->frag_off = 0;
+
+	uref_init(&ext->shinfo.dataref);
+	ext->shinfo.datalen = (uint32_t)len;
+	ext->shinfo.nr_frags = 0;
+	ext->shinfo.pool = 0;
+	ext->shinfo.frags_len = 0;
+	ext->shinfo.external = true;
+	ext->shinfo.confined = false;
+	ext->shinfo.frags = NULL;
+
+	log_debug("attach pb : %p/%p(%zu)", pb, ptr, len);
+
+	return pb;
+}
+
+static void shinfo_release(struct pb_shared_info *shinfo);
+
+static inline void shinfo_get(struct pb_shared_info *shinfo)
 {
-	if (__uref_put(&(pb_shinfo(pb)->dataref))) {
-		log_debug("free shared data : %p/%p(%u)", pb, pb_head(pb),
-			pb_shinfo(pb)->datalen);
-		free(pb_head(pb));
+	if (shinfo->confined) {
+		uref_get_local(&shinfo->dataref);
+	} else {
+		uref_get(&shinfo->dataref);
 	}
 }
 
+static inline bool shinfo_put(struct pb_shared_info *shinfo)
+{
+	if (shinfo->confined)
+		return __uref_put_local(&shinfo->dataref);
+	return __uref_put(&shinfo->dataref);
+}
+
+/*解除限定，包括引用的分片*/
+static void shinfo_unconfine(struct pb_shared_info *shinfo)
+{
+	if (!shinfo->confined)
+		return;
+	shinfo->confined = false;
+	for (uint32_t i = 0; i < shinfo->nr_frags; i++)
+		shinfo_unconfine(shinfo->frags[i].shinfo);
+}
+
+/*
+ * 引用分片的数据区，to 没有被限定时可能被其他线程释放，
+ * 所以分片也不能再被限定
+ */
+static inline void shinfo_ref_frag(struct pb_shared_info *to,
+		struct pb_shared_info *from)
+{
+	if (!to->confined)
+		shinfo_unconfine(from);
+	shinfo_get(from);
+}
+
+static inline struct pb_frag *shinfo_alloc_frags(void)
+{
+	return malloc(sizeof(struct pb_frag) * CONFIG_PB_MAX_FRAGS);
+}
+
+void __pb_release_frags(struct pb_shared_info *shinfo)
+{
+	for (uint32_t i = 0; i < shinfo->nr_frags; i++)
+		shinfo_release(shinfo->frags[i].shinfo);
+	free(shinfo->frags);
+	shinfo->frags = NULL;
+	shinfo->nr_frags = 0;
+	shinfo->frags_len = 0;
+}
+
+/*释放一个 dataref，最后一个引用释放数据区及其引用的分片*/
+static void shinfo_release(struct pb_shared_info *shinfo)
+{
+	uint8_t *head;
+	struct pb_ext_shared_info *ext;
+
+	if (!shinfo_put(shinfo))
+		return;
+	head = pb_shinfo_head(shinfo);
+	if (shinfo->nr_frags)
+		__pb_release_frags(shinfo);
+	log_debug("free shared data : %p(%u)", head, shinfo->datalen);
+	if (skp_unlikely(shinfo->external)) {
+		ext = container_of(shinfo, struct pb_ext_shared_info, shinfo);
+		ext->release(head, ext->arg);
+		free(ext);
+		return;
+	}
+	pb_data_free(head, shinfo->pool);
+}
+
+/*新的数据区引用同样的分片，to 还没有分片*/
+static int shinfo_copy_frags(struct pb_shared_info *to,
+		const struct pb_shared_info *from)
+{
+	to->frags = NULL;
+	to->nr_frags = 0;
+	to->frags_len = 0;
+	if (!from->nr_frags)
+		return 0;
+
+	to->frags = shinfo_alloc_frags();
+	if (skp_unlikely(!to->frags))
+		return -ENOMEM;
+	for (uint32_t i = 0; i < from->nr_frags; i++) {
+		to->frags[i] = from->frags[i];
+		shinfo_ref_frag(to, to->frags[i].shinfo);
+	}
+	to->nr_frags = from->nr_frags;
+	to->frags_len = from->frags_len;
+	return 0;
+}
+
+static inline void pb_release_data(struct pbuff *pb)
+{
+	shinfo_release(pb_shinfo(pb));
+}
+
 void __free_pb(uref_t *refs)
 {
 	struct pbuff *pb = container_of(refs, struct pbuff, users);
@@ -91,7 +516,7 @@ struct pbuff *pb_clone(struct pbuff *pb)
 	/*基类的字段相同*/
 	memcpy(new, pb, sizeof(*pb));
 
-	uref_get(&(pb_shinfo(pb)->dataref));
+	shinfo_get(pb_shinfo(pb));
 	pb->cloned = 1;
 
 	uref_init(&new->users);
@@ -106,6 +531,21 @@ struct pbuff *pb_clone(struct pbuff *pb)
 	return new;
 }
 
+bool pb_confine(struct pbuff *pb)
+{
+	if (WARN_ON(pb_shared(pb) || pb_cloned(pb)))
+		return false;
+	pb->confined = 1;
+	pb_shinfo(pb)->confined = true;
+	return true;
+}
+
+void pb_unconfine(struct pbuff *pb)
+{
+	pb->confined = 0;
+	shinfo_unconfine(pb_shinfo(pb));
+}
+
 static inline int pb_copy_bits(const struct pbuff *pb,
 	ssize_t offset, void *to, uint32_t len)
 {
@@ -137,14 +577,16 @@ struct pbuff *pb_copy(struct pbuff *pb)
 
 	headerlen = pb->data - pb_head(pb);
 #ifdef DEBUG
-	BUG_ON(ALIGN(pb->end - pb_head(pb), sizeof(struct pb_shared_info)) !=
-		pb_shinfo(pb)->datalen);
+	BUG_ON(!pb_shinfo(pb)->external && ALIGN(pb->end - pb_head(pb),
+		PB_DATA_ALIGN) != pb_shinfo(pb)->datalen);
 #endif
 	new = __alloc_pb(pb_size(pb), pb->pb_ops, pb->user);
 	if (skp_unlikely(!new))
 		return NULL;
 
 	/*meta信息*/
+	new->confined = pb->confined;
+	pb_shinfo(new)->confined = pb->confined;
 	/*data信息*/
 	pb_reserve(new, (uint32_t)headerlen);
 	pb_putdata(new, pb_headlen(pb));
@@ -152,6 +594,16 @@ struct pbuff *pb_copy(struct pbuff *pb)
 	BUG_ON(pb_copy_bits(pb, -headerlen,
 		pb_head(new), (uint32_t)headerlen + pb_headlen(pb)));
 
+	/*分片是只读的，只复制引用*/
+	if (pb_nr_frags(pb)) {
+		if (skp_unlikely(shinfo_copy_frags(pb_shinfo(new), pb_shinfo(pb)))) {
+			free_pb(new);
+			return NULL;
+		}
+		new->data_len = pb->data_len;
+		new->frag_off = pb->frag_off;
+	}
+
 	/*使用回调去初始化继承类*/
 	if (new->pb_ops->copy)
 		new->pb_ops->copy(new, pb);
@@ -176,9 +628,15 @@ struct pbuff *pb_share(struct pbuff *src, ssize_t l, void *user,
 	pb->cloned = 1;
 	pb->pb_ops = ops;
 	pb->end = src->end;
+	pb->shinfo = src->shinfo;
+	/*只共享线性数据*/
+	pb->data_len = 0;
+	pb->frag_off = 0;
+
+	pb->confined = src->confined;
 
 	uref_init(&pb->users);
-	uref_get(&pb_shinfo(src)->dataref);
+	shinfo_get(pb_shinfo(src));
 
 	if (l > 0) {
 		pb->data = src->data;
@@ -198,6 +656,7 @@ int __pb_expand_head(struct pbuff *pb, size_t nhead, size_t ntail)
 	uint8_t *data;
 	ssize_t offset;
 	size_t size;
+	uint16_t pool;
 
 	BUG_ON(nhead > U32_MAX);
 	BUG_ON(ntail > U32_MAX);
@@ -206,26 +665,35 @@ int __pb_expand_head(struct pbuff *pb, size_t nhead, size_t ntail)
 		return -EPERM;
 
 	size = nhead + pb_size(pb) + ntail;
-	size = ALIGN(size, sizeof(struct pb_shared_info));
-
-	data = malloc(size + sizeof(struct pb_shared_info));
+	data = pb_data_alloc(&size, &pool);
 	if (skp_unlikely(!data))
 		return -ENOMEM;
+	/*向上调整到尺寸等级的部分留在尾部*/
 
 	/*copy user data*/
 	memcpy(data + nhead, pb_head(pb), pb_size(pb));
+	/*新的数据区在释放原来的数据区之前引用分片*/
+	((struct pb_shared_info*)(data + size))->confined = pb->confined;
+	if (skp_unlikely(shinfo_copy_frags((struct pb_shared_info*)(data + size),
+			pb_shinfo(pb)))) {
+		pb_data_free(data, pool);
+		return -ENOMEM;
+	}
 	/*注意基准点，是 data + nhead */
 	offset = data + nhead - pb_head(pb);
 	/*pb_head 动态计算，必须在计算偏移后，释放原来的数据区*/
 	pb_release_data(pb);
 
 	pb->end = data + size;
+	pb->shinfo = (struct pb_shared_info*)pb->end;
 	pb->data += offset;
 	pb->tail += offset;
 
 	pb->cloned = 0;
 	uref_init(&pb_shinfo(pb)->dataref);
 	pb_shinfo(pb)->datalen = (uint32_t)size;
+	pb_shinfo(pb)->pool = pool;
+	pb_shinfo(pb)->external = false;
 
 	/*使用回调来初始化继承类*/
 	if (pb->pb_ops->expand)
@@ -235,3 +703,115 @@ int __pb_expand_head(struct pbuff *pb, size_t nhead, size_t ntail)
 		pb, pb_head(pb), pb_shinfo(pb)->datalen);
 	return 0;
 }
+
+int pb_add_frag(struct pbuff *pb, struct pbuff *src, size_t offset, size_t len)
+{
+	struct pb_frag *frag;
+	struct pb_shared_info *shinfo = pb_shinfo(pb);
+	struct pb_shared_info *from = pb_shinfo(src);
+	uint32_t start;
+
+	if (skp_unlikely(!len))
+		return 0;
+	if (WARN_ON(offset + len > pb_headlen(src) || from == shinfo))
+		return -EINVAL;
+	/*分片数组被共享，或可见的分片数据已不是全部*/
+	if (WARN_ON(pb_cloned(pb) || pb->frag_off ||
+			pb->data_len != shinfo->frags_len))
+		return -EPERM;
+	if (skp_unlikely(shinfo->frags_len + len > U32_MAX))
+		return -EOVERFLOW;
+
+	start = (uint32_t)(pb_data(src) + offset - pb_head(src));
+	frag = shinfo->nr_frags ? &shinfo->frags[shinfo->nr_frags - 1] : NULL;
+	if (frag && frag->shinfo == from && frag->offset + frag->size == start) {
+		frag->size += (uint32_t)len;
+	} else {
+		if (skp_unlikely(shinfo->nr_frags >= CONFIG_PB_MAX_FRAGS))
+			return -ENOSPC;
+		if (!shinfo->frags) {
+			shinfo->frags = shinfo_alloc_frags();
+			if (skp_unlikely(!shinfo->frags))
+				return -ENOMEM;
+		}
+		frag = &shinfo->frags[shinfo->nr_frags++];
+		frag->shinfo = from;
+		frag->offset = start;
+		frag->size = (uint32_t)len;
+		shinfo_ref_frag(shinfo, from);
+	}
+
+	shinfo->frags_len += (uint32_t)len;
+	pb->data_len += (uint32_t)len;
+	return 0;
+}
+
+int __pb_linearize(struct pbuff *pb)
+{
+	int rc;
+	void *addr;
+	uint32_t len;
+	size_t need = pb->data_len;
+
+	/*分片被共享时，需要独立的数据区才能解除引用*/
+	if (pb_tailroom(pb) < need || pb_cloned(pb)) {
+		rc = __pb_expand_head(pb, 0, pb_tailroom(pb) < need ? need : 0);
+		if (skp_unlikely(rc))
+			return rc;
+	}
+
+	pb_for_each_frag(pb, addr, len)
+		__pb_write_bytes(pb, addr, len);
+
+	__pb_release_frags(pb_shinfo(pb));
+	pb->data_len = 0;
+	pb->frag_off = 0;
+	return 0;
+}
+
+int pb_to_iovec(const struct pbuff *pb, struct iovec *iov, int nr)
+{
+	int n = 0;
+	void *addr;
+	uint32_t len;
+
+	if (skp_unlikely(nr < 1))
+		return 0;
+	if (pb_headlen(pb)) {
+		iov[n].iov_base = pb_data(pb);
+		iov[n++].iov_len = pb_headlen(pb);
+	}
+
+	pb_for_each_frag(pb, addr, len) {
+		if (n == nr)
+			break;
+		iov[n].iov_base = addr;
+		iov[n++].iov_len = len;
+	}
+	return n;
+}
+
+uint32_t pb_csum(const struct pbuff *pb, uint32_t sum)
+{
+	void *addr;
+	uint32_t len;
+	size_t offset = pb_headlen(pb);
+
+	sum = csum_partial(pb_data(pb), offset, sum);
+	pb_for_each_frag(pb, addr, len) {
+		sum = csum_block_add(sum, csum_partial(addr, len, 0), offset);
+		offset += len;
+	}
+	return sum;
+}
+
+uint32_t pb_crc32c(const struct pbuff *pb, uint32_t crc)
+{
+	void *addr;
+	uint32_t len;
+
+	crc = crc32c(pb_data(pb), pb_headlen(pb), crc);
+	pb_for_each_frag(pb, addr, len)
+		crc = crc32c(addr, len, crc);
+	return crc;
+}
@@ -19,6 +19,70 @@ static void write_data(struct vpage *page)
 # define write_data(p) ((void)(p))
 #endif
 
+#define NR_SCAVENGE 16
+
+static long buddy_resident(void)
+{
+	struct hpage_stat stat;
+	BUG_ON(node_hpage_stat(&stat));
+	return (long)stat.resident;
+}
+
+static void dirty_and_free(int order, int gfp_flags)
+{
+	struct vpage *pages[NR_SCAVENGE];
+
+	for (int i = 0; i < NR_SCAVENGE >> order; i++) {
+		pages[i] = __alloc_pages(gfp_flags, order);
+		BUG_ON(!pages[i]);
+		if (gfp_flags & __GFP_ZERO) {
+			/*归还的页再次分配时内容为零*/
+			char *ptr = page_to_virt(pages[i]);
+			for (size_t j = 0; j < VPAGE_SIZE << order; j += 64)
+				BUG_ON(ptr[j]);
+		}
+		memset(page_to_virt(pages[i]), 0xa5, VPAGE_SIZE << order);
+	}
+	for (int i = 0; i < NR_SCAVENGE >> order; i++)
+		___free_pages(pages[i], order);
+}
+
+static void test_scavenge(void)
+{
+	unsigned long nr;
+	long before, after;
+	const long expect = (NR_SCAVENGE * VPAGE_SIZE) / 2;
+
+	dirty_and_free(0, 0);
+	before = buddy_resident();
+
+	/*第一次只标记空闲，第二次才归还*/
+	BUG_ON(buddy_scavenge(0));
+	nr = buddy_scavenge(0);
+	after = buddy_resident();
+	log_info("scavenge %lu pages, resident %ld KB -> %ld KB", nr,
+		before >> 10, after >> 10);
+	BUG_ON(nr < NR_SCAVENGE);
+	BUG_ON(before - after < expect);
+	/*没有新的空闲块*/
+	BUG_ON(buddy_scavenge(0));
+
+	dirty_and_free(0, __GFP_ZERO);
+
+	/*后台回收，先启动以免工作线程的分配影响统计*/
+	buddy_set_scavenger(1, 20);
+	usleep(100000);
+	dirty_and_free(2, __GFP_ZERO);
+	before = buddy_resident();
+	for (int i = 0; i < 50 && before - buddy_resident() < expect; i++)
+		usleep(20000);
+	buddy_set_scavenger(0, 0);
+	after = buddy_resident();
+	log_info("background scavenge, resident %ld KB -> %ld KB",
+		before >> 10, after >> 10);
+	BUG_ON(before - after < expect);
+}
+
 int main(int argc, char **argv)
 {
 	LIST__HEAD(list);
@@ -26,7 +90,9 @@ int main(int argc, char **argv)
 	int rand = 0;
 	int order = 0;
 	int count = 22;
+	unsigned long peak = 0;
 	struct vpage *page;
+	struct hpage_stat stat;
 	uint64_t start, end;
 
 	if (argc > 1)
@@ -44,11 +110,15 @@ int main(int argc, char **argv)
 	log_info("test param : block %ld MBytes, times %d",
 		(VPAGE_SIZE << order) >> 20, count);
 
+	thread_bind(0);
 	setup_memory();
 
 	/*compound*/
 	page = __alloc_pages(__GFP_COMP, 3);
 	BUG_ON(!page);
+	/*优先从本地物理节点分配*/
+	if (numa_local_nid() > NUMA_NO_NODE)
+		BUG_ON(page_to_nid(page) != numa_local_nid());
 	for (int i = 0; i < (1 << 3); i++) {
 		struct vpage *curr = &page[i];
 		BUG_ON(page != compound_head(curr));
@@ -68,6 +138,9 @@ int main(int argc, char **argv)
 		end = similar_abstime(0, 0);
 		log_info("alloc spend %.2lf", ((double)(end - start)) / count);
 
+		if (!WARN_ON(node_hpage_stat(&stat)))
+			peak = max(peak, stat.mapped);
+
 		start = similar_abstime(0, 0);
 		for (int i = 0; i < count; i++) {
 			page = first_page_on_list(&list);
@@ -81,7 +154,21 @@ int main(int argc, char **argv)
 		log_info("free spend %.2lf", ((double)(end - start)) / count);
 	}
 
+	if (!WARN_ON(node_hpage_stat(&stat))) {
+		/*释放后多余的内存块被解除映射，统计随之扣除*/
+		if (count >= (int)(BUDDY_BLKPAGES << 2) && !rand)
+			BUG_ON(stat.mapped >= peak);
+		BUG_ON(stat.hugetlb + stat.advised > stat.mapped);
+		BUG_ON(stat.huge_backed > stat.resident);
+		log_info("buddy memory : mapped %lu MB, hugetlb %lu MB, advised %lu MB,"
+			" resident %lu KB, huge backed %lu KB", stat.mapped >> 20,
+			stat.hugetlb >> 20, stat.advised >> 20, stat.resident >> 10,
+			stat.huge_backed >> 10);
+	}
+
 	pgcache_reclaim();
 
+	test_scavenge();
+
 	return EXIT_SUCCESS;
 }
@@ -0,0 +1,273 @@
+//
+//  test-prefork.c
+//  test
+//
+//  Created by 周凯 on 2020/01/16.
+//  Copyright © 2020 zhoukai. All rights reserved.
+//
+
+#include <stdio.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <skp/process/event.h>
+#include <skp/process/signal.h>
+#include <skp/server/server.h>
+#include <skp/server/socket.h>
+#include <skp/server/xprt.h>
+#include <skp/server/prefork.h>
+
+#define NR_WORKERS (2)
+#define NR_CLIENTS (8)
+#define PORT (10027)
+#define MSG "prefork"
+
+/*回显的字节数*/
+#define STAT_ECHOED (PREFORK_STAT_USER)
+
+static const struct service_address laddr = {
+	.host = "127.0.0.1",
+	.serv = "10027",
+};
+
+/*工作进程与客户端进程共享，在 fork() 之前映射*/
+struct test_shared {
+	uint32_t nr_started[NR_WORKERS]; /*工作进程进入事件循环的次数*/
+	ino_t lstn_ino[NR_WORKERS]; /*工作进程侦听套接字的 inode*/
+	uint32_t nr_exited; /*第二次运行中正常退出的工作进程数*/
+};
+
+static struct test_shared *shared = NULL;
+
+////////////////////////////////////////////////////////////////////////////////
+// 工作进程
+////////////////////////////////////////////////////////////////////////////////
+
+static struct server *SRV = NULL;
+static struct uev_timer stop_timer;
+static volatile sig_atomic_t stopping = 0;
+
+static void echo_recv(struct xprt *xprt, unsigned long stats)
+{
+	char buff[64];
+	ssize_t rc;
+
+	do {
+		rc = xprt_read(xprt, buff, sizeof(buff));
+		if (rc > 0) {
+			BUG_ON(xprt_write(xprt, buff, rc) != rc);
+			prefork_stat_add(STAT_ECHOED, rc);
+			continue;
+		}
+		shutdown_xprt(xprt, SHUT_RDWR);
+		break;
+	} while (1);
+}
+
+static void echo_changed(struct xprt *xprt, unsigned long stats)
+{
+	if (stats & XPRT_OPENED)
+		xprt_event_enable(xprt, EVENT_READ);
+}
+
+static const struct xprt_operations echo_ops = {
+	.constructor = xprt_tcpclnt_constructor,
+	.destructor = xprt_tcpclnt_destructor,
+	.on_recv = echo_recv,
+	.on_send = NULL,
+	.on_changed = echo_changed,
+};
+
+static void worker_signal(int signo)
+{
+	stopping = 1;
+}
+
+/*信号处理函数中不能操作服务器，由定时器检查*/
+static void stop_timer_cb(struct uev_timer *timer)
+{
+	if (stopping) {
+		server_stop(SRV);
+		return;
+	}
+	uev_timer_add(timer, 20);
+}
+
+static int worker_main(int index, void *arg)
+{
+	struct xprt *lstn;
+	struct stat st;
+	int reuse = 0;
+	const struct prefork_worker *self = prefork_worker(index);
+
+	BUG_ON(prefork_index() != index);
+	BUG_ON(!self);
+
+	/*第一个工作进程第一次运行时崩溃，由主进程重新创建*/
+	if (!arg && index == 0 && self->nr_spawns == 1)
+		raise(SIGKILL);
+
+	/*第二次运行时其余工作进程正常退出，不会被重新创建*/
+	if (arg && index > 0) {
+		__atomic_add_fetch(&shared->nr_exited, 1, __ATOMIC_SEQ_CST);
+		return 0;
+	}
+
+	signal_setup(SIGPIPE, signal_default);
+	signal_setup(SIGTERM, worker_signal);
+
+	SRV = ___alloc_server(sizeof(struct server), NR_CLIENTS + 2, 0);
+	BUG_ON(!SRV);
+
+	/*继承主进程的侦听套接字，不会因为地址被占用而失败*/
+	lstn = create_xprt(SRV, &laddr,
+		XPRT_TCPSERV|XPRT_OPT_NONBLOCK|XPRT_RDREADY, &xprt_tcpserv_ops,
+		NULL, &echo_ops);
+	BUG_ON(!lstn);
+	/*每个工作进程有自己的侦听套接字*/
+	BUG_ON(fstat(xprt_fd(lstn), &st));
+	BUG_ON(sockopt_get_intval(xprt_fd(lstn), SOL_SOCKET, SO_REUSEPORT,
+		&reuse) || !reuse);
+	shared->lstn_ino[index] = st.st_ino;
+	__atomic_add_fetch(&shared->nr_started[index], 1, __ATOMIC_SEQ_CST);
+
+	uev_timer_init(&stop_timer, stop_timer_cb);
+	uev_timer_add(&stop_timer, 20);
+
+	server_loop(SRV);
+	uev_timer_delete_sync(&stop_timer);
+	xprt_put(lstn);
+	destroy_server(SRV);
+	log_info("worker %d exit", index);
+	return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// 主进程
+////////////////////////////////////////////////////////////////////////////////
+
+static void raw_echo(void)
+{
+	union inet_address inet;
+	struct timeval tv = { .tv_sec = 5, .tv_usec = 0 };
+	char buff[sizeof(MSG)];
+	size_t n = 0;
+	ssize_t rc;
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+
+	BUG_ON(fd < 0);
+	memset(&inet, 0, sizeof(inet));
+	inet.sin_addr.sin_family = AF_INET;
+	inet.sin_addr.sin_port = htons(PORT);
+	inet.sin_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	BUG_ON(connect(fd, &inet.sock_addr, sizeof(inet.sin_addr)));
+	BUG_ON(setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)));
+	BUG_ON(write(fd, MSG, sizeof(MSG)) != sizeof(MSG));
+	while (n < sizeof(MSG)) {
+		rc = read(fd, buff + n, sizeof(MSG) - n);
+		BUG_ON(rc <= 0);
+		n += rc;
+	}
+	BUG_ON(memcmp(buff, MSG, sizeof(MSG)));
+	/*等待工作进程关闭*/
+	BUG_ON(shutdown(fd, SHUT_WR));
+	BUG_ON(read(fd, buff, 1) != 0);
+	close(fd);
+}
+
+/*
+ * 在 prefork_run() 之前创建的进程，主进程在此之前不能创建线程
+ * 只使用系统调用，成功后通知主进程停止，失败则由主进程的 alarm() 结束测试
+ */
+static void client_main(void)
+{
+	/*等待崩溃的工作进程被重新创建*/
+	while (__atomic_load_n(&shared->nr_started[0], __ATOMIC_SEQ_CST) < 1 ||
+			__atomic_load_n(&shared->nr_started[1], __ATOMIC_SEQ_CST) < 1)
+		usleep(20000);
+
+	for (int i = 0; i < NR_CLIENTS; i++)
+		raw_echo();
+
+	kill(getppid(), SIGTERM);
+	_exit(0);
+}
+
+/*
+ * 正常退出的工作进程的侦听套接字被主进程释放，
+ * 所有连接都应由剩下的工作进程接受，否则 raw_echo() 超时
+ */
+static void client_exited_main(void)
+{
+	while (__atomic_load_n(&shared->nr_started[0], __ATOMIC_SEQ_CST) < 1 ||
+			__atomic_load_n(&shared->nr_exited, __ATOMIC_SEQ_CST) < NR_WORKERS - 1)
+		usleep(20000);
+	/*等待主进程回收退出的工作进程*/
+	usleep(200000);
+
+	for (int i = 0; i < NR_CLIENTS; i++)
+		raw_echo();
+
+	kill(getppid(), SIGTERM);
+	_exit(0);
+}
+
+int main(int argc, char *argv[])
+{
+	pid_t pid;
+	uint64_t counters[CONFIG_PREFORK_NR_COUNTERS];
+
+	alarm(30);
+
+	shared = mmap(NULL, sizeof(*shared), PROT_READ|PROT_WRITE,
+		MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+	BUG_ON(shared == MAP_FAILED);
+	memset(shared, 0, sizeof(*shared));
+
+	BUG_ON(prefork_listen(&laddr));
+	BUG_ON(prefork_index() != -1);
+
+	pid = fork();
+	BUG_ON(pid < 0);
+	if (!pid)
+		client_main();
+
+	BUG_ON(prefork_run(NR_WORKERS, worker_main, NULL));
+
+	BUG_ON(prefork_stats(counters) != NR_WORKERS);
+	log_info("accepted %lu, closed %lu, echoed %lu",
+		(unsigned long)counters[PREFORK_STAT_ACCEPTED],
+		(unsigned long)counters[PREFORK_STAT_CLOSED],
+		(unsigned long)counters[STAT_ECHOED]);
+	BUG_ON(counters[PREFORK_STAT_ACCEPTED] != NR_CLIENTS);
+	BUG_ON(counters[PREFORK_STAT_CLOSED] != NR_CLIENTS);
+	BUG_ON(counters[STAT_ECHOED] != NR_CLIENTS * sizeof(MSG));
+
+	for (int i = 0; i < NR_WORKERS; i++) {
+		const struct prefork_worker *w = prefork_worker(i);
+		BUG_ON(!w || w->pid);
+		BUG_ON(w->nr_spawns != (i ? 1 : 2));
+		BUG_ON(shared->nr_started[i] != 1);
+	}
+	BUG_ON(shared->lstn_ino[0] == shared->lstn_ino[1]);
+	/*客户端进程可能已经被 prefork_run() 回收*/
+	waitpid(pid, NULL, 0);
+
+	/*再次运行，停止时暂停的侦听套接字重新侦听*/
+	memset(shared, 0, sizeof(*shared));
+	pid = fork();
+	BUG_ON(pid < 0);
+	if (!pid)
+		client_exited_main();
+
+	BUG_ON(prefork_run(NR_WORKERS, worker_main, (void *)1));
+
+	BUG_ON(prefork_stats(counters) != NR_WORKERS);
+	BUG_ON(counters[PREFORK_STAT_ACCEPTED] != NR_CLIENTS);
+	BUG_ON(counters[STAT_ECHOED] != NR_CLIENTS * sizeof(MSG));
+	BUG_ON(prefork_worker(1)->nr_spawns != 1);
+	waitpid(pid, NULL, 0);
+
+	log_info("test prefork success");
+	return 0;
+}
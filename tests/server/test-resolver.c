@@ -0,0 +1,230 @@
+//
+//  test-resolver.c
+//  test
+//
+//  Created by 周凯 on 2020/01/06.
+//  Copyright © 2020 zhoukai. All rights reserved.
+//
+
+#include <stdio.h>
+#include <skp/process/event.h>
+#include <skp/process/signal.h>
+#include <skp/server/server.h>
+#include <skp/server/xprt.h>
+#include <skp/server/resolver.h>
+
+#define NR_CLIENTS (4)
+#define PORT "10011"
+
+static struct server *SRV = NULL;
+static struct uev_timer watchdog;
+static int nr_opened = 0;
+static int nr_refused = 0;
+static int nr_closed = 0;
+static int nr_resolved = 0;
+
+static void test_sync(void)
+{
+	struct resolv_result result;
+	const struct service_address numeric = {
+		.host = "127.0.0.1",
+		.serv = PORT,
+	};
+	const struct service_address name = {
+		.host = "localhost",
+		.serv = PORT,
+	};
+	const struct service_address badserv = {
+		.host = "localhost",
+		.serv = "no-such-service",
+	};
+
+	/*数字地址不需要缓存*/
+	BUG_ON(resolv_cached(&numeric, AF_UNSPEC, &result));
+	BUG_ON(result.nr != 1);
+	BUG_ON(result.addrs[0].sock_addr.sa_family != AF_INET);
+	BUG_ON(inet_address_port(&result.addrs[0]) != 10011);
+
+	resolv_cache_flush();
+	BUG_ON(resolv_cached(&name, AF_INET, &result) != -ENOENT);
+	BUG_ON(resolv_lookup(&name, AF_INET, &result));
+	BUG_ON(!result.nr);
+	BUG_ON(inet_address_port(&result.addrs[0]) != 10011);
+	/*命中缓存*/
+	memset(&result, 0, sizeof(result));
+	BUG_ON(resolv_cached(&name, AF_INET, &result));
+	BUG_ON(!result.nr);
+
+	/*失败的结果也会被缓存*/
+	BUG_ON(!resolv_lookup(&badserv, AF_UNSPEC, &result));
+	BUG_ON(resolv_cached(&badserv, AF_UNSPEC, &result) == -ENOENT);
+	BUG_ON(!resolv_cached(&badserv, AF_UNSPEC, &result));
+
+	resolv_cache_flush();
+	BUG_ON(resolv_cached(&name, AF_INET, &result) != -ENOENT);
+}
+
+static void resolve_done(struct resolv_req *req, int err)
+{
+	BUG_ON(err);
+	BUG_ON(!req->result.nr);
+	BUG_ON(inet_address_port(&req->result.addrs[0]) != 10011);
+	__atomic_add_fetch(&nr_resolved, 1, __ATOMIC_SEQ_CST);
+}
+
+static void test_async(void)
+{
+	int rc, pending = 0;
+	struct resolv_req reqs[4];
+	const struct service_address name = {
+		.host = "localhost",
+		.serv = PORT,
+	};
+
+	/*同一名称的并发解析只会发起一次，之后命中缓存*/
+	for (int i = 0; i < ARRAY_SIZE(reqs); i++) {
+		rc = resolv_async(&name, AF_UNSPEC, &reqs[i], resolve_done);
+		BUG_ON(rc && rc != -EINPROGRESS);
+		if (rc)
+			pending++;
+	}
+	while (READ_ONCE(nr_resolved) != pending)
+		usleep(1000);
+
+	BUG_ON(resolv_async(&name, AF_UNSPEC, &reqs[0], resolve_done));
+	BUG_ON(!reqs[0].result.nr);
+	resolv_cache_flush();
+}
+
+static void client_recv(struct xprt *xprt, unsigned long stats)
+{
+	char buff[64];
+	ssize_t rc;
+
+	do {
+		rc = xprt_read(xprt, buff, sizeof(buff));
+		if (rc > 0)
+			continue;
+		if (rc != -EAGAIN)
+			shutdown_xprt(xprt, SHUT_RDWR);
+		break;
+	} while (1);
+}
+
+static void client_send(struct xprt *xprt, unsigned long stats)
+{
+}
+
+static void try_pause(void)
+{
+	/*主动端全部打开或被拒绝，被动端全部关闭*/
+	if (READ_ONCE(nr_opened) == NR_CLIENTS &&
+			READ_ONCE(nr_refused) == NR_CLIENTS &&
+			READ_ONCE(nr_closed) == NR_CLIENTS * 2) {
+		log_info("all connections has been finished");
+		server_pause(SRV);
+	}
+}
+
+static void client_changed(struct xprt *xprt, unsigned long stats)
+{
+	if (stats & XPRT_OPENED) {
+		if (xprt->user) {
+			xprt_event_enable(xprt, EVENT_READ);
+		} else {
+			/*已经解析并连接，远端地址为环回地址*/
+			struct xprt_tcpclnt *clnt = xprt_to_tcpclnt(xprt);
+			BUG_ON(inet_address_port(&clnt->remote) != 10011);
+			__atomic_add_fetch(&nr_opened, 1, __ATOMIC_SEQ_CST);
+			/*被动端在首次可读时才就绪*/
+			BUG_ON(xprt_write(xprt, "ping", 4) != 4);
+			shutdown_xprt(xprt, SHUT_RDWR);
+		}
+	} else if (stats & XPRT_CLOSED) {
+		__atomic_add_fetch(&nr_closed, 1, __ATOMIC_SEQ_CST);
+		try_pause();
+	} else if (stats & XPRT_CONNREFUSED) {
+		BUG_ON(xprt->user);
+		__atomic_add_fetch(&nr_refused, 1, __ATOMIC_SEQ_CST);
+		try_pause();
+	}
+}
+
+static const struct xprt_operations client_ops = {
+	.constructor = xprt_tcpclnt_constructor,
+	.destructor = xprt_tcpclnt_destructor,
+	.on_recv = client_recv,
+	.on_send = client_send,
+	.on_changed = client_changed,
+};
+
+static void watchdog_cb(struct uev_timer *timer)
+{
+	log_error("test has been timed out : opened %d, refused %d, closed %d",
+		nr_opened, nr_refused, nr_closed);
+	BUG();
+}
+
+static void server_init(void)
+{
+	struct xprt *xprt;
+	const struct service_address laddr = {
+		.host = "127.0.0.1",
+		.serv = PORT,
+	};
+	const struct service_address raddr = {
+		.host = "localhost",
+		.serv = PORT,
+	};
+	const struct service_address baddr = {
+		.host = "localhost",
+		.serv = "no-such-service",
+	};
+
+	signal_setup(SIGPIPE, signal_default);
+
+	SRV = ___alloc_server(sizeof(struct server), NR_CLIENTS * 3 + 1, 0);
+	BUG_ON(!SRV);
+
+	xprt = create_xprt(SRV, &laddr,
+			XPRT_TCPSERV|XPRT_OPT_NONBLOCK|XPRT_RDREADY, &xprt_tcpserv_ops,
+			NULL, &client_ops);
+	BUG_ON(!xprt);
+	xprt_put(xprt);
+
+	/*缓存已清空，主机名在工作队列中解析，create_xprt() 不会阻塞*/
+	for (int i = 0; i < NR_CLIENTS; i++) {
+		xprt = create_xprt(SRV, &raddr,
+			XPRT_TCPCLNT|XPRT_OPT_NONBLOCK|XPRT_WRREADY, &client_ops, NULL);
+		BUG_ON(!xprt);
+		xprt_put(xprt);
+	}
+
+	/*解析失败，通过事件报告连接被拒绝*/
+	for (int i = 0; i < NR_CLIENTS; i++) {
+		xprt = create_xprt(SRV, &baddr,
+			XPRT_TCPCLNT|XPRT_OPT_NONBLOCK|XPRT_WRREADY, &client_ops, NULL);
+		if (!xprt) {
+			/*命中了失败的缓存*/
+			BUG_ON(errno != ENXIO);
+			__atomic_add_fetch(&nr_refused, 1, __ATOMIC_SEQ_CST);
+			continue;
+		}
+		xprt_put(xprt);
+	}
+
+	uev_timer_init(&watchdog, watchdog_cb);
+	uev_timer_add(&watchdog, 10000);
+}
+
+int main(int argc, const char *argv[])
+{
+	test_sync();
+	test_async();
+	server_init();
+	server_loop(SRV);
+	uev_timer_delete_sync(&watchdog);
+	destroy_server(SRV);
+	log_info("test resolver success");
+	return 0;
+}
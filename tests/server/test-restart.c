@@ -0,0 +1,217 @@
+//
+//  test-restart.c
+//  test
+//
+//  Created by 周凯 on 2020/01/15.
+//  Copyright © 2020 zhoukai. All rights reserved.
+//
+
+#include <stdio.h>
+#include <sys/wait.h>
+#include <sys/stat.h>
+#include <skp/process/event.h>
+#include <skp/process/signal.h>
+#include <skp/process/daemon.h>
+#include <skp/server/server.h>
+#include <skp/server/xprt.h>
+#include <skp/server/restart.h>
+
+#define NR_CLIENTS (3)
+#define PORT (10026)
+
+static struct server *SRV = NULL;
+static struct uev_timer watchdog;
+static int nr_closed = 0;
+static const struct service_address laddr = {
+	.host = "127.0.0.1",
+	.serv = "10026",
+};
+
+static long pidfile_read(const char *name)
+{
+	long pid = 0;
+	char path[128];
+	FILE *fp;
+
+	snprintf(path, sizeof(path), "/tmp/%s.daemon.pid", name);
+	fp = fopen(path, "r");
+	BUG_ON(!fp);
+	BUG_ON(fscanf(fp, "%ld", &pid) != 1);
+	fclose(fp);
+	return pid;
+}
+
+/*原样返回后关闭*/
+static void echo_recv(struct xprt *xprt, unsigned long stats)
+{
+	char buff[64];
+	ssize_t rc;
+
+	do {
+		rc = xprt_read(xprt, buff, sizeof(buff));
+		if (rc > 0) {
+			BUG_ON(xprt_write(xprt, buff, rc) != rc);
+			continue;
+		}
+		shutdown_xprt(xprt, SHUT_RDWR);
+		break;
+	} while (1);
+}
+
+static void echo_changed(struct xprt *xprt, unsigned long stats)
+{
+	if (stats & XPRT_OPENED) {
+		xprt_event_enable(xprt, EVENT_READ);
+	} else if (stats & XPRT_CLOSED) {
+		if (__atomic_add_fetch(&nr_closed, 1, __ATOMIC_SEQ_CST) == NR_CLIENTS)
+			server_pause(SRV);
+	}
+}
+
+static const struct xprt_operations echo_ops = {
+	.constructor = xprt_tcpclnt_constructor,
+	.destructor = xprt_tcpclnt_destructor,
+	.on_recv = echo_recv,
+	.on_send = NULL,
+	.on_changed = echo_changed,
+};
+
+static void watchdog_cb(struct uev_timer *timer)
+{
+	log_error("test has been timed out : closed %d", nr_closed);
+	BUG();
+}
+
+static struct xprt *server_init(void)
+{
+	struct xprt *lstn;
+
+	signal_setup(SIGPIPE, signal_default);
+
+	SRV = ___alloc_server(sizeof(struct server), NR_CLIENTS + 2, 0);
+	BUG_ON(!SRV);
+
+	lstn = create_xprt(SRV, &laddr,
+		XPRT_TCPSERV|XPRT_OPT_NONBLOCK|XPRT_RDREADY, &xprt_tcpserv_ops,
+		NULL, &echo_ops);
+	BUG_ON(!lstn);
+
+	uev_timer_init(&watchdog, watchdog_cb);
+	uev_timer_add(&watchdog, 10000);
+	return lstn;
+}
+
+static int raw_connect(void)
+{
+	union inet_address inet;
+	struct timeval tv = { .tv_sec = 5, .tv_usec = 0 };
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+
+	BUG_ON(fd < 0);
+	memset(&inet, 0, sizeof(inet));
+	inet.sin_addr.sin_family = AF_INET;
+	inet.sin_addr.sin_port = htons(PORT);
+	inet.sin_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	BUG_ON(connect(fd, &inet.sock_addr, sizeof(inet.sin_addr)));
+	BUG_ON(setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)));
+	BUG_ON(write(fd, "x", 1) != 1);
+	return fd;
+}
+
+/*交接的目录与套接字只有自己可以访问，不是私有的目录被拒绝*/
+static void test_private(void)
+{
+	struct stat st;
+	const char *dir = "/tmp/test-restart-shared.restart";
+
+	BUG_ON(stat("/tmp/test-restart.restart", &st));
+	BUG_ON(!S_ISDIR(st.st_mode) || (st.st_mode & 07777) != S_IRWXU);
+	BUG_ON(stat("/tmp/test-restart.restart/" CONFIG_RESTART_SOCKET, &st));
+	BUG_ON(!S_ISSOCK(st.st_mode) || (st.st_mode & 07777) != (S_IRUSR|S_IWUSR));
+
+	rmdir(dir);
+	BUG_ON(mkdir(dir, 0755));
+	BUG_ON(chmod(dir, 0755));
+	BUG_ON(restart_serve(SRV, "test-restart-shared", -1) != -EPERM);
+	BUG_ON(restart_takeover("test-restart-shared", -1) != -EPERM);
+	BUG_ON(rmdir(dir));
+}
+
+/*新进程：接管侦听套接字，处理旧进程留在队列中的连接*/
+static int new_main(int argc, char *argv[])
+{
+	int lfd, rc;
+	struct xprt *lstn;
+
+	lfd = daemonize(argc, argv);
+	BUG_ON(lfd < 0 || !isrestart);
+
+	rc = restart_takeover(argv[0], lfd);
+	BUG_ON(rc != 1);
+	BUG_ON(pidfile_read("test-restart") != (long)getpid());
+
+	/*旧进程的套接字仍在侦听，不继承就会绑定失败*/
+	lstn = server_init();
+	restart_release();
+	BUG_ON(restart_serve(SRV, argv[0], lfd));
+
+	server_loop(SRV);
+	uev_timer_delete_sync(&watchdog);
+	xprt_put(lstn);
+	destroy_server(SRV);
+	log_info("new process has taken over all connections");
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	int lfd, status;
+	int fds[NR_CLIENTS];
+	struct xprt *lstn;
+	pid_t pid;
+	char c;
+
+	if (argc > 1 && !strcmp(argv[1], "--restart"))
+		return new_main(argc, argv);
+
+	lfd = daemonize(argc, argv);
+	BUG_ON(lfd < 0);
+	/*没有旧进程时直接加锁*/
+	BUG_ON(restart_takeover(argv[0], -1));
+
+	lstn = server_init();
+	BUG_ON(restart_serve(SRV, argv[0], lfd));
+	test_private();
+
+	/*不再接受，连接停留在内核的全连接队列中*/
+	BUG_ON(xprt_event_disable(lstn, EVENT_READ) < 0);
+	for (int i = 0; i < NR_CLIENTS; i++)
+		fds[i] = raw_connect();
+
+	pid = fork();
+	BUG_ON(pid < 0);
+	if (!pid) {
+		execl("/proc/self/exe", argv[0], "--restart", NULL);
+		_exit(127);
+	}
+
+	/*交接后没有其他连接，立即退出主循环*/
+	server_loop(SRV);
+	uev_timer_delete_sync(&watchdog);
+	log_info("old process has drained");
+
+	for (int i = 0; i < NR_CLIENTS; i++) {
+		BUG_ON(read(fds[i], &c, 1) != 1 || c != 'x');
+		close(fds[i]);
+	}
+
+	BUG_ON(waitpid(pid, &status, 0) != pid);
+	BUG_ON(!WIFEXITED(status) || WEXITSTATUS(status));
+	BUG_ON(pidfile_read("test-restart") != (long)pid);
+
+	xprt_put(lstn);
+	destroy_server(SRV);
+	close(lfd);
+	log_info("test restart success");
+	return 0;
+}
@@ -0,0 +1,234 @@
+//
+//  test-ssl_async.c
+//  test
+//
+//  Created by 周凯 on 2020/01/20.
+//  Copyright © 2020 zhoukai. All rights reserved.
+//
+
+#include <stdio.h>
+#include <skp/process/event.h>
+#include <skp/process/signal.h>
+#include <skp/server/server.h>
+#include <skp/server/xprt.h>
+
+#define MSG "message after async handshake"
+#define MSG_SIZE (sizeof(MSG) - 1)
+#define NR_CLNTS (4)
+
+/*
+ * 两端都在工作队列中握手，每一步都返回 -EAGAIN，
+ * 由工作线程开启的单次写事件回到事件线程继续
+ */
+struct hs_stat {
+	int nr_eagain; /*握手返回 -EAGAIN 的次数*/
+	int nr_queued; /*提交到工作队列的单步握手次数*/
+};
+
+static struct server *SRV = NULL;
+static struct uev_timer watchdog;
+static struct hs_stat clnt_stats[NR_CLNTS];
+static struct hs_stat serv_stats[NR_CLNTS];
+static size_t nr_echoed[NR_CLNTS];
+static int nr_accepted = 0;
+static int nr_closed = 0;
+
+static void try_pause(void)
+{
+	if (__atomic_add_fetch(&nr_closed, 1, __ATOMIC_SEQ_CST) == NR_CLNTS * 2)
+		server_pause(SRV);
+}
+
+static struct xprt *ssl_constructor(struct server *serv, unsigned long opt,
+		void *user)
+{
+	struct xprt_ssl *ssl = malloc(sizeof(*ssl));
+	BUG_ON(!ssl);
+	BUG_ON(xprt_ssl_init(ssl, opt));
+	BUG_ON(!(opt & XPRT_OPT_SSLASYNC));
+	ssl->tcp.xprt.user = user;
+	return &ssl->tcp.xprt;
+}
+
+static struct xprt *echo_constructor(struct server *serv, unsigned long opt,
+		void *user)
+{
+	int idx = __atomic_fetch_add(&nr_accepted, 1, __ATOMIC_SEQ_CST);
+	BUG_ON(idx >= NR_CLNTS);
+	return ssl_constructor(serv, opt, &serv_stats[idx]);
+}
+
+static void ssl_destructor(struct xprt *xprt)
+{
+	struct xprt_ssl *ssl = xprt_to_ssl(xprt);
+	xprt_ssl_finit(ssl);
+	free(ssl);
+}
+
+static int async_handshake(struct xprt *xprt, unsigned long event)
+{
+	int rc;
+	struct hs_stat *stat = xprt->user;
+	struct xprt_ssl *ssl = xprt_to_ssl(xprt);
+	bool idle = ssl->hs_state == XPRT_SSL_HS_IDLE;
+
+	rc = xprt_ssl_handshake(xprt, event);
+	if (rc == -EAGAIN) {
+		stat->nr_eagain++;
+		/*本次调用提交了新的一步*/
+		if (idle && ssl->hs_state != XPRT_SSL_HS_IDLE)
+			stat->nr_queued++;
+	}
+	return rc;
+}
+
+static void echo_recv(struct xprt *xprt, unsigned long stats)
+{
+	char buff[256];
+	ssize_t rc;
+
+	do {
+		rc = xprt_ssl_read(xprt, buff, sizeof(buff));
+		if (rc > 0) {
+			BUG_ON(xprt_ssl_write(xprt, buff, rc) != rc);
+			continue;
+		}
+		if (rc == -EAGAIN)
+			break;
+		shutdown_xprt(xprt, SHUT_RDWR);
+		break;
+	} while (1);
+}
+
+static void echo_changed(struct xprt *xprt, unsigned long stats)
+{
+	if (stats & XPRT_CLOSED)
+		try_pause();
+}
+
+static const struct xprt_operations echo_ops = {
+	.constructor = echo_constructor,
+	.destructor = ssl_destructor,
+	.on_recv = echo_recv,
+	.on_changed = echo_changed,
+	.do_handshake = async_handshake,
+	.on_shutdown = xprt_ssl_shutdown,
+	.do_flush = xprt_ssl_flush,
+};
+
+static void clnt_recv(struct xprt *xprt, unsigned long stats)
+{
+	char buff[256];
+	ssize_t rc;
+	size_t *echoed = &nr_echoed[(struct hs_stat *)xprt->user - clnt_stats];
+
+	do {
+		rc = xprt_ssl_read(xprt, buff, sizeof(buff));
+		if (rc > 0) {
+			BUG_ON(memcmp(buff, MSG + *echoed, rc));
+			*echoed += rc;
+			if (*echoed == MSG_SIZE) {
+				shutdown_xprt(xprt, SHUT_RDWR);
+				break;
+			}
+			continue;
+		}
+		if (rc == -EAGAIN)
+			break;
+		shutdown_xprt(xprt, SHUT_RDWR);
+		break;
+	} while (1);
+}
+
+static void clnt_changed(struct xprt *xprt, unsigned long stats)
+{
+	if (stats & XPRT_OPENED) {
+		BUG_ON(xprt_to_ssl(xprt)->hs_state != XPRT_SSL_HS_IDLE);
+		xprt_event_enable(xprt, EVENT_READ);
+		BUG_ON(xprt_ssl_write(xprt, MSG, MSG_SIZE) != MSG_SIZE);
+	} else if (stats & XPRT_CLOSED) {
+		try_pause();
+	} else if (stats & XPRT_CONNREFUSED) {
+		log_error("connect has been refused : %p", xprt);
+		BUG();
+	}
+}
+
+static const struct xprt_operations clnt_ops = {
+	.constructor = ssl_constructor,
+	.destructor = ssl_destructor,
+	.on_recv = clnt_recv,
+	.on_changed = clnt_changed,
+	.do_handshake = async_handshake,
+	.on_shutdown = xprt_ssl_shutdown,
+	.do_flush = xprt_ssl_flush,
+};
+
+static void watchdog_cb(struct uev_timer *timer)
+{
+	log_error("test has been timed out : accepted %d, closed %d",
+		nr_accepted, nr_closed);
+	BUG();
+}
+
+static void ssl_certs_prepare(void)
+{
+	if (!access("/tmp/ssl/certs/serverCert.cer", R_OK) &&
+			!access("/tmp/ssl/certs/serverKey.pem", R_OK))
+		return;
+	BUG_ON(system("mkdir -p /tmp/ssl/certs && cd /tmp/ssl/certs && "
+		"openssl req -newkey rsa:2048 -nodes -keyout serverKey.pem "
+		"-x509 -days 365 -out serverCert.cer "
+		"-subj \"/C=CN/ST=SH/L=SH/O=skp.default.cert/OU=skp.default.key\" "
+		">/dev/null 2>&1"));
+}
+
+int main(int argc, const char *argv[])
+{
+	struct xprt *lstn, *clnt;
+	const struct service_address laddr = {
+		.host = "127.0.0.1",
+		.serv = "10028",
+	};
+
+	signal_setup(SIGPIPE, signal_default);
+	ssl_certs_prepare();
+
+	SRV = ___alloc_server(sizeof(struct server), 16, 0);
+	BUG_ON(!SRV);
+
+	lstn = create_xprt(SRV, &laddr, XPRT_TCPSERV|XPRT_OPT_NONBLOCK|
+		XPRT_RDREADY|XPRT_OPT_SSLASYNC, &xprt_tcpserv_ops, NULL, &echo_ops);
+	BUG_ON(!lstn);
+
+	for (int i = 0; i < NR_CLNTS; i++) {
+		clnt = create_xprt(SRV, &laddr, XPRT_TCPCLNT|XPRT_OPT_NONBLOCK|
+			XPRT_WRREADY|XPRT_OPT_SSLASYNC, &clnt_ops, &clnt_stats[i]);
+		BUG_ON(!clnt);
+		xprt_put(clnt);
+	}
+
+	uev_timer_init(&watchdog, watchdog_cb);
+	uev_timer_add(&watchdog, 10000);
+
+	server_loop(SRV);
+	uev_timer_delete_sync(&watchdog);
+	xprt_put(lstn);
+	destroy_server(SRV);
+
+	BUG_ON(nr_accepted != NR_CLNTS);
+	for (int i = 0; i < NR_CLNTS; i++) {
+		log_info("handshake rounds : client %d/%d, server %d/%d",
+			clnt_stats[i].nr_queued, clnt_stats[i].nr_eagain,
+			serv_stats[i].nr_queued, serv_stats[i].nr_eagain);
+		BUG_ON(nr_echoed[i] != MSG_SIZE);
+		/*
+		 * 两端都至少有一步握手在工作队列中完成，
+		 * 具体的步数取决于数据到达的时机，不做检查
+		 */
+		BUG_ON(!clnt_stats[i].nr_queued);
+		BUG_ON(!serv_stats[i].nr_queued);
+	}
+	log_info("test ssl async handshake success");
+	return 0;
+}
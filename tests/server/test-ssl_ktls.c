@@ -0,0 +1,261 @@
+//
+//  test-ssl_ktls.c
+//  test
+//
+//  Created by 周凯 on 2020/01/20.
+//  Copyright © 2020 zhoukai. All rights reserved.
+//
+
+#include <stdio.h>
+#include <fcntl.h>
+#include <openssl/ssl.h>
+#include <skp/process/event.h>
+#include <skp/process/signal.h>
+#include <skp/server/server.h>
+#include <skp/server/xprt.h>
+
+#define MSG "message through kernel tls"
+#define MSG_SIZE (sizeof(MSG) - 1)
+#define FILE_DATA "file content sent by SSL_sendfile()"
+#define FILE_SIZE (sizeof(FILE_DATA) - 1)
+
+/*
+ * 两个客户端都请求卸载：
+ * 1. 使用 CBC 套件，linux 的 kTLS 不支持，必然退化为用户态加密
+ * 2. 使用默认套件，内核支持时发送方向走 send()，并测试 SSL_sendfile()
+ */
+enum {
+	CLNT_FALLBACK,
+	CLNT_OFFLOAD,
+	NR_CLNTS,
+};
+
+struct clnt_ctx {
+	int type;
+	size_t nr_echoed;
+	size_t nr_expect;
+	bool ktls_tx;
+};
+
+static struct server *SRV = NULL;
+static struct uev_timer watchdog;
+static struct clnt_ctx clnts[NR_CLNTS];
+static int nr_closed = 0;
+static int file_fd = -1;
+
+static void try_pause(void)
+{
+	/*每个客户端对应一个被动端*/
+	if (__atomic_add_fetch(&nr_closed, 1, __ATOMIC_SEQ_CST) == NR_CLNTS * 2)
+		server_pause(SRV);
+}
+
+static struct xprt *ssl_constructor(struct server *serv, unsigned long opt,
+		void *user)
+{
+	struct xprt_ssl *ssl = malloc(sizeof(*ssl));
+	BUG_ON(!ssl);
+	BUG_ON(xprt_ssl_init(ssl, opt));
+	ssl->tcp.xprt.user = user;
+	return &ssl->tcp.xprt;
+}
+
+static struct xprt *clnt_constructor(struct server *serv, unsigned long opt,
+		void *user)
+{
+	struct clnt_ctx *ctx = user;
+	struct xprt *xprt = ssl_constructor(serv, opt, user);
+	struct xprt_ssl *ssl = xprt_to_ssl(xprt);
+
+	if (ctx->type == CLNT_FALLBACK) {
+		BUG_ON(SSL_set_max_proto_version(ssl->ssl, TLS1_2_VERSION) != 1);
+		BUG_ON(SSL_set_cipher_list(ssl->ssl, "AES128-SHA256") != 1);
+	}
+	return xprt;
+}
+
+static void ssl_destructor(struct xprt *xprt)
+{
+	struct xprt_ssl *ssl = xprt_to_ssl(xprt);
+	xprt_ssl_finit(ssl);
+	free(ssl);
+}
+
+static void echo_recv(struct xprt *xprt, unsigned long stats)
+{
+	char buff[256];
+	ssize_t rc;
+
+	do {
+		rc = xprt_ssl_read(xprt, buff, sizeof(buff));
+		if (rc > 0) {
+			BUG_ON(xprt_ssl_write(xprt, buff, rc) != rc);
+			continue;
+		}
+		if (rc == -EAGAIN)
+			break;
+		shutdown_xprt(xprt, SHUT_RDWR);
+		break;
+	} while (1);
+}
+
+static void echo_changed(struct xprt *xprt, unsigned long stats)
+{
+	if (stats & XPRT_CLOSED)
+		try_pause();
+}
+
+static const struct xprt_operations echo_ops = {
+	.constructor = ssl_constructor,
+	.destructor = ssl_destructor,
+	.on_recv = echo_recv,
+	.on_changed = echo_changed,
+	.do_handshake = xprt_ssl_handshake,
+	.on_shutdown = xprt_ssl_shutdown,
+};
+
+/*回显了消息后测试文件的发送*/
+static void clnt_sendfile(struct xprt *xprt, struct clnt_ctx *ctx)
+{
+	ssize_t rc = xprt_ssl_sendfile(xprt, file_fd, 0, FILE_SIZE);
+
+	if (!ctx->ktls_tx) {
+		BUG_ON(rc != -EOPNOTSUPP);
+		shutdown_xprt(xprt, SHUT_RDWR);
+		return;
+	}
+	BUG_ON(rc != FILE_SIZE);
+	ctx->nr_expect += FILE_SIZE;
+}
+
+static void clnt_recv(struct xprt *xprt, unsigned long stats)
+{
+	char buff[256];
+	ssize_t rc;
+	struct clnt_ctx *ctx = xprt->user;
+
+	do {
+		rc = xprt_ssl_read(xprt, buff, sizeof(buff));
+		if (rc > 0) {
+			if (ctx->nr_echoed < MSG_SIZE)
+				BUG_ON(memcmp(buff, MSG + ctx->nr_echoed, rc));
+			else
+				BUG_ON(memcmp(buff, FILE_DATA + ctx->nr_echoed - MSG_SIZE, rc));
+			ctx->nr_echoed += rc;
+			if (ctx->nr_echoed == MSG_SIZE) {
+				clnt_sendfile(xprt, ctx);
+			} else if (ctx->nr_echoed == MSG_SIZE + FILE_SIZE) {
+				shutdown_xprt(xprt, SHUT_RDWR);
+				break;
+			}
+			continue;
+		}
+		if (rc == -EAGAIN)
+			break;
+		shutdown_xprt(xprt, SHUT_RDWR);
+		break;
+	} while (1);
+}
+
+static void clnt_changed(struct xprt *xprt, unsigned long stats)
+{
+	struct clnt_ctx *ctx = xprt->user;
+
+	if (stats & XPRT_OPENED) {
+		int ktls = xprt_ssl_ktls(xprt);
+		if (ctx->type == CLNT_FALLBACK) {
+			BUG_ON(ktls);
+		} else if (!(ktls & XPRT_SSL_KTLS_TX)) {
+			log_warn("kTLS is not available, only test fallback path");
+		}
+		ctx->ktls_tx = !!(ktls & XPRT_SSL_KTLS_TX);
+		ctx->nr_expect = MSG_SIZE;
+		xprt_event_enable(xprt, EVENT_READ);
+		BUG_ON(xprt_ssl_write(xprt, MSG, MSG_SIZE) != MSG_SIZE);
+	} else if (stats & XPRT_CLOSED) {
+		try_pause();
+	} else if (stats & XPRT_CONNREFUSED) {
+		log_error("connect has been refused : %p", xprt);
+		BUG();
+	}
+}
+
+static const struct xprt_operations clnt_ops = {
+	.constructor = clnt_constructor,
+	.destructor = ssl_destructor,
+	.on_recv = clnt_recv,
+	.on_changed = clnt_changed,
+	.do_handshake = xprt_ssl_handshake,
+	.on_shutdown = xprt_ssl_shutdown,
+};
+
+static void watchdog_cb(struct uev_timer *timer)
+{
+	log_error("test has been timed out : closed %d", nr_closed);
+	BUG();
+}
+
+static void ssl_certs_prepare(void)
+{
+	if (!access("/tmp/ssl/certs/serverCert.cer", R_OK) &&
+			!access("/tmp/ssl/certs/serverKey.pem", R_OK))
+		return;
+	BUG_ON(system("mkdir -p /tmp/ssl/certs && cd /tmp/ssl/certs && "
+		"openssl req -newkey rsa:2048 -nodes -keyout serverKey.pem "
+		"-x509 -days 365 -out serverCert.cer "
+		"-subj \"/C=CN/ST=SH/L=SH/O=skp.default.cert/OU=skp.default.key\" "
+		">/dev/null 2>&1"));
+}
+
+static int file_prepare(void)
+{
+	char path[] = "/tmp/test-ssl_ktls.XXXXXX";
+	int fd = mkstemp(path);
+	BUG_ON(fd < 0);
+	unlink(path);
+	BUG_ON(write(fd, FILE_DATA, FILE_SIZE) != FILE_SIZE);
+	return fd;
+}
+
+int main(int argc, const char *argv[])
+{
+	struct xprt *lstn, *clnt;
+	const struct service_address laddr = {
+		.host = "127.0.0.1",
+		.serv = "10027",
+	};
+
+	signal_setup(SIGPIPE, signal_default);
+	ssl_certs_prepare();
+	file_fd = file_prepare();
+
+	SRV = ___alloc_server(sizeof(struct server), 8, 0);
+	BUG_ON(!SRV);
+
+	lstn = create_xprt(SRV, &laddr, XPRT_TCPSERV|XPRT_OPT_NONBLOCK|
+		XPRT_RDREADY|XPRT_OPT_KTLS, &xprt_tcpserv_ops, NULL, &echo_ops);
+	BUG_ON(!lstn);
+
+	for (int i = 0; i < NR_CLNTS; i++) {
+		clnts[i].type = i;
+		clnt = create_xprt(SRV, &laddr, XPRT_TCPCLNT|XPRT_OPT_NONBLOCK|
+			XPRT_WRREADY|XPRT_OPT_KTLS, &clnt_ops, &clnts[i]);
+		BUG_ON(!clnt);
+		xprt_put(clnt);
+	}
+
+	uev_timer_init(&watchdog, watchdog_cb);
+	uev_timer_add(&watchdog, 10000);
+
+	server_loop(SRV);
+	uev_timer_delete_sync(&watchdog);
+	xprt_put(lstn);
+	destroy_server(SRV);
+	close(file_fd);
+
+	for (int i = 0; i < NR_CLNTS; i++)
+		BUG_ON(clnts[i].nr_echoed != clnts[i].nr_expect);
+	log_info("test ssl ktls success, offloaded : %s",
+		clnts[CLNT_OFFLOAD].ktls_tx ? "yes" : "no");
+	return 0;
+}
@@ -0,0 +1,305 @@
+//
+//  test-ssl_pbio.c
+//  test
+//
+//  Created by 周凯 on 2020/01/20.
+//  Copyright © 2020 zhoukai. All rights reserved.
+//
+
+#include <stdio.h>
+#include <openssl/ssl.h>
+#include <skp/process/event.h>
+#include <skp/process/signal.h>
+#include <skp/server/server.h>
+#include <skp/server/xprt.h>
+
+#define NR_CLNTS (2)
+#define WR_SIZE (256 << 10)
+#define NR_WRITES (4)
+#define DATA_SIZE (WR_SIZE * NR_WRITES)
+#define ECHO_SIZE (16 << 10)
+
+/*
+ * 两端都提供了刷新钩子且不卸载，使用 pbuff 发送链的 BIO
+ * 1. 客户端每次写入产生多个记录，套接字未接受的部分超过发送链的容量，
+ *    在 BIO 中途刷新
+ * 2. 回显端写入返回 -EAGAIN 时暂停读取，写就绪时由刷新钩子发出剩余数据，
+ *    再以相同的参数重试
+ */
+struct clnt_ctx {
+	size_t nr_sent;
+	size_t nr_echoed;
+	bool pbio;
+};
+
+struct echo_ctx {
+	size_t len; /*待回显的字节数，不为 0 时暂停读取*/
+	char buff[ECHO_SIZE];
+};
+
+static struct server *SRV = NULL;
+static struct uev_timer watchdog;
+static struct clnt_ctx clnts[NR_CLNTS];
+static unsigned char data[DATA_SIZE];
+static int nr_closed = 0;
+static int nr_eagain = 0;
+
+static void try_pause(void)
+{
+	/*每个客户端对应一个被动端*/
+	if (__atomic_add_fetch(&nr_closed, 1, __ATOMIC_SEQ_CST) == NR_CLNTS * 2)
+		server_pause(SRV);
+}
+
+static bool ssl_has_pbio(struct xprt *xprt)
+{
+	BIO *bio = SSL_get_wbio(xprt_to_ssl(xprt)->ssl);
+	return bio && BIO_method_type(bio) != BIO_TYPE_SOCKET;
+}
+
+/*缩小发送缓存，让写入尽快返回 -EAGAIN*/
+static void shrink_sndbuf(struct xprt *xprt)
+{
+	int size = 4096;
+	BUG_ON(setsockopt(xprt_fd(xprt), SOL_SOCKET, SO_SNDBUF, &size,
+		sizeof(size)));
+}
+
+static struct xprt *ssl_constructor(struct server *serv, unsigned long opt,
+		void *user)
+{
+	struct xprt_ssl *ssl = malloc(sizeof(*ssl));
+	BUG_ON(!ssl);
+	BUG_ON(xprt_ssl_init(ssl, opt));
+	ssl->tcp.xprt.user = user;
+	return &ssl->tcp.xprt;
+}
+
+static struct xprt *echo_constructor(struct server *serv, unsigned long opt,
+		void *user)
+{
+	struct echo_ctx *ctx = calloc(1, sizeof(*ctx));
+	BUG_ON(!ctx);
+	return ssl_constructor(serv, opt, ctx);
+}
+
+static void ssl_destructor(struct xprt *xprt)
+{
+	struct xprt_ssl *ssl = xprt_to_ssl(xprt);
+	xprt_ssl_finit(ssl);
+	free(ssl);
+}
+
+static void echo_destructor(struct xprt *xprt)
+{
+	free(xprt->user);
+	ssl_destructor(xprt);
+}
+
+/*回显暂存的数据，未发完则保留，失败返回 false*/
+static bool echo_pending(struct xprt *xprt, struct echo_ctx *ctx)
+{
+	ssize_t rc = xprt_ssl_write(xprt, ctx->buff, ctx->len);
+	if (rc == -EAGAIN) {
+		__atomic_add_fetch(&nr_eagain, 1, __ATOMIC_RELAXED);
+		xprt_event_disable(xprt, EVENT_READ);
+		return true;
+	}
+	if (rc != ctx->len) {
+		shutdown_xprt(xprt, SHUT_RDWR);
+		return false;
+	}
+	ctx->len = 0;
+	return true;
+}
+
+static void echo_recv(struct xprt *xprt, unsigned long stats)
+{
+	ssize_t rc;
+	struct echo_ctx *ctx = xprt->user;
+
+	while (!ctx->len) {
+		rc = xprt_ssl_read(xprt, ctx->buff, sizeof(ctx->buff));
+		if (rc > 0) {
+			ctx->len = rc;
+			if (!echo_pending(xprt, ctx))
+				break;
+			continue;
+		}
+		if (rc != -EAGAIN)
+			shutdown_xprt(xprt, SHUT_RDWR);
+		break;
+	}
+}
+
+static void echo_send(struct xprt *xprt, unsigned long stats)
+{
+	struct echo_ctx *ctx = xprt->user;
+
+	if (!ctx->len || !echo_pending(xprt, ctx) || ctx->len)
+		return;
+	xprt_event_enable(xprt, EVENT_READ);
+	echo_recv(xprt, stats);
+}
+
+static void echo_changed(struct xprt *xprt, unsigned long stats)
+{
+	if (stats & XPRT_OPENED) {
+		BUG_ON(!ssl_has_pbio(xprt));
+		shrink_sndbuf(xprt);
+	} else if (stats & XPRT_CLOSED) {
+		try_pause();
+	}
+}
+
+static const struct xprt_operations echo_ops = {
+	.constructor = echo_constructor,
+	.destructor = echo_destructor,
+	.on_recv = echo_recv,
+	.on_send = echo_send,
+	.on_changed = echo_changed,
+	.do_handshake = xprt_ssl_handshake,
+	.on_shutdown = xprt_ssl_shutdown,
+	.do_flush = xprt_ssl_flush,
+};
+
+/*每次以相同的参数写入，直到写完或返回 -EAGAIN*/
+static void clnt_send(struct xprt *xprt, unsigned long stats)
+{
+	ssize_t rc;
+	struct clnt_ctx *ctx = xprt->user;
+
+	while (ctx->nr_sent < DATA_SIZE) {
+		rc = xprt_ssl_write(xprt, data + ctx->nr_sent, WR_SIZE);
+		if (rc == -EAGAIN) {
+			__atomic_add_fetch(&nr_eagain, 1, __ATOMIC_RELAXED);
+			break;
+		}
+		if (rc != WR_SIZE) {
+			shutdown_xprt(xprt, SHUT_RDWR);
+			break;
+		}
+		/*一次写入的记录超过了发送链的容量，所有分片都已被使用*/
+		BUG_ON(xprt_to_ssl(xprt)->txq_nr != CONFIG_XPRT_SSL_TXSEGS);
+		ctx->nr_sent += rc;
+	}
+}
+
+static void clnt_recv(struct xprt *xprt, unsigned long stats)
+{
+	char buff[ECHO_SIZE];
+	ssize_t rc;
+	struct clnt_ctx *ctx = xprt->user;
+
+	do {
+		rc = xprt_ssl_read(xprt, buff, sizeof(buff));
+		if (rc > 0) {
+			/*未完成的写入可能已经发出了一部分*/
+			BUG_ON(ctx->nr_echoed + rc > ctx->nr_sent + WR_SIZE);
+			BUG_ON(memcmp(buff, data + ctx->nr_echoed, rc));
+			ctx->nr_echoed += rc;
+			if (ctx->nr_echoed == DATA_SIZE) {
+				shutdown_xprt(xprt, SHUT_RDWR);
+				break;
+			}
+			continue;
+		}
+		if (rc == -EAGAIN)
+			break;
+		shutdown_xprt(xprt, SHUT_RDWR);
+		break;
+	} while (1);
+}
+
+static void clnt_changed(struct xprt *xprt, unsigned long stats)
+{
+	struct clnt_ctx *ctx = xprt->user;
+
+	if (stats & XPRT_OPENED) {
+		ctx->pbio = ssl_has_pbio(xprt);
+		BUG_ON(!ctx->pbio);
+		shrink_sndbuf(xprt);
+		xprt_event_enable(xprt, EVENT_READ);
+		clnt_send(xprt, stats);
+	} else if (stats & XPRT_CLOSED) {
+		try_pause();
+	} else if (stats & XPRT_CONNREFUSED) {
+		log_error("connect has been refused : %p", xprt);
+		BUG();
+	}
+}
+
+static const struct xprt_operations clnt_ops = {
+	.constructor = ssl_constructor,
+	.destructor = ssl_destructor,
+	.on_recv = clnt_recv,
+	.on_send = clnt_send,
+	.on_changed = clnt_changed,
+	.do_handshake = xprt_ssl_handshake,
+	.on_shutdown = xprt_ssl_shutdown,
+	.do_flush = xprt_ssl_flush,
+};
+
+static void watchdog_cb(struct uev_timer *timer)
+{
+	log_error("test has been timed out : closed %d", nr_closed);
+	BUG();
+}
+
+static void ssl_certs_prepare(void)
+{
+	if (!access("/tmp/ssl/certs/serverCert.cer", R_OK) &&
+			!access("/tmp/ssl/certs/serverKey.pem", R_OK))
+		return;
+	BUG_ON(system("mkdir -p /tmp/ssl/certs && cd /tmp/ssl/certs && "
+		"openssl req -newkey rsa:2048 -nodes -keyout serverKey.pem "
+		"-x509 -days 365 -out serverCert.cer "
+		"-subj \"/C=CN/ST=SH/L=SH/O=skp.default.cert/OU=skp.default.key\" "
+		">/dev/null 2>&1"));
+}
+
+int main(int argc, const char *argv[])
+{
+	struct xprt *lstn, *clnt;
+	const struct service_address laddr = {
+		.host = "127.0.0.1",
+		.serv = "10030",
+	};
+
+	signal_setup(SIGPIPE, signal_default);
+	ssl_certs_prepare();
+
+	for (size_t i = 0; i < DATA_SIZE; i++)
+		data[i] = (unsigned char)(i * 131 + (i >> 13));
+
+	SRV = ___alloc_server(sizeof(struct server), 8, 0);
+	BUG_ON(!SRV);
+
+	lstn = create_xprt(SRV, &laddr, XPRT_TCPSERV|XPRT_OPT_NONBLOCK|
+		XPRT_RDREADY, &xprt_tcpserv_ops, NULL, &echo_ops);
+	BUG_ON(!lstn);
+
+	for (int i = 0; i < NR_CLNTS; i++) {
+		clnt = create_xprt(SRV, &laddr, XPRT_TCPCLNT|XPRT_OPT_NONBLOCK|
+			XPRT_WRREADY, &clnt_ops, &clnts[i]);
+		BUG_ON(!clnt);
+		xprt_put(clnt);
+	}
+
+	uev_timer_init(&watchdog, watchdog_cb);
+	uev_timer_add(&watchdog, 10000);
+
+	server_loop(SRV);
+	uev_timer_delete_sync(&watchdog);
+	xprt_put(lstn);
+	destroy_server(SRV);
+
+	for (int i = 0; i < NR_CLNTS; i++) {
+		BUG_ON(!clnts[i].pbio);
+		BUG_ON(clnts[i].nr_sent != DATA_SIZE);
+		BUG_ON(clnts[i].nr_echoed != DATA_SIZE);
+	}
+	BUG_ON(!nr_eagain);
+	log_info("test ssl pbuff bio success, write blocked %d times", nr_eagain);
+	return 0;
+}
@@ -59,6 +59,7 @@ static const struct xprt_operations client_ops = {
 	.on_changed = client_changed,
 	.do_handshake = xprt_ssl_handshake,
 	.on_shutdown = xprt_ssl_shutdown,
+	.do_flush = xprt_ssl_flush,
 };
 
 int main(int argc, char **argv)
@@ -70,8 +71,13 @@ int main(int argc, char **argv)
 		.serv = "1443",
 	};
 
-	struct xprt * ssl = create_xprt(SRV, &host_addr,
-			XPRT_TCPSERV|XPRT_OPT_NONBLOCK|XPRT_RDREADY,
+	/*指定 ktls 参数时使用内核卸载，否则使用基于发送链的 BIO*/
+	unsigned long opt = XPRT_TCPSERV|XPRT_OPT_NONBLOCK|XPRT_RDREADY|
+			XPRT_OPT_SSLASYNC;
+	if (argc > 1 && !strcmp(argv[1], "ktls"))
+		opt |= XPRT_OPT_KTLS;
+
+	struct xprt * ssl = create_xprt(SRV, &host_addr, opt,
 			&xprt_tcpserv_ops, (void*)&host_addr, &client_ops);
 	BUG_ON(!ssl);
 
@@ -0,0 +1,252 @@
+//
+//  test-ssl_session.c
+//  test
+//
+//  Created by 周凯 on 2020/01/20.
+//  Copyright © 2020 zhoukai. All rights reserved.
+//
+
+#include <stdio.h>
+#include <openssl/ssl.h>
+#include <skp/process/event.h>
+#include <skp/process/signal.h>
+#include <skp/server/server.h>
+#include <skp/server/xprt.h>
+
+#define MSG "message of resumed session"
+#define MSG_SIZE (sizeof(MSG) - 1)
+
+/*超过旧的键长度的公共前缀，只有完整比较主机名才能区分*/
+#define LABEL "abcdefghijklmnopqrstuvwxyzabcdefghijklmnopqrstuvwx"
+#define SNI_PREFIX LABEL "." LABEL "." LABEL "." LABEL
+#define SNI_A SNI_PREFIX ".a.test"
+#define SNI_B SNI_PREFIX ".b.test"
+#define SNI_C "session-id.test"
+
+/*
+ * 依次连接，上一个连接的两端都关闭后再发起下一个
+ * 1. TLSv1.3 使用无状态的票据，票据由轮换的密钥加密
+ * 2. TLSv1.2 且禁用票据时，使用服务器端的分片会话缓存
+ * 客户端都以地址加 SNI 为键保存会话
+ */
+struct conn_case {
+	const char *sni;
+	bool tls12;
+	bool reused;
+};
+
+static const struct conn_case cases[] = {
+	{ SNI_A, false, false },
+	{ SNI_A, false, true },
+	/*前缀相同的主机名不能复用 SNI_A 的会话*/
+	{ SNI_B, false, false },
+	{ SNI_B, false, true },
+	{ SNI_C, true, false },
+	{ SNI_C, true, true },
+};
+
+#define NR_CASES ARRAY_SIZE(cases)
+
+static struct server *SRV = NULL;
+static struct uev_timer watchdog;
+static struct uev_timer starter;
+static const struct service_address laddr = {
+	.host = "127.0.0.1",
+	.serv = "10029",
+};
+static int cur_case = 0;
+static int nr_closed = 0;
+static int nr_checked = 0;
+static size_t nr_echoed = 0;
+
+static void try_next(void)
+{
+	/*一个主动端，一个被动端*/
+	if (__atomic_add_fetch(&nr_closed, 1, __ATOMIC_SEQ_CST) % 2)
+		return;
+	if (++cur_case == NR_CASES) {
+		server_pause(SRV);
+		return;
+	}
+	uev_timer_add(&starter, 0);
+}
+
+static struct xprt *ssl_constructor(struct server *serv, unsigned long opt,
+		void *user)
+{
+	struct xprt_ssl *ssl = malloc(sizeof(*ssl));
+	BUG_ON(!ssl);
+	BUG_ON(xprt_ssl_init(ssl, opt));
+	ssl->tcp.xprt.user = user;
+	return &ssl->tcp.xprt;
+}
+
+static struct xprt *clnt_constructor(struct server *serv, unsigned long opt,
+		void *user)
+{
+	const struct conn_case *c = user;
+	struct xprt *xprt = ssl_constructor(serv, opt, user);
+	struct xprt_ssl *ssl = xprt_to_ssl(xprt);
+
+	xprt_ssl_set_tlsext_servername(ssl, c->sni);
+	if (c->tls12) {
+		BUG_ON(SSL_set_max_proto_version(ssl->ssl, TLS1_2_VERSION) != 1);
+		SSL_set_options(ssl->ssl, SSL_OP_NO_TICKET);
+	}
+	return xprt;
+}
+
+static void ssl_destructor(struct xprt *xprt)
+{
+	struct xprt_ssl *ssl = xprt_to_ssl(xprt);
+	xprt_ssl_finit(ssl);
+	free(ssl);
+}
+
+static void echo_recv(struct xprt *xprt, unsigned long stats)
+{
+	char buff[256];
+	ssize_t rc;
+
+	do {
+		rc = xprt_ssl_read(xprt, buff, sizeof(buff));
+		if (rc > 0) {
+			BUG_ON(xprt_ssl_write(xprt, buff, rc) != rc);
+			continue;
+		}
+		if (rc == -EAGAIN)
+			break;
+		shutdown_xprt(xprt, SHUT_RDWR);
+		break;
+	} while (1);
+}
+
+static void echo_changed(struct xprt *xprt, unsigned long stats)
+{
+	if (stats & XPRT_CLOSED)
+		try_next();
+}
+
+static const struct xprt_operations echo_ops = {
+	.constructor = ssl_constructor,
+	.destructor = ssl_destructor,
+	.on_recv = echo_recv,
+	.on_changed = echo_changed,
+	.do_handshake = xprt_ssl_handshake,
+	.on_shutdown = xprt_ssl_shutdown,
+	.do_flush = xprt_ssl_flush,
+};
+
+static void clnt_recv(struct xprt *xprt, unsigned long stats)
+{
+	char buff[256];
+	ssize_t rc;
+
+	/*回显之前读取到的 TLSv1.3 票据会被保存*/
+	do {
+		rc = xprt_ssl_read(xprt, buff, sizeof(buff));
+		if (rc > 0) {
+			BUG_ON(memcmp(buff, MSG + nr_echoed % MSG_SIZE, rc));
+			nr_echoed += rc;
+			if (!(nr_echoed % MSG_SIZE)) {
+				shutdown_xprt(xprt, SHUT_RDWR);
+				break;
+			}
+			continue;
+		}
+		if (rc == -EAGAIN)
+			break;
+		shutdown_xprt(xprt, SHUT_RDWR);
+		break;
+	} while (1);
+}
+
+static void clnt_changed(struct xprt *xprt, unsigned long stats)
+{
+	const struct conn_case *c = xprt->user;
+
+	if (stats & XPRT_OPENED) {
+		bool reused = xprt_ssl_session_reused(xprt);
+		log_info("case [%d] : sni [%.16s...], %s, reused [%d]",
+			(int)(c - cases), c->sni, c->tls12 ? "TLSv1.2" : "TLSv1.3",
+			reused);
+		BUG_ON(reused != c->reused);
+		nr_checked++;
+		xprt_event_enable(xprt, EVENT_READ);
+		BUG_ON(xprt_ssl_write(xprt, MSG, MSG_SIZE) != MSG_SIZE);
+	} else if (stats & XPRT_CLOSED) {
+		try_next();
+	} else if (stats & XPRT_CONNREFUSED) {
+		log_error("connect has been refused : %p", xprt);
+		BUG();
+	}
+}
+
+static const struct xprt_operations clnt_ops = {
+	.constructor = clnt_constructor,
+	.destructor = ssl_destructor,
+	.on_recv = clnt_recv,
+	.on_changed = clnt_changed,
+	.do_handshake = xprt_ssl_handshake,
+	.on_shutdown = xprt_ssl_shutdown,
+	.do_flush = xprt_ssl_flush,
+};
+
+static void starter_cb(struct uev_timer *timer)
+{
+	struct xprt *clnt = create_xprt(SRV, &laddr, XPRT_TCPCLNT|
+		XPRT_OPT_NONBLOCK|XPRT_WRREADY, &clnt_ops,
+		(void *)&cases[cur_case]);
+	BUG_ON(!clnt);
+	xprt_put(clnt);
+}
+
+static void watchdog_cb(struct uev_timer *timer)
+{
+	log_error("test has been timed out : case %d, closed %d", cur_case,
+		nr_closed);
+	BUG();
+}
+
+static void ssl_certs_prepare(void)
+{
+	if (!access("/tmp/ssl/certs/serverCert.cer", R_OK) &&
+			!access("/tmp/ssl/certs/serverKey.pem", R_OK))
+		return;
+	BUG_ON(system("mkdir -p /tmp/ssl/certs && cd /tmp/ssl/certs && "
+		"openssl req -newkey rsa:2048 -nodes -keyout serverKey.pem "
+		"-x509 -days 365 -out serverCert.cer "
+		"-subj \"/C=CN/ST=SH/L=SH/O=skp.default.cert/OU=skp.default.key\" "
+		">/dev/null 2>&1"));
+}
+
+int main(int argc, const char *argv[])
+{
+	struct xprt *lstn;
+
+	signal_setup(SIGPIPE, signal_default);
+	ssl_certs_prepare();
+
+	SRV = ___alloc_server(sizeof(struct server), 8, 0);
+	BUG_ON(!SRV);
+
+	lstn = create_xprt(SRV, &laddr, XPRT_TCPSERV|XPRT_OPT_NONBLOCK|
+		XPRT_RDREADY, &xprt_tcpserv_ops, NULL, &echo_ops);
+	BUG_ON(!lstn);
+
+	uev_timer_init(&starter, starter_cb);
+	uev_timer_add(&starter, 0);
+	uev_timer_init(&watchdog, watchdog_cb);
+	uev_timer_add(&watchdog, 10000);
+
+	server_loop(SRV);
+	uev_timer_delete_sync(&watchdog);
+	uev_timer_delete_sync(&starter);
+	xprt_put(lstn);
+	destroy_server(SRV);
+
+	BUG_ON(nr_checked != NR_CASES);
+	BUG_ON(nr_echoed != MSG_SIZE * NR_CASES);
+	log_info("test ssl session success");
+	return 0;
+}
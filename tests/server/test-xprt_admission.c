@@ -0,0 +1,303 @@
+//
+//  test-xprt_admission.c
+//  test
+//
+//  Created by 周凯 on 2020/01/12.
+//  Copyright © 2020 zhoukai. All rights reserved.
+//
+
+#include <stdio.h>
+#include <skp/process/event.h>
+#include <skp/process/signal.h>
+#include <skp/process/workqueue.h>
+#include <skp/server/server.h>
+#include <skp/server/socket.h>
+#include <skp/server/xprt.h>
+
+#define MAX_LAG (20)
+#define HOG_MS (150)
+#define NR_SHED (4)
+
+enum {
+	LSTN_REJECT,
+	LSTN_DEFER,
+	LSTN_SHED,
+	LSTN_MAX,
+};
+
+static const uint16_t ports[LSTN_MAX] = { 10020, 10021, 10022, };
+
+static struct server *SRV = NULL;
+static struct xprt *lstns[LSTN_MAX];
+static struct uev_timer hog;
+static bool hogging = false;
+static int nr_opened[LSTN_MAX];
+static int nr_shed_closed = 0;
+static int shed_order[NR_SHED];
+
+static inline uint64_t now_ms(void)
+{
+	return abstime(NULL, 0) / 1000000;
+}
+
+static int lstn_index(struct xprt *xprt)
+{
+	for (int i = 0; i < LSTN_MAX; i++) {
+		if (xprt->user == lstns[i])
+			return i;
+	}
+	return -1;
+}
+
+/*阻塞事件线程，模拟过载*/
+static void hog_cb(struct uev_timer *timer)
+{
+	uint64_t start = now_ms();
+	while (now_ms() - start < HOG_MS)
+		cpu_relax();
+	if (READ_ONCE(hogging))
+		uev_timer_modify(timer, 10);
+}
+
+static void reader_recv(struct xprt *xprt, unsigned long stats)
+{
+	char buff[64];
+	ssize_t rc;
+
+	do {
+		rc = xprt_read(xprt, buff, sizeof(buff));
+		if (rc > 0) {
+			/*第一个字节为优先级*/
+			if (lstn_index(xprt) == LSTN_SHED)
+				xprt_tcpclnt_set_priority(xprt, buff[0] - '0');
+			continue;
+		}
+		if (rc != -EAGAIN)
+			shutdown_xprt(xprt, SHUT_RDWR);
+		break;
+	} while (1);
+}
+
+static void reader_changed(struct xprt *xprt, unsigned long stats)
+{
+	int idx = lstn_index(xprt);
+
+	if (stats & XPRT_OPENED) {
+		__atomic_add_fetch(&nr_opened[idx], 1, __ATOMIC_SEQ_CST);
+		xprt_event_enable(xprt, EVENT_READ);
+	} else if (stats & XPRT_CLOSED) {
+		if (idx == LSTN_SHED) {
+			int nr = __atomic_fetch_add(&nr_shed_closed, 1, __ATOMIC_SEQ_CST);
+			if (nr < NR_SHED)
+				shed_order[nr] = xprt_to_tcpclnt(xprt)->priority;
+		}
+	}
+}
+
+static const struct xprt_operations reader_ops = {
+	.constructor = xprt_tcpclnt_constructor,
+	.destructor = xprt_tcpclnt_destructor,
+	.on_recv = reader_recv,
+	.on_send = NULL,
+	.on_changed = reader_changed,
+};
+
+/*被动端在首次可读时才就绪，发送一个字节作为优先级*/
+static int raw_connect(uint16_t port, char prio)
+{
+	union inet_address inet;
+	struct timeval tv = { .tv_sec = 3, .tv_usec = 0 };
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+
+	BUG_ON(fd < 0);
+	memset(&inet, 0, sizeof(inet));
+	inet.sin_addr.sin_family = AF_INET;
+	inet.sin_addr.sin_port = htons(port);
+	inet.sin_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	BUG_ON(connect(fd, &inet.sock_addr, sizeof(inet.sin_addr)));
+	BUG_ON(setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)));
+	BUG_ON(write(fd, &prio, 1) != 1);
+	return fd;
+}
+
+/*等待条件成立，超时则崩溃*/
+#define wait_until(cond, ms)											\
+	do {																\
+		uint64_t __start = now_ms();									\
+		while (!(cond)) {												\
+			if (now_ms() - __start > (ms)) {							\
+				log_error("wait for [" #cond "] timed out");			\
+				BUG();													\
+			}															\
+			usleep(5000);												\
+		}																\
+	} while (0)
+
+static bool all_overloaded(bool overloaded)
+{
+	for (int i = 0; i < LSTN_MAX; i++) {
+		if (xprt_tcpserv_overloaded(lstns[i]) != overloaded)
+			return false;
+	}
+	return true;
+}
+
+static void test_lag(void)
+{
+	char c;
+	int fd, shed[NR_SHED];
+	struct xprt_admission *adm;
+
+	/*没有过载时正常接受*/
+	usleep(CONFIG_XPRT_ADMIT_PROBE * 3 * 1000);
+	BUG_ON(xprt_loop_lag() > MAX_LAG);
+	BUG_ON(!all_overloaded(false));
+	fd = raw_connect(ports[LSTN_REJECT], '0');
+	wait_until(READ_ONCE(nr_opened[LSTN_REJECT]) == 1, 3000);
+	close(fd);
+
+	/*一半高优先级，一半低优先级*/
+	for (int i = 0; i < NR_SHED; i++)
+		shed[i] = raw_connect(ports[LSTN_SHED], i & 1 ? '1' : '0');
+	wait_until(READ_ONCE(nr_opened[LSTN_SHED]) == NR_SHED, 3000);
+	usleep(50000);
+
+	WRITE_ONCE(hogging, true);
+	uev_timer_add(&hog, 0);
+	wait_until(all_overloaded(true), 5000);
+	log_info("overloaded : loop lag %u ms", xprt_loop_lag());
+
+	/*拒绝：内核完成了握手，但接受后立即被 RST*/
+	fd = raw_connect(ports[LSTN_REJECT], '0');
+	BUG_ON(read(fd, &c, 1) != -1 || errno != ECONNRESET);
+	close(fd);
+	adm = &xprt_to_tcpserv(lstns[LSTN_REJECT])->admission;
+	wait_until(READ_ONCE(adm->nr_rejected) == 1, 1000);
+	BUG_ON(READ_ONCE(nr_opened[LSTN_REJECT]) != 1);
+
+	/*延迟：停留在内核的侦听队列中*/
+	fd = raw_connect(ports[LSTN_DEFER], '0');
+	usleep(CONFIG_XPRT_ADMIT_PROBE * 3 * 1000);
+	BUG_ON(READ_ONCE(nr_opened[LSTN_DEFER]));
+
+	/*关闭：低优先级的连接先被关闭*/
+	wait_until(READ_ONCE(nr_shed_closed) >= NR_SHED / 2, 5000);
+	for (int i = 0; i < NR_SHED / 2; i++)
+		BUG_ON(shed_order[i] != 0);
+	BUG_ON(read(shed[0], &c, 1) > 0);
+	BUG_ON(read(shed[2], &c, 1) > 0);
+
+	/*恢复后接受延迟的连接*/
+	WRITE_ONCE(hogging, false);
+	uev_timer_delete_sync(&hog);
+	wait_until(all_overloaded(false), 5000);
+	log_info("recovered : loop lag %u ms", xprt_loop_lag());
+	wait_until(READ_ONCE(nr_opened[LSTN_DEFER]) == 1, 3000);
+	close(fd);
+
+	for (int i = 0; i < NR_SHED; i++)
+		close(shed[i]);
+}
+
+static void wq_block(struct work_struct *work)
+{
+	usleep(300000);
+}
+
+static void test_congested(void)
+{
+	int fd;
+	struct work_struct works[3];
+	struct workqueue_struct *wq = alloc_workqueue("admission", WQ_UNBOUND, 1);
+
+	BUG_ON(!wq);
+	BUG_ON(xprt_tcpserv_set_admission(lstns[LSTN_REJECT], XPRT_ADMIT_REJECT,
+		0, wq, 0));
+
+	/*只有一个活动任务，其余的排队，任务队列拥塞了*/
+	for (int i = 0; i < ARRAY_SIZE(works); i++) {
+		INIT_WORK(&works[i], wq_block);
+		BUG_ON(!queue_work(wq, &works[i]));
+	}
+	wait_until(xprt_tcpserv_overloaded(lstns[LSTN_REJECT]), 3000);
+	flush_workqueue(wq);
+	wait_until(!xprt_tcpserv_overloaded(lstns[LSTN_REJECT]), 3000);
+
+	/*恢复后正常接受*/
+	fd = raw_connect(ports[LSTN_REJECT], '0');
+	wait_until(READ_ONCE(nr_opened[LSTN_REJECT]) == 2, 3000);
+	close(fd);
+
+	BUG_ON(xprt_tcpserv_set_admission(lstns[LSTN_REJECT], 0, 0, NULL, 0));
+	destroy_workqueue(wq);
+}
+
+/*阻塞一次事件线程*/
+static void hog_once(void)
+{
+	WRITE_ONCE(hogging, false);
+	uev_timer_add(&hog, 0);
+	usleep((HOG_MS + CONFIG_XPRT_ADMIT_PROBE * 3) * 1000);
+	uev_timer_delete_sync(&hog);
+}
+
+static void test_probe_stop(void)
+{
+	/*最后一个使用者关闭后，探针停止采样*/
+	for (int i = 0; i < LSTN_MAX; i++)
+		BUG_ON(xprt_tcpserv_set_admission(lstns[i], 0, 0, NULL, 0));
+	usleep(CONFIG_XPRT_ADMIT_PROBE * 3 * 1000);
+	BUG_ON(xprt_loop_lag());
+	hog_once();
+	BUG_ON(xprt_loop_lag());
+
+	/*再次开启时重新启动*/
+	BUG_ON(xprt_tcpserv_set_admission(lstns[LSTN_REJECT], XPRT_ADMIT_REJECT,
+		MAX_LAG, NULL, 0));
+	usleep(CONFIG_XPRT_ADMIT_PROBE * 3 * 1000);
+	hog_once();
+	log_info("restarted : loop lag %u ms", xprt_loop_lag());
+	BUG_ON(!xprt_loop_lag());
+
+	BUG_ON(xprt_tcpserv_set_admission(lstns[LSTN_REJECT], 0, 0, NULL, 0));
+	wait_until(!xprt_loop_lag(), 3000);
+}
+
+int main(int argc, const char *argv[])
+{
+	char serv[8];
+	const uint8_t policies[LSTN_MAX] = {
+		XPRT_ADMIT_REJECT, XPRT_ADMIT_DEFER, XPRT_ADMIT_SHED,
+	};
+
+	/*单线程模式，阻塞事件线程即可模拟过载*/
+	sysevent_init(true);
+	signal_setup(SIGPIPE, signal_default);
+
+	SRV = ___alloc_server(sizeof(struct server), 32, 0);
+	BUG_ON(!SRV);
+
+	/*被动端的用户数据为监听对象*/
+	for (int i = 0; i < LSTN_MAX; i++) {
+		struct service_address laddr = { .host = "127.0.0.1", .serv = serv, };
+		snprintf(serv, sizeof(serv), "%u", ports[i]);
+		lstns[i] = create_xprt(SRV, &laddr,
+			XPRT_TCPSERV|XPRT_OPT_NONBLOCK|XPRT_RDREADY, &xprt_tcpserv_ops,
+			NULL, &reader_ops);
+		BUG_ON(!lstns[i]);
+		BUG_ON(xprt_tcpserv_set_admission(lstns[i], policies[i], MAX_LAG,
+			NULL, 0));
+	}
+	uev_timer_init(&hog, hog_cb);
+
+	test_lag();
+	test_congested();
+	test_probe_stop();
+
+	/*没有进入主循环，直接销毁*/
+	for (int i = 0; i < LSTN_MAX; i++)
+		xprt_put(lstns[i]);
+	destroy_server(SRV);
+	log_info("test xprt admission success");
+	return 0;
+}
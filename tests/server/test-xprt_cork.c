@@ -0,0 +1,183 @@
+//
+//  test-xprt_cork.c
+//  test
+//
+//  Created by 周凯 on 2020/01/18.
+//  Copyright © 2020 zhoukai. All rights reserved.
+//
+
+#include <stdio.h>
+#include <skp/process/event.h>
+#include <skp/process/signal.h>
+#include <skp/server/server.h>
+#include <skp/server/xprt.h>
+
+#define HDR "HEAD"
+#define BODY "body of the chatty protocol"
+/*头部与消息体分别写入，不包括结尾的 0*/
+#define MSG_SIZE (sizeof(HDR) - 1 + sizeof(BODY) - 1)
+#define NR_ROUNDS (2)
+
+static struct server *SRV = NULL;
+static struct xprt *CLNT = NULL;
+static struct uev_timer watchdog;
+static struct uev_timer sender;
+static int nr_closed = 0;
+static int nr_rounds = 0;
+static size_t nr_echoed = 0;
+
+static void try_pause(void)
+{
+	/*1 个主动端，1 个被动端*/
+	if (__atomic_add_fetch(&nr_closed, 1, __ATOMIC_SEQ_CST) == 2)
+		server_pause(SRV);
+}
+
+static void send_msg(struct xprt *xprt)
+{
+	BUG_ON(xprt_write_more(xprt, HDR, sizeof(HDR) - 1) != sizeof(HDR) - 1);
+	BUG_ON(xprt_write_more(xprt, BODY, sizeof(BODY) - 1) != sizeof(BODY) - 1);
+	BUG_ON(!(xprt_status(xprt) & XPRT_CORKED));
+}
+
+static void echo_recv(struct xprt *xprt, unsigned long stats)
+{
+	char buff[MSG_SIZE * 2];
+	ssize_t rc;
+
+	do {
+		rc = xprt_read(xprt, buff, sizeof(buff));
+		if (rc > 0) {
+			/*两次写入合并为一个分节，一次读取到完整的消息*/
+			BUG_ON(rc != MSG_SIZE);
+			BUG_ON(memcmp(buff, HDR BODY, MSG_SIZE));
+			send_msg(xprt);
+			continue;
+		}
+		if (rc == -EAGAIN)
+			break;
+		shutdown_xprt(xprt, SHUT_RDWR);
+		break;
+	} while (1);
+}
+
+static void echo_changed(struct xprt *xprt, unsigned long stats)
+{
+	if (stats & XPRT_OPENED) {
+		xprt_event_enable(xprt, EVENT_READ);
+	} else if (stats & XPRT_CLOSED) {
+		try_pause();
+	}
+}
+
+static const struct xprt_operations echo_ops = {
+	.constructor = xprt_tcpclnt_constructor,
+	.destructor = xprt_tcpclnt_destructor,
+	.on_recv = echo_recv,
+	.on_send = NULL,
+	.on_changed = echo_changed,
+};
+
+/*不在传输对象的事件回调中，需要手动发出*/
+static void sender_cb(struct uev_timer *timer)
+{
+	send_msg(CLNT);
+	BUG_ON(xprt_write_flush(CLNT));
+	BUG_ON(xprt_status(CLNT) & XPRT_CORKED);
+}
+
+static void clnt_recv(struct xprt *xprt, unsigned long stats)
+{
+	char buff[MSG_SIZE * 2];
+	ssize_t rc;
+
+	do {
+		rc = xprt_read(xprt, buff, sizeof(buff));
+		if (rc > 0) {
+			BUG_ON(rc != MSG_SIZE);
+			BUG_ON(memcmp(buff, HDR BODY, MSG_SIZE));
+			nr_echoed += rc;
+			if (++nr_rounds == NR_ROUNDS) {
+				shutdown_xprt(xprt, SHUT_RDWR);
+				break;
+			}
+			uev_timer_add(&sender, 1);
+			continue;
+		}
+		if (rc == -EAGAIN)
+			break;
+		shutdown_xprt(xprt, SHUT_RDWR);
+		break;
+	} while (1);
+}
+
+static void clnt_changed(struct xprt *xprt, unsigned long stats)
+{
+	if (stats & XPRT_OPENED) {
+		CLNT = xprt_get(xprt);
+		xprt_event_enable(xprt, EVENT_READ);
+		/*在回调中写入，回调返回后由框架发出*/
+		send_msg(xprt);
+	} else if (stats & XPRT_CLOSED) {
+		try_pause();
+	} else if (stats & XPRT_CONNREFUSED) {
+		log_error("connect has been refused : %p", xprt);
+		BUG();
+	}
+}
+
+static const struct xprt_operations clnt_ops = {
+	.constructor = xprt_tcpclnt_constructor,
+	.destructor = xprt_tcpclnt_destructor,
+	.on_recv = clnt_recv,
+	.on_send = NULL,
+	.on_changed = clnt_changed,
+};
+
+static void watchdog_cb(struct uev_timer *timer)
+{
+	log_error("test has been timed out : rounds %d, echoed %zu, closed %d",
+		nr_rounds, nr_echoed, nr_closed);
+	BUG();
+}
+
+int main(int argc, const char *argv[])
+{
+	struct xprt *lstn, *clnt;
+	const struct service_address laddr = {
+		.host = "127.0.0.1",
+		.serv = "10030",
+	};
+
+	signal_setup(SIGPIPE, signal_default);
+
+	SRV = ___alloc_server(sizeof(struct server), 8, 0);
+	BUG_ON(!SRV);
+
+	/*开启 Nagle 算法，不合并时第二次写入要等待确认*/
+	lstn = create_xprt(SRV, &laddr,
+		XPRT_TCPSERV|XPRT_OPT_NONBLOCK|XPRT_RDREADY, &xprt_tcpserv_ops,
+		NULL, &echo_ops);
+	BUG_ON(!lstn);
+
+	clnt = create_xprt(SRV, &laddr,
+		XPRT_TCPCLNT|XPRT_OPT_NONBLOCK|XPRT_WRREADY, &clnt_ops, NULL);
+	BUG_ON(!clnt);
+	xprt_put(clnt);
+
+	uev_timer_init(&sender, sender_cb);
+	uev_timer_init(&watchdog, watchdog_cb);
+	uev_timer_add(&watchdog, 10000);
+
+	server_loop(SRV);
+	uev_timer_delete_sync(&watchdog);
+	uev_timer_delete_sync(&sender);
+	BUG_ON(CLNT->stats.tx_bytes != MSG_SIZE * NR_ROUNDS);
+	xprt_put(CLNT);
+	xprt_put(lstn);
+	destroy_server(SRV);
+
+	BUG_ON(nr_echoed != MSG_SIZE * NR_ROUNDS);
+	log_info("test xprt cork success");
+	return 0;
+}
@@ -0,0 +1,327 @@
+//
+//  test-xprt_pipeline.c
+//  test
+//
+//  Created by 周凯 on 2020/01/14.
+//  Copyright © 2020 zhoukai. All rights reserved.
+//
+
+#include <stdio.h>
+#include <skp/process/event.h>
+#include <skp/process/signal.h>
+#include <skp/server/server.h>
+#include <skp/server/pipeline.h>
+
+#define NR_ROUNDS (3)
+
+/*包含空帧与超过一次读取大小的帧*/
+static const uint32_t frame_sizes[] = {
+	1, 100, 0, 3, CONFIG_XPRT_PIPELINE_RXSIZE + 3616, 4096, 7, 65536, 2,
+};
+
+#define NR_FRAMES (ARRAY_SIZE(frame_sizes) * NR_ROUNDS)
+
+static struct server *SRV = NULL;
+static struct uev_timer watchdog;
+static int nr_closed = 0;
+static int nr_echoed = 0;
+static int nr_received = 0;
+static int nr_counted = 0;
+
+static inline uint8_t frame_byte(uint32_t seq, uint32_t off)
+{
+	return (uint8_t)(seq * 31 + off);
+}
+
+static void frame_check(uint32_t seq, struct pbuff *pb)
+{
+	uint8_t *data = pb_data(pb);
+	BUG_ON(pb_headlen(pb) != frame_sizes[seq % ARRAY_SIZE(frame_sizes)]);
+	for (uint32_t i = 0; i < pb_headlen(pb); i++)
+		BUG_ON(data[i] != frame_byte(seq, i));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// 拆帧
+////////////////////////////////////////////////////////////////////////////////
+
+#define NR_UNIT (4)
+
+struct collector {
+	uint32_t nr;
+	struct pbuff *frames[NR_UNIT * 2];
+};
+
+static int collect_inbound(struct xprt_handler_ctx *ctx, struct pbuff *pb)
+{
+	struct collector *coll = ctx->priv;
+	BUG_ON(coll->nr >= ARRAY_SIZE(coll->frames));
+	coll->frames[coll->nr++] = pb;
+	return 0;
+}
+
+static void collect_fini(struct xprt_handler_ctx *ctx)
+{
+	struct collector *coll = ctx->priv;
+	for (uint32_t i = 0; i < coll->nr; i++)
+		free_pb(coll->frames[i]);
+}
+
+static const struct xprt_handler collect_handler = {
+	.name = "collect",
+	.privsize = sizeof(struct collector),
+	.fini = collect_fini,
+	.inbound = collect_inbound,
+};
+
+static const struct xprt_handler *const unit_handlers[] = {
+	&xprt_lenframe_handler, &collect_handler,
+};
+
+static const struct xprt_pipeline_desc unit_desc =
+	XPRT_PIPELINE_DESC(unit_handlers);
+
+/*构造 NR_UNIT 个连续的帧*/
+static struct pbuff *unit_stream(void)
+{
+	struct pbuff *pb = alloc_pb(1024);
+	BUG_ON(!pb);
+	for (uint32_t seq = 0; seq < NR_UNIT; seq++) {
+		uint32_t size = frame_sizes[seq];
+		__pb_write_uint32(pb, size);
+		for (uint32_t i = 0; i < size; i++)
+			__pb_write_uint8(pb, frame_byte(seq, i));
+	}
+	return pb;
+}
+
+static void test_unit(void)
+{
+	struct xprt *xprt;
+	struct collector *coll;
+	struct xprt_handler_ctx *ctx;
+	struct pbuff *stream, *pb;
+	uint8_t *head;
+
+	xprt = xprt_pipeline_ops.constructor(NULL, XPRT_TCPCLNT, (void*)&unit_desc);
+	BUG_ON(!xprt);
+	BUG_ON(xprt_to_pipeline(xprt)->headroom != sizeof(uint32_t));
+	BUG_ON(xprt_pipeline_lookup(xprt, "lenframe") !=
+		&xprt_to_pipeline(xprt)->ctx[0]);
+	BUG_ON(xprt_pipeline_lookup(xprt, "none"));
+	ctx = xprt_pipeline_lookup(xprt, "collect");
+	BUG_ON(!ctx || ctx->index != 1);
+	coll = ctx->priv;
+	BUG_ON(coll->nr);
+
+	/*一次读取多个帧，共享底层数据，最后一帧直接传递*/
+	stream = unit_stream();
+	head = pb_data(stream);
+	BUG_ON(xprt_lenframe_handler.inbound(&xprt_to_pipeline(xprt)->ctx[0],
+		pb_get(stream)));
+	BUG_ON(coll->nr != NR_UNIT);
+	for (uint32_t i = 0; i < NR_UNIT; i++) {
+		pb = coll->frames[i];
+		frame_check(i, pb);
+		if (pb_headlen(pb)) {
+			BUG_ON(pb_data(pb) < head || pb_tail(pb) > pb_tail(stream));
+		}
+	}
+	BUG_ON(coll->frames[NR_UNIT - 1] != stream);
+	free_pb(stream);
+
+	/*逐字节读取，前缀与数据都跨越了读取边界*/
+	stream = unit_stream();
+	while (pb_headlen(stream)) {
+		pb = alloc_pb(1);
+		BUG_ON(!pb);
+		__pb_write_bytes(pb, pb_pulldata(stream, 1), 1);
+		BUG_ON(xprt_lenframe_handler.inbound(&xprt_to_pipeline(xprt)->ctx[0],
+			pb));
+	}
+	free_pb(stream);
+	BUG_ON(coll->nr != NR_UNIT * 2);
+	for (uint32_t i = 0; i < NR_UNIT; i++)
+		frame_check(i, coll->frames[NR_UNIT + i]);
+
+	/*超长的帧*/
+	pb = alloc_pb(8);
+	BUG_ON(!pb);
+	__pb_write_uint32(pb, CONFIG_XPRT_LENFRAME_MAX + 1);
+	BUG_ON(xprt_lenframe_handler.inbound(&xprt_to_pipeline(xprt)->ctx[0],
+		pb) != -EMSGSIZE);
+
+	xprt_pipeline_ops.destructor(xprt);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// 回显
+////////////////////////////////////////////////////////////////////////////////
+
+static void try_pause(void)
+{
+	/*1 个主动端，1 个被动端*/
+	if (__atomic_add_fetch(&nr_closed, 1, __ATOMIC_SEQ_CST) == 2) {
+		log_info("all connections has been closed");
+		server_pause(SRV);
+	}
+}
+
+/*原样返回，帧共享读缓存，不会复制*/
+static int echo_inbound(struct xprt_handler_ctx *ctx, struct pbuff *pb)
+{
+	__atomic_add_fetch(&nr_echoed, 1, __ATOMIC_SEQ_CST);
+	return xprt_fire_outbound(ctx, pb);
+}
+
+static void echo_changed(struct xprt_handler_ctx *ctx, unsigned long stats)
+{
+	if (stats & XPRT_CLOSED)
+		try_pause();
+}
+
+static const struct xprt_handler echo_handler = {
+	.name = "echo",
+	.inbound = echo_inbound,
+	.changed = echo_changed,
+};
+
+static const struct xprt_handler *const server_handlers[] = {
+	&xprt_lenframe_handler, &echo_handler,
+};
+
+static const struct xprt_pipeline_desc server_desc =
+	XPRT_PIPELINE_DESC(server_handlers);
+
+/*只处理入站的中间处理器*/
+static int counter_inbound(struct xprt_handler_ctx *ctx, struct pbuff *pb)
+{
+	(*(uint32_t*)ctx->priv)++;
+	return xprt_fire_inbound(ctx, pb);
+}
+
+static const struct xprt_handler counter_handler = {
+	.name = "counter",
+	.privsize = sizeof(uint32_t),
+	.inbound = counter_inbound,
+};
+
+static int app_inbound(struct xprt_handler_ctx *ctx, struct pbuff *pb)
+{
+	uint32_t *seq = ctx->priv;
+	struct xprt *xprt = xprt_handler_xprt(ctx);
+
+	frame_check((*seq)++, pb);
+	free_pb(pb);
+	__atomic_add_fetch(&nr_received, 1, __ATOMIC_SEQ_CST);
+	if (*seq == NR_FRAMES) {
+		nr_counted = *(uint32_t*)xprt_pipeline_lookup(xprt, "counter")->priv;
+		shutdown_xprt(xprt, SHUT_RDWR);
+	}
+	return 0;
+}
+
+static void app_changed(struct xprt_handler_ctx *ctx, unsigned long stats)
+{
+	struct pbuff *pb, *frag;
+	struct xprt *xprt = xprt_handler_xprt(ctx);
+
+	if (stats & XPRT_OPENED) {
+		/*突发写入，不等待回显*/
+		for (uint32_t seq = 0; seq < NR_FRAMES; seq++) {
+			uint32_t size = frame_sizes[seq % ARRAY_SIZE(frame_sizes)];
+			/*奇数帧的后半部分作为分片，不复制*/
+			uint32_t split = (seq & 1) ? size / 2 : size;
+			pb = xprt_pipeline_alloc(xprt, split);
+			BUG_ON(!pb);
+			/*预留了前缀的空间*/
+			BUG_ON(pb_headroom(pb) < sizeof(uint32_t));
+			for (uint32_t i = 0; i < split; i++)
+				__pb_write_uint8(pb, frame_byte(seq, i));
+			if (split < size) {
+				frag = alloc_pb(size - split);
+				BUG_ON(!frag);
+				for (uint32_t i = split; i < size; i++)
+					__pb_write_uint8(frag, frame_byte(seq, i));
+				BUG_ON(pb_add_frag(pb, frag, 0, size - split));
+				free_pb(frag);
+				BUG_ON(pb_len(pb) != size);
+			}
+			BUG_ON(xprt_pipeline_write(xprt, pb));
+		}
+	} else if (stats & XPRT_CLOSED) {
+		try_pause();
+	} else if (stats & XPRT_CONNREFUSED) {
+		log_error("connect has been refused : %p", xprt);
+		BUG();
+	}
+}
+
+static const struct xprt_handler app_handler = {
+	.name = "app",
+	.privsize = sizeof(uint32_t),
+	.inbound = app_inbound,
+	.changed = app_changed,
+};
+
+static const struct xprt_handler *const client_handlers[] = {
+	&xprt_lenframe_handler, &counter_handler, &app_handler,
+};
+
+static const struct xprt_pipeline_desc client_desc =
+	XPRT_PIPELINE_DESC(client_handlers);
+
+static void watchdog_cb(struct uev_timer *timer)
+{
+	log_error("test has been timed out : echoed %d, received %d, closed %d",
+		nr_echoed, nr_received, nr_closed);
+	BUG();
+}
+
+static void server_init(void)
+{
+	struct xprt *xprt;
+	const struct service_address laddr = {
+		.host = "127.0.0.1",
+		.serv = "10024",
+	};
+
+	signal_setup(SIGPIPE, signal_default);
+
+	SRV = ___alloc_server(sizeof(struct server), 8, 0);
+	BUG_ON(!SRV);
+
+	/*侦听对象的用户数据为被动端的处理器链*/
+	xprt = create_xprt(SRV, &laddr,
+		XPRT_TCPSERV|XPRT_OPT_NONBLOCK|XPRT_RDREADY, &xprt_tcpserv_ops,
+		(void*)&server_desc, &xprt_pipeline_ops);
+	BUG_ON(!xprt);
+	xprt_put(xprt);
+
+	xprt = create_xprt(SRV, &laddr,
+		XPRT_TCPCLNT|XPRT_OPT_NONBLOCK|XPRT_WRREADY, &xprt_pipeline_ops,
+		(void*)&client_desc);
+	BUG_ON(!xprt);
+	xprt_put(xprt);
+
+	uev_timer_init(&watchdog, watchdog_cb);
+	uev_timer_add(&watchdog, 10000);
+}
+
+int main(int argc, const char *argv[])
+{
+	test_unit();
+
+	server_init();
+	server_loop(SRV);
+	uev_timer_delete_sync(&watchdog);
+	destroy_server(SRV);
+
+	log_info("echoed %d frames, received %d frames", nr_echoed, nr_received);
+	BUG_ON(nr_echoed != NR_FRAMES);
+	BUG_ON(nr_received != NR_FRAMES);
+	BUG_ON(nr_counted != NR_FRAMES);
+
+	log_info("test xprt pipeline success");
+	return 0;
+}
@@ -0,0 +1,342 @@
+//
+//  test-xprt_race.c
+//  test
+//
+//  Created by 周凯 on 2020/01/08.
+//  Copyright © 2020 zhoukai. All rights reserved.
+//
+
+#include <stdio.h>
+#include <skp/process/event.h>
+#include <skp/process/signal.h>
+#include <skp/server/server.h>
+#include <skp/server/socket.h>
+#include <skp/server/xprt.h>
+#include <skp/server/resolver.h>
+
+#define NR_CLIENTS (4)
+#define GOOD_PORT (10012)
+#define HOLE_PORT (10013)
+#define DEAD_PORT (10014)
+#define RAW_PORT (10015)
+
+static struct server *SRV = NULL;
+static struct uev_timer watchdog;
+static int nr_opened = 0;
+static int nr_refused = 0;
+static int nr_closed = 0;
+static int nr_cancelled = 0;
+static uint64_t start_ms = 0;
+static struct xprt *hole_xprt = NULL;
+static struct uev_timer canceller;
+
+static inline uint64_t now_ms(void)
+{
+	return abstime(NULL, 0) / 1000000;
+}
+
+static void inet_loopback(union inet_address *inet, uint16_t port)
+{
+	memset(inet, 0, sizeof(*inet));
+	inet->sin_addr.sin_family = AF_INET;
+	inet->sin_addr.sin_port = htons(port);
+	inet->sin_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+}
+
+static void inet6_loopback(union inet_address *inet, uint16_t port)
+{
+	memset(inet, 0, sizeof(*inet));
+	inet->sin6_addr.sin6_family = AF_INET6;
+	inet->sin6_addr.sin6_port = htons(port);
+	inet->sin6_addr.sin6_addr = in6addr_loopback;
+}
+
+static int raw_listen(uint16_t port, int backlog)
+{
+	union inet_address inet;
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+
+	BUG_ON(fd < 0);
+	inet_loopback(&inet, port);
+	sockopt_reuseaddress(fd);
+	BUG_ON(bind(fd, &inet.sock_addr, sizeof(inet.sin_addr)));
+	BUG_ON(listen(fd, backlog));
+	return fd;
+}
+
+/*
+ * 构造一个黑洞地址，全连接队列已满的侦听套接字会丢弃新的 SYN，
+ * 连接将一直处于进行中，模拟不可达的地址
+ */
+static int blackhole_setup(int *fillers, int nr)
+{
+	union inet_address inet;
+	int fd = raw_listen(HOLE_PORT, 0);
+
+	inet_loopback(&inet, HOLE_PORT);
+	for (int i = 0; i < nr; i++) {
+		fillers[i] = socket(AF_INET, SOCK_STREAM|SOCK_NONBLOCK, 0);
+		BUG_ON(fillers[i] < 0);
+		connect(fillers[i], &inet.sock_addr, sizeof(inet.sin_addr));
+	}
+	usleep(100000);
+	return fd;
+}
+
+static void test_interleave(void)
+{
+	union inet_address addrs[5];
+
+	inet6_loopback(&addrs[0], 1);
+	inet6_loopback(&addrs[1], 2);
+	inet6_loopback(&addrs[2], 3);
+	inet_loopback(&addrs[3], 4);
+	inet_loopback(&addrs[4], 5);
+
+	inet_address_interleave(addrs, ARRAY_SIZE(addrs));
+	/*首选的地址族优先，各地址族内保持原有的顺序*/
+	BUG_ON(inet_address_port(&addrs[0]) != 1);
+	BUG_ON(inet_address_port(&addrs[1]) != 4);
+	BUG_ON(inet_address_port(&addrs[2]) != 2);
+	BUG_ON(inet_address_port(&addrs[3]) != 5);
+	BUG_ON(inet_address_port(&addrs[4]) != 3);
+}
+
+static void test_blocking(void)
+{
+	int fd, lfd;
+	uint64_t elapse;
+	union inet_address addrs[2], inet;
+
+	lfd = raw_listen(RAW_PORT, 16);
+
+	/*第一个地址无响应，间隔后向第二个地址发起连接*/
+	inet_loopback(&addrs[0], HOLE_PORT);
+	inet_loopback(&addrs[1], RAW_PORT);
+	elapse = now_ms();
+	fd = tcp_connect_inet(addrs, 2, NULL, NULL, NULL, &inet);
+	elapse = now_ms() - elapse;
+	log_info("blocking race with blackhole : %lu ms", (unsigned long)elapse);
+	BUG_ON(fd < 0);
+	BUG_ON(inet_address_port(&inet) != RAW_PORT);
+	BUG_ON(elapse + 10 < CONFIG_TCP_CONNECT_DELAY);
+	BUG_ON(elapse > CONFIG_TCP_CONNECT_DELAY + 500);
+	/*胜出的套接字恢复为阻塞模式*/
+	BUG_ON(fcntl(fd, F_GETFL) & O_NONBLOCK);
+	close(fd);
+
+	/*第一个地址被拒绝，不用等待间隔*/
+	inet_loopback(&addrs[0], DEAD_PORT);
+	elapse = now_ms();
+	fd = tcp_connect_inet(addrs, 2, NULL, NULL, NULL, &inet);
+	elapse = now_ms() - elapse;
+	BUG_ON(fd < 0);
+	BUG_ON(inet_address_port(&inet) != RAW_PORT);
+	BUG_ON(elapse >= CONFIG_TCP_CONNECT_DELAY);
+	close(fd);
+
+	/*全部失败*/
+	inet_loopback(&addrs[1], DEAD_PORT);
+	fd = tcp_connect_inet(addrs, 2, NULL, NULL, NULL, &inet);
+	BUG_ON(fd != -ECONNREFUSED);
+
+	close(lfd);
+}
+
+static void client_recv(struct xprt *xprt, unsigned long stats)
+{
+	char buff[64];
+	ssize_t rc;
+
+	do {
+		rc = xprt_read(xprt, buff, sizeof(buff));
+		if (rc > 0)
+			continue;
+		if (rc != -EAGAIN)
+			shutdown_xprt(xprt, SHUT_RDWR);
+		break;
+	} while (1);
+}
+
+static void client_send(struct xprt *xprt, unsigned long stats)
+{
+}
+
+static void try_pause(void)
+{
+	if (READ_ONCE(nr_opened) == NR_CLIENTS &&
+			READ_ONCE(nr_refused) == NR_CLIENTS &&
+			READ_ONCE(nr_closed) == NR_CLIENTS * 2 &&
+			READ_ONCE(nr_cancelled) == 1) {
+		log_info("all connections has been finished");
+		server_pause(SRV);
+	}
+}
+
+static void client_changed(struct xprt *xprt, unsigned long stats)
+{
+	if (stats & XPRT_OPENED) {
+		if (xprt->user) {
+			xprt_event_enable(xprt, EVENT_READ);
+		} else {
+			uint64_t elapse = now_ms() - start_ms;
+			struct xprt_tcpclnt *clnt = xprt_to_tcpclnt(xprt);
+
+			log_info("racing connection established after %lu ms",
+				(unsigned long)elapse);
+			/*黑洞地址之后的地址被拒绝，立即尝试了最后一个地址*/
+			BUG_ON(inet_address_port(&clnt->remote) != GOOD_PORT);
+			BUG_ON(elapse > CONFIG_TCP_CONNECT_DELAY + 1000);
+			__atomic_add_fetch(&nr_opened, 1, __ATOMIC_SEQ_CST);
+			BUG_ON(xprt_write(xprt, "ping", 4) != 4);
+			shutdown_xprt(xprt, SHUT_RDWR);
+		}
+	} else if (stats & XPRT_CLOSED) {
+		__atomic_add_fetch(&nr_closed, 1, __ATOMIC_SEQ_CST);
+		try_pause();
+	} else if (stats & XPRT_CONNREFUSED) {
+		BUG_ON(xprt->user);
+		__atomic_add_fetch(&nr_refused, 1, __ATOMIC_SEQ_CST);
+		try_pause();
+	}
+}
+
+static const struct xprt_operations client_ops = {
+	.constructor = xprt_tcpclnt_constructor,
+	.destructor = xprt_tcpclnt_destructor,
+	.on_recv = client_recv,
+	.on_send = client_send,
+	.on_changed = client_changed,
+};
+
+/*所有的尝试都在等待黑洞地址，关闭后必须立即结束，不能等到连接超时*/
+static void hole_changed(struct xprt *xprt, unsigned long stats)
+{
+	uint64_t elapse = now_ms() - start_ms;
+
+	BUG_ON(stats & XPRT_OPENED);
+	if (!(stats & (XPRT_CLOSED|XPRT_CONNREFUSED)))
+		return;
+	log_info("cancelled racing connection finished after %lu ms",
+		(unsigned long)elapse);
+	BUG_ON(elapse > CONFIG_TCP_CONNECT_DELAY * 3 + 1000);
+	__atomic_add_fetch(&nr_cancelled, 1, __ATOMIC_SEQ_CST);
+	try_pause();
+}
+
+static const struct xprt_operations hole_ops = {
+	.constructor = xprt_tcpclnt_constructor,
+	.destructor = xprt_tcpclnt_destructor,
+	.on_recv = client_recv,
+	.on_send = client_send,
+	.on_changed = hole_changed,
+};
+
+static void canceller_cb(struct uev_timer *timer)
+{
+	shutdown_xprt(hole_xprt, SHUT_RDWR);
+	xprt_put(hole_xprt);
+}
+
+static void watchdog_cb(struct uev_timer *timer)
+{
+	log_error("test has been timed out : opened %d, refused %d, closed %d, "
+		"cancelled %d", nr_opened, nr_refused, nr_closed, nr_cancelled);
+	BUG();
+}
+
+static void server_init(void)
+{
+	struct xprt *xprt;
+	struct resolv_result result;
+	const struct service_address laddr = {
+		.host = "127.0.0.1",
+		.serv = "10012",
+	};
+	const struct service_address raddr = {
+		.host = "race.test",
+		.serv = "race",
+	};
+	const struct service_address daddr = {
+		.host = "dead.test",
+		.serv = "race",
+	};
+	const struct service_address haddr = {
+		.host = "hole.test",
+		.serv = "race",
+	};
+
+	signal_setup(SIGPIPE, signal_default);
+
+	SRV = ___alloc_server(sizeof(struct server), NR_CLIENTS * 3 + 2, 0);
+	BUG_ON(!SRV);
+
+	xprt = create_xprt(SRV, &laddr,
+			XPRT_TCPSERV|XPRT_OPT_NONBLOCK|XPRT_RDREADY, &xprt_tcpserv_ops,
+			NULL, &client_ops);
+	BUG_ON(!xprt);
+	xprt_put(xprt);
+
+	/*预置多个地址：无响应、拒绝、可用*/
+	result.nr = 3;
+	inet_loopback(&result.addrs[0], HOLE_PORT);
+	inet_loopback(&result.addrs[1], DEAD_PORT);
+	inet_loopback(&result.addrs[2], GOOD_PORT);
+	BUG_ON(resolv_cache_insert(&raddr, AF_UNSPEC, &result));
+
+	result.nr = 2;
+	inet_loopback(&result.addrs[0], DEAD_PORT);
+	inet6_loopback(&result.addrs[1], DEAD_PORT);
+	BUG_ON(resolv_cache_insert(&daddr, AF_UNSPEC, &result));
+
+	result.nr = 2;
+	inet_loopback(&result.addrs[0], HOLE_PORT);
+	inet_loopback(&result.addrs[1], HOLE_PORT);
+	BUG_ON(resolv_cache_insert(&haddr, AF_UNSPEC, &result));
+
+	start_ms = now_ms();
+	for (int i = 0; i < NR_CLIENTS; i++) {
+		xprt = create_xprt(SRV, &raddr,
+			XPRT_TCPCLNT|XPRT_OPT_NONBLOCK|XPRT_WRREADY, &client_ops, NULL);
+		BUG_ON(!xprt);
+		xprt_put(xprt);
+
+		/*全部地址都被拒绝，通过事件报告连接被拒绝*/
+		xprt = create_xprt(SRV, &daddr,
+			XPRT_TCPCLNT|XPRT_OPT_NONBLOCK|XPRT_WRREADY, &client_ops, NULL);
+		BUG_ON(!xprt);
+		xprt_put(xprt);
+	}
+
+	/*两个尝试都已发起，间隔定时器不再开启时关闭*/
+	hole_xprt = create_xprt(SRV, &haddr,
+		XPRT_TCPCLNT|XPRT_OPT_NONBLOCK|XPRT_WRREADY, &hole_ops, NULL);
+	BUG_ON(!hole_xprt);
+	uev_timer_init(&canceller, canceller_cb);
+	uev_timer_add(&canceller, CONFIG_TCP_CONNECT_DELAY * 3);
+
+	uev_timer_init(&watchdog, watchdog_cb);
+	uev_timer_add(&watchdog, 10000);
+}
+
+int main(int argc, const char *argv[])
+{
+	int hole, fillers[2];
+
+	hole = blackhole_setup(fillers, ARRAY_SIZE(fillers));
+
+	test_interleave();
+	test_blocking();
+
+	server_init();
+	server_loop(SRV);
+	uev_timer_delete_sync(&watchdog);
+	uev_timer_delete_sync(&canceller);
+	destroy_server(SRV);
+
+	for (int i = 0; i < ARRAY_SIZE(fillers); i++)
+		close(fillers[i]);
+	close(hole);
+	log_info("test xprt race success");
+	return 0;
+}
@@ -0,0 +1,311 @@
+//
+//  test-xprt_rate.c
+//  test
+//
+//  Created by 周凯 on 2020/01/10.
+//  Copyright © 2020 zhoukai. All rights reserved.
+//
+
+#include <stdio.h>
+#include <skp/process/event.h>
+#include <skp/process/signal.h>
+#include <skp/server/server.h>
+#include <skp/server/xprt.h>
+
+#define RX_BPS (64 * 1024)
+#define RX_TOTAL (32 * 1024)
+#define MSG_SIZE (100)
+#define MSG_PS (50)
+#define MSG_TOTAL (30)
+#define MIXED_MPS (1)
+#define FAIR_TOTAL (16 << 20)
+#define FAIR_CHUNK (64 * 1024)
+
+enum {
+	LSTN_BYTES,
+	LSTN_MSGS,
+	LSTN_MIXED,
+	LSTN_FAIR,
+	LSTN_MAX,
+};
+
+struct sender {
+	struct xprt *xprt;
+	uint16_t weight;
+	uint64_t sent;
+};
+
+static struct server *SRV = NULL;
+static struct uev_timer watchdog;
+static struct xprt *lstns[LSTN_MAX];
+static struct sender senders[2];
+static int nr_closed = 0;
+static bool fair_done = false;
+static uint64_t start_ms = 0;
+static uint64_t bytes_ms = 0;
+static uint64_t msgs_ms = 0;
+static uint64_t mixed_ms = 0;
+static uint64_t fair_ratio = 0;
+static char buff[FAIR_CHUNK];
+
+static inline uint64_t now_ms(void)
+{
+	return abstime(NULL, 0) / 1000000;
+}
+
+static struct sender *xprt_sender(struct xprt *xprt)
+{
+	for (int i = 0; i < ARRAY_SIZE(senders); i++) {
+		if (senders[i].xprt == xprt)
+			return &senders[i];
+	}
+	return NULL;
+}
+
+/*被动端计数读取的字节*/
+struct reader {
+	struct xprt_tcpclnt clnt;
+	uint64_t nbytes;
+};
+
+static struct xprt *reader_constructor(struct server *serv, unsigned long opt,
+		void *user)
+{
+	struct reader *reader = malloc(sizeof(*reader));
+	if (skp_unlikely(!reader))
+		return NULL;
+	memset(reader, 0, sizeof(*reader));
+	reader->clnt.xprt.user = user;
+	return &reader->clnt.xprt;
+}
+
+static void reader_destructor(struct xprt *xprt)
+{
+	free(container_of(xprt, struct reader, clnt.xprt));
+}
+
+static void reader_recv(struct xprt *xprt, unsigned long stats)
+{
+	ssize_t rc;
+	struct reader *reader = container_of(xprt, struct reader, clnt.xprt);
+	/*每次读取一个消息*/
+	size_t size = xprt->user == lstns[LSTN_MSGS] ? MSG_SIZE : sizeof(buff);
+
+	do {
+		rc = xprt_read(xprt, buff, size);
+		if (rc > 0) {
+			uint64_t old = reader->nbytes;
+			reader->nbytes += rc;
+			if (xprt->user == lstns[LSTN_BYTES]) {
+				if (old < RX_TOTAL && reader->nbytes >= RX_TOTAL)
+					bytes_ms = now_ms() - start_ms;
+			} else if (xprt->user == lstns[LSTN_MIXED]) {
+				if (old < RX_TOTAL && reader->nbytes >= RX_TOTAL)
+					mixed_ms = now_ms() - start_ms;
+			} else if (xprt->user == lstns[LSTN_MSGS]) {
+				xprt_rate_charge(xprt, reader->nbytes / MSG_SIZE -
+					old / MSG_SIZE);
+				if (old < MSG_SIZE * MSG_TOTAL &&
+						reader->nbytes >= MSG_SIZE * MSG_TOTAL)
+					msgs_ms = now_ms() - start_ms;
+			}
+			continue;
+		}
+		if (rc != -EAGAIN)
+			shutdown_xprt(xprt, SHUT_RDWR);
+		break;
+	} while (1);
+}
+
+static void try_pause(void)
+{
+	/*5 个主动端，5 个被动端*/
+	if (__atomic_add_fetch(&nr_closed, 1, __ATOMIC_SEQ_CST) == 10) {
+		log_info("all connections has been closed");
+		server_pause(SRV);
+	}
+}
+
+static void reader_changed(struct xprt *xprt, unsigned long stats)
+{
+	if (stats & XPRT_OPENED) {
+		if (xprt->user == lstns[LSTN_BYTES]) {
+			BUG_ON(xprt_set_rate(xprt, RX_BPS, 0));
+		} else if (xprt->user == lstns[LSTN_MSGS]) {
+			BUG_ON(xprt_set_rate(xprt, 0, MSG_PS));
+		} else if (xprt->user == lstns[LSTN_MIXED]) {
+			/*消息的令牌补充得很慢，不能因此重复补充字节的令牌*/
+			BUG_ON(xprt_set_rate(xprt, RX_BPS, MIXED_MPS));
+		}
+		xprt_event_enable(xprt, EVENT_READ);
+	} else if (stats & XPRT_CLOSED) {
+		try_pause();
+	}
+}
+
+static const struct xprt_operations reader_ops = {
+	.constructor = reader_constructor,
+	.destructor = reader_destructor,
+	.on_recv = reader_recv,
+	.on_send = NULL,
+	.on_changed = reader_changed,
+};
+
+static void client_recv(struct xprt *xprt, unsigned long stats)
+{
+	ssize_t rc;
+	do {
+		rc = xprt_read(xprt, buff, sizeof(buff));
+	} while (rc > 0);
+	if (rc != -EAGAIN)
+		shutdown_xprt(xprt, SHUT_RDWR);
+}
+
+static void client_send(struct xprt *xprt, unsigned long stats)
+{
+	ssize_t rc;
+	struct sender *sender = xprt_sender(xprt);
+
+	if (!sender) {
+		/*限速的对端，一次写完，内核缓存足够容纳*/
+		size_t size = xprt_to_tcpclnt(xprt)->remote.sin_addr.sin_port ==
+			htons(10017) ? MSG_SIZE * MSG_TOTAL : RX_TOTAL;
+		BUG_ON(xprt_write(xprt, buff, size) != size);
+		shutdown_xprt(xprt, SHUT_RDWR);
+		return;
+	}
+
+	do {
+		if (READ_ONCE(fair_done)) {
+			shutdown_xprt(xprt, SHUT_RDWR);
+			return;
+		}
+		rc = xprt_write(xprt, buff, sizeof(buff));
+		if (rc > 0) {
+			sender->sent += rc;
+			if (senders[0].sent + senders[1].sent >= FAIR_TOTAL) {
+				fair_ratio = senders[1].sent * 100 / (senders[0].sent + 1);
+				WRITE_ONCE(fair_done, true);
+			}
+			continue;
+		}
+		/*份额用完或内核缓存已满，等待再次可写*/
+		if (rc == -EAGAIN) {
+			xprt_event_enable(xprt, EVENT_WRITE);
+			return;
+		}
+		shutdown_xprt(xprt, SHUT_RDWR);
+		return;
+	} while (1);
+}
+
+static void client_changed(struct xprt *xprt, unsigned long stats)
+{
+	if (stats & XPRT_OPENED) {
+		struct sender *sender = xprt_sender(xprt);
+		if (sender)
+			BUG_ON(xprt_set_weight(xprt, sender->weight));
+		xprt_event_enable(xprt, EVENT_READ);
+	} else if (stats & XPRT_CLOSED) {
+		try_pause();
+	} else if (stats & XPRT_CONNREFUSED) {
+		log_error("connect has been refused : %p", xprt);
+		BUG();
+	}
+}
+
+static const struct xprt_operations client_ops = {
+	.constructor = xprt_tcpclnt_constructor,
+	.destructor = xprt_tcpclnt_destructor,
+	.on_recv = client_recv,
+	.on_send = client_send,
+	.on_changed = client_changed,
+};
+
+static void watchdog_cb(struct uev_timer *timer)
+{
+	log_error("test has been timed out : closed %d, sent %lu/%lu", nr_closed,
+		(unsigned long)senders[0].sent, (unsigned long)senders[1].sent);
+	BUG();
+}
+
+static void server_init(void)
+{
+	struct xprt *xprt;
+	struct service_address laddrs[LSTN_MAX] = {
+		{ .host = "127.0.0.1", .serv = "10016", },
+		{ .host = "127.0.0.1", .serv = "10017", },
+		{ .host = "127.0.0.1", .serv = "10019", },
+		{ .host = "127.0.0.1", .serv = "10018", },
+	};
+
+	signal_setup(SIGPIPE, signal_default);
+
+	SRV = ___alloc_server(sizeof(struct server), LSTN_MAX + 10, 0);
+	BUG_ON(!SRV);
+
+	/*被动端的用户数据为监听对象*/
+	for (int i = 0; i < LSTN_MAX; i++) {
+		lstns[i] = create_xprt(SRV, &laddrs[i],
+			XPRT_TCPSERV|XPRT_OPT_NONBLOCK|XPRT_RDREADY, &xprt_tcpserv_ops,
+			NULL, &reader_ops);
+		BUG_ON(!lstns[i]);
+	}
+
+	start_ms = now_ms();
+	for (int i = 0; i < LSTN_FAIR; i++) {
+		xprt = create_xprt(SRV, &laddrs[i],
+			XPRT_TCPCLNT|XPRT_OPT_NONBLOCK|XPRT_WRREADY, &client_ops, NULL);
+		BUG_ON(!xprt);
+		xprt_put(xprt);
+	}
+
+	/*权重为 1 : 3 的两个发送者*/
+	senders[0].weight = 1;
+	senders[1].weight = 3;
+	for (int i = 0; i < ARRAY_SIZE(senders); i++) {
+		xprt = create_xprt(SRV, &laddrs[LSTN_FAIR],
+			XPRT_TCPCLNT|XPRT_OPT_NONBLOCK, &client_ops, NULL);
+		BUG_ON(!xprt);
+		senders[i].xprt = xprt;
+	}
+	for (int i = 0; i < ARRAY_SIZE(senders); i++)
+		BUG_ON(xprt_event_add(senders[i].xprt, EVENT_WRITE));
+
+	uev_timer_init(&watchdog, watchdog_cb);
+	uev_timer_add(&watchdog, 10000);
+}
+
+int main(int argc, const char *argv[])
+{
+	/*单线程模式，所有的传输对象共享同一个事件槽位*/
+	sysevent_init(true);
+
+	server_init();
+	server_loop(SRV);
+	uev_timer_delete_sync(&watchdog);
+
+	log_info("bytes limited : %lu ms, messages limited : %lu ms, "
+		"mixed limited : %lu ms, fair share : %lu/%lu (%lu%%)",
+		(unsigned long)bytes_ms, (unsigned long)msgs_ms,
+		(unsigned long)mixed_ms, (unsigned long)senders[0].sent,
+		(unsigned long)senders[1].sent, (unsigned long)fair_ratio);
+
+	/*满桶可以突发 CONFIG_XPRT_RATE_BURST 毫秒的量，其余的按速率读取*/
+	BUG_ON(bytes_ms < (RX_TOTAL - RX_BPS / 10) * 1000 / RX_BPS - 50);
+	BUG_ON(bytes_ms > 3000);
+	BUG_ON(msgs_ms < (MSG_TOTAL - MSG_PS / 10) * 1000 / MSG_PS - 50);
+	BUG_ON(msgs_ms > 3000);
+	BUG_ON(mixed_ms < (RX_TOTAL - RX_BPS / 10) * 1000 / RX_BPS - 50);
+	BUG_ON(mixed_ms > 3000);
+	/*发送量与权重成比例*/
+	BUG_ON(fair_ratio < 250 || fair_ratio > 350);
+
+	for (int i = 0; i < ARRAY_SIZE(senders); i++)
+		xprt_put(senders[i].xprt);
+	for (int i = 0; i < LSTN_MAX; i++)
+		xprt_put(lstns[i]);
+	destroy_server(SRV);
+	log_info("test xprt rate success");
+	return 0;
+}
@@ -0,0 +1,184 @@
+//
+//  test-xprt_sockopt.c
+//  test
+//
+//  Created by 周凯 on 2020/01/17.
+//  Copyright © 2020 zhoukai. All rights reserved.
+//
+
+#include <stdio.h>
+#include <skp/process/event.h>
+#include <skp/process/signal.h>
+#include <skp/server/server.h>
+#include <skp/server/socket.h>
+#include <skp/server/xprt.h>
+
+#define MSG "fastopen"
+
+#define TCP_OPTS (XPRT_OPT_TCPFASTOPEN|XPRT_OPT_TCPDEFERACCEPT|	\
+	XPRT_OPT_TCPNOTSENTLOWAT)
+
+static struct server *SRV = NULL;
+static struct uev_timer watchdog;
+static int nr_closed = 0;
+static size_t nr_sent = 0;
+static size_t nr_echoed = 0;
+
+static int sockopt_tcp(struct xprt *xprt, int name)
+{
+	int val = -1;
+	BUG_ON(sockopt_get_intval(xprt_fd(xprt), IPPROTO_TCP, name, &val));
+	return val;
+}
+
+static void try_pause(void)
+{
+	/*1 个主动端，1 个被动端*/
+	if (__atomic_add_fetch(&nr_closed, 1, __ATOMIC_SEQ_CST) == 2)
+		server_pause(SRV);
+}
+
+static void echo_recv(struct xprt *xprt, unsigned long stats)
+{
+	char buff[64];
+	ssize_t rc;
+
+	do {
+		rc = xprt_read(xprt, buff, sizeof(buff));
+		if (rc > 0) {
+			BUG_ON(xprt_write(xprt, buff, rc) != rc);
+			continue;
+		}
+		if (rc == -EAGAIN)
+			break;
+		shutdown_xprt(xprt, SHUT_RDWR);
+		break;
+	} while (1);
+}
+
+static void echo_changed(struct xprt *xprt, unsigned long stats)
+{
+	if (stats & XPRT_OPENED) {
+		/*从侦听套接字继承，被动连接也会设置*/
+		BUG_ON(sockopt_tcp(xprt, TCP_NOTSENT_LOWAT) != CONFIG_XPRT_NOTSENT_LOWAT);
+		xprt_event_enable(xprt, EVENT_READ);
+	} else if (stats & XPRT_CLOSED) {
+		try_pause();
+	}
+}
+
+static const struct xprt_operations echo_ops = {
+	.constructor = xprt_tcpclnt_constructor,
+	.destructor = xprt_tcpclnt_destructor,
+	.on_recv = echo_recv,
+	.on_send = NULL,
+	.on_changed = echo_changed,
+};
+
+/*没有 cookie 时第一次写入返回 -EAGAIN，握手完成后可写*/
+static void clnt_send(struct xprt *xprt, unsigned long stats)
+{
+	ssize_t rc;
+
+	while (nr_sent < sizeof(MSG)) {
+		rc = xprt_write(xprt, MSG + nr_sent, sizeof(MSG) - nr_sent);
+		if (rc == -EAGAIN) {
+			BUG_ON(xprt_event_enable(xprt, EVENT_WRITE) < 0);
+			return;
+		}
+		BUG_ON(rc <= 0);
+		nr_sent += rc;
+	}
+}
+
+static void clnt_recv(struct xprt *xprt, unsigned long stats)
+{
+	char buff[64];
+	ssize_t rc;
+
+	do {
+		rc = xprt_read(xprt, buff, sizeof(buff));
+		if (rc > 0) {
+			BUG_ON(memcmp(buff, MSG + nr_echoed, rc));
+			nr_echoed += rc;
+			if (nr_echoed == sizeof(MSG)) {
+				shutdown_xprt(xprt, SHUT_RDWR);
+				break;
+			}
+			continue;
+		}
+		if (rc == -EAGAIN)
+			break;
+		shutdown_xprt(xprt, SHUT_RDWR);
+		break;
+	} while (1);
+}
+
+static void clnt_changed(struct xprt *xprt, unsigned long stats)
+{
+	if (stats & XPRT_OPENED) {
+		BUG_ON(sockopt_tcp(xprt, TCP_FASTOPEN_CONNECT) != 1);
+		BUG_ON(sockopt_tcp(xprt, TCP_NOTSENT_LOWAT) != CONFIG_XPRT_NOTSENT_LOWAT);
+		xprt_event_enable(xprt, EVENT_READ);
+		clnt_send(xprt, stats);
+	} else if (stats & XPRT_CLOSED) {
+		try_pause();
+	} else if (stats & XPRT_CONNREFUSED) {
+		log_error("connect has been refused : %p", xprt);
+		BUG();
+	}
+}
+
+static const struct xprt_operations clnt_ops = {
+	.constructor = xprt_tcpclnt_constructor,
+	.destructor = xprt_tcpclnt_destructor,
+	.on_recv = clnt_recv,
+	.on_send = clnt_send,
+	.on_changed = clnt_changed,
+};
+
+static void watchdog_cb(struct uev_timer *timer)
+{
+	log_error("test has been timed out : sent %zu, echoed %zu, closed %d",
+		nr_sent, nr_echoed, nr_closed);
+	BUG();
+}
+
+int main(int argc, const char *argv[])
+{
+	struct xprt *lstn, *clnt;
+	const struct service_address laddr = {
+		.host = "127.0.0.1",
+		.serv = "10029",
+	};
+
+	signal_setup(SIGPIPE, signal_default);
+
+	SRV = ___alloc_server(sizeof(struct server), 8, 0);
+	BUG_ON(!SRV);
+
+	lstn = create_xprt(SRV, &laddr,
+		XPRT_TCPSERV|XPRT_OPT_NONBLOCK|XPRT_RDREADY|TCP_OPTS,
+		&xprt_tcpserv_ops, NULL, &echo_ops);
+	BUG_ON(!lstn);
+	BUG_ON(sockopt_tcp(lstn, TCP_FASTOPEN) != CONFIG_XPRT_TFO_QLEN);
+	/*内核按重传的次数取整，不会小于设置的值*/
+	BUG_ON(sockopt_tcp(lstn, TCP_DEFER_ACCEPT) < CONFIG_XPRT_DEFER_ACCEPT);
+
+	clnt = create_xprt(SRV, &laddr,
+		XPRT_TCPCLNT|XPRT_OPT_NONBLOCK|XPRT_WRREADY|TCP_OPTS, &clnt_ops, NULL);
+	BUG_ON(!clnt);
+	xprt_put(clnt);
+
+	uev_timer_init(&watchdog, watchdog_cb);
+	uev_timer_add(&watchdog, 10000);
+
+	server_loop(SRV);
+	uev_timer_delete_sync(&watchdog);
+	xprt_put(lstn);
+	destroy_server(SRV);
+
+	BUG_ON(nr_echoed != sizeof(MSG));
+	log_info("test xprt sockopt success");
+	return 0;
+}
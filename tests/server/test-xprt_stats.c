@@ -0,0 +1,214 @@
+//
+//  test-xprt_stats.c
+//  test
+//
+//  Created by 周凯 on 2020/01/17.
+//  Copyright © 2020 zhoukai. All rights reserved.
+//
+
+#include <stdio.h>
+#include <skp/process/event.h>
+#include <skp/process/signal.h>
+#include <skp/server/server.h>
+#include <skp/server/pipeline.h>
+
+#define NR_FRAMES (64)
+#define FRAME_SIZE (100)
+/*每帧在线路上有 4 字节的长度前缀*/
+#define WIRE_BYTES (NR_FRAMES * (FRAME_SIZE + sizeof(uint32_t)))
+#define TCPINFO_PERIOD (20)
+
+static struct server *SRV = NULL;
+static struct xprt *CLNT = NULL;
+static struct uev_timer watchdog;
+static struct uev_timer checker;
+static int nr_closed = 0;
+static int nr_received = 0;
+static bool checked = false;
+
+struct stats_check {
+	int nr_lstn;
+	int nr_clnt;
+	int nr_sampled;
+};
+
+static void try_pause(void)
+{
+	/*1 个主动端，1 个被动端*/
+	if (__atomic_add_fetch(&nr_closed, 1, __ATOMIC_SEQ_CST) == 2)
+		server_pause(SRV);
+}
+
+static int echo_inbound(struct xprt_handler_ctx *ctx, struct pbuff *pb)
+{
+	return xprt_fire_outbound(ctx, pb);
+}
+
+static void echo_changed(struct xprt_handler_ctx *ctx, unsigned long stats)
+{
+	if (stats & XPRT_CLOSED)
+		try_pause();
+}
+
+static const struct xprt_handler echo_handler = {
+	.name = "echo",
+	.inbound = echo_inbound,
+	.changed = echo_changed,
+};
+
+static const struct xprt_handler *const server_handlers[] = {
+	&xprt_lenframe_handler, &echo_handler,
+};
+
+static const struct xprt_pipeline_desc server_desc =
+	XPRT_PIPELINE_DESC(server_handlers);
+
+static int app_inbound(struct xprt_handler_ctx *ctx, struct pbuff *pb)
+{
+	BUG_ON(pb_headlen(pb) != FRAME_SIZE);
+	free_pb(pb);
+	/*全部收到后，等待采样完成再关闭*/
+	if (__atomic_add_fetch(&nr_received, 1, __ATOMIC_SEQ_CST) == NR_FRAMES)
+		uev_timer_add(&checker, TCPINFO_PERIOD);
+	return 0;
+}
+
+static void app_changed(struct xprt_handler_ctx *ctx, unsigned long stats)
+{
+	struct pbuff *pb;
+	struct xprt *xprt = xprt_handler_xprt(ctx);
+
+	if (stats & XPRT_OPENED) {
+		CLNT = xprt_get(xprt);
+		for (uint32_t seq = 0; seq < NR_FRAMES; seq++) {
+			pb = xprt_pipeline_alloc(xprt, FRAME_SIZE);
+			BUG_ON(!pb);
+			for (uint32_t i = 0; i < FRAME_SIZE; i++)
+				__pb_write_uint8(pb, (uint8_t)(seq + i));
+			BUG_ON(xprt_pipeline_write(xprt, pb));
+		}
+	} else if (stats & XPRT_CLOSED) {
+		try_pause();
+	} else if (stats & XPRT_CONNREFUSED) {
+		log_error("connect has been refused : %p", xprt);
+		BUG();
+	}
+}
+
+static const struct xprt_handler app_handler = {
+	.name = "app",
+	.inbound = app_inbound,
+	.changed = app_changed,
+};
+
+static const struct xprt_handler *const client_handlers[] = {
+	&xprt_lenframe_handler, &app_handler,
+};
+
+static const struct xprt_pipeline_desc client_desc =
+	XPRT_PIPELINE_DESC(client_handlers);
+
+/*持有服务器的锁，只做检查*/
+static int stats_check(struct xprt *xprt, void *arg)
+{
+	struct stats_check *check = arg;
+	const struct xprt_tcpinfo *info;
+
+	if (xprt_is_tcpserv(xprt)) {
+		check->nr_lstn++;
+		return 0;
+	}
+
+	BUG_ON(!xprt_is_tcpclnt(xprt));
+	check->nr_clnt++;
+
+	/*两端对称，收发的字节与消息数量相同*/
+	BUG_ON(xprt->stats.rx_msgs != NR_FRAMES);
+	BUG_ON(xprt->stats.tx_msgs != NR_FRAMES);
+	BUG_ON(xprt->stats.rx_bytes != WIRE_BYTES);
+	BUG_ON(xprt->stats.tx_bytes != WIRE_BYTES);
+
+	info = &xprt_to_tcpclnt(xprt)->tcpinfo;
+	if (!READ_ONCE(info->stamp))
+		return 0;
+	BUG_ON(info->state != 1 /*TCP_ESTABLISHED*/);
+	BUG_ON(!info->snd_mss || !info->snd_cwnd);
+	check->nr_sampled++;
+	return 0;
+}
+
+static void checker_cb(struct uev_timer *timer)
+{
+	struct stats_check check = { 0 };
+
+	server_for_each_xprt(SRV, stats_check, &check);
+	BUG_ON(check.nr_lstn != 1 || check.nr_clnt != 2);
+	if (check.nr_sampled < check.nr_clnt) {
+		uev_timer_add(timer, TCPINFO_PERIOD);
+		return;
+	}
+
+	log_info("all of connections have been sampled");
+	/*停止周期采样后仍然可以立即采样*/
+	server_set_tcpinfo(SRV, 0);
+	BUG_ON(xprt_tcpinfo_sample(CLNT));
+	checked = true;
+	shutdown_xprt(CLNT, SHUT_RDWR);
+}
+
+static void watchdog_cb(struct uev_timer *timer)
+{
+	log_error("test has been timed out : received %d, closed %d",
+		nr_received, nr_closed);
+	BUG();
+}
+
+static void server_init(void)
+{
+	struct xprt *xprt;
+	const struct service_address laddr = {
+		.host = "127.0.0.1",
+		.serv = "10028",
+	};
+
+	signal_setup(SIGPIPE, signal_default);
+
+	SRV = ___alloc_server(sizeof(struct server), 8, 0);
+	BUG_ON(!SRV);
+
+	xprt = create_xprt(SRV, &laddr,
+		XPRT_TCPSERV|XPRT_OPT_NONBLOCK|XPRT_RDREADY, &xprt_tcpserv_ops,
+		(void*)&server_desc, &xprt_pipeline_ops);
+	BUG_ON(!xprt);
+	/*侦听对象没有读写*/
+	BUG_ON(xprt->stats.rx_bytes || xprt->stats.tx_bytes);
+	xprt_put(xprt);
+
+	xprt = create_xprt(SRV, &laddr,
+		XPRT_TCPCLNT|XPRT_OPT_NONBLOCK|XPRT_WRREADY, &xprt_pipeline_ops,
+		(void*)&client_desc);
+	BUG_ON(!xprt);
+	xprt_put(xprt);
+
+	server_set_tcpinfo(SRV, TCPINFO_PERIOD);
+
+	uev_timer_init(&checker, checker_cb);
+	uev_timer_init(&watchdog, watchdog_cb);
+	uev_timer_add(&watchdog, 10000);
+}
+
+int main(int argc, const char *argv[])
+{
+	server_init();
+	server_loop(SRV);
+	uev_timer_delete_sync(&watchdog);
+	uev_timer_delete_sync(&checker);
+
+	BUG_ON(!checked);
+	BUG_ON(nr_received != NR_FRAMES);
+	xprt_put(CLNT);
+	destroy_server(SRV);
+
+	log_info("test xprt stats success");
+	return 0;
+}
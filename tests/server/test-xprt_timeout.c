@@ -0,0 +1,158 @@
+//
+//  test-xprt_timeout.c
+//  test
+//
+//  Created by 周凯 on 2020/01/02.
+//  Copyright © 2020 zhoukai. All rights reserved.
+//
+
+#include <stdio.h>
+#include <skp/process/event.h>
+#include <skp/process/signal.h>
+#include <skp/server/server.h>
+#include <skp/server/xprt.h>
+
+#define NR_CLIENTS (8)
+#define READ_TIMEOUT (300)
+#define PORT "10010"
+
+static struct server *SRV = NULL;
+static struct uev_timer watchdog;
+static int nr_closed = 0;
+static int nr_timedout = 0;
+static uint64_t start_ns = 0;
+
+static void client_recv(struct xprt *xprt, unsigned long stats)
+{
+	char buff[64];
+	ssize_t rc;
+
+	do {
+		rc = xprt_read(xprt, buff, sizeof(buff));
+		if (!rc) {
+			shutdown_xprt(xprt, SHUT_RDWR);
+			break;
+		}
+		if (rc < 0) {
+			if (rc != -EAGAIN)
+				shutdown_xprt(xprt, SHUT_RDWR);
+			break;
+		}
+	} while (1);
+}
+
+static void client_send(struct xprt *xprt, unsigned long stats)
+{
+	/*不需要发送数据，仅保持连接*/
+}
+
+static void client_changed(struct xprt *xprt, unsigned long stats)
+{
+	if (stats & XPRT_OPENED) {
+		xprt_event_enable(xprt, EVENT_READ);
+		/*被动端设置读超时，主动端设置较长的空闲超时，不应该触发*/
+		if (xprt->user) {
+			BUG_ON(xprt_set_timeouts(xprt, 0, READ_TIMEOUT, 0));
+		} else {
+			/*被动端在首次可读时才就绪，所以主动端发送一次数据*/
+			BUG_ON(xprt_write(xprt, "ping", 4) != 4);
+			BUG_ON(xprt_set_timeouts(xprt, 10 * READ_TIMEOUT, 0, 0));
+		}
+	} else if (stats & XPRT_CLOSED) {
+		if (__atomic_add_fetch(&nr_closed, 1, __ATOMIC_SEQ_CST) ==
+				NR_CLIENTS * 2) {
+			log_info("all connections has been closed");
+			server_pause(SRV);
+		}
+	} else if (stats & XPRT_CONNREFUSED) {
+		log_error("connect has been refused : %p", xprt);
+		BUG();
+	}
+}
+
+static void client_timeout(struct xprt *xprt, unsigned long stats)
+{
+	uint64_t elapse = (uev_timer_future(0) - start_ns) / 1000000;
+
+	log_info("xprt [%p] timed out : %lx, after %lu ms", xprt, stats,
+		(unsigned long)elapse);
+
+	/*只有被动端会超时，且是读超时*/
+	BUG_ON(!xprt->user);
+	BUG_ON(!(stats & XPRT_TIMEDOUT));
+	BUG_ON(!(stats & EVENT_READ));
+	BUG_ON(stats & EVENT_WRITE);
+	BUG_ON(elapse < READ_TIMEOUT);
+
+	__atomic_add_fetch(&nr_timedout, 1, __ATOMIC_SEQ_CST);
+	shutdown_xprt(xprt, SHUT_RDWR);
+}
+
+static const struct xprt_operations client_ops = {
+	.constructor = xprt_tcpclnt_constructor,
+	.destructor = xprt_tcpclnt_destructor,
+	.on_recv = client_recv,
+	.on_send = client_send,
+	.on_changed = client_changed,
+	.on_timeout = client_timeout,
+};
+
+static void watchdog_cb(struct uev_timer *timer)
+{
+	log_error("test has been timed out : closed %d, timedout %d",
+		nr_closed, nr_timedout);
+	BUG();
+}
+
+static void server_init(void)
+{
+	struct xprt *xprt;
+	const struct service_address laddr = {
+		.host = "127.0.0.1",
+		.serv = PORT,
+	};
+
+	signal_setup(SIGPIPE, signal_default);
+
+	SRV = ___alloc_server(sizeof(struct server), NR_CLIENTS * 2 + 1, 0);
+	BUG_ON(!SRV);
+
+	/*被动端的用户数据为监听对象*/
+	xprt = create_xprt(SRV, &laddr,
+			XPRT_TCPSERV|XPRT_OPT_NONBLOCK|XPRT_RDREADY, &xprt_tcpserv_ops,
+			NULL, &client_ops);
+	BUG_ON(!xprt);
+	xprt_put(xprt);
+
+	start_ns = uev_timer_future(0);
+
+	for (int i = 0; i < NR_CLIENTS; i++) {
+		xprt = create_xprt(SRV, &laddr,
+			XPRT_TCPCLNT|XPRT_OPT_NONBLOCK|XPRT_WRREADY, &client_ops, NULL);
+		BUG_ON(!xprt);
+		xprt_put(xprt);
+	}
+
+	uev_timer_init(&watchdog, watchdog_cb);
+	uev_timer_add(&watchdog, 20 * READ_TIMEOUT);
+}
+
+int main(int argc, const char *argv[])
+{
+	struct xprt_timeo_stat stat;
+
+	server_init();
+	server_loop(SRV);
+	uev_timer_delete_sync(&watchdog);
+	BUG_ON(nr_timedout != NR_CLIENTS);
+
+	/*每次滴答只遍历流失的槽位，而不是整个时间轮*/
+	xprt_timeo_stat(&stat);
+	log_info("timing wheel : ticks %lu, slots visited %lu",
+		(unsigned long)stat.nr_ticks, (unsigned long)stat.nr_slots);
+	BUG_ON(!stat.nr_ticks);
+	BUG_ON(stat.nr_slots > stat.nr_ticks * 4);
+	destroy_server(SRV);
+	log_info("test xprt timeout success");
+	return 0;
+}
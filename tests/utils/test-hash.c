@@ -6,11 +6,109 @@
 
 static uint32_t distribution[1 << HASH_BITS] = { };
 
+#define NR_BENCH_BYTES (1U << 30)
+#define BENCH_BUFSIZE (64U << 10)
+
+/*逐字节计算的参考实现*/
+static uint32_t ref_crc32(const uint8_t *buf, size_t size, uint32_t crc)
+{
+	while (size--) {
+		crc ^= (uint32_t)*buf++ << 24;
+		for (int k = 0; k < 8; k++)
+			crc = crc & (1U << 31) ? (crc << 1) ^ 0x04c11db7 : crc << 1;
+	}
+	return crc;
+}
+
+static uint32_t ref_crc32c(const uint8_t *buf, size_t size, uint32_t crc)
+{
+	crc = ~crc;
+	while (size--) {
+		crc ^= *buf++;
+		for (int k = 0; k < 8; k++)
+			crc = crc & 1 ? (crc >> 1) ^ 0x82f63b78 : crc >> 1;
+	}
+	return ~crc;
+}
+
+static uint16_t ref_csum(const uint8_t *buf, size_t size)
+{
+	uint32_t sum = 0;
+	for (size_t i = 0; i < size; i += 2) {
+		uint8_t w[2] = { buf[i], i + 1 < size ? buf[i + 1] : 0 };
+		sum += *(uint16_t*)w;
+	}
+	while (sum >> 16)
+		sum = (sum & 0xffff) + (sum >> 16);
+	return (uint16_t)~sum;
+}
+
+static void bench(const char *name, uint32_t (*fn)(const void*, size_t,
+		uint32_t), const uint8_t *buf, size_t size)
+{
+	uint64_t start, end;
+	volatile uint32_t value = 0;
+
+	start = abstime(0, 0);
+	for (size_t i = 0; i < NR_BENCH_BYTES / size; i++)
+		value = fn(buf, size, value);
+	end = abstime(0, 0);
+
+	printf("%s %6zu bytes : %.2f GB/s\n", name, size,
+		(double)NR_BENCH_BYTES / (end - start));
+}
+
+static void test_checksum(void)
+{
+	uint8_t *buf;
+
+	/*标准测试向量*/
+	BUG_ON(crc32c("123456789", 9, 0) != 0xe3069283);
+	BUG_ON(crc32c("", 0, 0) != 0);
+
+	BUG_ON(!(buf = malloc(BENCH_BUFSIZE + 8)));
+	for (int i = 0; i < BENCH_BUFSIZE + 8; i++)
+		buf[i] = (uint8_t)prandom_int(0, 255);
+
+	/*覆盖各种长度与对齐，以及并行计算的边界*/
+	for (size_t size = 0; size < 4096; size += prandom_int(1, 97)) {
+		for (int off = 0; off < 8; off++) {
+			const uint8_t *p = buf + off;
+			size_t half = size / 2;
+			BUG_ON(byteCrc32(p, size, 7) != ref_crc32(p, size, 7));
+			BUG_ON(byteCrc32(p + half, size - half, byteCrc32(p, half, 7)) !=
+				ref_crc32(p, size, 7));
+			BUG_ON(crc32c(p, size, 0) != ref_crc32c(p, size, 0));
+			BUG_ON(crc32c(p + half, size - half, crc32c(p, half, 0)) !=
+				crc32c(p, size, 0));
+			BUG_ON(csum_fold(csum_partial(p, size, 0)) != ref_csum(p, size));
+			BUG_ON(csum_fold(csum_block_add(csum_partial(p, half, 0),
+				csum_partial(p + half, size - half, 0), half)) !=
+				ref_csum(p, size));
+		}
+	}
+	BUG_ON(byteCrc32(buf, BENCH_BUFSIZE, 0) != ref_crc32(buf, BENCH_BUFSIZE, 0));
+	BUG_ON(crc32c(buf, BENCH_BUFSIZE, 0) != ref_crc32c(buf, BENCH_BUFSIZE, 0));
+	BUG_ON(csum_fold(csum_partial(buf, BENCH_BUFSIZE, 0)) !=
+		ref_csum(buf, BENCH_BUFSIZE));
+
+	for (size_t size = 64; size <= BENCH_BUFSIZE; size <<= 4) {
+		bench("crc32    ", byteCrc32, buf, size);
+		bench("crc32c   ", crc32c, buf, size);
+		bench("checksum ", csum_partial, buf, size);
+	}
+	printf("---------------------------------------------------\n");
+
+	free(buf);
+}
+
 int main(int argc, char const *argv[])
 {
 	uint64_t start, end;
 	uint32_t *calc_value;
 
+	test_checksum();
+
 	start = abstime(0, 0);
 
 	for (int i = 0; i < NR_HASH; i++) {
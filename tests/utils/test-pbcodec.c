@@ -0,0 +1,177 @@
+#include <skp/utils/utils.h>
+#include <skp/utils/pbcodec.h>
+
+#define NR_VALUES (1U << 16)
+#define NR_ROUNDS 256
+
+static uint64_t values[NR_VALUES];
+static uint64_t decoded[NR_VALUES];
+static uint32_t decoded32[NR_VALUES];
+static uint8_t encoded[NR_VALUES * VARINT_MAX_LEN];
+
+/*小值居多，偶尔有大值*/
+static uint64_t random_value(void)
+{
+	uint32_t bits = prandom_chance(0.8) ? 7 : prandom_int(1, 64);
+	uint64_t v = ((uint64_t)prandom_int(0, INT_MAX) << 33) ^
+		((uint64_t)prandom_int(0, INT_MAX) << 2) ^ prandom_int(0, 3);
+	return bits == 64 ? v : v & ((1ULL << bits) - 1);
+}
+
+static void test_varint(void)
+{
+	static const uint64_t edges[] = {
+		0, 1, 127, 128, 16383, 16384, U32_MAX, (1ULL << 56) - 1,
+		1ULL << 56, (1ULL << 63) - 1, 1ULL << 63, U64_MAX,
+	};
+	uint8_t buf[VARINT_MAX_LEN + 1];
+	const uint8_t *p;
+	uint64_t v;
+
+	for (int i = 0; i < ARRAY_SIZE(edges); i++) {
+		uint32_t n = varint_encode(buf, edges[i]);
+		BUG_ON(n != varint_len(edges[i]));
+		BUG_ON(varint_decode(buf, buf + n, &v) != n || v != edges[i]);
+		/*不完整*/
+		BUG_ON(varint_decode(buf, buf + n - 1, &v));
+		p = buf;
+		BUG_ON(varint_decode_array(&p, buf + n, &v, 1) != 1);
+		BUG_ON(v != edges[i] || p != buf + n);
+	}
+	BUG_ON(varint_len(U64_MAX) != VARINT_MAX_LEN);
+
+	/*超过 64 位*/
+	memset(buf, 0xff, sizeof(buf));
+	BUG_ON(varint_decode(buf, buf + sizeof(buf), &v));
+	buf[9] = 0x02;
+	BUG_ON(varint_decode(buf, buf + sizeof(buf), &v));
+
+	BUG_ON(zigzag_encode64(0) != 0 || zigzag_encode64(-1) != 1);
+	BUG_ON(zigzag_encode64(1) != 2 || zigzag_encode32(INT32_MIN) != U32_MAX);
+	BUG_ON(zigzag_decode64(zigzag_encode64(INT64_MIN)) != INT64_MIN);
+	BUG_ON(zigzag_decode32(zigzag_encode32(-12345)) != -12345);
+
+	BUG_ON(get_be32("\x01\x02\x03\x04") != 0x01020304);
+	BUG_ON(get_le16("\x01\x02") != 0x0201);
+	put_be64(buf, 0x0102030405060708ULL);
+	BUG_ON(get_le64(buf) != 0x0807060504030201ULL);
+}
+
+static void test_batch(void)
+{
+	const uint8_t *p, *end;
+	uint8_t *w = encoded;
+	uint64_t start;
+	size_t n;
+
+	for (int i = 0; i < NR_VALUES; i++) {
+		values[i] = random_value();
+		w += varint_encode(w, values[i]);
+	}
+	end = w;
+
+	/*与逐个解码的结果相同，分批时边界在任意位置*/
+	p = encoded;
+	for (size_t i = 0; i < NR_VALUES; i += n) {
+		n = min_t(size_t, prandom_int(1, 100), NR_VALUES - i);
+		BUG_ON(varint_decode_array(&p, end, decoded + i, n) != n);
+	}
+	BUG_ON(p != end || memcmp(values, decoded, sizeof(values)));
+
+	/*超出 32 位时停在该位置*/
+	p = encoded;
+	n = varint_decode_array32(&p, end, decoded32, NR_VALUES);
+	for (size_t i = 0; i < n; i++)
+		BUG_ON(decoded32[i] != values[i]);
+	BUG_ON(n < NR_VALUES && values[n] <= U32_MAX);
+
+	/*截断时只解码完整的部分*/
+	p = encoded;
+	n = varint_decode_array(&p, end - 1, decoded, NR_VALUES);
+	BUG_ON(n != NR_VALUES - 1);
+
+	start = abstime(0, 0);
+	for (int r = 0; r < NR_ROUNDS; r++) {
+		p = encoded;
+		for (int i = 0; i < NR_VALUES; i++)
+			p += varint_decode(p, end, &decoded[i]);
+	}
+	log_info("scalar varint decode cost : %.2f ns",
+		(double)(abstime(0, 0) - start) / NR_ROUNDS / NR_VALUES);
+
+	start = abstime(0, 0);
+	for (int r = 0; r < NR_ROUNDS; r++) {
+		p = encoded;
+		BUG_ON(varint_decode_array(&p, end, decoded, NR_VALUES) != NR_VALUES);
+	}
+	log_info("batch varint decode cost : %.2f ns",
+		(double)(abstime(0, 0) - start) / NR_ROUNDS / NR_VALUES);
+}
+
+static void test_cursor(void)
+{
+	struct pb_wcursor wc;
+	struct pb_rcursor rc;
+	struct pbuff *pb = alloc_pb(4);
+	uint64_t arr[3];
+
+	BUG_ON(!pb);
+
+	/*空间不足时扩展*/
+	pb_wcursor_init(&wc, pb, 64);
+	BUG_ON(wc.error || pb_wcursor_room(&wc) < 64);
+	pb_wcursor_u8(&wc, 0xab);
+	pb_wcursor_be16(&wc, 0x1234);
+	pb_wcursor_le32(&wc, 0x12345678);
+	pb_wcursor_be64(&wc, 0x0102030405060708ULL);
+	pb_wcursor_varint(&wc, 300);
+	pb_wcursor_svarint(&wc, -3);
+	pb_wcursor_varint(&wc, 1);
+	pb_wcursor_varint(&wc, U64_MAX);
+	pb_wcursor_varint(&wc, 2);
+	pb_wcursor_write(&wc, "tail", 4);
+	BUG_ON(pb_wcursor_commit(&wc, pb));
+	BUG_ON(pb_headlen(pb) != 1 + 2 + 4 + 8 + 2 + 1 + 1 + 10 + 1 + 4);
+
+	pb_rcursor_init(&rc, pb);
+	BUG_ON(pb_rcursor_u8(&rc) != 0xab);
+	BUG_ON(pb_rcursor_be16(&rc) != 0x1234);
+	BUG_ON(pb_rcursor_le32(&rc) != 0x12345678);
+	BUG_ON(pb_rcursor_be64(&rc) != 0x0102030405060708ULL);
+	BUG_ON(pb_rcursor_varint32(&rc) != 300);
+	BUG_ON(pb_rcursor_svarint(&rc) != -3);
+	pb_rcursor_varint_array(&rc, arr, 3);
+	BUG_ON(arr[0] != 1 || arr[1] != U64_MAX || arr[2] != 2);
+	BUG_ON(memcmp(pb_rcursor_bytes(&rc, 4), "tail", 4));
+	BUG_ON(rc.error || pb_rcursor_remain(&rc));
+	BUG_ON(pb_rcursor_commit(&rc, pb) || pb_headlen(pb));
+
+	/*越界后错误是粘滞的，不消费*/
+	__pb_write_bytes(pb, "\x01\x02\x03", 3);
+	pb_rcursor_init(&rc, pb);
+	BUG_ON(pb_rcursor_be16(&rc) != 0x0102);
+	BUG_ON(pb_rcursor_be32(&rc) != 0);
+	BUG_ON(pb_rcursor_u8(&rc) != 0);
+	BUG_ON(rc.error != -ENODATA);
+	BUG_ON(pb_rcursor_commit(&rc, pb) != -ENODATA || pb_headlen(pb) != 3);
+
+	/*写满后同样粘滞，不追加*/
+	pb_wcursor_init(&wc, pb, 0);
+	pb_wcursor_write(&wc, NULL, 0);
+	while (!wc.error)
+		pb_wcursor_be32(&wc, 0);
+	pb_wcursor_u8(&wc, 0);
+	BUG_ON(wc.error != -ENOSPC);
+	BUG_ON(pb_wcursor_commit(&wc, pb) != -ENOSPC || pb_headlen(pb) != 3);
+
+	free_pb(pb);
+}
+
+int main(void)
+{
+	test_varint();
+	test_batch();
+	test_cursor();
+	log_info("test pbuff codec success");
+	return 0;
+}
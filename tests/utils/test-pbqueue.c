@@ -0,0 +1,136 @@
+#include "test.h"
+#include <skp/utils/utils.h>
+#include <skp/utils/pbqueue.h>
+#include <skp/utils/futex.h>
+
+#define NR_PRODUCERS 4
+#define NR_ITEMS (1U << 18)
+#define NR_BULK 32
+
+static struct pb_queue queue;
+
+static void *producer(void *arg)
+{
+	uint32_t id = (uint32_t)(uintptr_t)arg;
+
+	for (uint32_t i = 0; i < NR_ITEMS; i++) {
+		struct pbuff *pb = alloc_pb(8);
+		BUG_ON(!pb);
+		__pb_write_uint32(pb, id);
+		__pb_write_uint32(pb, i);
+		BUG_ON(!pb_confine(pb));
+		/*有界队列满时等待消费者*/
+		while (pb_queue_push(&queue, pb) == -ENOSPC)
+			sched_yield();
+	}
+	return NULL;
+}
+
+/*不放入对象，只唤醒等待的消费者*/
+static void *spurious_waker(void *arg)
+{
+	for (int i = 0; i < 10; i++) {
+		usleep(10000);
+		futex_wake(&queue.sleeping, 1);
+	}
+	return NULL;
+}
+
+/*每个生产者的对象按顺序到达*/
+static void consume(int nr_producers)
+{
+	struct pbuff *pbs[NR_BULK];
+	uint32_t next[NR_PRODUCERS] = { 0 };
+	uint32_t id, seq, n;
+	uint64_t total = 0, start = similar_abstime(0, 0);
+
+	while (total < (uint64_t)NR_ITEMS * nr_producers) {
+		BUG_ON(pb_queue_wait(&queue, -1));
+		while ((n = pb_queue_pop_bulk(&queue, pbs, NR_BULK))) {
+			for (uint32_t i = 0; i < n; i++) {
+				BUG_ON(pb_confined(pbs[i]));
+				__pb_read_uint32(pbs[i], &id);
+				__pb_read_uint32(pbs[i], &seq);
+				BUG_ON(id >= nr_producers || seq != next[id]++);
+				free_pb(pbs[i]);
+			}
+			total += n;
+		}
+	}
+
+	log_info("%s queue pass %llu pbuffs, cost : %llu ns",
+		nr_producers > 1 ? "mpsc" : "spsc", total,
+		(uint64_t)(similar_abstime(0, 0) - start) / total);
+}
+
+int main(void)
+{
+	pthread_t pthd[NR_PRODUCERS];
+	struct pbuff *pbs[NR_BULK], *pb;
+
+	/*空队列*/
+	BUG_ON(pb_queue_init(&queue, 0, NULL));
+	BUG_ON(!pb_queue_empty(&queue));
+	BUG_ON(pb_queue_pop(&queue));
+	BUG_ON(pb_queue_wait(&queue, 10) != -ETIMEDOUT);
+
+	/*虚假唤醒不会提前返回*/
+	{
+		pthread_t waker;
+		uint64_t start = abstime(NULL, 0);
+		BUG_ON(pthread_create(&waker, NULL, spurious_waker, NULL));
+		BUG_ON(pb_queue_wait(&queue, 200) != -ETIMEDOUT);
+		BUG_ON(abstime(NULL, 0) - start < 200 * 1000000ULL);
+		BUG_ON(pthread_join(waker, NULL));
+	}
+
+	/*先进先出*/
+	for (int i = 0; i < 3; i++) {
+		pb = alloc_pb(4);
+		__pb_write_uint32(pb, i);
+		BUG_ON(!pb_confine(pb));
+		BUG_ON(pb_queue_push(&queue, pb));
+	}
+	BUG_ON(pb_queue_wait(&queue, 0));
+	BUG_ON(pb_queue_pop_bulk(&queue, pbs, 2) != 2);
+	pb = alloc_pb(4);
+	__pb_write_uint32(pb, 3);
+	BUG_ON(pb_queue_push(&queue, pb));
+	BUG_ON(pb_queue_pop_bulk(&queue, pbs + 2, NR_BULK) != 2);
+	for (uint32_t i = 0, v; i < 4; i++) {
+		__pb_read_uint32(pbs[i], &v);
+		BUG_ON(v != i);
+		free_pb(pbs[i]);
+	}
+	BUG_ON(!pb_queue_empty(&queue));
+
+	/*剩余的对象在销毁时释放*/
+	BUG_ON(pb_queue_push(&queue, alloc_pb(4)));
+	pb_queue_destroy(&queue);
+
+	BUG_ON(pb_queue_init(&queue, 0, NULL));
+	for (int i = 0; i < NR_PRODUCERS; i++)
+		pthd[i] = thread_create(producer, (void*)(uintptr_t)i);
+	consume(NR_PRODUCERS);
+	for (int i = 0; i < NR_PRODUCERS; i++)
+		thread_join(pthd[i]);
+	pb_queue_destroy(&queue);
+
+	/*有界队列*/
+	BUG_ON(pb_queue_init(&queue, 4, NULL));
+	for (int i = 0; i < 4; i++)
+		BUG_ON(pb_queue_push(&queue, alloc_pb(4)));
+	pb = alloc_pb(4);
+	BUG_ON(pb_queue_push(&queue, pb) != -ENOSPC);
+	free_pb(pb);
+	pb_queue_destroy(&queue);
+
+	BUG_ON(pb_queue_init(&queue, 256, NULL));
+	pthd[0] = thread_create(producer, (void*)(uintptr_t)0);
+	consume(1);
+	thread_join(pthd[0]);
+	pb_queue_destroy(&queue);
+
+	log_info("test pbuff queue success");
+	return 0;
+}
@@ -1,3 +1,5 @@
+#include <sys/uio.h>
+#include <skp/utils/hash.h>
 #include <skp/utils/pbuff.h>
 
 struct object {
@@ -81,6 +83,29 @@ const struct pb_ops mybuff_ops = {
 	.expand = mybuff_expand,
 };
 
+static struct pbuff *plain_constructor(void *user)
+{
+	return malloc(sizeof(struct pbuff));
+}
+
+static void plain_destructor(struct pbuff *pb)
+{
+	free(pb);
+}
+
+static const struct pb_ops plain_ops = {
+	.constructor = plain_constructor,
+	.destructor = plain_destructor,
+};
+
+static int nr_released = 0;
+
+static void ext_release(void *ptr, void *arg)
+{
+	BUG_ON(ptr != arg);
+	nr_released++;
+}
+
 int main(void)
 {
 	struct pbuff *pb;
@@ -186,6 +211,196 @@ int main(void)
 	BUG_ON(var64 != 64);
 
 	free_pb(pb);
-	
+
+	/*分片*/
+	struct pbuff *body, *tail, *fclone, *fcopy;
+	struct iovec iov[4];
+	void *addr;
+	uint32_t len, nr = 0;
+
+	pb = alloc_pb(16);
+	body = alloc_pb(64);
+	tail = alloc_pb(64);
+	BUG_ON(!pb || !body || !tail);
+	__pb_write_bytes(pb, "HEAD", 4);
+	__pb_write_bytes(body, "0123456789", 10);
+	__pb_write_bytes(tail, "abcdef", 6);
+	/*分片数组在第一次添加时才分配*/
+	BUG_ON(pb_shinfo(pb)->frags);
+
+	BUG_ON(pb_add_frag(pb, body, 0, 5));
+	BUG_ON(!pb_shinfo(pb)->frags);
+	/*与上一个分片连续，合并*/
+	BUG_ON(pb_add_frag(pb, body, 5, 5));
+	BUG_ON(pb_add_frag(pb, tail, 2, 4));
+	BUG_ON(pb_nr_frags(pb) != 2);
+	BUG_ON(pb_headlen(pb) != 4 || pb_len(pb) != 18);
+	BUG_ON(!pb_is_nonlinear(pb));
+	/*不能引用自身*/
+	BUG_ON(pb_add_frag(pb, pb, 0, 1) != -EINVAL);
+
+	/*分片持有数据区的引用*/
+	free_pb(body);
+	free_pb(tail);
+
+	BUG_ON(pb_to_iovec(pb, iov, 4) != 3);
+	BUG_ON(iov[0].iov_len != 4 || memcmp(iov[0].iov_base, "HEAD", 4));
+	BUG_ON(iov[1].iov_len != 10 || memcmp(iov[1].iov_base, "0123456789", 10));
+	BUG_ON(iov[2].iov_len != 4 || memcmp(iov[2].iov_base, "cdef", 4));
+	BUG_ON(pb_to_iovec(pb, iov, 2) != 2);
+
+	pb_for_each_frag(pb, addr, len) {
+		BUG_ON(memcmp(addr, nr ? "cdef" : "0123456789", len));
+		nr += len;
+	}
+	BUG_ON(nr != 14);
+
+	/*校验和覆盖分片数据*/
+	BUG_ON(pb_crc32c(pb, 0) != crc32c("HEAD0123456789cdef", 18, 0));
+	BUG_ON(csum_fold(pb_csum(pb, 0)) !=
+		csum_fold(csum_partial("HEAD0123456789cdef", 18, 0)));
+
+	/*克隆共享分片，不能再添加*/
+	fclone = pb_clone(pb);
+	BUG_ON(!fclone);
+	BUG_ON(pb_len(fclone) != 18);
+	body = alloc_pb(8);
+	BUG_ON(!body);
+	__pb_write_uint8(body, 0);
+	BUG_ON(pb_add_frag(pb, body, 0, 1) != -EPERM);
+	free_pb(body);
+
+	/*消费跨越线性数据与分片，只影响自身*/
+	BUG_ON(pb_consume(fclone, 7) != 7);
+	BUG_ON(pb_headlen(fclone) || pb_len(fclone) != 11);
+	BUG_ON(pb_to_iovec(fclone, iov, 4) != 2);
+	BUG_ON(iov[0].iov_len != 7 || memcmp(iov[0].iov_base, "3456789", 7));
+	/*分片在奇数偏移处开始*/
+	BUG_ON(csum_fold(pb_csum(fclone, 0)) !=
+		csum_fold(csum_partial("3456789cdef", 11, 0)));
+	BUG_ON(pb_crc32c(fclone, 0) != crc32c("3456789cdef", 11, 0));
+	pb_trimdata(fclone, 9);
+	BUG_ON(pb_to_iovec(fclone, iov, 4) != 2);
+	BUG_ON(iov[1].iov_len != 2 || memcmp(iov[1].iov_base, "cd", 2));
+	BUG_ON(pb_len(pb) != 18);
+
+	/*深拷贝只复制分片的引用*/
+	fcopy = pb_copy(pb);
+	BUG_ON(!fcopy);
+	BUG_ON(pb_len(fcopy) != 18 || pb_nr_frags(fcopy) != 2);
+
+	/*被共享时线性化需要独立的数据区*/
+	BUG_ON(pb_linearize(fclone));
+	BUG_ON(pb_is_nonlinear(fclone) || pb_headlen(fclone) != 9);
+	BUG_ON(memcmp(pb_data(fclone), "3456789cd", 9));
+	BUG_ON(pb_len(pb) != 18 || pb_nr_frags(pb) != 2);
+	free_pb(fclone);
+
+	BUG_ON(pb_linearize(fcopy));
+	BUG_ON(pb_nr_frags(fcopy) || pb_headlen(fcopy) != 18);
+	BUG_ON(memcmp(pb_data(fcopy), "HEAD0123456789cdef", 18));
+	free_pb(fcopy);
+
+	/*共享只包括线性数据*/
+	fclone = pb_share(pb, 4, NULL, &plain_ops);
+	BUG_ON(!fclone || pb_len(fclone) != 4);
+	free_pb(fclone);
+
+	BUG_ON(!pb_reset(pb));
+	BUG_ON(pb_nr_frags(pb) || pb_len(pb));
+	BUG_ON(pb_shinfo(pb)->frags);
+	free_pb(pb);
+
+	/*限定在当前线程*/
+	pb = alloc_pb(16);
+	BUG_ON(!pb || pb_confined(pb));
+	BUG_ON(!pb_confine(pb));
+	BUG_ON(pb_get(pb) != pb || uref_read(&pb->users) != 2);
+	free_pb(pb);
+	BUG_ON(uref_read(&pb->users) != 1);
+
+	/*克隆与共享的 pbuff 同样被限定*/
+	fclone = pb_clone(pb);
+	BUG_ON(!fclone || !pb_confined(fclone));
+	__pb_write_bytes(pb, "confined", 8);
+	body = pb_share(pb, 4, NULL, &plain_ops);
+	BUG_ON(!body || !pb_confined(body));
+	BUG_ON(uref_read(&pb_shinfo(pb)->dataref) != 3);
+	fcopy = pb_copy(pb);
+	BUG_ON(!fcopy || !pb_confined(fcopy));
+	BUG_ON(pb_add_frag(fcopy, body, 0, 4));
+	BUG_ON(uref_read(&pb_shinfo(pb)->dataref) != 4);
+
+	/*解除限定后使用原子操作，引用的分片同样解除*/
+	pb_unconfine(fcopy);
+	BUG_ON(pb_confined(fcopy) || pb_shinfo(pb)->confined);
+	BUG_ON(!pb_confined(pb) || pb_confine(pb));
+	free_pb(fclone);
+	free_pb(body);
+	free_pb(pb);
+	BUG_ON(pb_len(fcopy) != 12 || pb_crc32c(fcopy, 0) !=
+		crc32c("confinedconf", 12, 0));
+	free_pb(fcopy);
+
+	/*外部数据区*/
+	static char external[] = "external memory";
+	struct pbuff *ext;
+
+	ext = pb_attach_external(external, 8, ext_release, external);
+	BUG_ON(!ext);
+	BUG_ON(pb_data(ext) != (uint8_t*)external || pb_headlen(ext) != 8);
+	BUG_ON(pb_head(ext) != (uint8_t*)external || pb_size(ext) != 8);
+	BUG_ON(pb_headroom(ext) || pb_tailroom(ext));
+
+	fclone = pb_clone(ext);
+	BUG_ON(!fclone || pb_data(fclone) != pb_data(ext));
+	BUG_ON(!pb_cloned(ext));
+	body = pb_share(ext, 3, NULL, &plain_ops);
+	BUG_ON(!body || memcmp(pb_data(body), "ext", 3));
+
+	/*作为分片被引用*/
+	pb = alloc_pb(16);
+	BUG_ON(!pb);
+	__pb_write_bytes(pb, "<", 1);
+	BUG_ON(pb_add_frag(pb, ext, 3, 5));
+	BUG_ON(pb_to_iovec(pb, iov, 4) != 2);
+	BUG_ON(iov[1].iov_base != external + 3 || iov[1].iov_len != 5);
+
+	/*深拷贝与扩展都使用新的数据区*/
+	fcopy = pb_copy(ext);
+	BUG_ON(!fcopy || pb_data(fcopy) == pb_data(ext));
+	BUG_ON(pb_headlen(fcopy) != 8 || memcmp(pb_data(fcopy), external, 8));
+	free_pb(fcopy);
+
+	free_pb(ext);
+	free_pb(fclone);
+	free_pb(body);
+	BUG_ON(nr_released);
+	free_pb(pb);
+	BUG_ON(nr_released != 1);
+
+	nr_released = 0;
+	ext = pb_attach_external(external, sizeof(external), ext_release, external);
+	BUG_ON(!ext);
+	BUG_ON(pb_write_uint8(ext, '!'));
+	BUG_ON(nr_released != 1);
+	BUG_ON(pb_headlen(ext) != sizeof(external) + 1);
+	BUG_ON(memcmp(pb_data(ext), external, sizeof(external)));
+	BUG_ON(pb_data(ext)[sizeof(external)] != '!');
+	free_pb(ext);
+
+	/*消费和截断后仍然不能写入调用者的内存*/
+	nr_released = 0;
+	ext = pb_attach_external(external, sizeof(external), ext_release, external);
+	BUG_ON(!ext);
+	BUG_ON(!pb_pulldata(ext, 2) || !pb_popdata(ext, 2));
+	BUG_ON(pb_headroom(ext) || pb_tailroom(ext));
+	BUG_ON(pb_reset(ext));
+	BUG_ON(pb_expand_head(ext, 4, 0));
+	BUG_ON(nr_released != 1);
+	BUG_ON(pb_headroom(ext) < 4 || pb_headlen(ext) != sizeof(external) - 4);
+	BUG_ON(memcmp(pb_data(ext), external + 2, sizeof(external) - 4));
+	free_pb(ext);
+
 	return 0;
 }
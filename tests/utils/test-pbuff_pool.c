@@ -0,0 +1,122 @@
+#include "test.h"
+#include <skp/utils/utils.h>
+#include <skp/utils/pbuff.h>
+
+#define NR_BUFFS (CONFIG_PB_POOL_BATCH * 2)
+#define NR_BENCH (1U << 22)
+
+static struct pbuff *buffs[NR_BUFFS];
+static void *heads[NR_BUFFS];
+
+static bool in_heads(void *head)
+{
+	for (int i = 0; i < NR_BUFFS; i++) {
+		if (heads[i] == head)
+			return true;
+	}
+	return false;
+}
+
+static void alloc_all(size_t size)
+{
+	for (int i = 0; i < NR_BUFFS; i++) {
+		buffs[i] = alloc_pb(size);
+		BUG_ON(!buffs[i]);
+		heads[i] = pb_head(buffs[i]);
+	}
+}
+
+static void free_all(void)
+{
+	for (int i = 0; i < NR_BUFFS; i++)
+		free_pb(buffs[i]);
+}
+
+/*缓存后退出，由之后创建的线程接管*/
+static void *orphan_thread(void *arg)
+{
+	alloc_all(100);
+	free_all();
+	return NULL;
+}
+
+static void *adopt_thread(void *arg)
+{
+	struct pbuff *pb = alloc_pb(100);
+	BUG_ON(!pb || !in_heads(pb_head(pb)));
+	free_pb(pb);
+	return NULL;
+}
+
+/*在其他线程中释放，批量归还*/
+static void *remote_free_thread(void *arg)
+{
+	/*本线程也有缓存，才会攒批*/
+	free_pb(alloc_pb(1));
+	free_all();
+	pb_pool_reclaim();
+	return NULL;
+}
+
+static void *bench_thread(void *arg)
+{
+	size_t size = (size_t)(uintptr_t)arg;
+	uint64_t start = similar_abstime(0, 0);
+
+	for (uint32_t i = 0; i < NR_BENCH; i++) {
+		struct pbuff *pb = alloc_pb(size);
+		BUG_ON(!pb);
+		free_pb(pb);
+	}
+
+	log_info("alloc/free %zu bytes cost : %llu ns", size,
+		(uint64_t)(similar_abstime(0, 0) - start) / NR_BENCH);
+	return NULL;
+}
+
+int main(void)
+{
+	struct pbuff *pb;
+	void *head;
+
+	/*同一个线程中立即复用，尺寸向上调整到等级*/
+	pb = alloc_pb(1000);
+	BUG_ON(!pb || pb_size(pb) != 2048);
+	head = pb_head(pb);
+	free_pb(pb);
+	pb = alloc_pb(2000);
+	BUG_ON(!pb || pb_head(pb) != head);
+
+	/*扩展时仍然使用缓存池*/
+	BUG_ON(__pb_expand_head(pb, 0, 4096));
+	BUG_ON(pb_size(pb) != 16384);
+	free_pb(pb);
+
+	/*超过尺寸上限不使用缓存池*/
+	pb = alloc_pb(100000);
+	BUG_ON(!pb || pb_size(pb) < 100000);
+	free_pb(pb);
+
+	thread_join(thread_create(orphan_thread, NULL));
+	thread_join(thread_create(adopt_thread, NULL));
+
+	/*归还后在分配线程中取回*/
+	alloc_all(5000);
+	thread_join(thread_create(remote_free_thread, NULL));
+	for (int i = 0; i < NR_BUFFS; i++) {
+		pb = alloc_pb(5000);
+		BUG_ON(!pb || !in_heads(pb_head(pb)));
+		buffs[i] = pb;
+	}
+	free_all();
+	pb_pool_reclaim();
+
+	pthread_t pthd[2];
+	pthd[0] = thread_create(bench_thread, (void*)(uintptr_t)64);
+	pthd[1] = thread_create(bench_thread, (void*)(uintptr_t)16000);
+	for (int i = 0; i < ARRAY_SIZE(pthd); i++)
+		thread_join(pthd[i]);
+
+	log_info("test pbuff pool success");
+	return 0;
+}